@@ -1,6 +1,7 @@
 #pragma once
 #include "Engine.h"
 #include "constants.h"
+#include "ResourceLoader.h"
 #include "input/InputManager.h"
 #include "input/InputEvents.h"
 #include "gpu/ComputeModule.h"
@@ -91,12 +92,50 @@ void Engine::start() {
     // quad->addComponent<MeshComponent>()->mesh = MeshBuilder::createCube(1);
     entityManager->setQuad(quad, renderModule);
 
+    loadScene();
+
     std::cout << "== vroom vroom ==" << std::endl;
     while (m_isRunning) {
         tick();
     }
 }
 
+void Engine::loadScene() {
+    // the sky the lit materials reflect, baked on the first run and cached next to the image
+    if (!renderModule->setEnvironment(RESOURCE_DIR "/textures", "autumn_park_4k.jpg")) {
+        std::cout << "failed to set the environment" << std::endl;
+    }
+
+    // welded, optimized and packed, see ResourceLoader::loadObjMesh
+    std::shared_ptr<Mesh> teapot = ResourceLoader::loadObjMesh(RESOURCE_DIR "/models", "teapot.obj");
+    if (teapot == nullptr) {
+        std::cout << "failed to load the scene meshes" << std::endl;
+        return;
+    }
+    auto entity = std::make_shared<Entity>();
+    entity->addComponent<TransformComponent>()->transform->setPosition(vec3(0.0, 0.0, -10.0));
+    entity->addComponent<MeshComponent>()->mesh = teapot;
+    entityManager->addEntity(entity, renderModule);
+
+    // scattered static props, merged into one mesh and one draw per cell (see StaticBatcher).
+    // the batcher transforms full vertices, so these stay unpacked
+    std::shared_ptr<Mesh> cube = ResourceLoader::loadObjMesh(RESOURCE_DIR "/models", "cube.obj", {}, false);
+    if (cube == nullptr) return;
+    std::vector<std::shared_ptr<Entity>> props;
+    for (int x = -16; x < 16; x++) {
+        for (int z = -16; z < 16; z++) {
+            auto prop = std::make_shared<Entity>();
+            auto transform = prop->addComponent<TransformComponent>()->transform;
+            transform->setPosition(vec3(x * 6.0f, -3.0f, z * 6.0f - 10.0f));
+            transform->setRotation(vec3(0.0f, (float)((x * 7 + z * 13) % 8) * 0.4f, 0.0f));
+            transform->setScale(vec3(0.5f + 0.25f * (float)((x * 3 + z * 5 + 256) % 4)));
+            prop->addComponent<MeshComponent>()->mesh = cube;
+            props.push_back(prop);
+        }
+    }
+    entityManager->addStaticEntities(props, renderModule);
+}
+
 void Engine::tick() {
     float newTime = SDL_GetTicks64() / 1000.0f;
     m_deltaTime = newTime - m_time;
@@ -175,6 +214,8 @@ void Engine::updateCamera() {
 
 void Engine::draw() {
     updateCamera();
+    // the view matrix looks from position - forward, see RenderModule::updateViewMatrix
+    entityManager->lodSystem->update(renderModule->getModels(), renderModule->m_camera.position - renderModule->m_camera.forward, renderModule->getProjectionScale());
     renderModule->onFrame(
         terrainManager->getTerrainPatches(renderModule->m_camera),
         entityManager->getRenderableEntities(),
@@ -311,29 +352,37 @@ bool Engine::initGPU() {
     requiredLimits.limits.maxUniformBufferBindingSize = sizeof(DefaultPipeline::UniformData);
     requiredLimits.limits.maxUniformBuffersPerShaderStage = 1;
     requiredLimits.limits.maxBindGroups = 1;
-    requiredLimits.limits.maxBindingsPerBindGroup = 7;
-    requiredLimits.limits.maxVertexBuffers = 1;
+    requiredLimits.limits.maxBindingsPerBindGroup = 9; // DefaultPipeline, with the environment cube, lut and sampler
+    requiredLimits.limits.maxVertexBuffers = 2; // position + attribute streams
     requiredLimits.limits.maxVertexAttributes = 7;
-    requiredLimits.limits.maxBufferSize = 1000000 * sizeof(DefaultPipeline::ModelData); // 1,000,000 models
+    requiredLimits.limits.maxBufferSize = 80000000; // the vertex and index arenas, was sized by the old 80 byte model data
     requiredLimits.limits.maxVertexBufferArrayStride = sizeof(Mesh::VertexData);
     requiredLimits.limits.maxInterStageShaderComponents = 22;
-    requiredLimits.limits.maxStorageBuffersPerShaderStage = 2;
+    requiredLimits.limits.maxStorageBuffersPerShaderStage = 3; // models, materials, visible indices
     requiredLimits.limits.maxStorageBufferBindingSize = 1000000 * sizeof(DefaultPipeline::ModelData); // 1 million objects
 
     requiredLimits.limits.maxTextureDimension1D = 8192;
     requiredLimits.limits.maxTextureDimension2D = 8192;
-    requiredLimits.limits.maxTextureArrayLayers = 1;
-    requiredLimits.limits.maxSampledTexturesPerShaderStage = 100;
-    requiredLimits.limits.maxSamplersPerShaderStage = 2;
+    requiredLimits.limits.maxTextureArrayLayers = 6; // the faces of the specular environment cube
+    requiredLimits.limits.maxSampledTexturesPerShaderStage = 102; // the texture array, the environment cube and brdf lut
+    requiredLimits.limits.maxSamplersPerShaderStage = 2; // the texture sampler and the environment sampler
 
     DeviceDescriptor deviceDesc;
     deviceDesc.defaultQueue = QueueDescriptor{};
-    deviceDesc.requiredFeatureCount = 2;
     // special conversion for native features
     std::vector<WGPUFeatureName> reqFeatures{
         (WGPUFeatureName)NativeFeature::TextureBindingArray,
         (WGPUFeatureName)NativeFeature::SampledTextureAndStorageBufferArrayNonUniformIndexing
     };
+    // meshlet draws go through drawIndexedIndirect when firstInstance can be set there
+    if (adapter.hasFeature(FeatureName::IndirectFirstInstance)) {
+        reqFeatures.push_back(FeatureName::IndirectFirstInstance);
+    }
+    // textures are uploaded block compressed when the adapter can sample bc formats
+    if (adapter.hasFeature(FeatureName::TextureCompressionBC)) {
+        reqFeatures.push_back(FeatureName::TextureCompressionBC);
+    }
+    deviceDesc.requiredFeatureCount = reqFeatures.size();
     deviceDesc.requiredFeatures = reqFeatures.data();
     deviceDesc.requiredLimits = &requiredLimits;
     deviceDesc.deviceLostCallback = [](WGPUDeviceLostReason reason, char const * message, void * userdata) {
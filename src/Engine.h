@@ -32,6 +32,8 @@ public:
 private:
     void handleInput();
     void updateCamera();
+    // the entities drawn at startup
+    void loadScene();
 
     void setupBindings();
     void wrapCursor(SDL_Event e);
@@ -10,6 +10,10 @@
 #include "ecs/components/Texture.h"
 #include "ecs/components/Material.h"
 #include "utilities/VertexDataCalculations.h"
+#include "utilities/MeshOptimizer.h"
+#include "utilities/MeshletBuilder.h"
+#include "utilities/MeshSimplifier.h"
+#include "utilities/VertexCompression.h"
 
 #include <iostream>
 #include <string>
@@ -24,21 +28,41 @@ using mat3x3 = glm::mat3x3;
 
 using namespace coho;
 
-Texture ResourceLoader::loadTexture(const std::string& path, const std::string& filename) {
+Texture ResourceLoader::loadTexture(const std::string& path, const std::string& filename, MippedTexture::CookOptions options) {
     Texture texture;
-    
+    std::string source = path + std::string("/") + filename;
+
+    std::shared_ptr<MippedTexture> mipped = MippedTexture::loadCache(source, options);
+    if (mipped != nullptr) {
+        texture.width = mipped->width;
+        texture.height = mipped->height;
+        texture.channels = 4;
+        texture.mipLevels = (int)mipped->levels.size();
+        texture.mipped = mipped;
+        return texture;
+    }
+
     int width, height, channels;
-    auto data = stbi_load(std::string(path + std::string("/") + filename).c_str(), &width, &height, &channels, 4);
+    auto data = stbi_load(source.c_str(), &width, &height, &channels, 4);
+    if (data == nullptr) {
+        std::cout << "failed to load image: " << source << std::endl;
+        return texture;
+    }
 
     texture.width = width;
     texture.height = height;
     texture.channels = channels;
     size_t dataSize = width * height * 4;
     texture.pixelData = std::vector<unsigned char>(data, data + dataSize);
-    texture.mipLevels = 8;
 
     stbi_image_free(data);
 
+    texture.mipped = MippedTexture::cook(texture.pixelData.data(), width, height, options);
+    texture.mipLevels = (int)texture.mipped->levels.size();
+    if (texture.mipped->save(MippedTexture::cachePath(source))) {
+        std::cout << "cooked " << filename << " (" << BlockCompression::name(texture.mipped->format) << ", " << texture.mipLevels << " levels)" << std::endl;
+    }
+
     return texture;
 }
 
@@ -88,7 +112,7 @@ bool ResourceLoader::loadGLTF(const std::string& path, const std::string& filena
     return true;
 }
 
-bool ResourceLoader::loadObj(const std::string& path, const std::string& filename, std::vector<VertexData>& vertexData) {
+bool ResourceLoader::loadObjCorners(const std::string& path, const std::string& filename, std::vector<VertexData>& vertexData) {
     std::cout << "loading .obj file: " << filename << "from " << path << std::endl;
 
     tinyobj::ObjReaderConfig reader_config;
@@ -153,6 +177,43 @@ bool ResourceLoader::loadObj(const std::string& path, const std::string& filenam
     return true;
 }
 
+bool ResourceLoader::loadObj(
+        const std::string& path,
+        const std::string& filename,
+        std::vector<VertexData>& vertexData,
+        std::vector<uint32_t>& indexData,
+        VertexWeldOptions weldOptions
+        ) {
+    // tangents are calculated per face on the soup, welding then averages them over the shared corners
+    if (!loadObjCorners(path, filename, vertexData)) {
+        return false;
+    }
+
+    VertexWeldStats stats = VertexWelder::weld(vertexData, indexData, weldOptions);
+    VertexWelder::logStats(filename, stats);
+    return true;
+}
+
+std::shared_ptr<Mesh> ResourceLoader::loadObjMesh(const std::string& path, const std::string& filename, VertexWeldOptions weldOptions, bool packVertices) {
+    std::vector<VertexData> vertexData;
+    std::vector<uint32_t> indexData;
+    if (!loadObj(path, filename, vertexData, indexData, weldOptions)) {
+        return nullptr;
+    }
+
+    auto mesh = std::make_shared<Mesh>();
+    mesh->setVertexData(vertexData);
+    mesh->setIndexData(indexData);
+    MeshOptimizer::optimize(mesh, filename);
+    MeshSimplifier::buildLodChain(mesh, filename);
+    MeshletBuilder::buildMeshlets(mesh);
+    // last, the steps above work on the full vertices. they stay on the mesh for the cpu side
+    if (packVertices && !VertexCompression::packMesh(mesh)) {
+        return nullptr;
+    }
+    return mesh;
+}
+
 char* loadBinaryFile(const std::string& path, const std::string& filename, int& fileSize) {
     std::ifstream file (std::string(path + "/" + filename), std::ios::in|std::ios::binary|std::ios::ate);
     if (file.is_open())
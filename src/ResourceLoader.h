@@ -3,7 +3,10 @@
 #include <webgpu/webgpu.hpp>
 #include "ecs/components/Mesh.h"
 #include "ecs/components/Texture.h"
+#include "utilities/VertexWelder.h"
+#include "utilities/texture/MippedTexture.h"
 
+#include <memory>
 #include <string>
 #include <vector>
 using vec3 = glm::vec3;
@@ -21,16 +24,37 @@ public:
 
     static std::string loadShaderCode(std::string path);
     
+    // reads <filename>.ctex, the cooked mip chain, when it's newer than the image and
+    // cooked with the same options. otherwise decodes the image and writes it
     static coho::Texture loadTexture(
         const std::string& path, 
-        const std::string& filename
+        const std::string& filename,
+        MippedTexture::CookOptions options = MippedTexture::CookOptions()
+        );
+
+    // the face corners are welded into unique vertices, see VertexWelder
+    static bool loadObj(
+        const std::string& path,
+        const std::string& filename,
+        std::vector<VertexData>& vertexData,
+        std::vector<uint32_t>& indexData,
+        VertexWeldOptions weldOptions = VertexWeldOptions()
+        );
+    // welded, optimized, with a lod chain and meshlets. packVertices stores it in the 20 byte
+    // packed format (VertexCompression), so it's drawn by the packed vertex pipeline
+    static std::shared_ptr<Mesh> loadObjMesh(
+        const std::string& path,
+        const std::string& filename,
+        VertexWeldOptions weldOptions = VertexWeldOptions(),
+        bool packVertices = true
         );
 
-    static bool loadObj(const std::string& path, const std::string& filename, std::vector<VertexData>& vertexData);
-    
     bool loadGLTF(const std::string& path, const std::string& filename, std::vector<VertexData>& vertexData);
 
     static char* loadBinaryFile(const std::string& path, const std::string& filename, int& filesize);
     static ImageData* loadImage(const std::string& path, const std::string& filename);
 
+private:
+    // a vertex per face corner, with the per face tangent frames
+    static bool loadObjCorners(const std::string& path, const std::string& filename, std::vector<VertexData>& vertexData);
 };
\ No newline at end of file
@@ -7,8 +7,13 @@
 #include "components/MeshComponent.h"
 #include "components/Mesh.h"
 #include "components/MaterialComponent.h"
+#include "components/LodComponent.h"
 #include "components/Material.h"
 #include "utilities/MeshBuilder.h"
+#include "utilities/ImpostorBaker.h"
+#include "utilities/InstanceCompression.h"
+#include <algorithm>
+#include <iostream>
 #include <memory>
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
@@ -16,10 +21,12 @@
 EntityManager::EntityManager() {
     camera = std::make_shared<Entity>();
     camera->addComponent<TransformComponent>();
+    lodSystem = std::make_shared<LodSystem>();
 }
 
 EntityManager::~EntityManager() {
     camera.reset();
+    lodSystem.reset();
 }
 
 void EntityManager::addDefaultMaterial(std::shared_ptr<RenderModule> renderModule) {
@@ -28,7 +35,7 @@ void EntityManager::addDefaultMaterial(std::shared_ptr<RenderModule> renderModul
     defaultTexture->width = 1;
     defaultTexture->height = 1;
     defaultTexture->mipLevels = 1;
-    defaultTexture->pixelData = std::vector<unsigned char>(1);
+    defaultTexture->pixelData = std::vector<unsigned char>(4, 0);
 
     // register default/blank texture
     // register default/blank material
@@ -54,74 +61,138 @@ int EntityManager::addEntity(std::shared_ptr<Entity> entity, std::shared_ptr<Ren
     m_entities.push_back(entity);
     m_renderableEntities.push_back(entity);
 
-    DefaultPipeline::ModelData modelData;
-    modelData.materialIndex = 0; // default material
+    uint32_t materialIndex = 0; // default material
 
     // write the transform to the model data
+    std::shared_ptr<Mesh> mesh = entity->getComponent<MeshComponent>()->mesh;
     glm::mat4x4 transform = entity->getComponent<TransformComponent>()->transform->getMatrix();
-    modelData.transform = transform;
+    if (mesh->isPacked) {
+        // packed positions are quantized inside the mesh bounds
+        transform = transform * mesh->getDequantizeTransform();
+    }
     if (entity->hasComponent<MaterialComponent>()) {
         // write the material to the model data
         std::shared_ptr<Material> material = entity->getComponent<MaterialComponent>()->material;
         if (material->materialIndex == -1) { // we gotta register it!
             addMaterial(material, renderModule);
         }
-        modelData.materialIndex = material->materialIndex;
+        materialIndex = material->materialIndex;
     }
 
     // write the model buffer
-    std::vector<DefaultPipeline::ModelData> mds = { modelData };
+    std::vector<DefaultPipeline::ModelData> mds = { InstanceCompression::pack(transform, materialIndex) };
     renderModule->writeModelBuffer(mds, m_nextModelBufferOffset);
     m_nextModelBufferOffset += sizeof(DefaultPipeline::ModelData);
 
-    // write the mesh vertices to the vertex buffer
-    std::shared_ptr<Mesh> mesh = entity->getComponent<MeshComponent>()->mesh;
-    std::vector<Mesh::VertexData> vds = mesh->m_vertexData;
-    int vertexBufferOffset = renderModule->addMeshToVertexBuffer(vds);
-    mesh->setVertexBufferOffset(vertexBufferOffset);
-    if (mesh->isIndexed) {
-        std::vector<uint32_t> indices = mesh->getIndexData();
-        int indexBufferOffset = renderModule->addMeshToIndexBuffer(indices);
-        mesh->setIndexBufferOffset(indexBufferOffset);
+    // upload the mesh, entities sharing a mesh share its vertex/index ranges
+    renderModule->addMesh(mesh);
+
+    // every detail level has to be resident, the lod system picks one per frame
+    if (entity->hasComponent<LodComponent>()) {
+        auto lodComponent = entity->getComponent<LodComponent>();
+        std::shared_ptr<ImpostorAtlas> atlas = lodComponent->impostor;
+        if (atlas != nullptr) {
+            // the billboard vertices carry the atlas material, so it's registered first
+            if (atlas->material->materialIndex == -1) {
+                addMaterial(atlas->material, renderModule);
+            }
+            if (atlas->billboard == nullptr) {
+                atlas->billboard = ImpostorBaker::createBillboard(atlas);
+            }
+            if (atlas->billboard == nullptr) {
+                // no billboard, the entity keeps drawing its mesh levels
+                std::cout << "skipping the impostor of entity " << id << ", its billboard couldn't be created" << std::endl;
+                auto& levels = lodComponent->levels;
+                levels.erase(std::remove_if(levels.begin(), levels.end(), [](const LodComponent::Level& level) { return level.impostor; }), levels.end());
+                lodComponent->impostor.reset();
+            } else {
+                for (auto& level : lodComponent->levels) {
+                    if (level.impostor) level.mesh = atlas->billboard;
+                }
+            }
+        }
+
+        std::vector<std::shared_ptr<Mesh>> acquired = { mesh };
+        for (auto& level : lodComponent->levels) {
+            if (std::find(acquired.begin(), acquired.end(), level.mesh) != acquired.end()) continue;
+            renderModule->addMesh(level.mesh);
+            acquired.push_back(level.mesh);
+        }
+        lodSystem->add(entity);
     }
 
     // return the id for this entity
     return id;
 }
 
-// todo: pass array of instances and write to model buffer en-mass 
-// these sequential queue operations are killer
-int EntityManager::addInstance(std::shared_ptr<Entity> entity, std::shared_ptr<RenderModule> renderModule) {
-    if (!entity->hasComponent<InstanceComponent>()) {
-        std::cout << "ERROR: No instance component found on entity!" << std::endl;
-        return -1;
-    }
-    std::shared_ptr<Entity> prototype = entity->getComponent<InstanceComponent>()->prototype;
+std::vector<int> EntityManager::addStaticEntities(const std::vector<std::shared_ptr<Entity>>& entities, std::shared_ptr<RenderModule> renderModule, StaticBatchOptions options) {
+    std::vector<std::shared_ptr<Entity>> skipped;
+    std::vector<std::shared_ptr<Entity>> cells = StaticBatcher::merge(entities, skipped, options);
 
-    int id = m_nextId;
-    entity->setId(m_nextId);
-    m_nextId = m_nextId + 1;
-    m_entities.push_back(entity);
+    std::vector<int> ids;
+    for (auto& cell : cells) {
+        ids.push_back(addEntity(cell, renderModule));
+    }
+    for (auto& entity : skipped) {
+        ids.push_back(addEntity(entity, renderModule));
+    }
+    return ids;
+}
 
-    DefaultPipeline::ModelData modelData;
-    glm::mat4x4 transform = entity->getComponent<TransformComponent>()->transform->getMatrix();
-    modelData.transform = transform;
-    modelData.materialIndex = 0;
+int EntityManager::addInstance(std::shared_ptr<Entity> entity, std::shared_ptr<RenderModule> renderModule) {
+    std::vector<int> ids = addInstances({ entity }, renderModule);
+    return ids.empty() ? -1 : ids.front();
+}
 
-    if (prototype->hasComponent<MaterialComponent>()) {
-        // write the material to the model data
-        std::shared_ptr<Material> material = prototype->getComponent<MaterialComponent>()->material;
-        if (material->materialIndex == -1) { // we gotta register it!
-            material->materialIndex = addMaterial(material, renderModule);
+// the model data of all instances is packed in one go and written with a single upload
+std::vector<int> EntityManager::addInstances(const std::vector<std::shared_ptr<Entity>>& entities, std::shared_ptr<RenderModule> renderModule) {
+    std::vector<int> ids;
+    std::vector<glm::mat4x4> transforms;
+    std::vector<uint32_t> materialIndices;
+    ids.reserve(entities.size());
+    transforms.reserve(entities.size());
+    materialIndices.reserve(entities.size());
+
+    for (auto& entity : entities) {
+        if (!entity->hasComponent<InstanceComponent>()) {
+            std::cout << "ERROR: No instance component found on entity!" << std::endl;
+            continue;
+        }
+        std::shared_ptr<Entity> prototype = entity->getComponent<InstanceComponent>()->prototype;
+
+        int id = m_nextId;
+        entity->setId(m_nextId);
+        m_nextId = m_nextId + 1;
+        m_entities.push_back(entity);
+        ids.push_back(id);
+
+        glm::mat4x4 transform = entity->getComponent<TransformComponent>()->transform->getMatrix();
+        std::shared_ptr<Mesh> mesh = prototype->getComponent<MeshComponent>()->mesh;
+        if (mesh->isPacked) {
+            transform = transform * mesh->getDequantizeTransform();
         }
-        modelData.materialIndex = material->materialIndex;
+        transforms.push_back(transform);
+
+        uint32_t materialIndex = 0;
+        if (prototype->hasComponent<MaterialComponent>()) {
+            // write the material to the model data
+            std::shared_ptr<Material> material = prototype->getComponent<MaterialComponent>()->material;
+            if (material->materialIndex == -1) { // we gotta register it!
+                material->materialIndex = addMaterial(material, renderModule);
+            }
+            materialIndex = material->materialIndex;
+        }
+        materialIndices.push_back(materialIndex);
     }
 
-    std::vector<DefaultPipeline::ModelData> mds = { modelData };
+    if (ids.empty()) return ids;
+
+    // ids are handed out in order, so the instances are one contiguous range of the model buffer
+    std::vector<DefaultPipeline::ModelData> mds = InstanceCompression::pack(transforms, materialIndices);
     renderModule->writeModelBuffer(mds, m_nextModelBufferOffset);
-    m_nextModelBufferOffset += sizeof(DefaultPipeline::ModelData);
-    
-    return id;
+    m_nextModelBufferOffset += (int)(mds.size() * sizeof(DefaultPipeline::ModelData));
+
+    return ids;
 }
 
 int EntityManager::setSky(std::shared_ptr<Entity> sky, std::shared_ptr<RenderModule> renderModule) {
@@ -132,32 +203,21 @@ int EntityManager::setSky(std::shared_ptr<Entity> sky, std::shared_ptr<RenderMod
     m_sky = sky;
 
     glm::mat4x4 transform = sky->getComponent<TransformComponent>()->transform->getMatrix();
-    DefaultPipeline::ModelData modelData;
-    modelData.materialIndex = 0;
-    modelData.transform = transform;
-    modelData.isSkybox = 1;
+    uint32_t materialIndex = 0;
     if (sky->hasComponent<MaterialComponent>()) {
         std::shared_ptr<Material> skymaterial = sky->getComponent<MaterialComponent>()->material;
         if (skymaterial->materialIndex == -1) {
             skymaterial->materialIndex = addMaterial(skymaterial, renderModule);
         }
-        modelData.materialIndex = skymaterial->materialIndex;
+        materialIndex = skymaterial->materialIndex;
     }
 
-    std::vector<DefaultPipeline::ModelData> mds = { modelData };
+    std::vector<DefaultPipeline::ModelData> mds = { InstanceCompression::pack(transform, materialIndex, true) };
     renderModule->writeModelBuffer(mds, m_nextModelBufferOffset);
     m_nextModelBufferOffset += sizeof(DefaultPipeline::ModelData);
 
     std::shared_ptr<Mesh> mesh = sky->getComponent<MeshComponent>()->mesh;
-    std::vector<Mesh::VertexData> vds = mesh->m_vertexData;
-    int vertexBufferOffset = renderModule->addMeshToVertexBuffer(vds);
-    mesh->setVertexBufferOffset(vertexBufferOffset);
-    if (mesh->isIndexed) {
-        std::cout << "adding indices" << std::endl;
-        std::vector<uint32_t> indices = mesh->getIndexData();
-        int indexBufferOffset = renderModule->addMeshToIndexBuffer(indices);
-        mesh->setIndexBufferOffset(indexBufferOffset);
-    }
+    renderModule->addMesh(mesh);
 
     return id;
 }
@@ -170,23 +230,12 @@ int EntityManager::setQuad(std::shared_ptr<Entity> quad, std::shared_ptr<RenderM
     m_quad = quad;
 
     glm::mat4x4 transform = quad->getComponent<TransformComponent>()->transform->getMatrix();
-    DefaultPipeline::ModelData modelData;
-    modelData.materialIndex = 0;
-    modelData.transform = transform;
-    modelData.isSkybox = 0;
-
-    std::vector<DefaultPipeline::ModelData> mds = { modelData };
+    std::vector<DefaultPipeline::ModelData> mds = { InstanceCompression::pack(transform, 0) };
     renderModule->writeModelBuffer(mds, m_nextModelBufferOffset);
     m_nextModelBufferOffset += sizeof(DefaultPipeline::ModelData);
 
     std::shared_ptr<Mesh> mesh = quad->getComponent<MeshComponent>()->mesh;
-    std::vector<Mesh::VertexData> vds = mesh->m_vertexData;
-    int vertexBufferOffset = renderModule->addMeshToVertexBuffer(vds);
-    mesh->setVertexBufferOffset(vertexBufferOffset);
-    
-    std::vector<uint32_t> indices = mesh->getIndexData();
-    int indexBufferOffset = renderModule->addMeshToIndexBuffer(indices);
-    mesh->setIndexBufferOffset(indexBufferOffset);
+    renderModule->addMesh(mesh);
 
     return id;
 }
@@ -1,6 +1,8 @@
 #pragma once
 #include "Entity.h"
 #include "components/Material.h"
+#include "LodSystem.h"
+#include "../utilities/StaticBatcher.h"
 #include <unordered_map>
 #include <vector>
 #include <memory>
@@ -14,6 +16,10 @@ public:
     std::vector<std::shared_ptr<Entity>> getRenderableEntities();
     int addEntity(std::shared_ptr<Entity> entity, std::shared_ptr<RenderModule> renderModule);
     int addInstance(std::shared_ptr<Entity> entity, std::shared_ptr<RenderModule> renderModule);
+    std::vector<int> addInstances(const std::vector<std::shared_ptr<Entity>>& entities, std::shared_ptr<RenderModule> renderModule);
+    // merges static scenery per (material, cell) before adding it, see StaticBatcher.
+    // entities that can't be merged are added as they are. returns the ids of everything added
+    std::vector<int> addStaticEntities(const std::vector<std::shared_ptr<Entity>>& entities, std::shared_ptr<RenderModule> renderModule, StaticBatchOptions options = StaticBatchOptions());
     void addDefaultMaterial(std::shared_ptr<RenderModule> renderModule);
     int addMaterial(std::shared_ptr<Material> material, std::shared_ptr<RenderModule> renderModule);
     int EntityManager::setSky(std::shared_ptr<Entity> sky, std::shared_ptr<RenderModule> renderModule);
@@ -22,6 +28,7 @@ public:
     std::shared_ptr<Entity> getQuad();
 
     std::shared_ptr<Entity> camera;
+    std::shared_ptr<LodSystem> lodSystem;
 private:
 
     std::vector<std::shared_ptr<Entity>> m_entities;
@@ -0,0 +1,131 @@
+#include "LodSystem.h"
+#include "components/MeshComponent.h"
+#include "../utilities/ThreadPool.h"
+#include <algorithm>
+#include <cfloat>
+#include <iostream>
+
+namespace {
+const uint32_t GRAIN_SIZE = 16384;
+}
+
+void LodSystem::Instances::resize(size_t count) {
+    spheres.resize(count);
+    scales.resize(count);
+    errorSets.resize(count);
+    levels.resize(count, 0);
+}
+
+LodSystem::LodSystem(LodSettings settings) : m_settings(settings) {
+}
+
+bool LodSystem::add(std::shared_ptr<Entity> entity) {
+    auto lod = entity->getComponent<LodComponent>();
+    auto meshComponent = entity->getComponent<MeshComponent>();
+    if (lod == nullptr || meshComponent == nullptr || meshComponent->mesh == nullptr || lod->levels.empty()) {
+        std::cout << "can't select lods for entity " << entity->getId() << ", it needs levels and a mesh" << std::endl;
+        return false;
+    }
+    if (lod->levels.size() > MAX_LEVELS) {
+        std::cout << "entity " << entity->getId() << " has " << lod->levels.size() << " lod levels, only " << MAX_LEVELS << " are used" << std::endl;
+    }
+
+    auto mesh = meshComponent->mesh;
+    uint32_t owner = (uint32_t)m_entities.size();
+    m_entities.push_back(entity);
+    m_lods.push_back(lod.get());
+    m_bounds.push_back(mesh->getBoundingSphere());
+    m_boundsToMesh.push_back(mesh->isPacked ? mesh->getDequantizeTransform()[0][0] : 1.0f);
+
+    // the entity's model slots were reserved by EntityManager::addEntity, its instances stay put
+    uint32_t count = (uint32_t)std::max(entity->instanceCount, 0);
+    uint32_t errorSet = registerErrorSet(*lod);
+    size_t first = m_instances.size();
+    m_instances.resize(first + count);
+    lod->instanceLevels.resize(count, 0);
+    for (uint32_t i = 0; i < count; i++) {
+        m_modelSlots.push_back((uint32_t)entity->getId() + i);
+        m_owners.push_back(owner);
+        m_ownerInstances.push_back(i);
+        m_instances.errorSets[first + i] = errorSet;
+        m_instances.levels[first + i] = (uint8_t)std::min((uint32_t)lod->instanceLevels[i], MAX_LEVELS - 1);
+    }
+    return true;
+}
+
+uint32_t LodSystem::registerErrorSet(const LodComponent& lod) {
+    std::vector<float> errors;
+    for (auto& level : lod.levels) {
+        if (errors.size() == MAX_LEVELS) break;
+        errors.push_back(level.error);
+    }
+    auto it = m_errorSetsByErrors.find(errors);
+    if (it != m_errorSetsByErrors.end()) return it->second;
+
+    ErrorSet errorSet;
+    errorSet.levelCount = (uint32_t)errors.size();
+    std::fill(errorSet.errors, errorSet.errors + MAX_LEVELS, FLT_MAX); // never within a limit
+    std::copy(errors.begin(), errors.end(), errorSet.errors);
+    m_errorSets.push_back(errorSet);
+    m_errorSetsByErrors[errors] = (uint32_t)m_errorSets.size() - 1;
+    return (uint32_t)m_errorSets.size() - 1;
+}
+
+void LodSystem::update(const std::vector<InstanceCompression::PackedInstance>& models, glm::vec3 eye, float projectionScale) {
+    // gather, select and scatter in one pass per chunk, each chunk stays in cache
+    ThreadPool::shared().parallelFor((uint32_t)m_instances.size(), GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++) {
+            uint32_t owner = m_owners[i];
+            glm::vec4 bounds = m_bounds[owner];
+            uint32_t model = m_modelSlots[i];
+            if (model >= models.size() || bounds.w <= 0.0f) {
+                // nothing to measure, a sphere around the eye selects the finest level
+                m_instances.spheres[i] = glm::vec4(eye, 0.0f);
+                m_instances.scales[i] = 1.0f;
+                continue;
+            }
+            glm::vec4 world = InstanceCompression::transformSphere(models[model], bounds);
+            m_instances.spheres[i] = world;
+            m_instances.scales[i] = world.w / (bounds.w * m_boundsToMesh[owner]);
+        }
+        select(m_instances, begin, end, m_errorSets, eye, projectionScale, m_settings);
+        for (uint32_t i = begin; i < end; i++) {
+            m_lods[m_owners[i]]->instanceLevels[m_ownerInstances[i]] = m_instances.levels[i];
+        }
+    });
+}
+
+void LodSystem::select(Instances& instances, const std::vector<ErrorSet>& errorSets, glm::vec3 eye, float projectionScale, LodSettings settings) {
+    ThreadPool::shared().parallelFor((uint32_t)instances.size(), GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+        select(instances, begin, end, errorSets, eye, projectionScale, settings);
+    });
+}
+
+void LodSystem::select(Instances& instances, uint32_t begin, uint32_t end, const std::vector<ErrorSet>& errorSets, glm::vec3 eye, float projectionScale, LodSettings settings) {
+    // projected error = error * scale * projectionScale / distance. the threshold is moved
+    // into mesh units instead, one divide per instance and plain compares per level
+    float toMeshUnits = settings.errorThreshold / projectionScale;
+    float coarsen = 1.0f - settings.hysteresis;
+    float refine = 1.0f + settings.hysteresis;
+
+    for (uint32_t i = begin; i < end; i++) {
+        glm::vec4 sphere = instances.spheres[i];
+        float distance = std::max(glm::length(glm::vec3(sphere) - eye) - sphere.w, 0.0f); // 0 inside the bounds
+        const ErrorSet& errorSet = errorSets[instances.errorSets[i]];
+        float limit = distance * toMeshUnits / instances.scales[i];
+        uint32_t current = std::min((uint32_t)instances.levels[i], errorSet.levelCount - 1);
+
+        // errors grow with the level, so counting the levels under a limit finds the coarsest
+        // one within it. unused levels are FLT_MAX, the fixed length loop has no branches
+        uint32_t withinRefine = 0;
+        uint32_t withinCoarsen = 0;
+        for (uint32_t level = 1; level < MAX_LEVELS; level++) {
+            withinRefine += errorSet.errors[level] <= limit;
+            withinCoarsen += errorSet.errors[level] <= limit * coarsen;
+        }
+        // too coarse: step down to the coarsest level within the threshold, else only step up
+        // once the next level is inside the tighter band
+        bool tooCoarse = errorSet.errors[current] > limit * refine;
+        instances.levels[i] = (uint8_t)(tooCoarse ? std::min(current, withinRefine) : std::max(current, withinCoarsen));
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include "Entity.h"
+#include "components/LodComponent.h"
+#include "../utilities/InstanceCompression.h"
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <vector>
+
+struct LodSettings {
+    float errorThreshold = 1.0; // pixels a level may deviate on screen
+    float hysteresis = 0.25;    // band around the threshold, as a fraction of it
+};
+
+// Picks a detail level per instance from its projected (screen space) error.
+// The selection runs in batches over flat arrays on the shared ThreadPool.
+// Hysteresis: a level only gets coarser once its error is below threshold * (1 - h),
+// and only finer once the current one is above threshold * (1 + h), so instances
+// near a switching distance don't flip between levels every frame.
+class LodSystem {
+public:
+    static const uint32_t MAX_LEVELS = 8;
+
+    // level errors shared by every instance with the same chain, FLT_MAX past levelCount
+    struct ErrorSet {
+        uint32_t levelCount;
+        float errors[MAX_LEVELS];
+    };
+
+    // one entry per instance
+    struct Instances {
+        std::vector<glm::vec4> spheres;  // world space center and radius
+        std::vector<float> scales;       // world units per mesh unit
+        std::vector<uint32_t> errorSets;
+        std::vector<uint8_t> levels;     // in and out, the previous level drives the hysteresis
+
+        void resize(size_t count);
+        size_t size() { return levels.size(); }
+    };
+
+    LodSystem(LodSettings settings = LodSettings());
+
+    // entities need a LodComponent and a MeshComponent, and their instanceCount set already
+    bool add(std::shared_ptr<Entity> entity);
+    uint32_t getInstanceCount() { return (uint32_t)m_instances.size(); }
+
+    // gathers the instances' model data (slots id .. id + instanceCount, see RenderModule::getModels),
+    // selects and writes LodComponent::instanceLevels. instances without model data get the finest level.
+    // projectionScale is pixels per world unit at distance 1, see RenderModule::getProjectionScale
+    void update(const std::vector<InstanceCompression::PackedInstance>& models, glm::vec3 eye, float projectionScale);
+
+    static void select(Instances& instances, const std::vector<ErrorSet>& errorSets, glm::vec3 eye, float projectionScale, LodSettings settings);
+    static void select(Instances& instances, uint32_t begin, uint32_t end, const std::vector<ErrorSet>& errorSets, glm::vec3 eye, float projectionScale, LodSettings settings);
+
+    LodSettings m_settings;
+
+private:
+    uint32_t registerErrorSet(const LodComponent& lod);
+
+    std::vector<std::shared_ptr<Entity>> m_entities;
+    // raw pointers into m_entities, so the per frame gather skips the component lookups
+    std::vector<LodComponent*> m_lods;
+    // per entity, the bounds its model data transforms (those of the MeshComponent mesh) and
+    // the mesh units per unit of them, packed meshes are bounded in their unorm space
+    std::vector<glm::vec4> m_bounds;
+    std::vector<float> m_boundsToMesh;
+
+    // per instance, its model slot, the index of its entity and its index within the entity
+    std::vector<uint32_t> m_modelSlots;
+    std::vector<uint32_t> m_owners;
+    std::vector<uint32_t> m_ownerInstances;
+    Instances m_instances;
+    std::vector<ErrorSet> m_errorSets;
+    std::map<std::vector<float>, uint32_t> m_errorSetsByErrors;
+};
@@ -0,0 +1,31 @@
+#include "LodComponent.h"
+#include "../../utilities/ImpostorBaker.h"
+#include <algorithm>
+
+LodComponent::LodComponent() {
+}
+
+LodComponent::~LodComponent() {
+    levels.clear();
+    impostor.reset();
+}
+
+void LodComponent::setLevelsFromLodChain(std::shared_ptr<Mesh> mesh) {
+    levels.clear();
+    for (uint32_t lod = 0; lod < mesh->getLodCount(); lod++) {
+        levels.push_back({ mesh, lod, mesh->getLod(lod).error });
+    }
+}
+
+void LodComponent::addLevel(std::shared_ptr<Mesh> mesh, float error, uint32_t lod) {
+    levels.push_back({ mesh, lod, error });
+}
+
+void LodComponent::setImpostor(std::shared_ptr<ImpostorAtlas> atlas) {
+    if (!levels.empty() && levels.back().impostor) levels.pop_back();
+    impostor = atlas;
+    // never finer than the mesh levels, the selection expects growing errors
+    float error = atlas->error;
+    if (!levels.empty()) error = std::max(error, levels.back().error);
+    levels.push_back({ atlas->billboard, 0, error, true });
+}
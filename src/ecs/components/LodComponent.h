@@ -0,0 +1,37 @@
+#pragma once
+#include "Components.h"
+#include "Mesh.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+struct ImpostorAtlas;
+
+// Detail levels of an entity, finest first. A level is a mesh plus one of its
+// lod ranges, so it can be a separate mesh or a level of a MeshSimplifier chain.
+// LodSystem picks a level per instance each frame, the render passes draw the instances
+// of each level with its mesh instead of the MeshComponent.
+// An impostor can follow as the coarsest level, see ImpostorBaker.
+class LodComponent : public Component {
+public:
+    struct Level {
+        std::shared_ptr<Mesh> mesh;
+        uint32_t lod;
+        float error; // mesh space, has to grow with the level
+        bool impostor = false; // mesh is the atlas billboard, drawn with the impostor pipeline
+    };
+
+    LodComponent();
+    ~LodComponent();
+
+    // one level per range of the mesh lod chain
+    void setLevelsFromLodChain(std::shared_ptr<Mesh> mesh);
+    void addLevel(std::shared_ptr<Mesh> mesh, float error, uint32_t lod = 0);
+    // appends the impostor as the last level, its billboard mesh is filled in by EntityManager::addEntity
+    void setImpostor(std::shared_ptr<ImpostorAtlas> atlas);
+
+    std::vector<Level> levels;
+    std::vector<uint8_t> instanceLevels; // one per instance of the entity, selected by LodSystem
+
+    std::shared_ptr<ImpostorAtlas> impostor;
+};
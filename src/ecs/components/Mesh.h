@@ -2,7 +2,11 @@
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <iostream>
+#include <vector>
 class Mesh {
 public:
     struct VertexData {
@@ -14,22 +18,96 @@ public:
         glm::vec2 uv;
     };
 
+    // compact 20 byte vertex, see VertexCompression.
+    // position xyz is unorm16 inside the mesh bounds, position w holds the tangent
+    // angle around the normal (15 bits) and the bitangent sign (1 bit).
+    struct PackedVertexData {
+        uint16_t position[4];
+        int16_t normal[2];  // octahedral snorm16
+        uint16_t uv[2];     // half floats
+        uint8_t color[4];   // unorm8, alpha unused
+    };
+
+    // a cluster of at most 64 vertices and 124 triangles, see MeshletBuilder.
+    // its triangles are a contiguous range of the mesh index data.
+    struct Meshlet {
+        uint32_t firstIndex;
+        uint32_t indexCount;
+        uint32_t vertexCount;
+        glm::vec3 center;     // bounding sphere, mesh space
+        float radius;
+        glm::vec3 coneAxis;   // normal cone, the meshlet faces away from the viewer
+        float coneCutoff;     // when dot(center - eye, axis) >= cutoff * |center - eye| + radius. 1 never culls
+    };
+
+    // a level of detail, see MeshSimplifier. level 0 is the full mesh, simplified
+    // levels are index ranges appended behind it that share its vertices.
+    struct Lod {
+        uint32_t firstIndex;
+        uint32_t indexCount;
+        float error; // mesh space distance the level may deviate from the full mesh, conservative
+    };
+
     void setVertexData(std::vector<VertexData> data) {
         m_vertexData = data;
         m_vertexCount = (uint32_t)data.size();
         m_size = (uint32_t)(data.size() * sizeof(VertexData));
+        m_hasBoundingSphere = false;
+        m_uvSpan = 0.0f;
     }
 
+    // indices are kept as uint16 when they all fit, halving index memory and bandwidth.
+    // 0xffff is left out, it's the strip restart value.
     void setIndexData(std::vector<uint32_t> data) {
+        uint32_t maxIndex = 0;
+        for (uint32_t index : data) {
+            maxIndex = std::max(maxIndex, index);
+        }
+        if (maxIndex < UINT16_MAX) {
+            setIndexData16(std::vector<uint16_t>(data.begin(), data.end()));
+            return;
+        }
         m_indexData = data;
+        m_indexData16.clear();
+        m_meshlets.clear(); // the ranges no longer match
+        m_lods.clear();
+        m_indexCount = (uint32_t)data.size();
+        isIndexed = true;
+        isIndex16 = false;
+        m_uvSpan = 0.0f;
+    }
+
+    void setIndexData16(std::vector<uint16_t> data) {
+        m_indexData16 = data;
+        m_indexData.clear();
+        m_meshlets.clear(); // the ranges no longer match
+        m_lods.clear();
         m_indexCount = (uint32_t)data.size();
         isIndexed = true;
+        isIndex16 = true;
+        m_uvSpan = 0.0f;
     }
 
+    // always 32 bit, widened if the mesh stores 16 bit indices
     std::vector<uint32_t> getIndexData() {
+        if (isIndex16) {
+            return std::vector<uint32_t>(m_indexData16.begin(), m_indexData16.end());
+        }
         return m_indexData;
     }
 
+    const std::vector<uint16_t>& getIndexData16() {
+        return m_indexData16;
+    }
+
+    // the indices as stored, uint16 when isIndex16 and uint32 otherwise, without a copy
+    const void* getIndexBytes() {
+        return isIndex16 ? (const void*)m_indexData16.data() : (const void*)m_indexData.data();
+    }
+    size_t getIndexByteSize() {
+        return (size_t)m_indexCount * (isIndex16 ? sizeof(uint16_t) : sizeof(uint32_t));
+    }
+
     uint32_t getVertexBufferOffset() {
         return m_vertexBufferOffset;
     }
@@ -43,10 +121,21 @@ public:
     void setIndexBufferOffset(uint32_t offset) {
         m_indexBufferOffset = offset;
     }
+    // all indices, lod levels included. draws want getLod(level).indexCount
     uint32_t getIndexCount() {
         return m_indexCount;
     }
 
+    uint32_t getLodCount() {
+        return m_lods.empty() ? 1 : (uint32_t)m_lods.size();
+    }
+
+    // levels past the last one clamp to it
+    Lod getLod(uint32_t level) {
+        if (m_lods.empty()) return { 0, m_indexCount, 0.0f };
+        return m_lods[std::min(level, (uint32_t)m_lods.size() - 1)];
+    }
+
     uint32_t getSize() {
         return m_size;
     }
@@ -54,15 +143,95 @@ public:
     uint32_t getVertexCount() {
         return m_vertexCount;
     }
+
+    // packed vertices replace m_vertexData on upload. dequantize maps the unorm
+    // positions back to mesh space and has to be applied on top of the model transform.
+    void setPackedVertexData(std::vector<PackedVertexData> data, glm::mat4x4 dequantize) {
+        m_packedVertexData = data;
+        m_dequantize = dequantize;
+        isPacked = true;
+        m_hasBoundingSphere = false;
+        m_uvSpan = 0.0f;
+    }
+
+    glm::mat4x4 getDequantizeTransform() {
+        return m_dequantize;
+    }
+
+    // xyz center, w radius, around the center of the bounds. packed meshes are bounded in
+    // their unorm space, the dequantize transform is part of their model transform.
+    // a negative radius means there's nothing to bound, such meshes are never culled
+    glm::vec4 getBoundingSphere() {
+        if (m_hasBoundingSphere) return m_boundingSphere;
+        m_hasBoundingSphere = true;
+        if (isPacked) {
+            m_boundingSphere = glm::vec4(0.5, 0.5, 0.5, 0.8660254); // the unit cube
+            return m_boundingSphere;
+        }
+        if (m_vertexData.empty()) {
+            m_boundingSphere = glm::vec4(0.0, 0.0, 0.0, -1.0);
+            return m_boundingSphere;
+        }
+        glm::vec3 low = m_vertexData[0].position;
+        glm::vec3 high = m_vertexData[0].position;
+        for (auto& vertex : m_vertexData) {
+            low = glm::min(low, vertex.position);
+            high = glm::max(high, vertex.position);
+        }
+        glm::vec3 center = (low + high) * 0.5f;
+        float radius = 0.0f;
+        for (auto& vertex : m_vertexData) {
+            radius = std::max(radius, glm::length(vertex.position - center));
+        }
+        m_boundingSphere = glm::vec4(center, radius);
+        return m_boundingSphere;
+    }
+
+    // mesh units one uv unit covers, the square root of the ratio of the lod 0 triangle
+    // areas to their uv areas. texture streaming turns it into texels per pixel.
+    // in the bounding sphere's space, packed meshes (and ones without uvs) assume
+    // the uvs span the bounds once
+    float getUvSpan() {
+        if (m_uvSpan > 0.0f) return m_uvSpan;
+        float diameter = std::max(2.0f * getBoundingSphere().w, 1e-6f);
+        m_uvSpan = diameter;
+        if (isPacked || m_vertexData.empty()) return m_uvSpan;
+
+        std::vector<uint32_t> indices = getIndexData();
+        Lod lod = getLod(0);
+        double area = 0.0;
+        double uvArea = 0.0;
+        for (uint32_t i = lod.firstIndex; i + 2 < lod.firstIndex + lod.indexCount; i += 3) {
+            const VertexData& a = m_vertexData[indices[i]];
+            const VertexData& b = m_vertexData[indices[i + 1]];
+            const VertexData& c = m_vertexData[indices[i + 2]];
+            area += 0.5 * glm::length(glm::cross(b.position - a.position, c.position - a.position));
+            glm::vec2 ab = b.uv - a.uv;
+            glm::vec2 ac = c.uv - a.uv;
+            uvArea += 0.5 * std::abs(ab.x * ac.y - ab.y * ac.x);
+        }
+        if (area > 0.0 && uvArea > 0.0) m_uvSpan = (float)std::sqrt(area / uvArea);
+        return m_uvSpan;
+    }
 public:
     bool isIndexed = false;
+    bool isIndex16 = false;
+    bool isPacked = false;
     std::vector<VertexData> m_vertexData;
+    std::vector<PackedVertexData> m_packedVertexData;
+    std::vector<Meshlet> m_meshlets; // cover lod 0 only
+    std::vector<Lod> m_lods;
 
 private:
     std::vector<uint32_t> m_indexData;
+    std::vector<uint16_t> m_indexData16;
     uint32_t m_indexCount = 0;
     uint32_t m_vertexBufferOffset;
     uint32_t m_indexBufferOffset;
     uint32_t m_vertexCount = 0;
     uint32_t m_size;
+    glm::mat4x4 m_dequantize = glm::mat4x4(1.0);
+    glm::vec4 m_boundingSphere = glm::vec4(0.0);
+    bool m_hasBoundingSphere = false;
+    float m_uvSpan = 0.0f; // 0 until getUvSpan
 };
\ No newline at end of file
@@ -1,4 +1,3 @@
-#pragma once
 #include "MeshComponent.h"
 #include <memory>
 
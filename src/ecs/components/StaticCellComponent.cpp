@@ -0,0 +1,8 @@
+#pragma once
+#include "StaticCellComponent.h"
+
+StaticCellComponent::StaticCellComponent() {
+}
+
+StaticCellComponent::~StaticCellComponent() {
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include "Components.h"
+#include <glm/glm.hpp>
+#include <cstdint>
+
+// Marks an entity as a merged cell of static geometry, see StaticBatcher.
+// The bounds cull the whole cell, tighter than its bounding sphere.
+class StaticCellComponent : public Component {
+public:
+    StaticCellComponent();
+    ~StaticCellComponent();
+
+    glm::ivec3 cell = glm::ivec3(0);
+    glm::vec3 boundsMin = glm::vec3(0.0); // world space
+    glm::vec3 boundsMax = glm::vec3(0.0);
+    uint32_t objectCount = 0; // entities merged into the cell
+};
@@ -1,5 +1,8 @@
 #pragma once
+#include <glm/glm.hpp>
+#include <memory>
 #include <vector>
+class MippedTexture;
 namespace coho {
     class Texture {
     public:
@@ -8,7 +11,13 @@ namespace coho {
         int height;
         int channels;
         int mipLevels;
+        bool compress = true; // block compressed on upload when the device supports it
+        // the cooked mip chain, uploaded as it is. pixelData is empty when it comes from a cooked file
+        std::shared_ptr<MippedTexture> mipped;
+        bool loading = false; // decoding on the AsyncTextureLoader, materials bind the placeholder meanwhile
 
         int bufferIndex = -1;
+        // xy scale, zw offset of the texture's rect in its view, not identity once it's packed into an atlas page
+        glm::vec4 uvTransform = glm::vec4(1.0, 1.0, 0.0, 0.0);
     };
 }
\ No newline at end of file
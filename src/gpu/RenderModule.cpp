@@ -3,8 +3,18 @@
 #include "../ecs/Entity.h"
 #include "../ecs/components/MeshComponent.h"
 #include "../ecs/components/TransformComponent.h"
+#include "../ecs/components/StaticCellComponent.h"
+#include "../ecs/components/MaterialComponent.h"
+#include "../ecs/components/LodComponent.h"
+#include "../ecs/LodSystem.h"
 
 #include "../utilities/MeshBuilder.h"
+#include "../utilities/MeshletBuilder.h"
+#include "../utilities/StaticBatcher.h"
+#include "../utilities/InstanceCuller.h"
+#include "../utilities/texture/MipGenerator.h"
+#include "../utilities/texture/BlockCompression.h"
+#include "../utilities/texture/MippedTexture.h"
 
 #include "../memory/Buffer.h"
 #include "../memory/Shader.h"
@@ -13,11 +23,13 @@
 #include "../resources/renderpass/geometry.h"
 #include "../resources/renderpass/terrain.h"
 #include "../resources/renderpass/noiseVis.h"
+#include "../resources/renderpass/depth.h"
 #include "../resources/pipelines/FullscreenQuad.h"
 
 #include <SDL2/SDL.h>
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
+#include <cfloat>
 
 #include <webgpu/webgpu.hpp>
 #include <sdl2webgpu/sdl2webgpu.h>
@@ -58,6 +70,8 @@ void RenderModule::addTerrainPipeline(
     m_terrainindexCount = indexCount;
     m_terrainPipeline = pipeline;
     m_terrainuniformBuffer = uniformBuffer;
+    // per frame updates only touch the fields that change, so seed the whole thing once
+    m_uploadManager->write(m_terrainuniformBuffer->getBuffer(), 0, &m_uniformData, sizeof(TerrainPipeline::UniformData));
 }
 
 // void RenderModule::addFullscreenQuadPipeline(
@@ -77,11 +91,15 @@ void RenderModule::addTerrainPipeline(
 // }
 
 void RenderModule::writeModelBuffer(std::vector<DefaultPipeline::ModelData> modelData, int offset = 0) {
-    m_device->getQueue().writeBuffer(m_modelBuffer->getBuffer(), offset, modelData.data(), modelData.size() * sizeof(DefaultPipeline::ModelData));
+    m_uploadManager->write(m_modelBuffer->getBuffer(), offset, modelData.data(), modelData.size() * sizeof(DefaultPipeline::ModelData));
+    // the culler reads the instances from the cpu copy
+    size_t first = offset / sizeof(DefaultPipeline::ModelData);
+    if (m_models.size() < first + modelData.size()) m_models.resize(first + modelData.size());
+    std::copy(modelData.begin(), modelData.end(), m_models.begin() + first);
 }
 
 void RenderModule::writeMaterialBuffer(std::vector<DefaultPipeline::MaterialData> materialData, int offset = 0) {
-    m_device->getQueue().writeBuffer(m_materialBuffer->getBuffer(), offset, materialData.data(), materialData.size() * sizeof(DefaultPipeline::MaterialData));
+    m_uploadManager->write(m_materialBuffer->getBuffer(), offset, materialData.data(), materialData.size() * sizeof(DefaultPipeline::MaterialData));
 }
 
 void RenderModule::onFrame(
@@ -91,9 +109,23 @@ void RenderModule::onFrame(
         std::shared_ptr<Entity> fullscreenQuad,
         float time) {
     m_uniformData.time = time;
-    m_device->getQueue().writeBuffer(m_uniformBuffer->getBuffer(), offsetof(DefaultPipeline::UniformData, time), &m_uniformData.time, sizeof(DefaultPipeline::UniformData::time));
-    m_device->getQueue().writeBuffer(m_terrainuniformBuffer->getBuffer(), 0, &m_uniformData, sizeof(TerrainPipeline::UniformData));
-    
+    uploadLoadedTextures();
+    m_uploadManager->write(m_uniformBuffer->getBuffer(), offsetof(DefaultPipeline::UniformData, time), &m_uniformData.time, sizeof(DefaultPipeline::UniformData::time));
+    m_uploadManager->write(m_terrainuniformBuffer->getBuffer(), offsetof(TerrainPipeline::UniformData, time), &m_uniformData.time, sizeof(TerrainPipeline::UniformData::time));
+
+    // everything written this frame goes to the gpu before any pass is recorded
+    m_uploadManager->flush();
+    m_uploadManager->endFrame();
+
+    // compact the mesh buffers a little at a time once they're fragmented enough
+    defragmentMeshBuffers(4);
+    // a mesh buffer that grew was swapped, the pipelines holding the old one are made again
+    if (m_meshResidency->getGeneration() != m_meshBufferGeneration && m_renderPipeline != nullptr) {
+        releaseTexturePipelines();
+        initTexturePipelines();
+        m_meshBufferGeneration = m_meshResidency->getGeneration();
+    }
+
     // ~~~
     m_surfaceTextureTexture.release();
     m_surface->getCurrentTexture(&m_surfaceTexture);
@@ -144,49 +176,258 @@ void RenderModule::noiseVisRenderPass(std::shared_ptr<Entity> quad) {
         m_surfaceTextureView,
         m_depthTextureView,
         m_fullscreenQuadRenderPipeline->getRenderPipeline(),
-        m_vertexBuffer->getBuffer(), 
-        m_vertexCount * sizeof(VertexData),
-        m_indexBuffer->getBuffer(),
-        m_vertexCount * sizeof(VertexData),
+        m_vertexBuffer->getBuffer(coho::MeshResidencyTable::PositionStream)->getBuffer(),
+        m_vertexBuffer->getSizeInBytes(coho::MeshResidencyTable::PositionStream),
+        m_vertexBuffer->getBuffer(coho::MeshResidencyTable::AttributeStream)->getBuffer(),
+        m_vertexBuffer->getSizeInBytes(coho::MeshResidencyTable::AttributeStream),
+        getIndexBuffers(),
         m_fullscreenQuadRenderPipeline->m_bindGroup,
         quad
     );
 }
 
 void RenderModule::skyBoxRenderPass(std::shared_ptr<Entity> sky) {
+    // the sky is never culled, the first slot of the visible index buffer is its own
+    uint32_t model = (uint32_t)sky->getId();
+    m_uploadManager->write(m_visibleBuffer->getBuffer(), 0, &model, sizeof(uint32_t));
+    m_uploadManager->flush();
+    IndirectDraws draws;
+    draws.instancesByEntity[sky->getId()] = { 0, 1 };
+
     SkyboxRenderPass::render(*m_device,
         m_surfaceTextureView,
         m_depthTextureView,
         m_renderPipeline->getRenderPipeline(),
-        m_vertexBuffer->getBuffer(), 
-        m_vertexCount * sizeof(VertexData),
+        m_vertexBuffer->getBuffer(coho::MeshResidencyTable::PositionStream)->getBuffer(),
+        m_vertexBuffer->getSizeInBytes(coho::MeshResidencyTable::PositionStream),
+        m_vertexBuffer->getBuffer(coho::MeshResidencyTable::AttributeStream)->getBuffer(),
+        m_vertexBuffer->getSizeInBytes(coho::MeshResidencyTable::AttributeStream),
         m_renderPipeline->m_bindGroup,
-        {sky}
+        {sky},
+        &draws
     );
 }
 
+IndexBuffers RenderModule::getIndexBuffers() {
+    IndexBuffers indexBuffers;
+    indexBuffers.index32Buffer = m_indexBuffer->getBuffer()->getBuffer();
+    indexBuffers.index32BufferSize = m_indexBuffer->getSizeInBytes();
+    indexBuffers.index16Buffer = m_index16Buffer->getBuffer()->getBuffer();
+    indexBuffers.index16BufferSize = m_index16Buffer->getSizeInBytes();
+    return indexBuffers;
+}
+
 void RenderModule::geometryRenderPass(std::vector<std::shared_ptr<Entity>> entities) {
+    IndirectDraws draws;
+    cullInstances(entities, draws);
+    cullMeshlets(entities, draws);
+    // before any pass, a residency change rebuilds the texture pipelines
+    streamTextures(entities);
+    // the visible indices and indirect arguments go up before the passes read them
+    m_uploadManager->flush();
+
+    // depth prepass over the position stream only, shading then only runs for visible fragments
+    if (m_depthPrepass) {
+        DepthRenderPass::render(*m_device,
+            m_depthTextureView,
+            m_depthPipeline->getRenderPipeline(),
+            m_vertexBuffer->getBuffer(coho::MeshResidencyTable::PositionStream)->getBuffer(),
+            m_vertexBuffer->getSizeInBytes(coho::MeshResidencyTable::PositionStream),
+            getIndexBuffers(),
+            m_depthPipeline->m_bindGroup,
+            entities,
+            &draws,
+            FullVertexDraws
+        );
+    }
+
     GeometryRenderPass::render(*m_device,
         m_surfaceTextureView,
         m_depthTextureView,
         m_renderPipeline->getRenderPipeline(),
-        m_vertexBuffer->getBuffer(), 
-        m_vertexCount * sizeof(VertexData),
-        m_indexBuffer->getBuffer(),
-        m_vertexCount * sizeof(VertexData),
+        m_vertexBuffer->getBuffer(coho::MeshResidencyTable::PositionStream)->getBuffer(),
+        m_vertexBuffer->getSizeInBytes(coho::MeshResidencyTable::PositionStream),
+        m_vertexBuffer->getBuffer(coho::MeshResidencyTable::AttributeStream)->getBuffer(),
+        m_vertexBuffer->getSizeInBytes(coho::MeshResidencyTable::AttributeStream),
+        getIndexBuffers(),
         m_renderPipeline->m_bindGroup,
-        entities
+        entities,
+        m_depthPrepass ? wgpu::LoadOp::Load : wgpu::LoadOp::Clear,
+        &draws,
+        FullVertexDraws
+    );
+
+    // packed meshes use their own vertex buffer and pipeline, impostors their own pipeline
+    if (draws.visibleKinds & PackedVertexDraws) {
+        GeometryRenderPass::render(*m_device,
+            m_surfaceTextureView,
+            m_depthTextureView,
+            m_packedRenderPipeline->getRenderPipeline(),
+            m_packedVertexBuffer->getBuffer()->getBuffer(),
+            m_packedVertexBuffer->getSizeInBytes(),
+            nullptr,
+            0,
+            getIndexBuffers(),
+            m_packedRenderPipeline->m_bindGroup,
+            entities,
+            wgpu::LoadOp::Load,
+            &draws,
+            PackedVertexDraws
+        );
+    }
+
+    // impostors write their own (baked) depth, they stay out of the prepass if there is one
+    if (!(draws.visibleKinds & ImpostorDraws)) return;
+    GeometryRenderPass::render(*m_device,
+        m_surfaceTextureView,
+        m_depthTextureView,
+        m_impostorPipeline->getRenderPipeline(),
+        m_vertexBuffer->getBuffer(coho::MeshResidencyTable::PositionStream)->getBuffer(),
+        m_vertexBuffer->getSizeInBytes(coho::MeshResidencyTable::PositionStream),
+        m_vertexBuffer->getBuffer(coho::MeshResidencyTable::AttributeStream)->getBuffer(),
+        m_vertexBuffer->getSizeInBytes(coho::MeshResidencyTable::AttributeStream),
+        getIndexBuffers(),
+        m_impostorPipeline->m_bindGroup,
+        entities,
+        wgpu::LoadOp::Load,
+        &draws,
+        ImpostorDraws
     );
 }
 
+void RenderModule::cullInstances(const std::vector<std::shared_ptr<Entity>>& entities, IndirectDraws& draws) {
+    static_assert(InstanceCuller::MAX_LEVELS >= LodSystem::MAX_LEVELS, "the culler has to bucket every level LodSystem selects");
+    glm::mat4x4 viewProjection = m_uniformData.projection_matrix * m_uniformData.view_matrix;
+
+    std::vector<InstanceBatch> batches;
+    batches.reserve(entities.size());
+    for (auto& entity : entities) {
+        // the model transform was built for the MeshComponent mesh, its bounds hold for every lod level and the impostor
+        auto mesh = entity->getComponent<MeshComponent>()->mesh;
+        InstanceBatch batch = { (uint32_t)entity->getId(), (uint32_t)entity->instanceCount, mesh->getBoundingSphere() };
+        auto lodComponent = entity->getComponent<LodComponent>();
+        if (lodComponent != nullptr && !lodComponent->levels.empty() && lodComponent->instanceLevels.size() >= batch.count) {
+            batch.levels = lodComponent->instanceLevels.data();
+            batch.levelCount = std::min((uint32_t)lodComponent->levels.size(), InstanceCuller::MAX_LEVELS);
+        }
+        batches.push_back(batch);
+    }
+    InstanceCuller::cull(batches, m_models, viewProjection, m_visibleIndices, m_visibleRanges, m_visibleLevelRanges);
+
+    uint32_t capacity = m_visibleBuffer->getSize() / sizeof(uint32_t) - FIRST_VISIBLE_SLOT;
+    bool overflow = m_visibleIndices.size() > capacity;
+    if (overflow && !m_visibleOverflow) {
+        std::cout << "visible index buffer overflow, " << m_visibleIndices.size() - capacity << " instances dropped" << std::endl;
+    }
+    m_visibleOverflow = overflow;
+    auto clamp = [&](const VisibleRange& range) {
+        uint32_t first = std::min(range.first, capacity);
+        uint32_t count = std::min(range.count, capacity - first);
+        return std::pair<uint32_t, uint32_t>(FIRST_VISIBLE_SLOT + first, count);
+    };
+    uint32_t levelRange = 0;
+    for (size_t i = 0; i < entities.size(); i++) {
+        auto instances = clamp(m_visibleRanges[i]);
+        // a merged static cell is one draw, its box culls tighter than the sphere
+        auto cell = entities[i]->getComponent<StaticCellComponent>();
+        if (cell != nullptr && instances.second > 0 && !StaticBatcher::isVisible(*cell, viewProjection)) instances.second = 0;
+        draws.instancesByEntity[entities[i]->getId()] = instances;
+        if (batches[i].levels == nullptr) {
+            levelRange += batches[i].levelCount;
+            if (instances.second > 0) draws.visibleKinds |= RenderPass::drawKind(entities[i]->getComponent<MeshComponent>()->mesh, false);
+            continue;
+        }
+        // every level draws its own instances with its own mesh
+        auto& levels = entities[i]->getComponent<LodComponent>()->levels;
+        draws.levelRangesByEntity[entities[i]->getId()] = { (uint32_t)draws.levelRanges.size(), batches[i].levelCount };
+        for (uint32_t level = 0; level < batches[i].levelCount; level++) {
+            auto levelInstances = clamp(m_visibleLevelRanges[levelRange++]);
+            draws.levelRanges.push_back(levelInstances);
+            if (levelInstances.second > 0) draws.visibleKinds |= RenderPass::drawKind(levels[level].mesh, levels[level].impostor);
+        }
+    }
+    if (m_visibleIndices.empty()) return;
+
+    // 4 bytes per visible instance, the model buffer itself stays untouched
+    uint32_t count = std::min((uint32_t)m_visibleIndices.size(), capacity);
+    m_uploadManager->write(m_visibleBuffer->getBuffer(), FIRST_VISIBLE_SLOT * sizeof(uint32_t), m_visibleIndices.data(), count * sizeof(uint32_t));
+}
+
+void RenderModule::cullMeshlets(const std::vector<std::shared_ptr<Entity>>& entities, IndirectDraws& draws) {
+    glm::mat4x4 viewProjection = m_uniformData.projection_matrix * m_uniformData.view_matrix;
+    glm::vec3 eye = m_camera.position - m_camera.forward; // see updateViewMatrix
+
+    std::vector<uint32_t> visible;
+    for (auto& entity : entities) {
+        auto mesh = entity->getComponent<MeshComponent>()->mesh;
+        auto lodComponent = entity->getComponent<LodComponent>();
+        if (lodComponent != nullptr && !lodComponent->levels.empty()) {
+            // meshlets only cover lod 0, the finest level once LodSystem picked it
+            auto& level = lodComponent->levels.front();
+            if (level.lod != 0 || level.impostor || lodComponent->instanceLevels.empty() || lodComponent->instanceLevels[0] != 0) continue;
+            mesh = level.mesh;
+        }
+        // instanced entities share one model lookup per instance, they're drawn whole
+        if (mesh->m_meshlets.empty() || entity->instanceCount != 1) continue;
+        auto transform = entity->getComponent<TransformComponent>();
+        if (transform == nullptr) continue;
+        // nothing to do once the instance is culled, otherwise its visible slot is the firstInstance
+        auto instances = draws.instancesByEntity.find(entity->getId());
+        if (instances == draws.instancesByEntity.end() || instances->second.second == 0) continue;
+        visible.clear();
+        MeshletBuilder::cull(mesh->m_meshlets, transform->transform->getMatrix(), viewProjection, eye, visible);
+
+        uint32_t first = (uint32_t)draws.args.size();
+        for (uint32_t i : visible) {
+            const Mesh::Meshlet& meshlet = mesh->m_meshlets[i];
+            DrawIndexedIndirectArgs args;
+            args.indexCount = meshlet.indexCount;
+            args.instanceCount = 1;
+            args.firstIndex = mesh->getIndexBufferOffset() + meshlet.firstIndex;
+            args.baseVertex = (int32_t)mesh->getVertexBufferOffset();
+            args.firstInstance = instances->second.first;
+            draws.args.push_back(args);
+        }
+        draws.rangesByEntity[entity->getId()] = { first, (uint32_t)visible.size() };
+    }
+
+    // firstInstance carries the visible slot, indirect draws can only set it with IndirectFirstInstance
+    draws.useIndirect = m_supportsIndirectFirstInstance && !draws.args.empty();
+    if (!draws.useIndirect) return;
+
+    uint32_t size = (uint32_t)(draws.args.size() * sizeof(DrawIndexedIndirectArgs));
+    if (m_indirectBuffer == nullptr || m_indirectBuffer->getSize() < size) {
+        uint32_t capacity = std::max(size, m_indirectBuffer == nullptr ? 0u : m_indirectBuffer->getSize() * 2);
+        BufferDescriptor bufferDesc;
+        bufferDesc.label = "meshlet indirect buffer";
+        bufferDesc.usage = BufferUsage::Indirect | BufferUsage::CopyDst;
+        bufferDesc.size = capacity;
+        m_indirectBuffer = std::make_shared<coho::Buffer>(m_device, bufferDesc, BufferBindingLayout(Default), capacity, bufferDesc.label);
+    }
+    m_uploadManager->write(m_indirectBuffer->getBuffer(), 0, draws.args.data(), size);
+    draws.buffer = m_indirectBuffer->getBuffer();
+}
+
 bool RenderModule::init() {
     if (!initBuffers()) return false;
+    m_textureLoader = std::make_shared<AsyncTextureLoader>();
+    m_textureRegistry = std::make_shared<coho::TextureRegistry>();
+    m_textureStreamer = std::make_shared<coho::TextureStreamer>();
     
     return true;
 }
 
 bool RenderModule::startup() {
     if (!initShaderModule()) return false;
+    // the lit pipelines always bind an environment, a black one until setEnvironment
+    if (m_specularTexture == nullptr) {
+        const uint16_t black[6 * 4] = {};
+        SpecularEnvironment placeholder;
+        placeholder.levels.push_back({ 1, black, sizeof(black) });
+        placeholder.lutSize = 1;
+        placeholder.lut = black;
+        uploadSpecularEnvironment(placeholder);
+    }
     if (!initRenderPipeline()) return false;
     if (!initSurfaceTexture()) return false;
     if (!initDepthBuffer()) return false;
@@ -195,6 +436,8 @@ bool RenderModule::startup() {
 }
 
 void RenderModule::terminate() {
+    m_textureLoader.reset();
+    releaseSpecularEnvironment();
     releaseDepthBuffer();
     releaseSurfaceTexture();
     releaseRenderPipeline();
@@ -216,28 +459,43 @@ void RenderModule::releaseSurfaceTexture() {
 }
 
 void RenderModule::releaseRenderPipeline() {
-    m_renderPipeline.reset();
+    releaseTexturePipelines();
+    m_depthPipeline.reset();
     m_terrainPipeline.reset();
+}
+
+void RenderModule::releaseTexturePipelines() {
+    m_renderPipeline.reset();
+    m_packedRenderPipeline.reset();
+    m_impostorPipeline.reset();
     m_fullscreenQuadRenderPipeline.reset();
 }
 
 void RenderModule::releaseBuffers() {
+    m_meshResidency.reset();
+    m_indirectBuffer.reset();
     m_indexBuffer.reset();
+    m_index16Buffer.reset();
     m_terrainindexBuffer.reset();
     m_vertexBuffer.reset();
+    m_packedVertexBuffer.reset();
     m_terrainvertexBuffer.reset();
     m_uniformBuffer.reset();
     m_terrainuniformBuffer.reset();
     m_modelBuffer.reset();
+    m_visibleBuffer.reset();
     m_terrainmodelBuffer.reset();
     m_materialBuffer.reset();
     m_terrainmaterialBuffer.reset();
+    m_uploadManager.reset();
 
 }
 
 void RenderModule::releaseShaderModule() {
     m_shader.reset();
     m_visShader.reset();
+    m_depthShader.reset();
+    m_impostorShader.reset();
 }
 
 void RenderModule::releaseDevice() {
@@ -248,128 +506,326 @@ void RenderModule::releaseWindowAndSurface() {
     m_surface.reset();
 }
 
-// returns the vertex offset of this mesh in the vertex buffer.
-int RenderModule::addMeshToVertexBuffer(std::vector<Mesh::VertexData> vertexData) {
-    int vertexOffset = m_vertexCount;
-    int offset = m_vertexCount * sizeof(VertexData);
-    int newDataSize = (int)(vertexData.size() * sizeof(VertexData));
-    m_device->getQueue().writeBuffer(m_vertexBuffer->getBuffer(), offset, vertexData.data(), newDataSize);
-    m_vertexCount = (int)(m_vertexCount + vertexData.size());
-    return vertexOffset;
+bool RenderModule::addMesh(std::shared_ptr<Mesh> mesh, bool matchContent) {
+    return m_meshResidency->acquire(mesh, matchContent);
+}
+
+void RenderModule::removeMesh(std::shared_ptr<Mesh> mesh) {
+    m_meshResidency->release(mesh);
 }
 
-// returns the index offset of this mesh in the index buffer.
-int RenderModule::addMeshToIndexBuffer(std::vector<uint32_t> indexData) {
-    int indexOffset = m_indexCount;
-    int offset = m_indexCount * sizeof(uint32_t);
-    int newDataSize = (int)(indexData.size() * sizeof(uint32_t));
-    m_device->getQueue().writeBuffer(m_indexBuffer->getBuffer(), offset, indexData.data(), newDataSize);
-    m_indexCount = (int)(m_indexCount + indexData.size());
-    return indexOffset;
+void RenderModule::defragmentMeshBuffers(uint32_t maxMoves) {
+    m_meshResidency->defragment(maxMoves, MESH_DEFRAGMENT_THRESHOLD);
 }
 
 // returns the index of the material in the material buffer
 int RenderModule::registerMaterial(std::shared_ptr<coho::Material> material) {
+    int materialIndex = m_materialCount;
     DefaultPipeline::MaterialData md;
     md.baseColor = material->baseColor;
     md.roughness = material->roughness;
     md.diffuseTextureIndex = 0;
     md.normalTextureIndex = 0;
-
-    if (material->diffuseTexture != nullptr) {
-        md.diffuseTextureIndex = registerTexture(material->diffuseTexture, material->name + "(diffuse)", material->diffuseTexture->mipLevels);
+    md.diffuseUvTransform = glm::vec4(1.0, 1.0, 0.0, 0.0);
+    md.normalUvTransform = glm::vec4(1.0, 1.0, 0.0, 0.0);
+
+    // textures still loading bind the placeholder (index 0, base color and vertex normals) until uploadLoadedTextures
+    if (material->diffuseTexture != nullptr && material->diffuseTexture->loading) {
+        bindWhenLoaded(material->diffuseTexture, materialIndex, offsetof(DefaultPipeline::MaterialData, diffuseTextureIndex), offsetof(DefaultPipeline::MaterialData, diffuseUvTransform));
+    } else if (material->diffuseTexture != nullptr) {
+        md.diffuseTextureIndex = registerTexture(material->diffuseTexture, material->name + "(diffuse)", material->diffuseTexture->mipLevels, TextureSlot::Albedo);
+        md.diffuseUvTransform = material->diffuseTexture->uvTransform;
     }
 
-    if (material->normalTexture != nullptr) {
-        md.normalTextureIndex = registerTexture(material->normalTexture, material->name + "(normal)", material->normalTexture->mipLevels);
+    if (material->normalTexture != nullptr && material->normalTexture->loading) {
+        bindWhenLoaded(material->normalTexture, materialIndex, offsetof(DefaultPipeline::MaterialData, normalTextureIndex), offsetof(DefaultPipeline::MaterialData, normalUvTransform));
+    } else if (material->normalTexture != nullptr) {
+        md.normalTextureIndex = registerTexture(material->normalTexture, material->name + "(normal)", material->normalTexture->mipLevels, TextureSlot::Normal);
+        md.normalUvTransform = material->normalTexture->uvTransform;
     }
 
-    int materialIndex = m_materialCount;
     int offset = m_materialCount * sizeof(DefaultPipeline::MaterialData);
     writeMaterialBuffer(std::vector<DefaultPipeline::MaterialData>{md}, offset);
     m_materialCount += 1;
     return materialIndex;
 }
 
-// Auxiliary function for registerTexture
-void RenderModule::writeMipMaps(
+std::shared_ptr<coho::Texture> RenderModule::loadTexture(const std::string& path, const std::string& filename, TextureSlot slot) {
+    MippedTexture::CookOptions options;
+    options.mips.filter = m_mipFilter;
+    options.mips.srgb = slot == TextureSlot::Albedo;
+    if (m_supportsBlockCompression && slot == TextureSlot::Albedo) {
+        options.format = m_highQualityTextures ? BlockFormat::BC7 : BlockFormat::BC1;
+    } else if (m_supportsBlockCompression && slot == TextureSlot::Normal) {
+        options.format = BlockFormat::BC5;
+    }
+
+    auto texture = std::make_shared<coho::Texture>();
+    texture->width = 0;
+    texture->height = 0;
+    texture->channels = 4;
+    texture->mipLevels = 0;
+    m_loadingTextures[texture.get()] = { texture, filename, slot, {} };
+    m_textureLoader->load(texture, path, filename, options);
+    return texture;
+}
+
+void RenderModule::bindWhenLoaded(std::shared_ptr<coho::Texture> texture, int materialIndex, size_t fieldOffset, size_t uvTransformOffset) {
+    auto loading = m_loadingTextures.find(texture.get());
+    if (loading == m_loadingTextures.end()) return; // not one of ours, it keeps the placeholder
+    size_t material = materialIndex * sizeof(DefaultPipeline::MaterialData);
+    loading->second.bindings.push_back({ material + fieldOffset, material + uvTransformOffset });
+}
+
+void RenderModule::uploadLoadedTextures() {
+    for (auto& texture : m_textureLoader->drain(MAX_TEXTURE_UPLOADS_PER_FRAME)) {
+        auto loading = m_loadingTextures.find(texture.get());
+        if (loading == m_loadingTextures.end()) continue;
+        LoadingTexture entry = loading->second;
+        m_loadingTextures.erase(loading);
+        if (texture->mipped == nullptr) continue; // failed to load, the placeholder stays
+
+        uint32_t textureIndex = (uint32_t)registerTexture(texture, entry.name, texture->mipLevels, entry.slot);
+        for (const LoadingTexture::Binding& binding : entry.bindings) {
+            m_uploadManager->write(m_materialBuffer->getBuffer(), binding.offset, &textureIndex, sizeof(uint32_t));
+            m_uploadManager->write(m_materialBuffer->getBuffer(), binding.uvTransformOffset, &texture->uvTransform, sizeof(glm::vec4));
+        }
+    }
+
+    rebindTextures();
+}
+
+void RenderModule::rebindTextures() {
+    // views replaced in place only need new bind groups, the texture arrays are sized at
+    // pipeline creation though, so a grown array makes the pipelines that bind it again
+    if (m_textureBindingsDirty && m_renderPipeline != nullptr) {
+        m_textureBindingsDirty = false;
+        bool rebound = m_renderPipeline->rebind(*m_device, m_textureViewArray, environmentBindings());
+        rebound = m_packedRenderPipeline->rebind(*m_device, m_textureViewArray, environmentBindings()) && rebound;
+        rebound = m_impostorPipeline->rebind(*m_device, m_textureViewArray, environmentBindings()) && rebound;
+        rebound = m_fullscreenQuadRenderPipeline->rebind(*m_device, m_textureViewArray) && rebound;
+        if (!rebound) {
+            releaseTexturePipelines();
+            initTexturePipelines();
+        }
+    }
+}
+
+void RenderModule::streamTextures(const std::vector<std::shared_ptr<Entity>>& entities) {
+    glm::vec3 eye = m_camera.position - m_camera.forward; // see updateViewMatrix
+    float projectionScale = getProjectionScale();
+
+    for (size_t i = 0; i < entities.size(); i++) {
+        const VisibleRange& range = m_visibleRanges[i];
+        auto materialComponent = entities[i]->getComponent<MaterialComponent>();
+        if (range.count == 0 || materialComponent == nullptr || materialComponent->material == nullptr) continue;
+        auto mesh = entities[i]->getComponent<MeshComponent>()->mesh;
+        glm::vec4 sphere = mesh->getBoundingSphere();
+        if (sphere.w <= 0.0f) continue;
+
+        // the closest visible instance decides, in mesh units so its scale is accounted for
+        float nearest = FLT_MAX;
+        for (uint32_t j = range.first; j < range.first + range.count; j++) {
+            glm::vec4 world = InstanceCompression::transformSphere(m_models[m_visibleIndices[j]], sphere);
+            float distance = std::max(glm::length(glm::vec3(world) - eye) - world.w, 1e-3f);
+            nearest = std::min(nearest, distance * sphere.w / world.w);
+        }
+        // a pixel covers distance / projectionScale mesh units there
+        float uvPerPixel = nearest / (projectionScale * mesh->getUvSpan());
+        for (auto& texture : { materialComponent->material->diffuseTexture, materialComponent->material->normalTexture }) {
+            if (texture != nullptr && texture->bufferIndex > 0) m_textureStreamer->request(texture->bufferIndex, uvPerPixel);
+        }
+    }
+
+    for (const coho::TextureStreamer::Change& change : m_textureStreamer->update()) {
+        applyResidency(change);
+    }
+    rebindTextures();
+}
+
+void RenderModule::applyResidency(const coho::TextureStreamer::Change& change) {
+    const MippedTexture& mipped = *change.mipped;
+    uint32_t levelCount = change.levelCount - change.toLevel;
+    const MippedTexture::Level& base = mipped.levels[change.toLevel];
+    wgpu::Texture texture = createTexture(change.name, change.format, base.width, base.height, levelCount);
+    wgpu::Texture previous = m_textureArray[change.viewIndex];
+
+    // the levels both textures have are copied on the gpu, only the finer ones are uploaded
+    CommandEncoder encoder = m_device->createCommandEncoder(CommandEncoderDescriptor{});
+    for (uint32_t level = std::max(change.fromLevel, change.toLevel); level < change.levelCount; level++) {
+        ImageCopyTexture source;
+        source.texture = previous;
+        source.mipLevel = level - change.fromLevel;
+        source.origin = { 0, 0, 0 };
+        source.aspect = TextureAspect::All;
+        ImageCopyTexture destination = source;
+        destination.texture = texture;
+        destination.mipLevel = level - change.toLevel;
+        encoder.copyTextureToTexture(source, destination, levelExtent(change.format, mipped.levels[level].width, mipped.levels[level].height));
+    }
+    CommandBuffer commands = encoder.finish(CommandBufferDescriptor{});
+    m_device->getQueue().submit(commands);
+    commands.release();
+    encoder.release();
+    if (change.toLevel < change.fromLevel) {
+        writeCookedLevels(texture, mipped, change.toLevel, change.toLevel, change.fromLevel, change.format);
+    }
+
+    // destroy waits for the copies already submitted
+    previous.destroy();
+    previous.release();
+    m_textureViewArray[change.viewIndex].release();
+    m_textureArray[change.viewIndex] = texture;
+    m_textureViewArray[change.viewIndex] = createTextureView(texture, change.name, change.format, levelCount);
+    m_textureBindingsDirty = true;
+}
+
+namespace {
+wgpu::TextureFormat textureFormatOf(BlockFormat format) {
+    switch (format) {
+    case BlockFormat::BC1: return wgpu::TextureFormat::BC1RGBAUnorm;
+    case BlockFormat::BC3: return wgpu::TextureFormat::BC3RGBAUnorm;
+    case BlockFormat::BC5: return wgpu::TextureFormat::BC5RGUnorm;
+    case BlockFormat::BC7: return wgpu::TextureFormat::BC7RGBAUnorm;
+    default: return wgpu::TextureFormat::RGBA8Unorm; // png/jpeg format
+    }
+}
+
+// the size a copy of a level covers, small levels of block compressed textures still take whole blocks
+wgpu::Extent3D levelExtent(BlockFormat format, uint32_t width, uint32_t height) {
+    wgpu::Extent3D extent;
+    extent.depthOrArrayLayers = 1;
+    extent.width = format == BlockFormat::RGBA8 ? width : 4 * BlockCompression::blockCount(width);
+    extent.height = format == BlockFormat::RGBA8 ? height : 4 * BlockCompression::blockCount(height);
+    return extent;
+}
+}
+
+// Auxiliary function for registerTexture, uploads one level that is already in the texture's format
+void RenderModule::writeTextureLevel(
 	wgpu::Texture texture,
-	wgpu::Extent3D textureSize,
-	uint32_t mipLevelCount,
-	std::vector<unsigned char> pixelData
+	uint32_t level,
+	const uint8_t* data,
+	size_t size,
+	uint32_t width,
+	uint32_t height,
+	BlockFormat format,
+	uint32_t x,
+	uint32_t y
     )
 {
 	// Arguments telling which part of the texture we upload to
 	wgpu::ImageCopyTexture destination;
 	destination.texture = texture;
-	destination.origin = { 0, 0, 0 };
+	destination.origin = { x, y, 0 };
 	destination.aspect = wgpu::TextureAspect::All;
+	destination.mipLevel = level;
 
 	// Arguments telling how the C++ side pixel memory is laid out
 	wgpu::TextureDataLayout source;
 	source.offset = 0;
 
-	// Create image data
-	wgpu::Extent3D mipLevelSize = textureSize;
-	std::vector<unsigned char> previousLevelPixels;
-	wgpu::Extent3D previousMipLevelSize;
-	for (uint32_t level = 0; level < mipLevelCount; ++level) {
-		// Pixel data for the current level
-		std::vector<unsigned char> pixels(4 * mipLevelSize.width * mipLevelSize.height);
-		if (level == 0) {
-			// We cannot really avoid this copy since we need this
-			// in previousLevelPixels at the next iteration
-			memcpy(pixels.data(), pixelData.data(), pixels.size());
+	wgpu::Extent3D levelSize = levelExtent(format, width, height);
+	if (format == BlockFormat::RGBA8) {
+		source.bytesPerRow = 4 * width;
+		source.rowsPerImage = height;
+	} else {
+		source.bytesPerRow = BlockCompression::blockCount(width) * BlockCompression::bytesPerBlock(format);
+		source.rowsPerImage = BlockCompression::blockCount(height);
+	}
+	m_device->getQueue().writeTexture(destination, data, size, source, levelSize);
+}
+
+// Auxiliary function for registerTexture, the levels are mipmapped in rgba8 and then block compressed one by one
+void RenderModule::writeMipMaps(
+	wgpu::Texture texture,
+	wgpu::Extent3D textureSize,
+	uint32_t mipLevelCount,
+	const std::vector<unsigned char>& pixelData,
+	bool srgb,
+	BlockFormat format,
+	uint32_t x,
+	uint32_t y
+    )
+{
+	size_t uploadedBytes = 0;
+	size_t uncompressedBytes = 0;
+	auto writeLevel = [&](uint32_t level, const unsigned char* pixels, uint32_t width, uint32_t height) {
+		uncompressedBytes += (size_t)4 * width * height;
+		if (format == BlockFormat::RGBA8) {
+			writeTextureLevel(texture, level, pixels, (size_t)4 * width * height, width, height, format, x >> level, y >> level);
+			uploadedBytes += (size_t)4 * width * height;
+			return;
 		}
-		else {
-			// Create mip level data
-			for (uint32_t i = 0; i < mipLevelSize.width; ++i) {
-				for (uint32_t j = 0; j < mipLevelSize.height; ++j) {
-					unsigned char* p = &pixels[4 * (j * mipLevelSize.width + i)];
-					// Get the corresponding 4 pixels from the previous level
-					unsigned char* p00 = &previousLevelPixels[4 * ((2 * j + 0) * previousMipLevelSize.width + (2 * i + 0))];
-					unsigned char* p01 = &previousLevelPixels[4 * ((2 * j + 0) * previousMipLevelSize.width + (2 * i + 1))];
-					unsigned char* p10 = &previousLevelPixels[4 * ((2 * j + 1) * previousMipLevelSize.width + (2 * i + 0))];
-					unsigned char* p11 = &previousLevelPixels[4 * ((2 * j + 1) * previousMipLevelSize.width + (2 * i + 1))];
-					// Average
-					p[0] = (p00[0] + p01[0] + p10[0] + p11[0]) / 4;
-					p[1] = (p00[1] + p01[1] + p10[1] + p11[1]) / 4;
-					p[2] = (p00[2] + p01[2] + p10[2] + p11[2]) / 4;
-					p[3] = (p00[3] + p01[3] + p10[3] + p11[3]) / 4;
-				}
-			}
+		std::vector<uint8_t> blocks = BlockCompression::encode(pixels, width, height, format);
+		if (level == 0) {
+			BlockCompression::Quality quality = BlockCompression::measure(pixels, width, height, blocks, format);
+			std::cout << "  " << BlockCompression::name(format) << " psnr " << quality.psnr << " dB" << std::endl;
 		}
+		writeTextureLevel(texture, level, blocks.data(), blocks.size(), width, height, format, x >> level, y >> level);
+		uploadedBytes += blocks.size();
+	};
+
+	writeLevel(0, pixelData.data(), textureSize.width, textureSize.height);
+
+	MipOptions options;
+	options.filter = m_mipFilter;
+	options.srgb = srgb;
+	options.levelCount = mipLevelCount;
+	std::vector<MipLevel> levels = MipGenerator::generate(pixelData.data(), textureSize.width, textureSize.height, options);
+	for (uint32_t level = 1; level <= (uint32_t)levels.size(); ++level) {
+		const MipLevel& mip = levels[level - 1];
+		writeLevel(level, mip.pixels.data(), mip.width, mip.height);
+	}
 
-		// Upload data to the GPU texture
-		destination.mipLevel = level;
-		source.bytesPerRow = 4 * mipLevelSize.width;
-		source.rowsPerImage = mipLevelSize.height;
-		m_device->getQueue().writeTexture(destination, pixels.data(), pixels.size(), source, mipLevelSize);
+	if (format != BlockFormat::RGBA8) {
+		std::cout << "  " << uploadedBytes / 1024 << " KiB instead of " << uncompressedBytes / 1024 << " KiB" << std::endl;
+	}
+}
 
-		previousLevelPixels = std::move(pixels);
-		previousMipLevelSize = mipLevelSize;
-		mipLevelSize.width /= 2;
-		mipLevelSize.height /= 2;
+// Auxiliary function for registerTexture, cooked levels go up as they are, or decoded when the device can't sample them.
+// the levels from firstLevel to endLevel, the texture's own levels start at baseLevel (see TextureStreamer)
+void RenderModule::writeCookedLevels(
+	wgpu::Texture texture,
+	const MippedTexture& mipped,
+	uint32_t baseLevel,
+	uint32_t firstLevel,
+	uint32_t endLevel,
+	BlockFormat format,
+	uint32_t x,
+	uint32_t y
+    )
+{
+	for (uint32_t level = firstLevel; level < endLevel; ++level) {
+		const MippedTexture::Level& l = mipped.levels[level];
+		uint32_t target = level - baseLevel;
+		if (format == mipped.format) {
+			writeTextureLevel(texture, target, l.data, l.size, l.width, l.height, format, x >> target, y >> target);
+		} else {
+			std::vector<uint8_t> pixels = mipped.decodeLevel(level);
+			writeTextureLevel(texture, target, pixels.data(), pixels.size(), l.width, l.height, format, x >> target, y >> target);
+		}
 	}
 }
 
-// returns the index of the registered textureView
-int RenderModule::registerTexture(std::shared_ptr<coho::Texture> texture, std::string name, int mipLevelCount) {
+wgpu::Texture RenderModule::createTexture(const std::string& name, BlockFormat format, uint32_t width, uint32_t height, uint32_t mipLevelCount) {
     wgpu::TextureDescriptor textureDesc;
     textureDesc.dimension = wgpu::TextureDimension::_2D;
-    textureDesc.format = wgpu::TextureFormat::RGBA8Unorm; // png/jpeg format
+    textureDesc.format = textureFormatOf(format);
     textureDesc.label = name.c_str();
     textureDesc.mipLevelCount = mipLevelCount;
     textureDesc.sampleCount = 1;
-    textureDesc.size.width = texture->width;
-    textureDesc.size.height = texture->height;
+    textureDesc.size.width = width;
+    textureDesc.size.height = height;
     textureDesc.size.depthOrArrayLayers = 1;
-    textureDesc.usage = wgpu::TextureUsage::CopyDst | wgpu::TextureUsage::TextureBinding;
+    // CopySrc, streaming copies the levels a texture keeps into its replacement
+    textureDesc.usage = wgpu::TextureUsage::CopyDst | wgpu::TextureUsage::CopySrc | wgpu::TextureUsage::TextureBinding;
     textureDesc.viewFormatCount = 0;
     textureDesc.viewFormats = nullptr;
-    wgpu::Texture registeredTexture = m_device->createTexture(textureDesc);
-    m_textureArray.push_back(registeredTexture);
+    return m_device->createTexture(textureDesc);
+}
 
+wgpu::TextureView RenderModule::createTextureView(wgpu::Texture texture, const std::string& name, BlockFormat format, uint32_t mipLevelCount) {
     wgpu::TextureViewDescriptor texViewDesc;
     texViewDesc.arrayLayerCount = 1;
     texViewDesc.baseArrayLayer = 0;
@@ -377,34 +833,237 @@ int RenderModule::registerTexture(std::shared_ptr<coho::Texture> texture, std::s
     texViewDesc.baseMipLevel = 0;
     texViewDesc.mipLevelCount = mipLevelCount;
     texViewDesc.dimension = wgpu::TextureViewDimension::_2D;
-    texViewDesc.format = wgpu::TextureFormat::RGBA8Unorm;
+    texViewDesc.format = textureFormatOf(format);
     texViewDesc.label = name.c_str();
-    TextureView texture_view = registeredTexture.createView(texViewDesc);
-    m_textureViewArray.push_back(texture_view);
+    return texture.createView(texViewDesc);
+}
+
+// returns the index of the registered textureView
+int RenderModule::registerTexture(std::shared_ptr<coho::Texture> texture, std::string name, int mipLevelCount, TextureSlot slot) {
+    // the chain ends at 1x1, longer ones aren't valid
+    mipLevelCount = std::min(mipLevelCount, (int)MipGenerator::fullChainLength(texture->width, texture->height));
+
+    // bc textures need a base size made of whole blocks
+    BlockFormat format = BlockFormat::RGBA8;
+    bool wholeBlocks = texture->width % 4 == 0 && texture->height % 4 == 0;
+    std::shared_ptr<MippedTexture> mipped = texture->mipped;
+    if (mipped != nullptr) {
+        // cooked, the format and the levels were settled at cook time
+        mipLevelCount = std::min(mipLevelCount, (int)mipped->levels.size());
+        if (mipped->format != BlockFormat::RGBA8 && m_supportsBlockCompression) {
+            format = mipped->format;
+        }
+    } else if (m_supportsBlockCompression && texture->compress && wholeBlocks) {
+        if (slot == TextureSlot::Albedo) {
+            if (m_highQualityTextures) {
+                format = BlockFormat::BC7;
+            } else {
+                bool opaque = BlockCompression::isOpaque(texture->pixelData.data(), texture->width, texture->height);
+                format = opaque ? BlockFormat::BC1 : BlockFormat::BC3;
+            }
+        } else if (slot == TextureSlot::Normal) {
+            format = BlockFormat::BC5;
+        }
+    }
+
+    // the same pixels in the same format and chain share the view that's there already
+    bool srgb = slot == TextureSlot::Albedo;
+    coho::TextureRegistry::Key key = coho::TextureRegistry::makeKey(*texture, format, (uint32_t)mipLevelCount, srgb);
+    int existing = m_textureRegistry->acquire(texture, key);
+    if (existing >= 0) {
+        useTextureSlot(texture, existing);
+        return texture->bufferIndex;
+    }
+
+    if (mipped == nullptr && format != BlockFormat::RGBA8) {
+        std::cout << "compressing " << name << " (" << texture->width << "x" << texture->height << ") to " << BlockCompression::name(format) << std::endl;
+    }
+
+    // small textures share atlas pages instead of taking a view each
+    if (registerAtlasTexture(texture, key, mipLevelCount, srgb, format)) {
+        return texture->bufferIndex;
+    }
+
+    int viewIndex = nextTextureSlot();
 
-    writeMipMaps(registeredTexture, textureDesc.size, textureDesc.mipLevelCount, texture->pixelData);
+    // cooked textures with a chain start with their small levels, TextureStreamer raises them when they're seen up close
+    uint32_t baseLevel = 0;
+    if (mipped != nullptr && m_streamTextures && mipLevelCount > 1) {
+        baseLevel = m_textureStreamer->add(viewIndex, mipped, (uint32_t)mipLevelCount, format, name);
+    }
+    uint32_t width = mipped != nullptr ? mipped->levels[baseLevel].width : (uint32_t)texture->width;
+    uint32_t height = mipped != nullptr ? mipped->levels[baseLevel].height : (uint32_t)texture->height;
+    wgpu::Texture registeredTexture = createTexture(name, format, width, height, mipLevelCount - baseLevel);
+    TextureView texture_view = createTextureView(registeredTexture, name, format, mipLevelCount - baseLevel);
+    placeTexture(viewIndex, registeredTexture, texture_view);
+    m_textureRegistry->add(texture, key, viewIndex);
+
+    if (mipped != nullptr) {
+        writeCookedLevels(registeredTexture, *mipped, baseLevel, baseLevel, mipLevelCount, format);
+    } else {
+        wgpu::Extent3D size;
+        size.width = width;
+        size.height = height;
+        size.depthOrArrayLayers = 1;
+        writeMipMaps(registeredTexture, size, mipLevelCount, texture->pixelData, srgb, format);
+    }
 
-    texture->bufferIndex = (int)m_textureViewArray.size() - 1;
+    useTextureSlot(texture, viewIndex);
     return texture->bufferIndex;
 }
 
+int RenderModule::nextTextureSlot() {
+    // slots of released textures are reused before the array grows
+    return m_freeTextureSlots.empty() ? (int)m_textureViewArray.size() : m_freeTextureSlots.back();
+}
+
+void RenderModule::placeTexture(int viewIndex, wgpu::Texture texture, wgpu::TextureView view) {
+    if (viewIndex < (int)m_textureViewArray.size()) {
+        m_freeTextureSlots.pop_back();
+        m_textureViewArray[viewIndex].release(); // the placeholder reference releaseTexture left
+        m_textureArray[viewIndex] = texture;
+        m_textureViewArray[viewIndex] = view;
+    } else {
+        m_textureArray.push_back(texture);
+        m_textureViewArray.push_back(view);
+    }
+    m_textureBindingsDirty = true;
+}
+
+void RenderModule::useTextureSlot(std::shared_ptr<coho::Texture> texture, int slot) {
+    auto entry = m_atlasEntries.find(slot);
+    if (entry == m_atlasEntries.end()) {
+        texture->bufferIndex = slot;
+        texture->uvTransform = glm::vec4(1.0, 1.0, 0.0, 0.0);
+    } else {
+        texture->bufferIndex = entry->second.page;
+        texture->uvTransform = entry->second.uvTransform;
+    }
+}
+
+bool RenderModule::registerAtlasTexture(std::shared_ptr<coho::Texture> texture, const coho::TextureRegistry::Key& key, int mipLevelCount, bool srgb, BlockFormat format) {
+    uint32_t width = (uint32_t)texture->width;
+    uint32_t height = (uint32_t)texture->height;
+    // every level of an entry has to be whole blocks at a whole block position
+    uint32_t alignment = (format == BlockFormat::RGBA8 ? 1u : 4u) << (ATLAS_LEVELS - 1);
+    if (!m_atlasTextures || mipLevelCount < (int)ATLAS_LEVELS || std::max(width, height) > MAX_ATLAS_ENTRY_SIZE
+        || width % alignment != 0 || height % alignment != 0) {
+        return false;
+    }
+    uint32_t sizeClass = alignment;
+    while (sizeClass < std::max(width, height)) sizeClass *= 2;
+
+    // a page holds one format and size class, similar rects pack tighter
+    int pageIndex = -1;
+    uint32_t x, y;
+    for (auto& page : m_atlasPages) {
+        if (page.second.format == format && page.second.sizeClass == sizeClass && page.second.packer->pack(width, height, x, y)) {
+            pageIndex = page.first;
+            break;
+        }
+    }
+    if (pageIndex < 0) {
+        std::string name = std::string("atlas page (") + BlockCompression::name(format) + ", " + std::to_string(sizeClass) + ")";
+        std::cout << "adding " << name << std::endl;
+        pageIndex = nextTextureSlot();
+        wgpu::Texture pageTexture = createTexture(name, format, ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE, ATLAS_LEVELS);
+        placeTexture(pageIndex, pageTexture, createTextureView(pageTexture, name, format, ATLAS_LEVELS));
+        AtlasPage page;
+        page.format = format;
+        page.sizeClass = sizeClass;
+        page.packer = std::make_shared<coho::SkylinePacker>(ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE, alignment);
+        page.packer->pack(width, height, x, y);
+        m_atlasPages[pageIndex] = page;
+    }
+    m_atlasPages[pageIndex].entryCount++;
+
+    wgpu::Texture pageTexture = m_textureArray[pageIndex];
+    if (texture->mipped != nullptr) {
+        writeCookedLevels(pageTexture, *texture->mipped, 0, 0, ATLAS_LEVELS, format, x, y);
+    } else {
+        wgpu::Extent3D size;
+        size.width = width;
+        size.height = height;
+        size.depthOrArrayLayers = 1;
+        writeMipMaps(pageTexture, size, ATLAS_LEVELS, texture->pixelData, srgb, format, x, y);
+    }
+
+    int slot = ATLAS_SLOT_BASE + m_nextAtlasEntry++;
+    float pageSize = (float)ATLAS_PAGE_SIZE;
+    m_atlasEntries[slot] = { pageIndex, glm::vec4(width / pageSize, height / pageSize, x / pageSize, y / pageSize) };
+    m_textureRegistry->add(texture, key, slot);
+    useTextureSlot(texture, slot);
+    return true;
+}
+
+void RenderModule::releaseTexture(std::shared_ptr<coho::Texture> texture) {
+    int viewIndex = m_textureRegistry->release(texture);
+    texture->bufferIndex = -1;
+    texture->uvTransform = glm::vec4(1.0, 1.0, 0.0, 0.0);
+
+    auto entry = m_atlasEntries.find(viewIndex);
+    if (entry != m_atlasEntries.end()) {
+        // a page's space isn't packed again, the page goes with its last entry
+        viewIndex = entry->second.page;
+        m_atlasEntries.erase(entry);
+        if (--m_atlasPages[viewIndex].entryCount > 0) return;
+        m_atlasPages.erase(viewIndex);
+    }
+    // index 0 is the default texture, the placeholder of every slot
+    if (viewIndex <= 0) return;
+
+    m_textureStreamer->remove(viewIndex);
+    m_textureArray[viewIndex].destroy();
+    m_textureArray[viewIndex].release();
+    m_textureArray[viewIndex] = nullptr;
+    m_textureViewArray[viewIndex].release();
+    // the texture arrays can't have holes, the slot shows the placeholder until it's reused
+    m_textureViewArray[viewIndex] = m_textureViewArray[0];
+    m_textureViewArray[viewIndex].reference();
+    m_freeTextureSlots.push_back(viewIndex);
+    m_textureBindingsDirty = true;
+}
+
 bool RenderModule::initBuffers() {
     std::cout << "initializing buffers" << std::endl;
 
+    m_uploadManager = std::make_shared<coho::UploadManager>(m_device);
+
+    SupportedLimits supportedLimits;
+    m_device->getLimits(&supportedLimits);
+    uint64_t maxBufferSize = supportedLimits.limits.maxBufferSize;
+
+    // mesh buffers start small and grow on demand
     BufferDescriptor bufferDesc;
-    bufferDesc.label = "vertex buffer";
-    bufferDesc.usage = BufferUsage::Vertex | BufferUsage::CopyDst;
-    bufferDesc.size = 1000000 * sizeof(VertexData); // 1,000,000 vertices
-    
-    BufferBindingLayout bindingLayout = Default;
-    bindingLayout.minBindingSize = sizeof(VertexData);
-    m_vertexBuffer = std::make_shared<coho::Buffer>(m_device, bufferDesc, bindingLayout, bufferDesc.size, bufferDesc.label);
+    // vertices are split into a position stream and an attribute stream sharing the same ranges
+    bufferDesc.label = "vertex position buffer";
+    bufferDesc.usage = BufferUsage::Vertex | BufferUsage::CopyDst | BufferUsage::CopySrc;
+    bufferDesc.size = 262144 * coho::PositionVertexLayout::stride; // 262,144 vertices
+    m_vertexBuffer = std::make_shared<coho::SubAllocatedBuffer>(m_device, m_uploadManager, bufferDesc, (uint32_t)coho::PositionVertexLayout::stride, maxBufferSize);
+    bufferDesc.label = "vertex attribute buffer";
+    bufferDesc.size = 262144 * coho::AttributeVertexLayout::stride;
+    m_vertexBuffer->addStream(bufferDesc, (uint32_t)coho::AttributeVertexLayout::stride);
 
     bufferDesc.label = "index buffer";
-    bufferDesc.usage = BufferUsage::Index | BufferUsage::CopyDst;
-    bufferDesc.size = 1000000 * sizeof(VertexData); // 1,000,000 indices
-    bindingLayout.minBindingSize = sizeof(VertexData);
-    m_indexBuffer = std::make_shared<coho::Buffer>(m_device, bufferDesc, bindingLayout, bufferDesc.size, bufferDesc.label);
+    bufferDesc.usage = BufferUsage::Index | BufferUsage::CopyDst | BufferUsage::CopySrc;
+    bufferDesc.size = 1000000 * sizeof(uint32_t); // 1,000,000 indices
+    m_indexBuffer = std::make_shared<coho::SubAllocatedBuffer>(m_device, m_uploadManager, bufferDesc, sizeof(uint32_t), maxBufferSize);
+
+    // meshes with fewer than 65535 vertices, an element is a pair of uint16 indices to keep ranges 4 byte aligned
+    bufferDesc.label = "16 bit index buffer";
+    bufferDesc.size = 1000000 * sizeof(uint16_t); // 1,000,000 indices
+    m_index16Buffer = std::make_shared<coho::SubAllocatedBuffer>(m_device, m_uploadManager, bufferDesc, 2 * sizeof(uint16_t), maxBufferSize);
+
+    bufferDesc.label = "packed vertex buffer";
+    bufferDesc.usage = BufferUsage::Vertex | BufferUsage::CopyDst | BufferUsage::CopySrc;
+    bufferDesc.size = 262144 * sizeof(Mesh::PackedVertexData); // 262,144 vertices
+    m_packedVertexBuffer = std::make_shared<coho::SubAllocatedBuffer>(m_device, m_uploadManager, bufferDesc, sizeof(Mesh::PackedVertexData), maxBufferSize);
+
+    m_meshResidency = std::make_shared<coho::MeshResidencyTable>(m_vertexBuffer, m_packedVertexBuffer, m_indexBuffer, m_index16Buffer);
+    m_supportsIndirectFirstInstance = m_device->hasFeature(FeatureName::IndirectFirstInstance);
+    m_supportsBlockCompression = m_device->hasFeature(FeatureName::TextureCompressionBC);
+
+    BufferBindingLayout bindingLayout = Default;
 
     bufferDesc.label = "model buffer";
     bufferDesc.usage = BufferUsage::Storage | BufferUsage::CopyDst;
@@ -412,6 +1071,13 @@ bool RenderModule::initBuffers() {
     bindingLayout.minBindingSize = sizeof(DefaultPipeline::ModelData);
     m_modelBuffer = std::make_shared<coho::Buffer>(m_device, bufferDesc, bindingLayout, bufferDesc.size, bufferDesc.label);
 
+    // rewritten every frame with the model indices of the visible instances, see cullInstances
+    bufferDesc.label = "visible index buffer";
+    bufferDesc.usage = BufferUsage::Storage | BufferUsage::CopyDst;
+    bufferDesc.size = (FIRST_VISIBLE_SLOT + 1000000) * sizeof(uint32_t); // one slot per instance
+    bindingLayout.minBindingSize = sizeof(uint32_t);
+    m_visibleBuffer = std::make_shared<coho::Buffer>(m_device, bufferDesc, bindingLayout, bufferDesc.size, bufferDesc.label);
+
     bufferDesc.label = "material buffer";
     bufferDesc.usage = BufferUsage::Storage | BufferUsage::CopyDst;
     bufferDesc.size = 100 * sizeof(DefaultPipeline::MaterialData); // 100 materials
@@ -428,7 +1094,7 @@ bool RenderModule::initBuffers() {
     float aspectRatio = (float)m_screenWidth / (float)m_screenHeight;
     m_uniformData.projection_matrix = glm::perspective(glm::radians(45.0f), aspectRatio, 0.001f, 1000.0f);
 
-    m_device->getQueue().writeBuffer(m_uniformBuffer->getBuffer(), 0, &m_uniformData, sizeof(DefaultPipeline::UniformData));
+    m_uploadManager->write(m_uniformBuffer->getBuffer(), 0, &m_uniformData, sizeof(DefaultPipeline::UniformData));
     updateViewMatrix();
 
     return true;
@@ -437,6 +1103,7 @@ bool RenderModule::initBuffers() {
 void RenderModule::releaseTextures() {
 
     for (auto texture : m_textureArray) {
+        if (texture == nullptr) continue; // a released slot
         texture.destroy();
         texture.release();
     }
@@ -448,19 +1115,74 @@ void RenderModule::releaseTextures() {
 
 bool RenderModule::initRenderPipeline() {
     std::cout << "initializing render pipeline" << std::endl;
+    if (!initTexturePipelines()) return false;
+    m_meshBufferGeneration = m_meshResidency->getGeneration();
+
+    if (m_depthPrepass) {
+        m_depthPipeline = std::make_shared<coho::DepthPipeline>(
+            m_uniformBuffer,
+            m_modelBuffer,
+            m_visibleBuffer,
+            m_depthShader
+            );
+
+        std::cout << "running depth pipeline init tasks" << std::endl;
+        if (!m_depthPipeline->init(*m_device)) {
+            std::cout << "failed to init depth pipeline!" << std::endl;
+            return false;
+        }
+    }
+
+    std::cout << "running terrain pipeline init tasks" << std::endl;
+    if (!m_terrainPipeline->init(*m_device, m_preferredFormat)) {
+        std::cout << "failed to init terrain pipeline!" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+// the pipelines binding m_textureViewArray, made again when textures are added after startup
+bool RenderModule::initTexturePipelines() {
     m_renderPipeline = std::make_shared<coho::DefaultPipeline>(
-        m_vertexBuffer,
-        m_indexBuffer,
+        m_vertexBuffer->getBuffer(),
+        m_indexBuffer->getBuffer(),
+        m_uniformBuffer,
+        m_modelBuffer,
+        m_materialBuffer,
+        m_visibleBuffer,
+        m_shader,
+        m_shader,
+        false,
+        m_depthPrepass
+        );
+
+    m_packedRenderPipeline = std::make_shared<coho::DefaultPipeline>(
+        m_packedVertexBuffer->getBuffer(),
+        m_indexBuffer->getBuffer(),
         m_uniformBuffer,
         m_modelBuffer,
         m_materialBuffer,
+        m_visibleBuffer,
+        m_shader,
         m_shader,
-        m_shader
+        true
         );
     
+    m_impostorPipeline = std::make_shared<coho::DefaultPipeline>(
+        m_vertexBuffer->getBuffer(),
+        m_indexBuffer->getBuffer(),
+        m_uniformBuffer,
+        m_modelBuffer,
+        m_materialBuffer,
+        m_visibleBuffer,
+        m_impostorShader,
+        m_impostorShader
+        );
+
     m_fullscreenQuadRenderPipeline = std::make_shared<coho::FullscreenQuadPipeline>(
-        m_vertexBuffer,
-        m_indexBuffer,
+        m_vertexBuffer->getBuffer(),
+        m_indexBuffer->getBuffer(),
         m_uniformBuffer,
         m_modelBuffer,
         m_materialBuffer,
@@ -469,14 +1191,20 @@ bool RenderModule::initRenderPipeline() {
         );
 
     std::cout << "running render pipeline init tasks" << std::endl;
-    if (!m_renderPipeline->init(*m_device, m_preferredFormat, m_textureViewArray)) {
+    if (!m_renderPipeline->init(*m_device, m_preferredFormat, m_textureViewArray, environmentBindings())) {
         std::cout << "failed to init render pipeline!" << std::endl;
         return false;
     }
 
-    std::cout << "running terrain pipeline init tasks" << std::endl;
-    if (!m_terrainPipeline->init(*m_device, m_preferredFormat)) {
-        std::cout << "failed to init terrain pipeline!" << std::endl;
+    std::cout << "running packed vertex render pipeline init tasks" << std::endl;
+    if (!m_packedRenderPipeline->init(*m_device, m_preferredFormat, m_textureViewArray, environmentBindings())) {
+        std::cout << "failed to init packed vertex render pipeline!" << std::endl;
+        return false;
+    }
+
+    std::cout << "running impostor pipeline init tasks" << std::endl;
+    if (!m_impostorPipeline->init(*m_device, m_preferredFormat, m_textureViewArray, environmentBindings())) {
+        std::cout << "failed to init impostor pipeline!" << std::endl;
         return false;
     }
 
@@ -504,6 +1232,20 @@ bool RenderModule::initShaderModule() {
         return false;
     }
 
+    if (m_depthPrepass) {
+        m_depthShader = std::make_shared<coho::Shader>(RESOURCE_DIR, "shaders/depth.wgsl", m_device);
+        if (m_depthShader->getShaderModule() == nullptr) {
+            std::cout << "failed to init depth shader module" << std::endl;
+            return false;
+        }
+    }
+
+    m_impostorShader = std::make_shared<coho::Shader>(RESOURCE_DIR, "shaders/impostor.wgsl", m_device);
+    if (m_impostorShader->getShaderModule() == nullptr) {
+        std::cout << "failed to init impostor shader module" << std::endl;
+        return false;
+    }
+
     return true;
 }
 
@@ -582,29 +1324,155 @@ bool RenderModule::initDepthBuffer() {
     return true;
 }
 
+bool RenderModule::setEnvironment(const std::string& path, const std::string& filename) {
+    IrradienceTexture::Coefficients coefficients;
+    if (!IrradienceTexture::bake(path, filename, coefficients)) return false;
+    for (int i = 0; i < 9; i++) {
+        m_uniformData.irradiance[i] = glm::vec4(coefficients.sh[i], 0.0f);
+    }
+    m_uniformData.irradiance[0].w = 1.0f;
+    // before startup init uploads it with the rest
+    if (m_uniformBuffer != nullptr) {
+        m_uploadManager->write(m_uniformBuffer->getBuffer(), offsetof(DefaultPipeline::UniformData, irradiance), &m_uniformData.irradiance, sizeof(DefaultPipeline::UniformData::irradiance));
+    }
+
+    std::shared_ptr<SpecularEnvironment> specular = SpecularEnvironment::bake(path, filename);
+    if (specular == nullptr) return false;
+    uploadSpecularEnvironment(*specular);
+    // the bind groups still hold the released views, they're made again before the next draw
+    m_textureBindingsDirty = true;
+    return true;
+}
+
+void RenderModule::uploadSpecularEnvironment(const SpecularEnvironment& environment) {
+    releaseSpecularEnvironment();
+    uint32_t size = environment.levels[0].size;
+    uint32_t levelCount = (uint32_t)environment.levels.size();
+
+    wgpu::TextureDescriptor textureDesc;
+    textureDesc.dimension = wgpu::TextureDimension::_2D;
+    textureDesc.format = wgpu::TextureFormat::RGBA16Float;
+    textureDesc.label = "specular environment";
+    textureDesc.mipLevelCount = levelCount;
+    textureDesc.sampleCount = 1;
+    textureDesc.size = { size, size, 6 };
+    textureDesc.usage = wgpu::TextureUsage::CopyDst | wgpu::TextureUsage::TextureBinding;
+    textureDesc.viewFormatCount = 0;
+    textureDesc.viewFormats = nullptr;
+    m_specularTexture = m_device->createTexture(textureDesc);
+
+    // a level's six faces are one write, a layer each
+    for (uint32_t level = 0; level < levelCount; level++) {
+        const SpecularEnvironment::Level& l = environment.levels[level];
+        wgpu::ImageCopyTexture destination;
+        destination.texture = m_specularTexture;
+        destination.origin = { 0, 0, 0 };
+        destination.aspect = wgpu::TextureAspect::All;
+        destination.mipLevel = level;
+        wgpu::TextureDataLayout source;
+        source.offset = 0;
+        source.bytesPerRow = 8 * l.size;
+        source.rowsPerImage = l.size;
+        wgpu::Extent3D levelSize;
+        levelSize.width = l.size;
+        levelSize.height = l.size;
+        levelSize.depthOrArrayLayers = 6;
+        m_device->getQueue().writeTexture(destination, l.data, l.bytes, source, levelSize);
+    }
+
+    wgpu::TextureViewDescriptor viewDesc;
+    viewDesc.aspect = wgpu::TextureAspect::All;
+    viewDesc.baseArrayLayer = 0;
+    viewDesc.arrayLayerCount = 6;
+    viewDesc.baseMipLevel = 0;
+    viewDesc.mipLevelCount = levelCount;
+    viewDesc.dimension = wgpu::TextureViewDimension::Cube;
+    viewDesc.format = wgpu::TextureFormat::RGBA16Float;
+    viewDesc.label = "specular environment";
+    m_specularTextureView = m_specularTexture.createView(viewDesc);
+
+    textureDesc.format = wgpu::TextureFormat::RG16Float;
+    textureDesc.label = "brdf lut";
+    textureDesc.mipLevelCount = 1;
+    textureDesc.size = { environment.lutSize, environment.lutSize, 1 };
+    m_brdfLutTexture = m_device->createTexture(textureDesc);
+
+    wgpu::ImageCopyTexture destination;
+    destination.texture = m_brdfLutTexture;
+    destination.origin = { 0, 0, 0 };
+    destination.aspect = wgpu::TextureAspect::All;
+    destination.mipLevel = 0;
+    wgpu::TextureDataLayout source;
+    source.offset = 0;
+    source.bytesPerRow = 4 * environment.lutSize;
+    source.rowsPerImage = environment.lutSize;
+    m_device->getQueue().writeTexture(destination, environment.lut, (size_t)4 * environment.lutSize * environment.lutSize, source, textureDesc.size);
+
+    viewDesc.arrayLayerCount = 1;
+    viewDesc.mipLevelCount = 1;
+    viewDesc.dimension = wgpu::TextureViewDimension::_2D;
+    viewDesc.format = wgpu::TextureFormat::RG16Float;
+    viewDesc.label = "brdf lut";
+    m_brdfLutTextureView = m_brdfLutTexture.createView(viewDesc);
+
+    // goes with the textures in releaseSpecularEnvironment. the lut's edges and the cube's seams mustn't wrap
+    wgpu::SamplerDescriptor samplerDesc;
+    samplerDesc.addressModeU = wgpu::AddressMode::ClampToEdge;
+    samplerDesc.addressModeV = wgpu::AddressMode::ClampToEdge;
+    samplerDesc.addressModeW = wgpu::AddressMode::ClampToEdge;
+    samplerDesc.magFilter = wgpu::FilterMode::Linear;
+    samplerDesc.minFilter = wgpu::FilterMode::Linear;
+    samplerDesc.mipmapFilter = wgpu::MipmapFilterMode::Linear;
+    samplerDesc.lodMinClamp = 0.0;
+    samplerDesc.lodMaxClamp = 16.0;
+    samplerDesc.maxAnisotropy = 1;
+    samplerDesc.compare = wgpu::CompareFunction::Undefined;
+    m_environmentSampler = m_device->createSampler(samplerDesc);
+}
+
+DefaultPipeline::Environment RenderModule::environmentBindings() {
+    DefaultPipeline::Environment environment;
+    environment.specular = m_specularTextureView;
+    environment.brdfLut = m_brdfLutTextureView;
+    environment.sampler = m_environmentSampler;
+    return environment;
+}
+
+void RenderModule::releaseSpecularEnvironment() {
+    if (m_specularTexture != nullptr) {
+        m_specularTextureView.release();
+        m_specularTexture.destroy();
+        m_specularTexture.release();
+        m_brdfLutTextureView.release();
+        m_brdfLutTexture.destroy();
+        m_brdfLutTexture.release();
+    }
+    if (m_environmentSampler != nullptr) m_environmentSampler.release();
+    m_specularTexture = nullptr;
+    m_specularTextureView = nullptr;
+    m_brdfLutTexture = nullptr;
+    m_brdfLutTextureView = nullptr;
+    m_environmentSampler = nullptr;
+}
+
 void RenderModule::updateProjectionMatrix() {
     float aspectRatio = (float)m_screenWidth / (float)m_screenHeight;
     m_uniformData.projection_matrix = glm::perspective(glm::radians(45.0f), aspectRatio, 0.1f, 100000.f);
-    m_device->getQueue().writeBuffer(m_uniformBuffer->getBuffer(), offsetof(DefaultPipeline::UniformData, projection_matrix), &m_uniformData.projection_matrix, sizeof(DefaultPipeline::UniformData::projection_matrix));
+    m_uploadManager->write(m_uniformBuffer->getBuffer(), offsetof(DefaultPipeline::UniformData, projection_matrix), &m_uniformData.projection_matrix, sizeof(DefaultPipeline::UniformData::projection_matrix));
     if (m_terrainuniformBuffer != nullptr) {
-        m_device->getQueue().writeBuffer(m_terrainuniformBuffer->getBuffer(), offsetof(TerrainPipeline::UniformData, projection_matrix), &m_uniformData.projection_matrix, sizeof(TerrainPipeline::UniformData::projection_matrix));
+        m_uploadManager->write(m_terrainuniformBuffer->getBuffer(), offsetof(TerrainPipeline::UniformData, projection_matrix), &m_uniformData.projection_matrix, sizeof(TerrainPipeline::UniformData::projection_matrix));
     }
 }
 
 void RenderModule::updateViewMatrix() {
     m_uniformData.camera_world_position = m_camera.position;
     m_uniformData.view_matrix = glm::lookAt(m_camera.position - m_camera.forward, m_camera.position, m_camera.up);
-	m_device->getQueue().writeBuffer(m_uniformBuffer->getBuffer(),
-		0,
-		&m_uniformData,
-		sizeof(DefaultPipeline::UniformData)
-	);
+    // only the view matrix and camera position change here, the projection is written on resize
+    m_uploadManager->write(m_uniformBuffer->getBuffer(), offsetof(DefaultPipeline::UniformData, view_matrix), &m_uniformData.view_matrix, sizeof(DefaultPipeline::UniformData::view_matrix));
+    m_uploadManager->write(m_uniformBuffer->getBuffer(), offsetof(DefaultPipeline::UniformData, camera_world_position), &m_uniformData.camera_world_position, sizeof(DefaultPipeline::UniformData::camera_world_position));
     if (m_terrainuniformBuffer != nullptr) {
-        m_device->getQueue().writeBuffer(m_terrainuniformBuffer->getBuffer(),
-            0,
-            &m_uniformData,
-            sizeof(TerrainPipeline::UniformData)
-        );
+        m_uploadManager->write(m_terrainuniformBuffer->getBuffer(), offsetof(TerrainPipeline::UniformData, view_matrix), &m_uniformData.view_matrix, sizeof(TerrainPipeline::UniformData::view_matrix));
+        m_uploadManager->write(m_terrainuniformBuffer->getBuffer(), offsetof(TerrainPipeline::UniformData, camera_world_position), &m_uniformData.camera_world_position, sizeof(TerrainPipeline::UniformData::camera_world_position));
     }
 }
 
@@ -622,10 +1490,19 @@ void RenderModule::resizeWindow(int new_width, int new_height) {
     updateProjectionMatrix();
 }
 
+float RenderModule::getProjectionScale() {
+    // projection[1][1] is 1 / tan(fovY / 2)
+    return m_uniformData.projection_matrix[1][1] * (float)m_screenHeight * 0.5f;
+}
+
 glm::vec2 RenderModule::getScreenDimensions() {
     return glm::vec2(m_screenWidth, m_screenHeight);
 }
 
 SDL_Window* RenderModule::getWindow() {
     return m_window;
+}
+
+coho::UploadManager::FrameStats RenderModule::getUploadStats() {
+    return m_uploadManager->getFrameStats();
 }
\ No newline at end of file
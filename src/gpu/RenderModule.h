@@ -6,15 +6,31 @@
 
 #include "../memory/Buffer.h"
 #include "../memory/Shader.h"
+#include "../memory/UploadManager.h"
+#include "../memory/SubAllocatedBuffer.h"
+#include "../memory/MeshResidencyTable.h"
+#include "../memory/TextureRegistry.h"
+#include "../memory/TextureStreamer.h"
+#include "../memory/SkylinePacker.h"
+#include "../memory/RenderPass.h"
+#include "../utilities/InstanceCuller.h"
+#include "../utilities/texture/MipGenerator.h"
+#include "../utilities/texture/BlockCompression.h"
+#include "../utilities/texture/MippedTexture.h"
+#include "../utilities/texture/AsyncTextureLoader.h"
+#include "../utilities/texture/IrradienceTexture.h"
+#include "../utilities/texture/SpecularEnvironment.h"
 
 #include "../resources/pipelines/default.h"
 #include "../resources/pipelines/terrain.h"
 #include "../resources/pipelines/FullscreenQuad.h"
+#include "../resources/pipelines/depth.h"
 
 #include <SDL2/SDL.h>
 #include <webgpu/webgpu.hpp>
 #include <sdl2webgpu/sdl2webgpu.h>
 #include <glm/glm.hpp>
+#include <unordered_map>
 #include <vector>
 
 class RenderModule
@@ -36,8 +52,9 @@ public:
         float time);
     void writeModelBuffer(std::vector<DefaultPipeline::ModelData> modelData, int offset);
     void writeMaterialBuffer(std::vector<DefaultPipeline::MaterialData> materialData, int offset);
-    int addMeshToVertexBuffer(std::vector<Mesh::VertexData> vertexData);
-    int addMeshToIndexBuffer(std::vector<uint32_t> indexData);
+    // meshes are uploaded once and shared, matchContent also shares between identical meshes
+    bool addMesh(std::shared_ptr<Mesh> mesh, bool matchContent = true);
+    void removeMesh(std::shared_ptr<Mesh> mesh);
     void resizeWindow(int new_width, int new_height);
 
     void addTerrainPipeline(std::shared_ptr<TerrainPipeline> pipeline,
@@ -56,8 +73,28 @@ public:
         std::shared_ptr<coho::Buffer> uniformBuffer
         );
 
+    // the material slot a texture is bound to, it decides the color space and the block format
+    enum class TextureSlot {
+        Generic, // rgba8, linear
+        Albedo,  // srgb, bc1 (opaque) / bc3 or bc7 with m_highQualityTextures
+        Normal,  // bc5, the shader rebuilds z
+    };
+
     int registerMaterial(std::shared_ptr<coho::Material> material);
-    int registerTexture(std::shared_ptr<coho::Texture> texture, std::string filename, int mipLevelCount = 8);
+    // textures with the same content, format and mip chain share a view, see TextureRegistry.
+    // small ones are packed into atlas pages, texture->uvTransform is their rect in it
+    int registerTexture(std::shared_ptr<coho::Texture> texture, std::string filename, int mipLevelCount = 8, TextureSlot slot = TextureSlot::Generic);
+    // drops a reference taken by registerTexture, the gpu texture goes with the last one
+    void releaseTexture(std::shared_ptr<coho::Texture> texture);
+    // decodes and cooks on the AsyncTextureLoader, the texture is uploaded by onFrame once it's ready.
+    // until then the materials registered with it bind the placeholder
+    std::shared_ptr<coho::Texture> loadTexture(const std::string& path, const std::string& filename, TextureSlot slot);
+    MipFilter m_mipFilter = MipFilter::Kaiser; // for the textures registered from then on
+    bool m_highQualityTextures = false;        // bc7 albedo, twice the size of bc1
+    bool m_streamTextures = true;              // cooked textures registered from then on start small, see TextureStreamer
+    bool m_atlasTextures = true;               // small ones are packed into shared atlas pages, see registerAtlasTexture
+    // the vram budget and the upload rate of the streamed textures
+    coho::StreamingSettings& getStreamingSettings() { return m_textureStreamer->m_settings; };
 
     struct Camera {
         glm::mat4x4 transform;
@@ -68,21 +105,66 @@ public:
     };
     Camera m_camera;
 
+    // the image based light of the lit materials, baked from an equirect image: the diffuse ambient (see IrradienceTexture)
+    // and the prefiltered specular cube with its brdf lut (see SpecularEnvironment). both are cached next to the image
+    bool setEnvironment(const std::string& path, const std::string& filename);
+
     void updateProjectionMatrix();
     void updateViewMatrix();
     glm::vec2 getScreenDimensions();
+    // pixels per world unit at distance 1, for screen space error
+    float getProjectionScale();
+    // cpu copy of the model buffer, the instances' transforms for LodSystem::update
+    const std::vector<DefaultPipeline::ModelData>& getModels() { return m_models; }
     SDL_Window* getWindow();
+    coho::UploadManager::FrameStats getUploadStats();
 
 private:
     bool init();
     void terminate();
 
+    void writeTextureLevel(
+	    wgpu::Texture texture,
+	    uint32_t level,
+	    const uint8_t* data,
+	    size_t size,
+	    uint32_t width,
+	    uint32_t height,
+	    BlockFormat format,
+	    uint32_t x = 0, // of the level's origin, atlas pages write into a rect
+	    uint32_t y = 0
+        );
     void writeMipMaps(
 	    wgpu::Texture texture,
 	    wgpu::Extent3D textureSize,
 	    uint32_t mipLevelCount,
-	    std::vector<unsigned char> pixelData
+	    const std::vector<unsigned char>& pixelData,
+	    bool srgb,
+	    BlockFormat format,
+	    uint32_t x = 0,
+	    uint32_t y = 0
         );
+    void writeCookedLevels(
+	    wgpu::Texture texture,
+	    const MippedTexture& mipped,
+	    uint32_t baseLevel,
+	    uint32_t firstLevel,
+	    uint32_t endLevel,
+	    BlockFormat format,
+	    uint32_t x = 0,
+	    uint32_t y = 0
+        );
+    wgpu::Texture createTexture(const std::string& name, BlockFormat format, uint32_t width, uint32_t height, uint32_t mipLevelCount);
+    wgpu::TextureView createTextureView(wgpu::Texture texture, const std::string& name, BlockFormat format, uint32_t mipLevelCount);
+    // the index the next view gets
+    int nextTextureSlot();
+    // puts a texture and its view at nextTextureSlot
+    void placeTexture(int viewIndex, wgpu::Texture texture, wgpu::TextureView view);
+    // sets the view and uv transform of a TextureRegistry slot on the texture
+    void useTextureSlot(std::shared_ptr<coho::Texture> texture, int slot);
+    // packs the texture's first ATLAS_LEVELS levels into an atlas page of its format and size class,
+    // false when it's too big or its levels wouldn't stay whole blocks
+    bool registerAtlasTexture(std::shared_ptr<coho::Texture> texture, const coho::TextureRegistry::Key& key, int mipLevelCount, bool srgb, BlockFormat format);
 
     bool initWindowAndSurface();
     void releaseWindowAndSurface();
@@ -92,6 +174,20 @@ private:
 
     bool initRenderPipeline();
     void releaseRenderPipeline();
+    bool initTexturePipelines();
+    void releaseTexturePipelines();
+
+    // points the material fields at fieldOffset and uvTransformOffset to the texture once it's uploaded
+    void bindWhenLoaded(std::shared_ptr<coho::Texture> texture, int materialIndex, size_t fieldOffset, size_t uvTransformOffset);
+    // registers the textures the loader finished and rebinds the texture arrays
+    void uploadLoadedTextures();
+    // remakes the pipelines binding the texture arrays once their views changed
+    void rebindTextures();
+    // requests the mips the visible entities' textures need from the streamer (after cullInstances)
+    // and moves the textures to the levels it hands out
+    void streamTextures(const std::vector<std::shared_ptr<Entity>>& entities);
+    // replaces the texture of a view with one starting at the new base level
+    void applyResidency(const coho::TextureStreamer::Change& change);
 
     bool initShaderModule();
     void releaseShaderModule();
@@ -110,12 +206,24 @@ private:
     bool initDepthBuffer();
     void releaseDepthBuffer();
 
+    void uploadSpecularEnvironment(const SpecularEnvironment& environment);
+    void releaseSpecularEnvironment();
+    DefaultPipeline::Environment environmentBindings();
+
     void geometryRenderPass(std::vector<std::shared_ptr<Entity>> entities);
     void terrainRenderPass(std::vector<std::shared_ptr<Entity>> patches);
     void skyBoxRenderPass(std::shared_ptr<Entity> sky);
     void noiseVisRenderPass(std::shared_ptr<Entity> quad);
 
+    void defragmentMeshBuffers(uint32_t maxMoves);
+    // frustum culls every instance of entities and uploads the visible index buffer, fills draws.instancesByEntity
+    void cullInstances(const std::vector<std::shared_ptr<Entity>>& entities, IndirectDraws& draws);
+    // fills draws with the visible meshlets of single instance entities and uploads the args
+    void cullMeshlets(const std::vector<std::shared_ptr<Entity>>& entities, IndirectDraws& draws);
+
 private:
+    IndexBuffers getIndexBuffers();
+
     int m_screenWidth = 720;
     int m_screenHeight = 480;
 
@@ -131,28 +239,60 @@ private:
     std::shared_ptr<wgpu::Device> m_device = nullptr;
     std::shared_ptr<coho::Shader> m_shader = nullptr;
     std::shared_ptr<coho::Shader> m_visShader = nullptr;
+    std::shared_ptr<coho::Shader> m_depthShader = nullptr;
+    std::shared_ptr<coho::Shader> m_impostorShader = nullptr;
 
     wgpu::TextureFormat m_preferredFormat = wgpu::TextureFormat::BGRA8Unorm;
     wgpu::TextureFormat m_depthTextureFormat = wgpu::TextureFormat::Depth24Plus;
 
     std::shared_ptr<coho::DefaultPipeline> m_renderPipeline;
+    std::shared_ptr<coho::DefaultPipeline> m_packedRenderPipeline;
+    std::shared_ptr<coho::DefaultPipeline> m_impostorPipeline;
+    std::shared_ptr<coho::DepthPipeline> m_depthPipeline;
+    // a position only depth pass before the full vertex geometry pass. it draws everything twice to
+    // shade every pixel once, which only pays off with heavy fragment shading and a lot of overdraw.
+    // our scenes have neither, so it's off. the geometry pass then clears depth and tests Less
+    bool m_depthPrepass = false;
     std::shared_ptr<coho::TerrainPipeline> m_terrainPipeline;
     std::shared_ptr<coho::FullscreenQuadPipeline> m_fullscreenQuadRenderPipeline;
 
     std::unique_ptr<wgpu::ErrorCallback> m_deviceErrorCallback;
 
-    std::shared_ptr<coho::Buffer> m_indexBuffer;
+    std::shared_ptr<coho::UploadManager> m_uploadManager;
+
+    std::shared_ptr<coho::SubAllocatedBuffer> m_indexBuffer;
+    std::shared_ptr<coho::SubAllocatedBuffer> m_index16Buffer;
     std::shared_ptr<coho::Buffer> m_terrainindexBuffer;
     int m_terrainindexCount = 0;
-    int m_indexCount = 0;
 
     std::shared_ptr<coho::Buffer> m_terrainvertexBuffer;
-    std::shared_ptr<coho::Buffer> m_vertexBuffer;
+    std::shared_ptr<coho::SubAllocatedBuffer> m_vertexBuffer;
+    std::shared_ptr<coho::SubAllocatedBuffer> m_packedVertexBuffer;
     int m_terrainvertexCount = 0;
-    int m_vertexCount = 0;
+
+    std::shared_ptr<coho::MeshResidencyTable> m_meshResidency;
+
+    // per meshlet draw args, grown on demand
+    std::shared_ptr<coho::Buffer> m_indirectBuffer;
+    // a mesh buffer is only compacted once this much of its live extent is holes
+    static constexpr float MESH_DEFRAGMENT_THRESHOLD = 0.25f;
+    uint32_t m_meshBufferGeneration = 0; // of m_meshResidency when the pipelines were made
+
+    bool m_supportsIndirectFirstInstance = false;
+    bool m_supportsBlockCompression = false; // TextureCompressionBC, textures stay rgba8 without it
 
     std::shared_ptr<coho::Buffer> m_terrainmodelBuffer;
     std::shared_ptr<coho::Buffer> m_modelBuffer;
+    std::vector<DefaultPipeline::ModelData> m_models; // cpu copy of m_modelBuffer
+
+    // model indices of the visible instances, the shaders index the model buffer through it.
+    // slot 0 is the sky's, the culled instances follow
+    static const uint32_t FIRST_VISIBLE_SLOT = 1;
+    std::shared_ptr<coho::Buffer> m_visibleBuffer;
+    std::vector<uint32_t> m_visibleIndices;
+    std::vector<VisibleRange> m_visibleRanges;
+    std::vector<VisibleRange> m_visibleLevelRanges;
+    bool m_visibleOverflow = false; // reported once until the visible instances fit again
 
     std::shared_ptr<coho::Buffer> m_terrainmaterialBuffer;
     std::shared_ptr<coho::Buffer> m_materialBuffer;
@@ -165,9 +305,53 @@ private:
     // textures
     std::vector<wgpu::Texture> m_textureArray;
     std::vector<wgpu::TextureView> m_textureViewArray;
+    std::shared_ptr<coho::TextureRegistry> m_textureRegistry;
+    std::vector<int> m_freeTextureSlots; // released views, they show the default texture
+    std::shared_ptr<coho::TextureStreamer> m_textureStreamer;
+
+    // textures up to MAX_ATLAS_ENTRY_SIZE share atlas pages instead of taking a view each.
+    // pages have ATLAS_LEVELS levels, sampling clamps to the last one
+    static const uint32_t ATLAS_PAGE_SIZE = 1024;
+    static const uint32_t ATLAS_LEVELS = 4;
+    static const uint32_t MAX_ATLAS_ENTRY_SIZE = 256;
+    static const int ATLAS_SLOT_BASE = 1 << 24; // the TextureRegistry slots of atlas entries, views are below
+    struct AtlasPage {
+        BlockFormat format;
+        uint32_t sizeClass; // the power of two its entries round up to
+        std::shared_ptr<coho::SkylinePacker> packer;
+        uint32_t entryCount = 0;
+    };
+    struct AtlasEntry {
+        int page;
+        glm::vec4 uvTransform;
+    };
+    std::unordered_map<int, AtlasPage> m_atlasPages;   // by view index
+    std::unordered_map<int, AtlasEntry> m_atlasEntries; // by registry slot
+    int m_nextAtlasEntry = 0;
+
+    std::shared_ptr<AsyncTextureLoader> m_textureLoader;
+    // textures the loader hasn't handed back yet and the material fields waiting on them
+    struct LoadingTexture {
+        struct Binding {
+            size_t offset; // into the material buffer
+            size_t uvTransformOffset;
+        };
+        std::shared_ptr<coho::Texture> texture;
+        std::string name;
+        TextureSlot slot;
+        std::vector<Binding> bindings;
+    };
+    std::unordered_map<coho::Texture*, LoadingTexture> m_loadingTextures;
+    static const uint32_t MAX_TEXTURE_UPLOADS_PER_FRAME = 2;
+    bool m_textureBindingsDirty = false;
 
     wgpu::Sampler m_textureSampler = nullptr;
     wgpu::Sampler m_environmentSampler = nullptr;
+    // the split sum image based light, for the pbr materials
+    wgpu::Texture m_specularTexture = nullptr;
+    wgpu::TextureView m_specularTextureView = nullptr; // cube, a roughness per level
+    wgpu::Texture m_brdfLutTexture = nullptr;
+    wgpu::TextureView m_brdfLutTextureView = nullptr;
 
 
     wgpu::Texture m_depthTexture = nullptr;
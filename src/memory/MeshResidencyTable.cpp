@@ -0,0 +1,262 @@
+#include "MeshResidencyTable.h"
+#include "../utilities/ContentHash.h"
+#include <cstring>
+#include <iostream>
+
+namespace coho {
+MeshResidencyTable::MeshResidencyTable(
+        std::shared_ptr<SubAllocatedBuffer> vertexBuffer,
+        std::shared_ptr<SubAllocatedBuffer> packedVertexBuffer,
+        std::shared_ptr<SubAllocatedBuffer> indexBuffer,
+        std::shared_ptr<SubAllocatedBuffer> index16Buffer
+        ) {
+    m_vertexBuffer = vertexBuffer;
+    m_packedVertexBuffer = packedVertexBuffer;
+    m_indexBuffer = indexBuffer;
+    m_index16Buffer = index16Buffer;
+}
+
+MeshResidencyTable::~MeshResidencyTable() {
+    m_residents.clear();
+    m_meshes.clear();
+    m_vertexBuffer.reset();
+    m_packedVertexBuffer.reset();
+    m_indexBuffer.reset();
+    m_index16Buffer.reset();
+}
+
+bool MeshResidencyTable::acquire(std::shared_ptr<Mesh> mesh, bool matchContent) {
+    // same mesh object, just take another reference
+    auto entry = m_meshes.find(mesh.get());
+    if (entry != m_meshes.end()) {
+        entry->second.refCount++;
+        Resident& resident = m_residents[entry->second.resident];
+        resident.refCount++;
+        applyOffsets(mesh, resident);
+        return true;
+    }
+
+    // a different mesh object with the same content
+    uint64_t hash = 0;
+    if (matchContent) {
+        hash = hashMeshContent(mesh);
+        auto range = m_residentsByHash.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            Resident& resident = m_residents[it->second];
+            if (!sameContent(resident.meshes.front(), mesh)) continue; // hash collision
+            resident.refCount++;
+            resident.meshes.push_back(mesh);
+            m_meshes[mesh.get()] = { it->second, 1 };
+            applyOffsets(mesh, resident);
+            return true;
+        }
+    }
+
+    Resident resident;
+    if (!upload(mesh, resident)) {
+        return false;
+    }
+    resident.contentHash = hash;
+    resident.hasContentHash = matchContent;
+    resident.refCount = 1;
+    resident.meshes.push_back(mesh);
+
+    uint32_t id = m_nextResident++;
+    m_residents[id] = resident;
+    m_meshes[mesh.get()] = { id, 1 };
+    if (resident.isPacked) {
+        m_residentsByPackedVertexOffset[resident.vertexOffset] = id;
+    } else {
+        m_residentsByVertexOffset[resident.vertexOffset] = id;
+    }
+    if (resident.isIndexed) {
+        indexLookup(resident)[resident.indexOffset] = id;
+    }
+    if (matchContent) {
+        m_residentsByHash.insert({ hash, id });
+    }
+    return true;
+}
+
+void MeshResidencyTable::release(std::shared_ptr<Mesh> mesh) {
+    auto entry = m_meshes.find(mesh.get());
+    if (entry == m_meshes.end()) {
+        std::cout << "MeshResidencyTable: release of a mesh that isn't resident" << std::endl;
+        return;
+    }
+    uint32_t id = entry->second.resident;
+    Resident& resident = m_residents[id];
+
+    if (--entry->second.refCount == 0) {
+        m_meshes.erase(entry);
+        for (auto it = resident.meshes.begin(); it != resident.meshes.end(); ++it) {
+            if (it->get() == mesh.get()) {
+                resident.meshes.erase(it);
+                break;
+            }
+        }
+    }
+    if (--resident.refCount > 0) return;
+
+    // last reference, give the ranges back
+    if (resident.isPacked) {
+        m_packedVertexBuffer->free(resident.vertexOffset);
+        m_residentsByPackedVertexOffset.erase(resident.vertexOffset);
+    } else {
+        m_vertexBuffer->free(resident.vertexOffset);
+        m_residentsByVertexOffset.erase(resident.vertexOffset);
+    }
+    if (resident.isIndexed) {
+        indexBuffer(resident)->free(resident.indexOffset);
+        indexLookup(resident).erase(resident.indexOffset);
+    }
+    if (resident.hasContentHash) {
+        auto range = m_residentsByHash.equal_range(resident.contentHash);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->second == id) {
+                m_residentsByHash.erase(it);
+                break;
+            }
+        }
+    }
+    m_residents.erase(id);
+}
+
+void MeshResidencyTable::defragment(uint32_t maxMoves, float minFragmentation) {
+    patchVertexMoves(m_vertexBuffer, m_residentsByVertexOffset, maxMoves, minFragmentation);
+    patchVertexMoves(m_packedVertexBuffer, m_residentsByPackedVertexOffset, maxMoves, minFragmentation);
+    patchIndexMoves(m_indexBuffer, m_residentsByIndexOffset, maxMoves, minFragmentation);
+    patchIndexMoves(m_index16Buffer, m_residentsByIndex16Offset, maxMoves, minFragmentation);
+}
+
+uint32_t MeshResidencyTable::getGeneration() {
+    return m_vertexBuffer->getGeneration() + m_packedVertexBuffer->getGeneration()
+        + m_indexBuffer->getGeneration() + m_index16Buffer->getGeneration();
+}
+
+void MeshResidencyTable::patchIndexMoves(std::shared_ptr<SubAllocatedBuffer> buffer, std::unordered_map<uint32_t, uint32_t>& residentsByOffset, uint32_t maxMoves, float minFragmentation) {
+    // the moves are copies submitted right away, not worth it for a few small holes
+    if (minFragmentation > 0.0f && buffer->getFragmentation() < minFragmentation) return;
+    for (auto& move : buffer->defragment(maxMoves)) {
+        uint32_t id = residentsByOffset[(uint32_t)move.from];
+        residentsByOffset.erase((uint32_t)move.from);
+        residentsByOffset[(uint32_t)move.to] = id;
+        Resident& resident = m_residents[id];
+        resident.indexOffset = (uint32_t)move.to;
+        assignOffsets(resident);
+    }
+}
+
+void MeshResidencyTable::patchVertexMoves(std::shared_ptr<SubAllocatedBuffer> buffer, std::unordered_map<uint32_t, uint32_t>& residentsByOffset, uint32_t maxMoves, float minFragmentation) {
+    // the moves are copies submitted right away, not worth it for a few small holes
+    if (minFragmentation > 0.0f && buffer->getFragmentation() < minFragmentation) return;
+    for (auto& move : buffer->defragment(maxMoves)) {
+        uint32_t id = residentsByOffset[(uint32_t)move.from];
+        residentsByOffset.erase((uint32_t)move.from);
+        residentsByOffset[(uint32_t)move.to] = id;
+        Resident& resident = m_residents[id];
+        resident.vertexOffset = (uint32_t)move.to;
+        assignOffsets(resident);
+    }
+}
+
+uint32_t MeshResidencyTable::getRefCount(std::shared_ptr<Mesh> mesh) {
+    auto entry = m_meshes.find(mesh.get());
+    if (entry == m_meshes.end()) return 0;
+    return m_residents[entry->second.resident].refCount;
+}
+
+// xxHash64 over the vertex bytes, then over the index bytes as stored. neither vertex struct has padding to worry about.
+// the index width is part of the content, sameContent won't match a 16 bit mesh with a 32 bit one either
+uint64_t MeshResidencyTable::hashMeshContent(std::shared_ptr<Mesh> mesh) {
+    uint64_t hash = 0;
+    if (mesh->isPacked) {
+        hash = ContentHash::hash(mesh->m_packedVertexData.data(), mesh->m_packedVertexData.size() * sizeof(Mesh::PackedVertexData));
+    } else {
+        hash = ContentHash::hash(mesh->m_vertexData.data(), mesh->m_vertexData.size() * sizeof(Mesh::VertexData));
+    }
+    if (mesh->isIndexed) {
+        hash = ContentHash::hash(mesh->getIndexBytes(), mesh->getIndexByteSize(), hash);
+    }
+    return hash;
+}
+
+bool MeshResidencyTable::upload(std::shared_ptr<Mesh> mesh, Resident& resident) {
+    resident.isPacked = mesh->isPacked;
+    std::shared_ptr<SubAllocatedBuffer> vertexBuffer = resident.isPacked ? m_packedVertexBuffer : m_vertexBuffer;
+    if (!vertexBuffer->allocate(mesh->getVertexCount(), resident.vertexOffset)) {
+        std::cout << "failed to allocate " << mesh->getVertexCount() << " vertices" << std::endl;
+        return false;
+    }
+    if (resident.isPacked) {
+        vertexBuffer->write(resident.vertexOffset, mesh->m_packedVertexData.data(), mesh->getVertexCount());
+    } else {
+        std::vector<PositionVertexLayout::Vertex> positions = PositionVertexLayout::fromVertexData(mesh->m_vertexData);
+        std::vector<AttributeVertexLayout::Vertex> attributes = AttributeVertexLayout::fromVertexData(mesh->m_vertexData);
+        vertexBuffer->write(resident.vertexOffset, positions.data(), mesh->getVertexCount(), PositionStream);
+        vertexBuffer->write(resident.vertexOffset, attributes.data(), mesh->getVertexCount(), AttributeStream);
+    }
+
+    resident.isIndexed = mesh->isIndexed;
+    resident.isIndex16 = mesh->isIndexed && mesh->isIndex16;
+    if (resident.isIndexed) {
+        // the 16 bit arena counts pairs of indices so ranges stay 4 byte aligned for copies and writes
+        uint32_t elementCount = resident.isIndex16 ? (mesh->getIndexCount() + 1) / 2 : mesh->getIndexCount();
+        if (!indexBuffer(resident)->allocate(elementCount, resident.indexOffset)) {
+            std::cout << "failed to allocate " << mesh->getIndexCount() << " indices" << std::endl;
+            vertexBuffer->free(resident.vertexOffset);
+            return false;
+        }
+        if (resident.isIndex16 && mesh->getIndexCount() % 2 != 0) {
+            // an odd count is padded to a whole pair
+            std::vector<uint16_t> indices = mesh->getIndexData16();
+            indices.push_back(0);
+            m_index16Buffer->write(resident.indexOffset, indices.data(), elementCount);
+        } else if (resident.isIndex16) {
+            m_index16Buffer->write(resident.indexOffset, mesh->getIndexBytes(), elementCount);
+        } else {
+            m_indexBuffer->write(resident.indexOffset, mesh->getIndexBytes(), elementCount);
+        }
+    }
+    applyOffsets(mesh, resident);
+    return true;
+}
+
+bool MeshResidencyTable::sameContent(std::shared_ptr<Mesh> a, std::shared_ptr<Mesh> b) {
+    if (a->getVertexCount() != b->getVertexCount() || a->isIndexed != b->isIndexed || a->getIndexCount() != b->getIndexCount() || a->isPacked != b->isPacked || a->isIndex16 != b->isIndex16) {
+        return false;
+    }
+    if (a->isPacked) {
+        if (std::memcmp(a->m_packedVertexData.data(), b->m_packedVertexData.data(), a->m_packedVertexData.size() * sizeof(Mesh::PackedVertexData)) != 0) {
+            return false;
+        }
+        // the packed data is relative to the mesh bounds, both have to agree on them
+        if (a->getDequantizeTransform() != b->getDequantizeTransform()) {
+            return false;
+        }
+    } else if (std::memcmp(a->m_vertexData.data(), b->m_vertexData.data(), a->m_vertexData.size() * sizeof(Mesh::VertexData)) != 0) {
+        return false;
+    }
+    return !a->isIndexed || std::memcmp(a->getIndexBytes(), b->getIndexBytes(), a->getIndexByteSize()) == 0;
+}
+
+void MeshResidencyTable::assignOffsets(Resident& resident) {
+    for (auto& mesh : resident.meshes) {
+        applyOffsets(mesh, resident);
+    }
+}
+
+void MeshResidencyTable::applyOffsets(std::shared_ptr<Mesh> mesh, Resident& resident) {
+    mesh->setVertexBufferOffset(resident.vertexOffset);
+    // first index for the draw, in indices rather than elements of the arena
+    mesh->setIndexBufferOffset(resident.isIndex16 ? resident.indexOffset * 2 : resident.indexOffset);
+}
+
+std::shared_ptr<SubAllocatedBuffer> MeshResidencyTable::indexBuffer(Resident& resident) {
+    return resident.isIndex16 ? m_index16Buffer : m_indexBuffer;
+}
+
+std::unordered_map<uint32_t, uint32_t>& MeshResidencyTable::indexLookup(Resident& resident) {
+    return resident.isIndex16 ? m_residentsByIndex16Offset : m_residentsByIndexOffset;
+}
+}
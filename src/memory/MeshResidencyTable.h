@@ -0,0 +1,96 @@
+#pragma once
+#include "SubAllocatedBuffer.h"
+#include "VertexLayout.h"
+#include "../ecs/components/Mesh.h"
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+
+namespace coho {
+// Tracks which meshes live in the shared vertex/index buffers. Every distinct
+// Mesh is uploaded once and reference counted, entities sharing a mesh share
+// its ranges. Optionally meshes with identical content (different objects,
+// same vertices and indices) are matched by hash and share a range too.
+// Unpacked meshes are split over two streams of the vertex buffer, positions
+// and the remaining attributes, so depth only passes fetch 12 bytes per vertex.
+// Packed meshes (Mesh::isPacked) live in their own vertex buffer, and meshes
+// with 16 bit indices (Mesh::isIndex16) in their own index buffer.
+class MeshResidencyTable {
+public:
+    enum VertexStream : uint32_t {
+        PositionStream = 0,  // PositionVertexLayout
+        AttributeStream = 1  // AttributeVertexLayout
+    };
+
+    MeshResidencyTable(
+        std::shared_ptr<SubAllocatedBuffer> vertexBuffer,
+        std::shared_ptr<SubAllocatedBuffer> packedVertexBuffer,
+        std::shared_ptr<SubAllocatedBuffer> indexBuffer,
+        std::shared_ptr<SubAllocatedBuffer> index16Buffer
+        );
+    ~MeshResidencyTable();
+
+    // takes a reference on the mesh, uploading it if it isn't resident yet.
+    // sets the vertex/index offsets on the mesh.
+    bool acquire(std::shared_ptr<Mesh> mesh, bool matchContent = true);
+    // drops a reference, the ranges are freed with the last one
+    void release(std::shared_ptr<Mesh> mesh);
+
+    // compacts the buffers a few ranges at a time and patches the offsets of resident meshes.
+    // buffers with less than minFragmentation of their live extent free are left alone
+    void defragment(uint32_t maxMoves, float minFragmentation = 0.0f);
+    // changes whenever one of the buffers grows, see SubAllocatedBuffer::getGeneration
+    uint32_t getGeneration();
+
+    uint32_t getResidentCount() { return (uint32_t)m_residents.size(); };
+    uint32_t getRefCount(std::shared_ptr<Mesh> mesh);
+
+    static uint64_t hashMeshContent(std::shared_ptr<Mesh> mesh);
+
+private:
+    struct Resident {
+        uint32_t vertexOffset = 0;
+        uint32_t indexOffset = 0;
+        bool isIndexed = false;
+        bool isPacked = false;
+        bool isIndex16 = false;  // indexOffset then counts pairs of indices
+        uint64_t contentHash = 0;
+        bool hasContentHash = false;
+        uint32_t refCount = 0;
+        std::vector<std::shared_ptr<Mesh>> meshes; // every mesh object using this range
+    };
+
+    struct MeshEntry {
+        uint32_t resident;
+        uint32_t refCount;
+    };
+
+    bool upload(std::shared_ptr<Mesh> mesh, Resident& resident);
+    bool sameContent(std::shared_ptr<Mesh> a, std::shared_ptr<Mesh> b);
+    void assignOffsets(Resident& resident);
+    void applyOffsets(std::shared_ptr<Mesh> mesh, Resident& resident);
+    std::shared_ptr<SubAllocatedBuffer> indexBuffer(Resident& resident);
+    std::unordered_map<uint32_t, uint32_t>& indexLookup(Resident& resident);
+    void patchVertexMoves(std::shared_ptr<SubAllocatedBuffer> buffer, std::unordered_map<uint32_t, uint32_t>& residentsByOffset, uint32_t maxMoves, float minFragmentation);
+    void patchIndexMoves(std::shared_ptr<SubAllocatedBuffer> buffer, std::unordered_map<uint32_t, uint32_t>& residentsByOffset, uint32_t maxMoves, float minFragmentation);
+
+private:
+    std::shared_ptr<SubAllocatedBuffer> m_vertexBuffer;
+    std::shared_ptr<SubAllocatedBuffer> m_packedVertexBuffer;
+    std::shared_ptr<SubAllocatedBuffer> m_indexBuffer;
+    std::shared_ptr<SubAllocatedBuffer> m_index16Buffer;
+
+    std::unordered_map<uint32_t, Resident> m_residents;
+    uint32_t m_nextResident = 0;
+
+    std::unordered_map<Mesh*, MeshEntry> m_meshes;
+    std::unordered_multimap<uint64_t, uint32_t> m_residentsByHash;
+
+    // element offset -> resident, so defragmentation moves can be mapped back
+    std::unordered_map<uint32_t, uint32_t> m_residentsByVertexOffset;
+    std::unordered_map<uint32_t, uint32_t> m_residentsByPackedVertexOffset;
+    std::unordered_map<uint32_t, uint32_t> m_residentsByIndexOffset;
+    std::unordered_map<uint32_t, uint32_t> m_residentsByIndex16Offset;
+};
+}
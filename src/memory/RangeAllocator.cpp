@@ -0,0 +1,138 @@
+#include "RangeAllocator.h"
+#include <iostream>
+
+namespace coho {
+RangeAllocator::RangeAllocator(uint64_t capacity) {
+    m_capacity = capacity;
+    if (capacity > 0) {
+        insertFree(0, capacity);
+    }
+}
+
+bool RangeAllocator::allocate(uint64_t size, uint64_t& offset) {
+    if (size == 0) return false;
+    auto best = m_freeBySize.lower_bound(size);
+    if (best == m_freeBySize.end()) return false;
+
+    offset = best->second;
+    return allocateAt(offset, size);
+}
+
+void RangeAllocator::free(uint64_t offset) {
+    auto it = m_allocations.find(offset);
+    if (it == m_allocations.end()) {
+        std::cout << "RangeAllocator: free of unknown offset " << offset << std::endl;
+        return;
+    }
+    uint64_t size = it->second;
+    m_allocations.erase(it);
+    m_used -= size;
+    insertFree(offset, size);
+}
+
+void RangeAllocator::grow(uint64_t newCapacity) {
+    if (newCapacity <= m_capacity) return;
+    insertFree(m_capacity, newCapacity - m_capacity);
+    m_capacity = newCapacity;
+}
+
+bool RangeAllocator::nextDefragMove(Move& move) {
+    if (m_freeByOffset.empty() || m_allocations.empty()) return false;
+
+    auto hole = m_freeByOffset.begin();
+    uint64_t holeOffset = hole->first;
+    uint64_t holeSize = hole->second;
+    if (holeOffset >= getHighWaterMark()) return false; // nothing lives above the first hole
+
+    // prefer filling the hole with the highest allocation that fits, it pulls the high water mark down
+    auto candidate = m_allocations.end();
+    for (auto it = m_allocations.rbegin(); it != m_allocations.rend() && it->first > holeOffset; ++it) {
+        if (it->second <= holeSize) {
+            candidate = std::next(it).base();
+            break;
+        }
+    }
+    // nothing fits, slide the allocation right after the hole down instead
+    if (candidate == m_allocations.end()) {
+        candidate = m_allocations.lower_bound(holeOffset);
+    }
+
+    move.from = candidate->first;
+    move.size = candidate->second;
+    move.to = holeOffset;
+
+    m_allocations.erase(candidate);
+    m_used -= move.size;
+    insertFree(move.from, move.size);
+    return allocateAt(move.to, move.size);
+}
+
+uint64_t RangeAllocator::getAllocationSize(uint64_t offset) {
+    auto it = m_allocations.find(offset);
+    return it == m_allocations.end() ? 0 : it->second;
+}
+
+uint64_t RangeAllocator::getLargestFreeBlock() {
+    if (m_freeBySize.empty()) return 0;
+    return m_freeBySize.rbegin()->first;
+}
+
+uint64_t RangeAllocator::getHighWaterMark() {
+    if (m_allocations.empty()) return 0;
+    auto last = m_allocations.rbegin();
+    return last->first + last->second;
+}
+
+void RangeAllocator::insertFree(uint64_t offset, uint64_t size) {
+    // merge with the block after
+    auto next = m_freeByOffset.lower_bound(offset);
+    if (next != m_freeByOffset.end() && next->first == offset + size) {
+        size += next->second;
+        eraseFree(next);
+    }
+    // merge with the block before
+    auto prev = m_freeByOffset.lower_bound(offset);
+    if (prev != m_freeByOffset.begin()) {
+        --prev;
+        if (prev->first + prev->second == offset) {
+            offset = prev->first;
+            size += prev->second;
+            eraseFree(prev);
+        }
+    }
+    m_freeByOffset[offset] = size;
+    m_freeBySize.insert({ size, offset });
+}
+
+void RangeAllocator::eraseFree(std::map<uint64_t, uint64_t>::iterator it) {
+    auto range = m_freeBySize.equal_range(it->second);
+    for (auto bySize = range.first; bySize != range.second; ++bySize) {
+        if (bySize->second == it->first) {
+            m_freeBySize.erase(bySize);
+            break;
+        }
+    }
+    m_freeByOffset.erase(it);
+}
+
+// carves [offset, offset + size) out of the free block containing it
+bool RangeAllocator::allocateAt(uint64_t offset, uint64_t size) {
+    auto it = m_freeByOffset.upper_bound(offset);
+    if (it == m_freeByOffset.begin()) return false;
+    --it;
+    uint64_t blockOffset = it->first;
+    uint64_t blockSize = it->second;
+    if (offset + size > blockOffset + blockSize) return false;
+
+    eraseFree(it);
+    if (offset > blockOffset) {
+        insertFree(blockOffset, offset - blockOffset);
+    }
+    if (offset + size < blockOffset + blockSize) {
+        insertFree(offset + size, (blockOffset + blockSize) - (offset + size));
+    }
+    m_allocations[offset] = size;
+    m_used += size;
+    return true;
+}
+}
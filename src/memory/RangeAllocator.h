@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdint>
+#include <map>
+
+namespace coho {
+// Free-list allocator over an abstract range [0, capacity). It only does the
+// bookkeeping, units are whatever the owner wants (bytes, vertices, indices).
+// Free blocks are coalesced on free and allocation is best fit.
+class RangeAllocator {
+public:
+    struct Move {
+        uint64_t from;
+        uint64_t to;
+        uint64_t size;
+    };
+
+    RangeAllocator(uint64_t capacity = 0);
+
+    bool allocate(uint64_t size, uint64_t& offset);
+    void free(uint64_t offset);
+    void grow(uint64_t newCapacity);
+
+    // plans a single defragmentation step and applies it to the bookkeeping.
+    // returns false when the range is already compacted. the caller is
+    // responsible for actually moving the data (source and destination may overlap).
+    bool nextDefragMove(Move& move);
+
+    uint64_t getCapacity() { return m_capacity; };
+    uint64_t getUsed() { return m_used; };
+    uint64_t getAllocationSize(uint64_t offset);
+    uint64_t getLargestFreeBlock();
+    uint64_t getFreeBlockCount() { return m_freeByOffset.size(); };
+    // end of the highest live allocation
+    uint64_t getHighWaterMark();
+
+private:
+    void insertFree(uint64_t offset, uint64_t size);
+    void eraseFree(std::map<uint64_t, uint64_t>::iterator it);
+    bool allocateAt(uint64_t offset, uint64_t size);
+
+private:
+    uint64_t m_capacity = 0;
+    uint64_t m_used = 0;
+    std::map<uint64_t, uint64_t> m_freeByOffset;
+    std::multimap<uint64_t, uint64_t> m_freeBySize;
+    std::map<uint64_t, uint64_t> m_allocations;
+};
+}
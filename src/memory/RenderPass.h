@@ -1,9 +1,71 @@
 #pragma once
 #include <webgpu/webgpu.hpp>
 #include "../ecs/Entity.h"
+#include "../ecs/components/MeshComponent.h"
+#include "../ecs/components/LodComponent.h"
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// the shared index arenas, small meshes live in the 16 bit one
+struct IndexBuffers {
+    wgpu::Buffer index32Buffer = nullptr;
+    uint32_t index32BufferSize = 0;
+    wgpu::Buffer index16Buffer = nullptr;
+    uint32_t index16BufferSize = 0;
+};
+
+// matches the layout drawIndexedIndirect reads, 20 bytes
+struct DrawIndexedIndirectArgs {
+    uint32_t indexCount;
+    uint32_t instanceCount;
+    uint32_t firstIndex;
+    int32_t baseVertex;
+    uint32_t firstInstance;
+};
+
+// per meshlet draws of the entities that survived meshlet culling.
+// rangesByEntity maps an entity id to its (first, count) in args, a count of 0 means fully culled.
+// without useIndirect (no IndirectFirstInstance) the args are drawn directly from the cpu copy.
+// instancesByEntity maps an entity id to the (first, count) of its visible instances in the
+// visible index buffer, firstInstance points there instead of at the model buffer (see InstanceCuller)
+// levelRangesByEntity maps an entity with a LodComponent to the (first, count) of its levels in
+// levelRanges, which hold the (first, count) of the visible instances of each level.
+// visibleKinds says which DrawKinds have anything visible, passes without any are skipped
+struct IndirectDraws {
+    wgpu::Buffer buffer = nullptr;
+    bool useIndirect = false;
+    std::vector<DrawIndexedIndirectArgs> args;
+    std::unordered_map<int, std::pair<uint32_t, uint32_t>> rangesByEntity;
+    std::unordered_map<int, std::pair<uint32_t, uint32_t>> instancesByEntity;
+    std::vector<std::pair<uint32_t, uint32_t>> levelRanges;
+    std::unordered_map<int, std::pair<uint32_t, uint32_t>> levelRangesByEntity;
+    uint32_t visibleKinds = 0;
+};
+
+// the pipelines a mesh can be drawn with, a pass draws the kinds it's given
+enum DrawKind : uint32_t {
+    FullVertexDraws = 1,
+    PackedVertexDraws = 2,
+    ImpostorDraws = 4,
+    AllDraws = 7
+};
 
 class RenderPass {
 public:
+static DrawKind drawKind(const std::shared_ptr<Mesh>& mesh, bool impostor) {
+    if (impostor) return ImpostorDraws;
+    return mesh->isPacked ? PackedVertexDraws : FullVertexDraws;
+}
+
+// firstInstance and instanceCount of an entity's draw, entities the culler never saw draw nothing
+static std::pair<uint32_t, uint32_t> instanceRange(const std::shared_ptr<Entity>& entity, const IndirectDraws* indirectDraws) {
+    if (indirectDraws == nullptr) return { 0, 0 };
+    auto range = indirectDraws->instancesByEntity.find(entity->getId());
+    if (range == indirectDraws->instancesByEntity.end()) return { 0, 0 };
+    return range->second;
+}
+
 static void render(
         wgpu::Device device,
         wgpu::TextureView surfaceTextureView,
@@ -15,4 +77,90 @@ static void render(
         std::vector<std::shared_ptr<Entity>> entities
     );
 
-};
\ No newline at end of file
+protected:
+// binds the index buffer matching the mesh, only when the format changes
+static void bindIndexBuffer(wgpu::RenderPassEncoder renderPassEncoder, IndexBuffers indexBuffers, bool index16, int& boundFormat) {
+    if (boundFormat == (index16 ? 16 : 32)) return;
+    if (index16) {
+        renderPassEncoder.setIndexBuffer(indexBuffers.index16Buffer, wgpu::IndexFormat::Uint16, 0, indexBuffers.index16BufferSize);
+    } else {
+        renderPassEncoder.setIndexBuffer(indexBuffers.index32Buffer, wgpu::IndexFormat::Uint32, 0, indexBuffers.index32BufferSize);
+    }
+    boundFormat = index16 ? 16 : 32;
+}
+
+// draws grouped by index format, 32 bit (and non indexed) first, then 16 bit,
+// so each index buffer is bound at most once per pass. entities with a LodComponent draw
+// the visible instances of every level with that level's mesh, meshlets only cover level 0
+static void drawEntities(
+        wgpu::RenderPassEncoder renderPassEncoder,
+        IndexBuffers indexBuffers,
+        const std::vector<std::shared_ptr<Entity>>& entities,
+        const IndirectDraws* indirectDraws,
+        uint32_t kinds = AllDraws) {
+    int boundFormat = 0;
+    for (bool index16 : { false, true }) {
+        for (auto& entity : entities) {
+            auto instances = instanceRange(entity, indirectDraws);
+            if (instances.second == 0) continue; // every instance was culled
+            // a visible instance means indirectDraws is set
+            auto meshlets = indirectDraws->rangesByEntity.find(entity->getId());
+            const std::pair<uint32_t, uint32_t>* meshletRange = meshlets == indirectDraws->rangesByEntity.end() ? nullptr : &meshlets->second;
+
+            auto lodComponent = entity->getComponent<LodComponent>();
+            auto levels = indirectDraws->levelRangesByEntity.find(entity->getId());
+            if (lodComponent == nullptr || levels == indirectDraws->levelRangesByEntity.end()) {
+                auto mesh = entity->getComponent<MeshComponent>()->mesh;
+                if (kinds & drawKind(mesh, false)) {
+                    drawMesh(renderPassEncoder, indexBuffers, *indirectDraws, mesh, 0, instances, meshletRange, index16, boundFormat);
+                }
+                continue;
+            }
+            for (uint32_t i = 0; i < levels->second.second; i++) {
+                auto& levelInstances = indirectDraws->levelRanges[levels->second.first + i];
+                auto& level = lodComponent->levels[i];
+                if (levelInstances.second == 0 || !(kinds & drawKind(level.mesh, level.impostor))) continue;
+                drawMesh(renderPassEncoder, indexBuffers, *indirectDraws, level.mesh, level.lod, levelInstances, i == 0 ? meshletRange : nullptr, index16, boundFormat);
+            }
+        }
+    }
+}
+
+// one lod range of a mesh for the instances (firstInstance, instanceCount), or its culled meshlets
+// (first, count in the args). only draws when the mesh uses the index format of this round
+static void drawMesh(
+        wgpu::RenderPassEncoder renderPassEncoder,
+        IndexBuffers indexBuffers,
+        const IndirectDraws& indirectDraws,
+        const std::shared_ptr<Mesh>& mesh,
+        uint32_t lodIndex,
+        std::pair<uint32_t, uint32_t> instances,
+        const std::pair<uint32_t, uint32_t>* meshletRange,
+        bool index16,
+        int& boundFormat) {
+    if (!mesh->isIndexed) {
+        if (!index16) renderPassEncoder.draw(mesh->getVertexCount(), instances.second, mesh->getVertexBufferOffset(), instances.first);
+        return;
+    }
+    if (mesh->isIndex16 != index16) return;
+    bindIndexBuffer(renderPassEncoder, indexBuffers, index16, boundFormat);
+    if (meshletRange != nullptr) {
+        drawMeshlets(renderPassEncoder, indirectDraws, meshletRange->first, meshletRange->second);
+        return;
+    }
+    Mesh::Lod lod = mesh->getLod(lodIndex);
+    renderPassEncoder.drawIndexed(lod.indexCount, instances.second, mesh->getIndexBufferOffset() + lod.firstIndex, mesh->getVertexBufferOffset(), instances.first);
+}
+
+static void drawMeshlets(wgpu::RenderPassEncoder renderPassEncoder, const IndirectDraws& indirectDraws, uint32_t first, uint32_t count) {
+    for (uint32_t i = first; i < first + count; i++) {
+        if (indirectDraws.useIndirect) {
+            renderPassEncoder.drawIndexedIndirect(indirectDraws.buffer, i * sizeof(DrawIndexedIndirectArgs));
+            continue;
+        }
+        const DrawIndexedIndirectArgs& args = indirectDraws.args[i];
+        renderPassEncoder.drawIndexed(args.indexCount, args.instanceCount, args.firstIndex, args.baseVertex, args.firstInstance);
+    }
+}
+
+};
@@ -0,0 +1,79 @@
+#include "SkylinePacker.h"
+#include <algorithm>
+
+namespace coho {
+SkylinePacker::SkylinePacker(uint32_t width, uint32_t height, uint32_t alignment) {
+    m_width = width;
+    m_height = height;
+    m_alignment = std::max(alignment, 1u);
+    m_skyline.push_back({ 0, 0, width });
+}
+
+bool SkylinePacker::pack(uint32_t width, uint32_t height, uint32_t& x, uint32_t& y) {
+    if (width == 0 || height == 0) return false;
+    width = (width + m_alignment - 1) / m_alignment * m_alignment;
+    height = (height + m_alignment - 1) / m_alignment * m_alignment;
+
+    // the lowest spot, the leftmost of equally low ones
+    size_t best = m_skyline.size();
+    uint32_t bestY = 0;
+    for (size_t i = 0; i < m_skyline.size(); i++) {
+        uint32_t top;
+        if (!fits(i, width, height, top)) continue;
+        if (best == m_skyline.size() || top < bestY) {
+            best = i;
+            bestY = top;
+        }
+    }
+    if (best == m_skyline.size()) return false;
+
+    x = m_skyline[best].x;
+    y = bestY;
+    place(best, x, y, width, height);
+    m_usedArea += (uint64_t)width * height;
+    return true;
+}
+
+bool SkylinePacker::fits(size_t index, uint32_t width, uint32_t height, uint32_t& y) {
+    uint32_t x = m_skyline[index].x;
+    if (x + width > m_width) return false;
+    // the rect rests on the highest segment under it
+    y = 0;
+    uint32_t covered = 0;
+    for (size_t i = index; covered < width; i++) {
+        y = std::max(y, m_skyline[i].y);
+        if (y + height > m_height) return false;
+        covered += m_skyline[i].width;
+    }
+    return true;
+}
+
+void SkylinePacker::place(size_t index, uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+    m_skyline.insert(m_skyline.begin() + index, { x, y + height, width });
+
+    // the segments under the rect shrink or go
+    uint32_t right = x + width;
+    for (size_t i = index + 1; i < m_skyline.size();) {
+        Segment& segment = m_skyline[i];
+        if (segment.x >= right) break;
+        uint32_t end = segment.x + segment.width;
+        if (end <= right) {
+            m_skyline.erase(m_skyline.begin() + i);
+            continue;
+        }
+        segment.width = end - right;
+        segment.x = right;
+        break;
+    }
+
+    // neighbours at the same height become one segment
+    for (size_t i = 0; i + 1 < m_skyline.size();) {
+        if (m_skyline[i].y == m_skyline[i + 1].y) {
+            m_skyline[i].width += m_skyline[i + 1].width;
+            m_skyline.erase(m_skyline.begin() + i + 1);
+        } else {
+            i++;
+        }
+    }
+}
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace coho {
+// Packs rectangles into a width x height area, bottom left first. The packed
+// area is kept as a skyline, the top edge of what's placed so far as a list of
+// horizontal segments, and a rect goes where its top ends up lowest. Like
+// RangeAllocator it only does the bookkeeping. Rects are rounded up to the
+// alignment, so every position is a multiple of it. Nothing is ever freed, the
+// space under the skyline is only given back with the whole packer.
+class SkylinePacker {
+public:
+    SkylinePacker(uint32_t width, uint32_t height, uint32_t alignment = 1);
+
+    // false when the rect doesn't fit anywhere
+    bool pack(uint32_t width, uint32_t height, uint32_t& x, uint32_t& y);
+
+    uint32_t getWidth() { return m_width; };
+    uint32_t getHeight() { return m_height; };
+    // area of the packed rects, alignment included
+    uint64_t getUsedArea() { return m_usedArea; };
+    float getOccupancy() { return (float)m_usedArea / ((float)m_width * (float)m_height); };
+
+private:
+    struct Segment {
+        uint32_t x;
+        uint32_t y;
+        uint32_t width;
+    };
+
+    // the height a rect starting at segment index would sit at, false when it runs off an edge
+    bool fits(size_t index, uint32_t width, uint32_t height, uint32_t& y);
+    void place(size_t index, uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+
+private:
+    uint32_t m_width;
+    uint32_t m_height;
+    uint32_t m_alignment;
+    uint64_t m_usedArea = 0;
+    std::vector<Segment> m_skyline; // left to right, covering the whole width
+};
+}
@@ -0,0 +1,170 @@
+#include "SubAllocatedBuffer.h"
+#include <algorithm>
+#include <iostream>
+
+namespace coho {
+SubAllocatedBuffer::SubAllocatedBuffer(
+        std::shared_ptr<wgpu::Device> device,
+        std::shared_ptr<UploadManager> uploadManager,
+        wgpu::BufferDescriptor descriptor,
+        uint32_t elementSize,
+        uint64_t maxSize
+        ) {
+    m_device = device;
+    m_uploadManager = uploadManager;
+    m_maxSize = maxSize;
+    m_allocator = RangeAllocator(descriptor.size / elementSize);
+    addStream(descriptor, elementSize);
+}
+
+SubAllocatedBuffer::~SubAllocatedBuffer() {
+    m_streams.clear();
+    if (m_scratchBuffer != nullptr) {
+        m_scratchBuffer.destroy();
+        m_scratchBuffer.release();
+    }
+    m_uploadManager.reset();
+    m_device.reset();
+}
+
+uint32_t SubAllocatedBuffer::addStream(wgpu::BufferDescriptor descriptor, uint32_t elementSize) {
+    if (m_allocator.getUsed() > 0) {
+        std::cout << "SubAllocatedBuffer: streams have to be added before allocating" << std::endl;
+    }
+    Stream stream;
+    stream.name = descriptor.label != nullptr ? descriptor.label : "sub-allocated buffer";
+    stream.descriptor = descriptor;
+    stream.elementSize = elementSize;
+    stream.buffer = createStreamBuffer(stream, m_allocator.getCapacity());
+    m_streams.push_back(stream);
+    return (uint32_t)m_streams.size() - 1;
+}
+
+bool SubAllocatedBuffer::allocate(uint32_t count, uint32_t& offset) {
+    uint64_t allocation = 0;
+    if (!m_allocator.allocate(count, allocation)) {
+        if (!grow(m_allocator.getCapacity() + count)) {
+            std::cout << m_streams[0].name << ": out of memory allocating " << count << " elements" << std::endl;
+            return false;
+        }
+        if (!m_allocator.allocate(count, allocation)) return false;
+    }
+    offset = (uint32_t)allocation;
+    return true;
+}
+
+void SubAllocatedBuffer::free(uint32_t offset) {
+    m_allocator.free(offset);
+}
+
+void SubAllocatedBuffer::write(uint32_t offset, const void* data, uint32_t count, uint32_t stream) {
+    uint64_t elementSize = m_streams[stream].elementSize;
+    m_uploadManager->write(m_streams[stream].buffer->getBuffer(), offset * elementSize, data, count * elementSize);
+}
+
+std::vector<RangeAllocator::Move> SubAllocatedBuffer::defragment(uint32_t maxMoves) {
+    std::vector<RangeAllocator::Move> moves;
+    RangeAllocator::Move move;
+    while (moves.size() < maxMoves && m_allocator.nextDefragMove(move)) {
+        moves.push_back(move);
+    }
+    if (moves.empty()) return moves;
+
+    // staged writes may target the ranges being moved, they have to land first
+    m_uploadManager->flush();
+
+    uint64_t largest = 0;
+    for (auto& stream : m_streams) {
+        for (auto& m : moves) {
+            largest = std::max(largest, m.size * stream.elementSize);
+        }
+    }
+    ensureScratch(largest);
+
+    // a buffer can't be both source and destination of a copy, bounce through the scratch buffer.
+    // copies in one encoder run in order, so the scratch can be reused for every move.
+    wgpu::CommandEncoder encoder = m_device->createCommandEncoder(wgpu::CommandEncoderDescriptor{});
+    for (auto& stream : m_streams) {
+        wgpu::Buffer buffer = stream.buffer->getBuffer();
+        for (auto& m : moves) {
+            uint64_t size = m.size * stream.elementSize;
+            encoder.copyBufferToBuffer(buffer, m.from * stream.elementSize, m_scratchBuffer, 0, size);
+            encoder.copyBufferToBuffer(m_scratchBuffer, 0, buffer, m.to * stream.elementSize, size);
+        }
+    }
+    submitCopies(encoder);
+
+    return moves;
+}
+
+bool SubAllocatedBuffer::grow(uint64_t minCapacity) {
+    uint64_t oldCapacity = m_allocator.getCapacity();
+    uint64_t maxCapacity = UINT64_MAX;
+    for (auto& stream : m_streams) {
+        maxCapacity = std::min(maxCapacity, m_maxSize / stream.elementSize);
+    }
+    uint64_t newCapacity = std::min(std::max(oldCapacity * 2, minCapacity), maxCapacity);
+    if (newCapacity < minCapacity) return false;
+
+    std::cout << m_streams[0].name << ": growing from " << oldCapacity << " to " << newCapacity << " elements" << std::endl;
+
+    // staged writes still point at the old buffers, get them in before copying them over
+    m_uploadManager->flush();
+
+    // the old buffers destroy themselves when released, hold on to them until the copies are submitted
+    std::vector<std::shared_ptr<Buffer>> oldBuffers;
+    uint64_t liveElements = m_allocator.getHighWaterMark();
+    wgpu::CommandEncoder encoder = m_device->createCommandEncoder(wgpu::CommandEncoderDescriptor{});
+    for (auto& stream : m_streams) {
+        std::shared_ptr<Buffer> newBuffer = createStreamBuffer(stream, newCapacity);
+        if (liveElements > 0) {
+            encoder.copyBufferToBuffer(stream.buffer->getBuffer(), 0, newBuffer->getBuffer(), 0, liveElements * stream.elementSize);
+        }
+        oldBuffers.push_back(stream.buffer);
+        stream.buffer = newBuffer;
+    }
+    submitCopies(encoder);
+    oldBuffers.clear();
+
+    m_allocator.grow(newCapacity);
+    m_generation++;
+    return true;
+}
+
+float SubAllocatedBuffer::getFragmentation() {
+    uint64_t extent = m_allocator.getHighWaterMark();
+    if (extent == 0) return 0.0f;
+    return 1.0f - (float)m_allocator.getUsed() / (float)extent;
+}
+
+std::shared_ptr<Buffer> SubAllocatedBuffer::createStreamBuffer(Stream& stream, uint64_t capacity) {
+    wgpu::BufferDescriptor descriptor = stream.descriptor;
+    descriptor.label = stream.name.c_str();
+    descriptor.size = capacity * stream.elementSize;
+    wgpu::BufferBindingLayout bindingLayout = wgpu::Default;
+    bindingLayout.minBindingSize = stream.elementSize;
+    return std::make_shared<Buffer>(m_device, descriptor, bindingLayout, (uint32_t)descriptor.size, stream.name);
+}
+
+void SubAllocatedBuffer::submitCopies(wgpu::CommandEncoder encoder) {
+    wgpu::CommandBuffer commandBuffer = encoder.finish(wgpu::CommandBufferDescriptor{});
+    m_device->getQueue().submit(commandBuffer);
+    commandBuffer.release();
+    encoder.release();
+}
+
+void SubAllocatedBuffer::ensureScratch(uint64_t size) {
+    if (m_scratchSize >= size) return;
+    if (m_scratchBuffer != nullptr) {
+        m_scratchBuffer.destroy();
+        m_scratchBuffer.release();
+    }
+    wgpu::BufferDescriptor descriptor;
+    descriptor.label = "defragment scratch buffer";
+    descriptor.usage = wgpu::BufferUsage::CopySrc | wgpu::BufferUsage::CopyDst;
+    descriptor.size = size;
+    descriptor.mappedAtCreation = false;
+    m_scratchBuffer = m_device->createBuffer(descriptor);
+    m_scratchSize = size;
+}
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <webgpu/webgpu.hpp>
+#include "Buffer.h"
+#include "RangeAllocator.h"
+#include "UploadManager.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace coho {
+// A gpu buffer carved up into ranges of fixed size elements (vertices, indices).
+// Ranges can be freed and reused, the buffer grows on demand by copying into a
+// bigger one, and defragment() compacts live ranges a few at a time.
+// Offsets handed out are in elements, not bytes.
+// Extra streams (addStream) are parallel buffers sharing the same ranges, e.g.
+// positions and the rest of the vertex attributes: element i of every stream
+// belongs to the same vertex, so one base vertex works for all of them.
+class SubAllocatedBuffer {
+public:
+    SubAllocatedBuffer(
+        std::shared_ptr<wgpu::Device> device,
+        std::shared_ptr<UploadManager> uploadManager,
+        wgpu::BufferDescriptor descriptor, // usage needs CopySrc | CopyDst
+        uint32_t elementSize,
+        uint64_t maxSize
+        );
+    ~SubAllocatedBuffer();
+
+    // returns the stream index. only valid before the first allocation
+    uint32_t addStream(wgpu::BufferDescriptor descriptor, uint32_t elementSize);
+
+    bool allocate(uint32_t count, uint32_t& offset);
+    void free(uint32_t offset);
+    void write(uint32_t offset, const void* data, uint32_t count, uint32_t stream = 0);
+
+    // moves up to maxMoves live ranges towards the start of the buffer.
+    // returned moves are in elements, callers must patch anything holding the old offsets.
+    std::vector<RangeAllocator::Move> defragment(uint32_t maxMoves);
+
+    std::shared_ptr<Buffer> getBuffer(uint32_t stream = 0) { return m_streams[stream].buffer; };
+    uint64_t getSizeInBytes(uint32_t stream = 0) { return m_allocator.getCapacity() * m_streams[stream].elementSize; };
+    uint32_t getCapacity() { return (uint32_t)m_allocator.getCapacity(); };
+    uint32_t getUsed() { return (uint32_t)m_allocator.getUsed(); };
+    uint32_t getElementSize(uint32_t stream = 0) { return m_streams[stream].elementSize; };
+    uint32_t getStreamCount() { return (uint32_t)m_streams.size(); };
+    // bumped every time grow() swaps the buffers, anything holding getBuffer() from before is stale
+    uint32_t getGeneration() { return m_generation; };
+    // the share of the live extent (up to the highest allocation) that is free, 0 when compacted
+    float getFragmentation();
+
+private:
+    bool grow(uint64_t minCapacity);
+    void ensureScratch(uint64_t size);
+
+private:
+    struct Stream {
+        wgpu::BufferDescriptor descriptor;
+        std::string name;
+        std::shared_ptr<Buffer> buffer;
+        uint32_t elementSize;
+    };
+
+    std::shared_ptr<Buffer> createStreamBuffer(Stream& stream, uint64_t capacity);
+    void submitCopies(wgpu::CommandEncoder encoder);
+
+private:
+    std::shared_ptr<wgpu::Device> m_device;
+    std::shared_ptr<UploadManager> m_uploadManager;
+
+    std::vector<Stream> m_streams;
+    wgpu::Buffer m_scratchBuffer = nullptr;
+    uint64_t m_scratchSize = 0;
+
+    RangeAllocator m_allocator;
+    uint64_t m_maxSize;
+    uint32_t m_generation = 0;
+};
+}
@@ -0,0 +1,133 @@
+#include "TextureRegistry.h"
+#include "../utilities/ContentHash.h"
+#include "../utilities/texture/MippedTexture.h"
+#include <cstring>
+
+namespace coho {
+bool TextureRegistry::Key::operator==(const Key& other) const {
+    return contentHash == other.contentHash
+        && width == other.width
+        && height == other.height
+        && mipLevelCount == other.mipLevelCount
+        && format == other.format
+        && srgb == other.srgb;
+}
+
+TextureRegistry::Key TextureRegistry::makeKey(const Texture& texture, BlockFormat format, uint32_t mipLevelCount, bool srgb) {
+    Key key;
+    const uint8_t* data;
+    size_t size;
+    contentBytes(texture, data, size);
+    // cooked and raw bytes of the same image differ, the cooked format seeds the hash so they can't mix up
+    uint64_t seed = texture.mipped != nullptr ? 1 + (uint64_t)texture.mipped->format : 0;
+    key.contentHash = ContentHash::hash(data, size, seed);
+    key.width = (uint32_t)texture.width;
+    key.height = (uint32_t)texture.height;
+    key.mipLevelCount = mipLevelCount;
+    key.format = format;
+    // a single level isn't filtered, srgb or not makes no difference
+    key.srgb = srgb && mipLevelCount > 1;
+    return key;
+}
+
+int TextureRegistry::acquire(std::shared_ptr<Texture> texture, const Key& key) {
+    // a view the texture already holds with this key
+    auto entry = m_textures.find(texture.get());
+    if (entry != m_textures.end()) {
+        for (const ViewReference& textureView : entry->second) {
+            auto view = m_views.find(textureView.view);
+            if (view == m_views.end() || !(view->second.key == key)) continue;
+            int viewIndex = textureView.view;
+            view->second.refCount++;
+            reference(texture.get(), viewIndex);
+            m_sharedCount++;
+            return viewIndex;
+        }
+    }
+
+    auto range = m_viewsByHash.equal_range(key.contentHash);
+    for (auto it = range.first; it != range.second; ++it) {
+        auto view = m_views.find(it->second);
+        if (view == m_views.end() || !(view->second.key == key) || !sameContent(*view->second.source, *texture)) continue; // hash collision
+        view->second.refCount++;
+        reference(texture.get(), it->second);
+        m_sharedCount++;
+        return it->second;
+    }
+    return -1;
+}
+
+void TextureRegistry::add(std::shared_ptr<Texture> texture, const Key& key, int viewIndex) {
+    View& view = m_views[viewIndex];
+    view.key = key;
+    view.refCount = 1;
+    view.source = texture;
+    m_viewsByHash.insert({ key.contentHash, viewIndex });
+    reference(texture.get(), viewIndex);
+}
+
+void TextureRegistry::reference(Texture* texture, int viewIndex) {
+    TextureEntry& entry = m_textures[texture];
+    ViewReference textureView = { viewIndex, 0 };
+    for (auto it = entry.begin(); it != entry.end(); ++it) {
+        if (it->view != viewIndex) continue;
+        textureView = *it;
+        entry.erase(it);
+        break;
+    }
+    textureView.refCount++;
+    entry.push_back(textureView);
+}
+
+int TextureRegistry::release(std::shared_ptr<Texture> texture) {
+    auto entry = m_textures.find(texture.get());
+    if (entry == m_textures.end() || entry->second.empty()) return -1;
+    ViewReference& textureView = entry->second.back();
+    int viewIndex = textureView.view;
+    if (--textureView.refCount == 0) {
+        entry->second.pop_back();
+        if (entry->second.empty()) m_textures.erase(entry);
+    }
+
+    auto view = m_views.find(viewIndex);
+    if (view == m_views.end() || --view->second.refCount > 0) return -1;
+
+    auto range = m_viewsByHash.equal_range(view->second.key.contentHash);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == viewIndex) {
+            m_viewsByHash.erase(it);
+            break;
+        }
+    }
+    m_views.erase(view);
+    return viewIndex;
+}
+
+uint32_t TextureRegistry::getRefCount(int viewIndex) {
+    auto view = m_views.find(viewIndex);
+    return view == m_views.end() ? 0 : view->second.refCount;
+}
+
+// the bytes uploaded from: the cooked levels (contiguous, the same layout cooked or loaded), or the rgba8 pixels
+void TextureRegistry::contentBytes(const Texture& texture, const uint8_t*& data, size_t& size) {
+    if (texture.mipped != nullptr && !texture.mipped->levels.empty()) {
+        const MippedTexture::Level& last = texture.mipped->levels.back();
+        data = texture.mipped->levels[0].data;
+        size = (size_t)(last.data + last.size - data);
+    } else {
+        data = texture.pixelData.data();
+        size = texture.pixelData.size();
+    }
+}
+
+bool TextureRegistry::sameContent(const Texture& a, const Texture& b) {
+    if ((a.mipped != nullptr) != (b.mipped != nullptr)) return false;
+    if (a.mipped != nullptr && a.mipped->format != b.mipped->format) return false;
+    const uint8_t* dataA;
+    const uint8_t* dataB;
+    size_t sizeA, sizeB;
+    contentBytes(a, dataA, sizeA);
+    contentBytes(b, dataB, sizeB);
+    return sizeA == sizeB && (sizeA == 0 || std::memcmp(dataA, dataB, sizeA) == 0);
+}
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include "../ecs/components/Texture.h"
+#include "../utilities/texture/BlockCompression.h"
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+
+namespace coho {
+// Tracks which textures have a view in the RenderModule's texture array. Textures
+// with the same content, size, gpu format and mip chain share one view: they're
+// matched by an xxHash64 of their bytes (ContentHash) and confirmed byte by byte.
+// Every registration of a texture takes a reference on the view it got, the view
+// can be freed with the last one. A texture registered again with another key
+// (format or mip count) holds references on both views, counted apart. A view is known by the index the owner gives it, for the
+// RenderModule that's a texture array index or one of its atlas entries.
+class TextureRegistry {
+public:
+    struct Key {
+        uint64_t contentHash = 0;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t mipLevelCount = 0;
+        BlockFormat format = BlockFormat::RGBA8; // on the gpu
+        bool srgb = false;                       // only set when there are mips to filter
+
+        bool operator==(const Key& other) const;
+    };
+
+    static Key makeKey(const Texture& texture, BlockFormat format, uint32_t mipLevelCount, bool srgb);
+
+    // the view of a texture with the same key and content, -1 when there's none.
+    // takes a reference when one is found
+    int acquire(std::shared_ptr<Texture> texture, const Key& key);
+    // takes the first reference on a texture acquire didn't find, uploaded to viewIndex
+    void add(std::shared_ptr<Texture> texture, const Key& key, int viewIndex);
+    // drops a reference of the texture on the view it got last, returns that view when it
+    // was the last reference on it, -1 otherwise
+    int release(std::shared_ptr<Texture> texture);
+
+    uint32_t getRefCount(int viewIndex);
+    uint32_t getViewCount() { return (uint32_t)m_views.size(); };
+    // registrations that were given an existing view
+    uint32_t getSharedCount() { return m_sharedCount; };
+
+private:
+    struct View {
+        Key key;
+        uint32_t refCount = 0;
+        std::shared_ptr<Texture> source; // what hash matches are compared against
+    };
+
+    // the references of a texture per view, the last one it was given at the back
+    struct ViewReference {
+        int view;
+        uint32_t refCount;
+    };
+    typedef std::vector<ViewReference> TextureEntry;
+
+    // a reference of the texture on viewIndex, moved to the back
+    void reference(Texture* texture, int viewIndex);
+
+    static void contentBytes(const Texture& texture, const uint8_t*& data, size_t& size);
+    static bool sameContent(const Texture& a, const Texture& b);
+
+private:
+    std::unordered_map<int, View> m_views;
+    std::unordered_map<Texture*, TextureEntry> m_textures;
+    std::unordered_multimap<uint64_t, int> m_viewsByHash;
+    uint32_t m_sharedCount = 0;
+};
+}
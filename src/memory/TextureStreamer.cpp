@@ -0,0 +1,147 @@
+#include "TextureStreamer.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <iostream>
+
+namespace coho {
+TextureStreamer::TextureStreamer(StreamingSettings settings) : m_settings(settings) {
+}
+
+uint32_t TextureStreamer::add(int viewIndex, std::shared_ptr<MippedTexture> mipped, uint32_t levelCount, BlockFormat format, const std::string& name) {
+    remove(viewIndex);
+    Streamed texture;
+    texture.mipped = mipped;
+    texture.format = format;
+    texture.name = name;
+    texture.levelCount = std::max(std::min(levelCount, (uint32_t)mipped->levels.size()), 1u);
+    texture.startLevel = 0;
+    for (uint32_t level = 0; level < texture.levelCount; level++) {
+        const MippedTexture::Level& l = mipped->levels[level];
+        texture.levelSizes.push_back(BlockCompression::encodedSize(format, l.width, l.height));
+        // a block compressed texture needs a base made of whole blocks
+        bool wholeBlocks = format == BlockFormat::RGBA8 || (l.width % 4 == 0 && l.height % 4 == 0);
+        if (wholeBlocks && (level == 0 || std::max(mipped->levels[level - 1].width, mipped->levels[level - 1].height) > m_settings.startSize)) {
+            texture.startLevel = level;
+        }
+    }
+    texture.baseLevel = texture.levelCount; // nothing resident yet
+    texture.uvPerPixel = FLT_MAX;
+    texture.lastRequested = m_frame;
+    setBaseLevel(texture, texture.startLevel);
+    texture.appliedLevel = texture.baseLevel;
+    m_textures[viewIndex] = texture;
+    return texture.startLevel;
+}
+
+void TextureStreamer::remove(int viewIndex) {
+    auto it = m_textures.find(viewIndex);
+    if (it == m_textures.end()) return;
+    m_residentBytes -= bytesBetween(it->second, it->second.baseLevel, it->second.levelCount);
+    m_textures.erase(it);
+}
+
+void TextureStreamer::request(int viewIndex, float uvPerPixel) {
+    auto it = m_textures.find(viewIndex);
+    if (it == m_textures.end()) return;
+    it->second.uvPerPixel = std::min(it->second.uvPerPixel, uvPerPixel);
+    it->second.lastRequested = m_frame;
+}
+
+uint32_t TextureStreamer::getBaseLevel(int viewIndex) {
+    auto it = m_textures.find(viewIndex);
+    return it == m_textures.end() ? 0 : it->second.baseLevel;
+}
+
+std::vector<TextureStreamer::Change> TextureStreamer::update() {
+    m_uploadedBytes = 0;
+
+    // textures are lowered first, what they free may go to the raised ones
+    std::vector<std::pair<uint32_t, int>> raises; // levels missing and the view
+    for (auto& entry : m_textures) {
+        Streamed& texture = entry.second;
+        if (texture.lastRequested != m_frame) continue;
+        uint32_t wanted = wantedLevel(texture);
+        if (wanted > texture.baseLevel + 1) {
+            setBaseLevel(texture, wanted);
+        } else if (wanted < texture.baseLevel) {
+            raises.push_back({ texture.baseLevel - wanted, entry.first });
+        }
+    }
+
+    // the textures furthest from their level go first, a level at a time within the upload rate
+    std::sort(raises.begin(), raises.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+    for (auto& raise : raises) {
+        Streamed& texture = m_textures[raise.second];
+        uint32_t wanted = texture.baseLevel - raise.first;
+        while (texture.baseLevel > wanted) {
+            size_t bytes = texture.levelSizes[texture.baseLevel - 1];
+            if (m_uploadedBytes > 0 && m_uploadedBytes + bytes > m_settings.uploadBytesPerFrame) break;
+            if (!makeRoom(bytes, raise.second)) break;
+            setBaseLevel(texture, texture.baseLevel - 1);
+            m_uploadedBytes += bytes;
+        }
+        if (m_uploadedBytes >= m_settings.uploadBytesPerFrame) break;
+    }
+
+    std::vector<Change> changes;
+    for (auto& entry : m_textures) {
+        Streamed& texture = entry.second;
+        texture.uvPerPixel = FLT_MAX;
+        if (texture.baseLevel == texture.appliedLevel) continue;
+        changes.push_back({ entry.first, texture.appliedLevel, texture.baseLevel, texture.levelCount, texture.format, texture.mipped, texture.name });
+        texture.appliedLevel = texture.baseLevel;
+    }
+    m_frame++;
+    return changes;
+}
+
+uint32_t TextureStreamer::wantedLevel(const Streamed& texture) {
+    if (texture.uvPerPixel == FLT_MAX) return texture.baseLevel;
+    // texels a pixel covers at the base, every level halves them
+    const MippedTexture::Level& base = texture.mipped->levels[0];
+    float texelsPerPixel = texture.uvPerPixel * (float)std::max(base.width, base.height);
+    if (!(texelsPerPixel > 1.0f)) return 0;
+    return std::min((uint32_t)std::floor(std::log2(texelsPerPixel)), texture.startLevel);
+}
+
+size_t TextureStreamer::bytesBetween(const Streamed& texture, uint32_t fine, uint32_t coarse) {
+    size_t bytes = 0;
+    for (uint32_t level = fine; level < coarse; level++) {
+        bytes += texture.levelSizes[level];
+    }
+    return bytes;
+}
+
+bool TextureStreamer::makeRoom(size_t bytes, int keep) {
+    if (m_residentBytes + bytes <= m_settings.budget) return true;
+
+    // textures requested this frame are on screen, they aren't given up for another one
+    std::vector<std::pair<uint64_t, Streamed*>> candidates;
+    for (auto& entry : m_textures) {
+        Streamed& texture = entry.second;
+        if (entry.first == keep || texture.lastRequested == m_frame || texture.baseLevel >= texture.startLevel) continue;
+        candidates.push_back({ texture.lastRequested, &texture });
+    }
+    std::sort(candidates.begin(), candidates.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    for (auto& candidate : candidates) {
+        Streamed& texture = *candidate.second;
+        while (texture.baseLevel < texture.startLevel && m_residentBytes + bytes > m_settings.budget) {
+            setBaseLevel(texture, texture.baseLevel + 1);
+        }
+        if (m_residentBytes + bytes <= m_settings.budget) return true;
+    }
+    return false;
+}
+
+void TextureStreamer::setBaseLevel(Streamed& texture, uint32_t level) {
+    level = std::min(level, texture.startLevel);
+    if (level < texture.baseLevel) {
+        m_residentBytes += bytesBetween(texture, level, texture.baseLevel);
+    } else {
+        m_residentBytes -= bytesBetween(texture, texture.baseLevel, level);
+    }
+    texture.baseLevel = level;
+}
+}
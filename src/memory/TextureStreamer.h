@@ -0,0 +1,83 @@
+#pragma once
+#include "../utilities/texture/BlockCompression.h"
+#include "../utilities/texture/MippedTexture.h"
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+
+namespace coho {
+struct StreamingSettings {
+    size_t budget = 256 * 1024 * 1024;             // bytes of the streamed textures' resident levels
+    size_t uploadBytesPerFrame = 4 * 1024 * 1024;  // new levels a frame may upload, one level always may
+    uint32_t startSize = 64;                       // textures start with the levels up to this size
+};
+
+// Decides which mips of the cooked textures are resident on the gpu. A streamed
+// texture keeps a contiguous range of levels, its base level down to the 1x1 one,
+// and starts with the levels that fit startSize. Every frame the renderer requests
+// the finest level each visible texture needs on screen (request), update then
+// raises textures to it within the upload rate and the budget. Raising a texture
+// that doesn't fit evicts the finest levels of the least recently requested ones,
+// textures that need a level coarser by more than one are lowered as well.
+// Nothing here touches the gpu, the renderer rebuilds the textures of the changes.
+class TextureStreamer {
+public:
+    struct Change {
+        int viewIndex;
+        uint32_t fromLevel; // base levels, before and after
+        uint32_t toLevel;
+        uint32_t levelCount;
+        BlockFormat format;
+        std::shared_ptr<MippedTexture> mipped;
+        std::string name;
+    };
+
+    TextureStreamer(StreamingSettings settings = StreamingSettings());
+
+    // streams the first levelCount levels of mipped, uploaded in format. returns the base level to start with
+    uint32_t add(int viewIndex, std::shared_ptr<MippedTexture> mipped, uint32_t levelCount, BlockFormat format, const std::string& name);
+    void remove(int viewIndex);
+    bool isStreamed(int viewIndex) { return m_textures.find(viewIndex) != m_textures.end(); };
+
+    // uvPerPixel is the uv distance a screen pixel covers where the texture is used most closely,
+    // the finest request of a frame wins
+    void request(int viewIndex, float uvPerPixel);
+    // moves the textures towards this frame's requests, the changes are to be applied before drawing
+    std::vector<Change> update();
+
+    uint32_t getBaseLevel(int viewIndex);
+    size_t getResidentBytes() { return m_residentBytes; };
+    size_t getUploadedBytes() { return m_uploadedBytes; }; // by the last update
+
+    StreamingSettings m_settings;
+
+private:
+    struct Streamed {
+        std::shared_ptr<MippedTexture> mipped;
+        BlockFormat format;
+        std::string name;
+        std::vector<size_t> levelSizes; // in the upload format
+        uint32_t levelCount;
+        uint32_t startLevel;     // the coarsest base, always resident
+        uint32_t baseLevel;
+        uint32_t appliedLevel;   // the base level the gpu texture has
+        float uvPerPixel;        // this frame's request, FLT_MAX without one
+        uint64_t lastRequested = 0;
+    };
+
+    // the finest level worth having for a request
+    static uint32_t wantedLevel(const Streamed& texture);
+    size_t bytesBetween(const Streamed& texture, uint32_t fine, uint32_t coarse);
+    // drops the finest levels of the least recently requested textures until bytes fit the budget
+    bool makeRoom(size_t bytes, int keep);
+    void setBaseLevel(Streamed& texture, uint32_t level);
+
+private:
+    std::unordered_map<int, Streamed> m_textures;
+    size_t m_residentBytes = 0;
+    size_t m_uploadedBytes = 0;
+    uint64_t m_frame = 0;
+};
+}
@@ -0,0 +1,222 @@
+#include "UploadManager.h"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <iostream>
+
+namespace coho {
+UploadManager::UploadManager(std::shared_ptr<wgpu::Device> device, uint64_t stagingBufferSize, uint32_t ringSize) {
+    m_device = device;
+    m_stagingBufferSize = (stagingBufferSize + 3) & ~(uint64_t)3;
+
+    wgpu::BufferDescriptor bufferDesc;
+    bufferDesc.label = "upload staging buffer";
+    bufferDesc.usage = wgpu::BufferUsage::MapWrite | wgpu::BufferUsage::CopySrc;
+    bufferDesc.size = m_stagingBufferSize;
+    bufferDesc.mappedAtCreation = true;
+
+    for (uint32_t i = 0; i < ringSize; ++i) {
+        std::unique_ptr<StagingBuffer> staging = std::make_unique<StagingBuffer>();
+        staging->buffer = m_device->createBuffer(bufferDesc);
+        staging->mappedData = (uint8_t*)staging->buffer.getMappedRange(0, m_stagingBufferSize);
+        staging->mapped = true;
+        m_ring.push_back(std::move(staging));
+    }
+}
+
+UploadManager::~UploadManager() {
+    if (m_encoder != nullptr) {
+        m_encoder.release();
+    }
+    for (auto& staging : m_ring) {
+        staging->mapCallback.reset();
+        staging->buffer.destroy();
+        staging->buffer.release();
+    }
+    m_ring.clear();
+    m_device.reset();
+}
+
+bool UploadManager::write(wgpu::Buffer destination, uint64_t offset, const void* data, uint64_t size) {
+    // rounding the offset down would clobber the bytes before it, nothing can be copied from there
+    assert((offset & 3) == 0 && "UploadManager: write offsets have to be multiples of 4");
+    if ((offset & 3) != 0) return false;
+    if (size == 0) return true;
+    m_frameStats.writeCalls += 1;
+    m_frameStats.bytesWritten += size;
+
+    PendingWrite pending;
+    pending.destination = destination;
+    pending.offset = offset;
+    pending.size = size;
+    pending.dataOffset = m_pendingData.size();
+    m_pendingData.insert(m_pendingData.end(), (const uint8_t*)data, (const uint8_t*)data + size);
+    m_pendingWrites.push_back(pending);
+    return true;
+}
+
+void UploadManager::flush() {
+    if (m_pendingWrites.empty()) return;
+
+    // sort by destination then offset. the original index is kept so
+    // overlapping writes can still be applied in submission order.
+    std::vector<uint32_t> order(m_pendingWrites.size());
+    for (uint32_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        WGPUBuffer bufferA = m_pendingWrites[a].destination;
+        WGPUBuffer bufferB = m_pendingWrites[b].destination;
+        if (bufferA != bufferB) return std::less<WGPUBuffer>()(bufferA, bufferB);
+        return m_pendingWrites[a].offset < m_pendingWrites[b].offset;
+    });
+
+    acquireStaging();
+
+    // sweep the sorted writes, merging everything that touches or overlaps into one span
+    std::vector<uint32_t> spanWrites;
+    size_t i = 0;
+    while (i < order.size()) {
+        const PendingWrite& first = m_pendingWrites[order[i]];
+        uint64_t begin = first.offset;
+        uint64_t end = first.offset + first.size;
+        spanWrites.clear();
+        spanWrites.push_back(order[i]);
+
+        size_t j = i + 1;
+        while (j < order.size()) {
+            const PendingWrite& next = m_pendingWrites[order[j]];
+            if ((WGPUBuffer)next.destination != (WGPUBuffer)first.destination || next.offset > end) break;
+            end = std::max(end, next.offset + next.size);
+            spanWrites.push_back(order[j]);
+            ++j;
+        }
+
+        std::sort(spanWrites.begin(), spanWrites.end());
+        stageSpan(first.destination, begin, end, spanWrites);
+        i = j;
+    }
+
+    submitStaging();
+
+    m_pendingWrites.clear();
+    m_pendingData.clear();
+}
+
+void UploadManager::endFrame() {
+    m_lastFrameStats = m_frameStats;
+    m_frameStats = FrameStats();
+}
+
+void UploadManager::stageSpan(wgpu::Buffer destination, uint64_t begin, uint64_t end, const std::vector<uint32_t>& writes) {
+    // copies are whole words, a span ending off a word is padded with zeros. spans start on a
+    // word, so the padding never reaches into the next one
+    uint64_t size = ((end + 3) & ~(uint64_t)3) - begin;
+    uint64_t padding = size - (end - begin);
+    if (size <= m_stagingBufferSize) {
+        // assemble the span straight into mapped memory
+        uint8_t* target = reserve(size);
+        memset(target + size - padding, 0, padding);
+        for (uint32_t index : writes) {
+            const PendingWrite& w = m_pendingWrites[index];
+            memcpy(target + (w.offset - begin), m_pendingData.data() + w.dataOffset, w.size);
+        }
+        m_encoder.copyBufferToBuffer(m_ring[m_currentStaging]->buffer, m_stagingUsed - size, destination, begin, size);
+        m_frameStats.copyCommands += 1;
+        m_frameStats.bytesUploaded += size;
+        return;
+    }
+
+    // too big for a single staging buffer, resolve it on the CPU and split it up
+    m_spanScratch.resize(size);
+    memset(m_spanScratch.data() + size - padding, 0, padding);
+    for (uint32_t index : writes) {
+        const PendingWrite& w = m_pendingWrites[index];
+        memcpy(m_spanScratch.data() + (w.offset - begin), m_pendingData.data() + w.dataOffset, w.size);
+    }
+    copyToStaging(destination, begin, m_spanScratch.data(), size);
+}
+
+void UploadManager::copyToStaging(wgpu::Buffer destination, uint64_t offset, const uint8_t* data, uint64_t size) {
+    uint64_t copied = 0;
+    while (copied < size) {
+        uint64_t chunk = std::min(size - copied, m_stagingBufferSize);
+        uint8_t* target = reserve(chunk);
+        memcpy(target, data + copied, chunk);
+        m_encoder.copyBufferToBuffer(m_ring[m_currentStaging]->buffer, m_stagingUsed - chunk, destination, offset + copied, chunk);
+        m_frameStats.copyCommands += 1;
+        m_frameStats.bytesUploaded += chunk;
+        copied += chunk;
+    }
+}
+
+// returns a pointer to size bytes of mapped staging memory, moving to the next
+// buffer in the ring when the current one is full
+uint8_t* UploadManager::reserve(uint64_t size) {
+    if (m_stagingUsed + size > m_stagingBufferSize) {
+        submitStaging();
+        acquireStaging();
+    }
+    uint8_t* target = m_ring[m_currentStaging]->mappedData + m_stagingUsed;
+    m_stagingUsed += size;
+    return target;
+}
+
+void UploadManager::submitStaging() {
+    if (m_stagingUsed == 0) return;
+
+    StagingBuffer* staging = m_ring[m_currentStaging].get();
+    staging->buffer.unmap();
+    staging->mappedData = nullptr;
+    staging->mapped = false;
+
+    wgpu::CommandBuffer commandBuffer = m_encoder.finish(wgpu::CommandBufferDescriptor{});
+    m_device->getQueue().submit(commandBuffer);
+    commandBuffer.release();
+    m_encoder.release();
+    m_encoder = nullptr;
+    m_frameStats.submits += 1;
+
+    // map it again in the background, it won't be needed until the ring wraps around
+    staging->mapPending = true;
+    staging->mapCallback = staging->buffer.mapAsync(wgpu::MapMode::Write, 0, m_stagingBufferSize, [staging](wgpu::BufferMapAsyncStatus status) {
+        staging->mapPending = false;
+        staging->mapped = status == wgpu::BufferMapAsyncStatus::Success;
+        if (!staging->mapped) {
+            std::cout << "UploadManager: failed to map staging buffer" << std::endl;
+        }
+    });
+
+    m_currentStaging = (m_currentStaging + 1) % (uint32_t)m_ring.size();
+    m_stagingUsed = 0;
+}
+
+void UploadManager::acquireStaging() {
+    StagingBuffer* staging = m_ring[m_currentStaging].get();
+    wgpu::Queue queue = m_device->getQueue();
+    while (staging->mapPending) {
+        queue.submit(0, nullptr);
+    }
+    if (!staging->mapped) {
+        // mapping failed, replace the buffer with a freshly mapped one
+        staging->buffer.destroy();
+        staging->buffer.release();
+        wgpu::BufferDescriptor bufferDesc;
+        bufferDesc.label = "upload staging buffer";
+        bufferDesc.usage = wgpu::BufferUsage::MapWrite | wgpu::BufferUsage::CopySrc;
+        bufferDesc.size = m_stagingBufferSize;
+        bufferDesc.mappedAtCreation = true;
+        staging->buffer = m_device->createBuffer(bufferDesc);
+        staging->mapped = true;
+        staging->mappedData = nullptr;
+    }
+    if (staging->mappedData == nullptr) {
+        staging->mappedData = (uint8_t*)staging->buffer.getMappedRange(0, m_stagingBufferSize);
+    }
+    staging->mapCallback.reset();
+
+    if (m_encoder == nullptr) {
+        m_encoder = m_device->createCommandEncoder(wgpu::CommandEncoderDescriptor{});
+    }
+}
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <webgpu/webgpu.hpp>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+namespace coho {
+// Collects every buffer write made during a frame and uploads them in one go.
+// Writes are copied into a CPU side arena, merged into contiguous spans per
+// destination buffer, packed into a ring of mapped staging buffers and then
+// applied with copyBufferToBuffer. Later writes to the same bytes win.
+class UploadManager {
+public:
+    struct FrameStats {
+        uint32_t writeCalls = 0;    // number of write() calls
+        uint32_t copyCommands = 0;  // number of copyBufferToBuffer commands recorded
+        uint32_t submits = 0;       // number of command buffers submitted
+        uint64_t bytesWritten = 0;  // bytes handed to write()
+        uint64_t bytesUploaded = 0; // bytes actually copied after merging
+    };
+
+    UploadManager(std::shared_ptr<wgpu::Device> device, uint64_t stagingBufferSize = 4 * 1024 * 1024, uint32_t ringSize = 3);
+    ~UploadManager();
+
+    // copyBufferToBuffer moves whole words. the offset has to be a multiple of 4, false
+    // otherwise. a size that isn't is padded with zeros up to the next word, the
+    // destination has to leave those bytes free and the buffer has to extend over them
+    bool write(wgpu::Buffer destination, uint64_t offset, const void* data, uint64_t size);
+
+    // records and submits the copies for everything written since the last flush
+    void flush();
+
+    // rolls the stats of the current frame over, call once per frame
+    void endFrame();
+
+    FrameStats getFrameStats() { return m_lastFrameStats; };
+    uint64_t getPendingBytes() { return m_pendingData.size(); };
+
+private:
+    struct PendingWrite {
+        wgpu::Buffer destination;
+        uint64_t offset;
+        uint64_t size;
+        uint64_t dataOffset; // offset into m_pendingData
+    };
+
+    struct StagingBuffer {
+        wgpu::Buffer buffer = nullptr;
+        uint8_t* mappedData = nullptr;
+        bool mapped = false;
+        bool mapPending = false;
+        std::unique_ptr<wgpu::BufferMapCallback> mapCallback;
+    };
+
+    void stageSpan(wgpu::Buffer destination, uint64_t begin, uint64_t end, const std::vector<uint32_t>& writes);
+    void copyToStaging(wgpu::Buffer destination, uint64_t offset, const uint8_t* data, uint64_t size);
+    uint8_t* reserve(uint64_t size);
+    void submitStaging();
+    void acquireStaging();
+
+private:
+    std::shared_ptr<wgpu::Device> m_device;
+
+    std::vector<uint8_t> m_pendingData;
+    std::vector<PendingWrite> m_pendingWrites;
+    std::vector<uint8_t> m_spanScratch;
+
+    std::vector<std::unique_ptr<StagingBuffer>> m_ring;
+    uint64_t m_stagingBufferSize;
+    uint32_t m_currentStaging = 0;
+    uint64_t m_stagingUsed = 0;
+    wgpu::CommandEncoder m_encoder = nullptr;
+
+    FrameStats m_frameStats;
+    FrameStats m_lastFrameStats;
+};
+}
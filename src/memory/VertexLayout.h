@@ -0,0 +1,141 @@
+#pragma once
+#include <webgpu/webgpu.hpp>
+#include <glm/glm.hpp>
+#include "../ecs/components/Mesh.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+namespace coho {
+// Compile time vertex layouts. A layout is a list of attribute tags, e.g.
+//   using DepthLayout = VertexLayout<vertex::Position>;
+// which gives a tightly packed Vertex struct, the offsets and stride, and the
+// VertexAttribute array for the pipeline, all in the order the tags are listed.
+namespace vertex {
+template<typename T, WGPUVertexFormat Format, uint32_t Location>
+struct Attribute {
+    using Type = T;
+    static constexpr WGPUVertexFormat format = Format;
+    static constexpr uint32_t location = Location;
+    static constexpr uint64_t size = sizeof(T);
+};
+
+// attributes that can be pulled straight out of Mesh::VertexData
+struct Position : Attribute<glm::vec3, wgpu::VertexFormat::Float32x3, 0> {
+    static Type from(const Mesh::VertexData& v) { return v.position; }
+};
+struct Normal : Attribute<glm::vec3, wgpu::VertexFormat::Float32x3, 1> {
+    static Type from(const Mesh::VertexData& v) { return v.normal; }
+};
+struct Color : Attribute<glm::vec3, wgpu::VertexFormat::Float32x3, 2> {
+    static Type from(const Mesh::VertexData& v) { return v.color; }
+};
+struct Tangent : Attribute<glm::vec3, wgpu::VertexFormat::Float32x3, 3> {
+    static Type from(const Mesh::VertexData& v) { return v.tangent; }
+};
+struct Bitangent : Attribute<glm::vec3, wgpu::VertexFormat::Float32x3, 4> {
+    static Type from(const Mesh::VertexData& v) { return v.bitangent; }
+};
+struct UV : Attribute<glm::vec2, wgpu::VertexFormat::Float32x2, 5> {
+    static Type from(const Mesh::VertexData& v) { return v.uv; }
+};
+
+// compressed attributes, filled in by VertexCompression
+struct QuantizedPosition : Attribute<std::array<uint16_t, 4>, wgpu::VertexFormat::Unorm16x4, 0> {};
+struct OctahedralNormal : Attribute<std::array<int16_t, 2>, wgpu::VertexFormat::Snorm16x2, 1> {};
+struct HalfUV : Attribute<std::array<uint16_t, 2>, wgpu::VertexFormat::Float16x2, 5> {};
+struct ColorUnorm8 : Attribute<std::array<uint8_t, 4>, wgpu::VertexFormat::Unorm8x4, 2> {};
+
+namespace detail {
+template<typename A, typename... Attrs>
+constexpr bool contains() {
+    return (std::is_same<A, Attrs>::value || ...);
+}
+
+template<typename A, typename... Attrs>
+constexpr uint64_t offsetOf() {
+    constexpr bool matches[] = { std::is_same<A, Attrs>::value... };
+    constexpr uint64_t sizes[] = { Attrs::size... };
+    uint64_t offset = 0;
+    for (size_t i = 0; i < sizeof...(Attrs); i++) {
+        if (matches[i]) return offset;
+        offset += sizes[i];
+    }
+    return offset;
+}
+}
+}
+
+template<typename... Attrs>
+struct VertexLayout {
+    static_assert(sizeof...(Attrs) > 0, "a vertex layout needs at least one attribute");
+
+    static constexpr uint32_t attributeCount = (uint32_t)sizeof...(Attrs);
+    static constexpr uint64_t stride = (Attrs::size + ...);
+
+    template<typename A>
+    static constexpr uint64_t offsetOf() {
+        static_assert(vertex::detail::contains<A, Attrs...>(), "attribute isn't part of this layout");
+        return vertex::detail::offsetOf<A, Attrs...>();
+    }
+
+    static constexpr std::array<WGPUVertexAttribute, sizeof...(Attrs)> attributes = {{
+        { Attrs::format, vertex::detail::offsetOf<Attrs, Attrs...>(), Attrs::location }...
+    }};
+
+    // tightly packed, attributes are read and written through memcpy so there are no alignment requirements
+    struct Vertex {
+        uint8_t data[stride];
+
+        template<typename A>
+        typename A::Type get() const {
+            typename A::Type value;
+            std::memcpy(&value, data + offsetOf<A>(), sizeof(value));
+            return value;
+        }
+
+        template<typename A>
+        void set(const typename A::Type& value) {
+            std::memcpy(data + offsetOf<A>(), &value, sizeof(value));
+        }
+    };
+
+    // attributes point at static storage, the layout can be handed straight to a pipeline descriptor
+    static wgpu::VertexBufferLayout bufferLayout(wgpu::VertexStepMode stepMode = wgpu::VertexStepMode::Vertex) {
+        wgpu::VertexBufferLayout layout;
+        layout.arrayStride = stride;
+        layout.attributeCount = attributeCount;
+        layout.attributes = attributes.data();
+        layout.stepMode = stepMode;
+        return layout;
+    }
+
+    // only for layouts made of attributes that can be read from Mesh::VertexData
+    static std::vector<Vertex> fromVertexData(const std::vector<Mesh::VertexData>& vertexData) {
+        std::vector<Vertex> vertices(vertexData.size());
+        for (size_t i = 0; i < vertexData.size(); i++) {
+            (vertices[i].template set<Attrs>(Attrs::from(vertexData[i])), ...);
+        }
+        return vertices;
+    }
+};
+
+// the layouts the pipelines use
+using FullVertexLayout = VertexLayout<vertex::Position, vertex::Normal, vertex::Color, vertex::Tangent, vertex::Bitangent, vertex::UV>;
+using PackedVertexLayout = VertexLayout<vertex::QuantizedPosition, vertex::OctahedralNormal, vertex::HalfUV, vertex::ColorUnorm8>;
+using PositionVertexLayout = VertexLayout<vertex::Position>;
+// everything but the position, the second stream of split meshes
+using AttributeVertexLayout = VertexLayout<vertex::Normal, vertex::Color, vertex::Tangent, vertex::Bitangent, vertex::UV>;
+
+// the mesh structs and their layouts have to agree byte for byte
+static_assert(FullVertexLayout::stride == sizeof(Mesh::VertexData), "FullVertexLayout doesn't match Mesh::VertexData");
+static_assert(FullVertexLayout::offsetOf<vertex::Normal>() == offsetof(Mesh::VertexData, normal), "FullVertexLayout doesn't match Mesh::VertexData");
+static_assert(FullVertexLayout::offsetOf<vertex::UV>() == offsetof(Mesh::VertexData, uv), "FullVertexLayout doesn't match Mesh::VertexData");
+static_assert(PackedVertexLayout::stride == sizeof(Mesh::PackedVertexData), "PackedVertexLayout doesn't match Mesh::PackedVertexData");
+static_assert(PackedVertexLayout::offsetOf<vertex::OctahedralNormal>() == offsetof(Mesh::PackedVertexData, normal), "PackedVertexLayout doesn't match Mesh::PackedVertexData");
+static_assert(PackedVertexLayout::offsetOf<vertex::HalfUV>() == offsetof(Mesh::PackedVertexData, uv), "PackedVertexLayout doesn't match Mesh::PackedVertexData");
+static_assert(PackedVertexLayout::offsetOf<vertex::ColorUnorm8>() == offsetof(Mesh::PackedVertexData, color), "PackedVertexLayout doesn't match Mesh::PackedVertexData");
+}
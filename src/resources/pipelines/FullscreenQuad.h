@@ -2,7 +2,9 @@
 #include "../../memory/Pipeline.h"
 #include "../../memory/Buffer.h"
 #include "../../memory/Shader.h"
+#include "../../memory/VertexLayout.h"
 #include "../../ecs/components/Mesh.h"
+#include "../../utilities/InstanceCompression.h"
 
 namespace coho {
 class FullscreenQuadPipeline: Pipeline {
@@ -51,40 +53,14 @@ bool FullscreenQuadPipeline::init(
 
     wgpu::RenderPipelineDescriptor renderPipelineDesc;
 
-    std::vector<wgpu::VertexAttribute> vertexAttributes(6);
-    // position
-    vertexAttributes[0].format = wgpu::VertexFormat::Float32x3;
-    vertexAttributes[0].offset = offsetof(Mesh::VertexData, position);
-    vertexAttributes[0].shaderLocation = 0;
-    // normal
-    vertexAttributes[1].format = wgpu::VertexFormat::Float32x3;
-    vertexAttributes[1].offset = offsetof(Mesh::VertexData, normal);
-    vertexAttributes[1].shaderLocation = 1;
-    // color
-    vertexAttributes[2].format = wgpu::VertexFormat::Float32x3;
-    vertexAttributes[2].offset = offsetof(Mesh::VertexData, color);
-    vertexAttributes[2].shaderLocation = 2;
-    // tangent
-    vertexAttributes[3].format = wgpu::VertexFormat::Float32x3;
-    vertexAttributes[3].offset = offsetof(Mesh::VertexData, tangent);
-    vertexAttributes[3].shaderLocation = 3;
-    // bitangent 
-    vertexAttributes[4].format = wgpu::VertexFormat::Float32x3;
-    vertexAttributes[4].offset = offsetof(Mesh::VertexData, bitangent);
-    vertexAttributes[4].shaderLocation = 4;
-    // uv
-    vertexAttributes[5].format = wgpu::VertexFormat::Float32x2;
-    vertexAttributes[5].offset = offsetof(Mesh::VertexData, uv);
-    vertexAttributes[5].shaderLocation = 5;
-
-    wgpu::VertexBufferLayout vertexBufferLayout;
-    vertexBufferLayout.arrayStride = sizeof(Mesh::VertexData);
-    vertexBufferLayout.attributes = vertexAttributes.data();
-    vertexBufferLayout.attributeCount = (uint32_t)vertexAttributes.size();
-    vertexBufferLayout.stepMode = wgpu::VertexStepMode::Vertex;
-
-    renderPipelineDesc.vertex.bufferCount = 1;
-    renderPipelineDesc.vertex.buffers = &vertexBufferLayout;
+    // position stream + attribute stream
+    std::vector<wgpu::VertexBufferLayout> vertexBufferLayouts = {
+        PositionVertexLayout::bufferLayout(),
+        AttributeVertexLayout::bufferLayout()
+    };
+
+    renderPipelineDesc.vertex.bufferCount = (uint32_t)vertexBufferLayouts.size();
+    renderPipelineDesc.vertex.buffers = vertexBufferLayouts.data();
     renderPipelineDesc.vertex.constantCount = 0;
     renderPipelineDesc.vertex.constants = 0;
     renderPipelineDesc.vertex.entryPoint = "vs_main";
@@ -148,6 +124,14 @@ wgpu::RenderPipeline FullscreenQuadPipeline::getRenderPipeline() {
     return m_renderPipeline;
 }
 
+// a new bind group over the same layout, for texture views replaced in place. false when
+// the array changed size, the layout and with it the pipeline have to be made again
+bool FullscreenQuadPipeline::rebind(wgpu::Device device, std::vector<wgpu::TextureView> textureViewArray) {
+    if (textureViewArray.size() != m_textureCount) return false;
+    m_bindGroup.release();
+    return initBindGroup(device, textureViewArray);
+}
+
 private:
 
 bool FullscreenQuadPipeline::initBindings(wgpu::Device device, std::vector<wgpu::TextureView> textureViewArray) {
@@ -187,7 +171,12 @@ bool FullscreenQuadPipeline::initBindings(wgpu::Device device, std::vector<wgpu:
     bindGroupLayoutDesc.entryCount = (uint32_t)bindGroupLayoutEntries.size();
 
     m_bindGroupLayout = device.createBindGroupLayout(bindGroupLayoutDesc);
+    m_textureCount = textureViewArray.size();
 
+    return initBindGroup(device, textureViewArray);
+}
+
+bool FullscreenQuadPipeline::initBindGroup(wgpu::Device device, std::vector<wgpu::TextureView> textureViewArray) {
     std::vector<wgpu::BindGroupEntry> bindGroupEntries(4, wgpu::Default);
     bindGroupEntries[0].binding = 0;
     bindGroupEntries[0].offset = 0;
@@ -248,12 +237,8 @@ struct UniformData {
     float padding[3]; // need to chunk into 4x4x4 sections (4x4 floats)
 };
 
-struct ModelData {
-    glm::mat4x4 transform;
-    uint32_t materialIndex;
-    uint32_t isSkybox;
-    float padding[2]; // need to chunk into 4x4x4 sections (4x4 floats)
-};
+// 32 bytes per instance, the shaders rebuild the transform (see InstanceCompression)
+using ModelData = InstanceCompression::PackedInstance;
 
 // todo: make bind group it's own thing
 wgpu::BindGroup m_bindGroup = nullptr;
@@ -267,6 +252,7 @@ private:
     wgpu::Sampler m_textureSampler = nullptr;
 
     wgpu::BindGroupLayout m_bindGroupLayout = nullptr;
+    size_t m_textureCount = 0; // the texture array size the layout was made for
 
 };
 }
\ No newline at end of file
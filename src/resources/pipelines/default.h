@@ -2,25 +2,40 @@
 #include "../../memory/Pipeline.h"
 #include "../../memory/Buffer.h"
 #include "../../memory/Shader.h"
+#include "../../memory/VertexLayout.h"
 #include "../../ecs/components/Mesh.h"
+#include "../../utilities/InstanceCompression.h"
 
 namespace coho {
 class DefaultPipeline: Pipeline {
 public:
+// the split sum image based light, see SpecularEnvironment
+struct Environment {
+    wgpu::TextureView specular = nullptr; // cube, a roughness per level
+    wgpu::TextureView brdfLut = nullptr;
+    wgpu::Sampler sampler = nullptr;
+};
+
 DefaultPipeline(
         std::shared_ptr<Buffer> vertexBuffer,
         std::shared_ptr<Buffer> indexBuffer,
         std::shared_ptr<Buffer> uniformBuffer,
         std::shared_ptr<Buffer> modelBuffer,
         std::shared_ptr<Buffer> materialBuffer,
+        std::shared_ptr<Buffer> visibleBuffer,
         std::shared_ptr<Shader> vertexShader,
-        std::shared_ptr<Shader> fragmentShader
+        std::shared_ptr<Shader> fragmentShader,
+        bool packedVertices = false,
+        bool afterDepthPrepass = false
         ) {
+    m_packedVertices = packedVertices;
+    m_afterDepthPrepass = afterDepthPrepass;
     m_vertexBuffer = vertexBuffer;
     m_indexBuffer = indexBuffer;
     m_uniformBuffer = uniformBuffer;
     m_modelBuffer = modelBuffer;
     m_materialBuffer = materialBuffer;
+    m_visibleBuffer = visibleBuffer;
 
     m_vertexShader = vertexShader;
     m_fragmentShader = fragmentShader;
@@ -32,6 +47,7 @@ DefaultPipeline(
     m_uniformBuffer.reset();
     m_modelBuffer.reset();
     m_materialBuffer.reset();
+    m_visibleBuffer.reset();
 
     m_textureSampler.release();
     m_bindGroupLayout.release();
@@ -41,8 +57,10 @@ DefaultPipeline(
 bool DefaultPipeline::init(
         wgpu::Device device,
         wgpu::TextureFormat preferredFormat,
-        std::vector<wgpu::TextureView> textureViewArray
+        std::vector<wgpu::TextureView> textureViewArray,
+        Environment environment
     ) {
+    m_environment = environment;
 
     if (!initSampler(device)) {
         std::cout << "failed to init sampler" << std::endl;
@@ -56,43 +74,21 @@ bool DefaultPipeline::init(
 
     wgpu::RenderPipelineDescriptor renderPipelineDesc;
 
-    std::vector<wgpu::VertexAttribute> vertexAttributes(6);
-    // position
-    vertexAttributes[0].format = wgpu::VertexFormat::Float32x3;
-    vertexAttributes[0].offset = offsetof(Mesh::VertexData, position);
-    vertexAttributes[0].shaderLocation = 0;
-    // normal
-    vertexAttributes[1].format = wgpu::VertexFormat::Float32x3;
-    vertexAttributes[1].offset = offsetof(Mesh::VertexData, normal);
-    vertexAttributes[1].shaderLocation = 1;
-    // color
-    vertexAttributes[2].format = wgpu::VertexFormat::Float32x3;
-    vertexAttributes[2].offset = offsetof(Mesh::VertexData, color);
-    vertexAttributes[2].shaderLocation = 2;
-    // tangent
-    vertexAttributes[3].format = wgpu::VertexFormat::Float32x3;
-    vertexAttributes[3].offset = offsetof(Mesh::VertexData, tangent);
-    vertexAttributes[3].shaderLocation = 3;
-    // bitangent 
-    vertexAttributes[4].format = wgpu::VertexFormat::Float32x3;
-    vertexAttributes[4].offset = offsetof(Mesh::VertexData, bitangent);
-    vertexAttributes[4].shaderLocation = 4;
-    // uv
-    vertexAttributes[5].format = wgpu::VertexFormat::Float32x2;
-    vertexAttributes[5].offset = offsetof(Mesh::VertexData, uv);
-    vertexAttributes[5].shaderLocation = 5;
-
-    wgpu::VertexBufferLayout vertexBufferLayout;
-    vertexBufferLayout.arrayStride = sizeof(Mesh::VertexData);
-    vertexBufferLayout.attributes = vertexAttributes.data();
-    vertexBufferLayout.attributeCount = (uint32_t)vertexAttributes.size();
-    vertexBufferLayout.stepMode = wgpu::VertexStepMode::Vertex;
-
-    renderPipelineDesc.vertex.bufferCount = 1;
-    renderPipelineDesc.vertex.buffers = &vertexBufferLayout;
+    // Mesh::PackedVertexData is decoded in vs_main_packed, everything else is
+    // split into a position stream and an attribute stream
+    std::vector<wgpu::VertexBufferLayout> vertexBufferLayouts;
+    if (m_packedVertices) {
+        vertexBufferLayouts.push_back(PackedVertexLayout::bufferLayout());
+    } else {
+        vertexBufferLayouts.push_back(PositionVertexLayout::bufferLayout());
+        vertexBufferLayouts.push_back(AttributeVertexLayout::bufferLayout());
+    }
+
+    renderPipelineDesc.vertex.bufferCount = (uint32_t)vertexBufferLayouts.size();
+    renderPipelineDesc.vertex.buffers = vertexBufferLayouts.data();
     renderPipelineDesc.vertex.constantCount = 0;
     renderPipelineDesc.vertex.constants = 0;
-    renderPipelineDesc.vertex.entryPoint = "vs_main";
+    renderPipelineDesc.vertex.entryPoint = m_packedVertices ? "vs_main_packed" : "vs_main";
     
     renderPipelineDesc.vertex.module = m_vertexShader->getShaderModule();
 
@@ -125,7 +121,8 @@ bool DefaultPipeline::init(
     renderPipelineDesc.primitive.stripIndexFormat = wgpu::IndexFormat::Undefined;
 
     wgpu::DepthStencilState depthStencilState = wgpu::Default;
-    depthStencilState.depthCompare = wgpu::CompareFunction::Less;
+    // LessEqual so fragments pass against the depth the prepass already wrote for them
+    depthStencilState.depthCompare = m_afterDepthPrepass ? wgpu::CompareFunction::LessEqual : wgpu::CompareFunction::Less;
 	depthStencilState.depthWriteEnabled = true;
 	depthStencilState.format = m_depthTextureFormat;
 	depthStencilState.stencilReadMask = 0;
@@ -154,10 +151,19 @@ wgpu::RenderPipeline DefaultPipeline::getRenderPipeline() {
     return m_renderPipeline;
 }
 
+// a new bind group over the same layout, for texture views replaced in place. false when
+// the array changed size, the layout and with it the pipeline have to be made again
+bool DefaultPipeline::rebind(wgpu::Device device, std::vector<wgpu::TextureView> textureViewArray, Environment environment) {
+    if (textureViewArray.size() != m_textureCount) return false;
+    m_environment = environment;
+    m_bindGroup.release();
+    return initBindGroup(device, textureViewArray);
+}
+
 private:
 
 bool DefaultPipeline::initBindings(wgpu::Device device, std::vector<wgpu::TextureView> textureViewArray) {
-    std::vector<wgpu::BindGroupLayoutEntry> bindGroupLayoutEntries(5, wgpu::Default);
+    std::vector<wgpu::BindGroupLayoutEntry> bindGroupLayoutEntries(9, wgpu::Default);
     // uniform layout
     bindGroupLayoutEntries[0].binding = 0;
     bindGroupLayoutEntries[0].visibility = wgpu::ShaderStage::Vertex | wgpu::ShaderStage::Fragment;
@@ -193,13 +199,43 @@ bool DefaultPipeline::initBindings(wgpu::Device device, std::vector<wgpu::Textur
     bindGroupLayoutEntries[4].buffer.type = wgpu::BufferBindingType::ReadOnlyStorage;
     bindGroupLayoutEntries[4].buffer.minBindingSize = sizeof(MaterialData);
 
+    // visible index layout, instance_index -> model buffer index
+    bindGroupLayoutEntries[5].binding = 5;
+    bindGroupLayoutEntries[5].visibility = wgpu::ShaderStage::Vertex | wgpu::ShaderStage::Fragment;
+    bindGroupLayoutEntries[5].buffer.type = wgpu::BufferBindingType::ReadOnlyStorage;
+    bindGroupLayoutEntries[5].buffer.minBindingSize = sizeof(uint32_t);
+
+    // prefiltered specular environment layout
+    bindGroupLayoutEntries[6].binding = 6;
+    bindGroupLayoutEntries[6].visibility = wgpu::ShaderStage::Fragment;
+    bindGroupLayoutEntries[6].texture.multisampled = false;
+    bindGroupLayoutEntries[6].texture.viewDimension = wgpu::TextureViewDimension::Cube;
+    bindGroupLayoutEntries[6].texture.sampleType = wgpu::TextureSampleType::Float;
+
+    // brdf lut layout
+    bindGroupLayoutEntries[7].binding = 7;
+    bindGroupLayoutEntries[7].visibility = wgpu::ShaderStage::Fragment;
+    bindGroupLayoutEntries[7].texture.multisampled = false;
+    bindGroupLayoutEntries[7].texture.viewDimension = wgpu::TextureViewDimension::_2D;
+    bindGroupLayoutEntries[7].texture.sampleType = wgpu::TextureSampleType::Float;
+
+    // environment sampler layout
+    bindGroupLayoutEntries[8].binding = 8;
+    bindGroupLayoutEntries[8].visibility = wgpu::ShaderStage::Fragment;
+    bindGroupLayoutEntries[8].sampler.type = wgpu::SamplerBindingType::Filtering;
+
     wgpu::BindGroupLayoutDescriptor bindGroupLayoutDesc;
     bindGroupLayoutDesc.entries = bindGroupLayoutEntries.data();
     bindGroupLayoutDesc.entryCount = (uint32_t)bindGroupLayoutEntries.size();
 
     m_bindGroupLayout = device.createBindGroupLayout(bindGroupLayoutDesc);
+    m_textureCount = textureViewArray.size();
 
-    std::vector<wgpu::BindGroupEntry> bindGroupEntries(5, wgpu::Default);
+    return initBindGroup(device, textureViewArray);
+}
+
+bool DefaultPipeline::initBindGroup(wgpu::Device device, std::vector<wgpu::TextureView> textureViewArray) {
+    std::vector<wgpu::BindGroupEntry> bindGroupEntries(9, wgpu::Default);
     bindGroupEntries[0].binding = 0;
     bindGroupEntries[0].offset = 0;
     bindGroupEntries[0].buffer = m_uniformBuffer->getBuffer();
@@ -228,6 +264,23 @@ bool DefaultPipeline::initBindings(wgpu::Device device, std::vector<wgpu::Textur
     bindGroupEntries[4].buffer = m_materialBuffer->getBuffer();
     bindGroupEntries[4].size = m_materialBuffer->getSize();
 
+    bindGroupEntries[5].binding = 5;
+    bindGroupEntries[5].offset = 0;
+    bindGroupEntries[5].buffer = m_visibleBuffer->getBuffer();
+    bindGroupEntries[5].size = m_visibleBuffer->getSize();
+
+    bindGroupEntries[6].binding = 6;
+    bindGroupEntries[6].offset = 0;
+    bindGroupEntries[6].textureView = m_environment.specular;
+
+    bindGroupEntries[7].binding = 7;
+    bindGroupEntries[7].offset = 0;
+    bindGroupEntries[7].textureView = m_environment.brdfLut;
+
+    bindGroupEntries[8].binding = 8;
+    bindGroupEntries[8].offset = 0;
+    bindGroupEntries[8].sampler = m_environment.sampler;
+
     wgpu::BindGroupDescriptor bindGroupDesc;
     bindGroupDesc.entries = bindGroupEntries.data();
     bindGroupDesc.entryCount = (uint32_t)bindGroupEntries.size();
@@ -261,14 +314,12 @@ struct UniformData {
     glm::mat4x4 projection_matrix;
     glm::vec3 camera_world_position;
     float time;
-    float padding[3]; // need to chunk into 4x4x4 sections (4x4 floats)
-};
-struct ModelData {
-    glm::mat4x4 transform;
-    uint32_t materialIndex;
-    uint32_t isSkybox;
-    float padding[2]; // need to chunk into 4x4x4 sections (4x4 floats)
+    // sh9 irradiance over pi of the environment (rgb), see IrradienceTexture.
+    // irradiance[0].w is 1 once an environment is set
+    glm::vec4 irradiance[9] = {};
 };
+// 32 bytes per instance, the shaders rebuild the transform (see InstanceCompression)
+using ModelData = InstanceCompression::PackedInstance;
 
 struct MaterialData {
     glm::vec3 baseColor;
@@ -276,21 +327,28 @@ struct MaterialData {
     uint32_t normalTextureIndex;
     float roughness;
     float padding[2];
+    glm::vec4 diffuseUvTransform; // Texture::uvTransform
+    glm::vec4 normalUvTransform;
 };
 // todo: make bind group it's own thing
 wgpu::BindGroup m_bindGroup = nullptr;
 
 private:
     wgpu::TextureFormat m_depthTextureFormat = wgpu::TextureFormat::Depth24Plus;
+    bool m_packedVertices = false;
+    bool m_afterDepthPrepass = false;
     std::shared_ptr<Buffer> m_vertexBuffer;
     std::shared_ptr<Buffer> m_indexBuffer;
     std::shared_ptr<Buffer> m_uniformBuffer;
     std::shared_ptr<Buffer> m_modelBuffer;
     std::shared_ptr<Buffer> m_materialBuffer;
+    std::shared_ptr<Buffer> m_visibleBuffer;
 
     wgpu::Sampler m_textureSampler = nullptr;
+    Environment m_environment; // owned by the RenderModule
 
     wgpu::BindGroupLayout m_bindGroupLayout = nullptr;
+    size_t m_textureCount = 0; // the texture array size the layout was made for
 
 };
 }
\ No newline at end of file
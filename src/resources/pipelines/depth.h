@@ -0,0 +1,150 @@
+#pragma once
+#include "../../memory/Pipeline.h"
+#include "../../memory/Buffer.h"
+#include "../../memory/Shader.h"
+#include "../../memory/VertexLayout.h"
+#include "default.h"
+
+namespace coho {
+// Depth only pipeline reading just the position stream of the mesh buffers.
+// Used for the depth prepass, the same pipeline with a light's view/projection
+// in the uniform buffer renders shadow maps.
+class DepthPipeline: Pipeline {
+public:
+DepthPipeline(
+        std::shared_ptr<Buffer> uniformBuffer,
+        std::shared_ptr<Buffer> modelBuffer,
+        std::shared_ptr<Buffer> visibleBuffer,
+        std::shared_ptr<Shader> vertexShader
+        ) {
+    m_uniformBuffer = uniformBuffer;
+    m_modelBuffer = modelBuffer;
+    m_visibleBuffer = visibleBuffer;
+    m_vertexShader = vertexShader;
+}
+
+~DepthPipeline() {
+    m_uniformBuffer.reset();
+    m_modelBuffer.reset();
+    m_visibleBuffer.reset();
+
+    m_bindGroupLayout.release();
+    m_bindGroup.release();
+}
+
+bool init(wgpu::Device device) {
+    if (!initBindings(device)) {
+        std::cout << "failed to init bindings" << std::endl;
+        return false;
+    }
+
+    wgpu::RenderPipelineDescriptor renderPipelineDesc;
+
+    wgpu::VertexBufferLayout vertexBufferLayout = PositionVertexLayout::bufferLayout();
+    renderPipelineDesc.vertex.bufferCount = 1;
+    renderPipelineDesc.vertex.buffers = &vertexBufferLayout;
+    renderPipelineDesc.vertex.constantCount = 0;
+    renderPipelineDesc.vertex.constants = 0;
+    renderPipelineDesc.vertex.entryPoint = "vs_main";
+    renderPipelineDesc.vertex.module = m_vertexShader->getShaderModule();
+
+    // no color targets
+    renderPipelineDesc.fragment = nullptr;
+
+    renderPipelineDesc.primitive.cullMode = wgpu::CullMode::Back;
+    renderPipelineDesc.primitive.frontFace = wgpu::FrontFace::CCW;
+    renderPipelineDesc.primitive.topology = wgpu::PrimitiveTopology::TriangleList;
+    renderPipelineDesc.primitive.stripIndexFormat = wgpu::IndexFormat::Undefined;
+
+    wgpu::DepthStencilState depthStencilState = wgpu::Default;
+    depthStencilState.depthCompare = wgpu::CompareFunction::Less;
+    depthStencilState.depthWriteEnabled = true;
+    depthStencilState.format = m_depthTextureFormat;
+    depthStencilState.stencilReadMask = 0;
+    depthStencilState.stencilWriteMask = 0;
+    renderPipelineDesc.depthStencil = &depthStencilState;
+
+    renderPipelineDesc.multisample.count = 1;
+    renderPipelineDesc.multisample.mask = ~0u;
+    renderPipelineDesc.multisample.alphaToCoverageEnabled = false;
+
+    wgpu::PipelineLayoutDescriptor pipelineLayoutDesc;
+    pipelineLayoutDesc.bindGroupLayoutCount = 1;
+    pipelineLayoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&m_bindGroupLayout;
+    renderPipelineDesc.layout = device.createPipelineLayout(pipelineLayoutDesc);
+
+    m_renderPipeline = device.createRenderPipeline(renderPipelineDesc);
+    if (m_renderPipeline == nullptr) {
+        std::cout << "depth pipeline wasn't created" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+wgpu::RenderPipeline getRenderPipeline() {
+    return m_renderPipeline;
+}
+
+wgpu::BindGroup m_bindGroup = nullptr;
+
+private:
+
+bool initBindings(wgpu::Device device) {
+    std::vector<wgpu::BindGroupLayoutEntry> bindGroupLayoutEntries(3, wgpu::Default);
+    // uniform layout
+    bindGroupLayoutEntries[0].binding = 0;
+    bindGroupLayoutEntries[0].visibility = wgpu::ShaderStage::Vertex;
+    bindGroupLayoutEntries[0].buffer.type = wgpu::BufferBindingType::Uniform;
+    bindGroupLayoutEntries[0].buffer.minBindingSize = sizeof(DefaultPipeline::UniformData);
+
+    // model buffer layout
+    bindGroupLayoutEntries[1].binding = 1;
+    bindGroupLayoutEntries[1].visibility = wgpu::ShaderStage::Vertex;
+    bindGroupLayoutEntries[1].buffer.type = wgpu::BufferBindingType::ReadOnlyStorage;
+    bindGroupLayoutEntries[1].buffer.minBindingSize = sizeof(DefaultPipeline::ModelData);
+
+    // visible index layout
+    bindGroupLayoutEntries[2].binding = 2;
+    bindGroupLayoutEntries[2].visibility = wgpu::ShaderStage::Vertex;
+    bindGroupLayoutEntries[2].buffer.type = wgpu::BufferBindingType::ReadOnlyStorage;
+    bindGroupLayoutEntries[2].buffer.minBindingSize = sizeof(uint32_t);
+
+    wgpu::BindGroupLayoutDescriptor bindGroupLayoutDesc;
+    bindGroupLayoutDesc.entries = bindGroupLayoutEntries.data();
+    bindGroupLayoutDesc.entryCount = (uint32_t)bindGroupLayoutEntries.size();
+    m_bindGroupLayout = device.createBindGroupLayout(bindGroupLayoutDesc);
+
+    std::vector<wgpu::BindGroupEntry> bindGroupEntries(3, wgpu::Default);
+    bindGroupEntries[0].binding = 0;
+    bindGroupEntries[0].offset = 0;
+    bindGroupEntries[0].buffer = m_uniformBuffer->getBuffer();
+    bindGroupEntries[0].size = sizeof(DefaultPipeline::UniformData);
+
+    bindGroupEntries[1].binding = 1;
+    bindGroupEntries[1].offset = 0;
+    bindGroupEntries[1].buffer = m_modelBuffer->getBuffer();
+    bindGroupEntries[1].size = m_modelBuffer->getSize();
+
+    bindGroupEntries[2].binding = 2;
+    bindGroupEntries[2].offset = 0;
+    bindGroupEntries[2].buffer = m_visibleBuffer->getBuffer();
+    bindGroupEntries[2].size = m_visibleBuffer->getSize();
+
+    wgpu::BindGroupDescriptor bindGroupDesc;
+    bindGroupDesc.entries = bindGroupEntries.data();
+    bindGroupDesc.entryCount = (uint32_t)bindGroupEntries.size();
+    bindGroupDesc.layout = m_bindGroupLayout;
+    m_bindGroup = device.createBindGroup(bindGroupDesc);
+
+    return true;
+}
+
+private:
+    wgpu::TextureFormat m_depthTextureFormat = wgpu::TextureFormat::Depth24Plus;
+    std::shared_ptr<Buffer> m_uniformBuffer;
+    std::shared_ptr<Buffer> m_modelBuffer;
+    std::shared_ptr<Buffer> m_visibleBuffer;
+
+    wgpu::BindGroupLayout m_bindGroupLayout = nullptr;
+};
+}
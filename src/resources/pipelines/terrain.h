@@ -2,6 +2,7 @@
 #include "../../memory/Pipeline.h"
 #include "../../memory/Buffer.h"
 #include "../../memory/Shader.h"
+#include "../../memory/VertexLayout.h"
 #include "../../ecs/components/Mesh.h"
 
 namespace coho {
@@ -55,37 +56,7 @@ bool TerrainPipeline::init(
 
     wgpu::RenderPipelineDescriptor renderPipelineDesc;
 
-    std::vector<wgpu::VertexAttribute> vertexAttributes(6);
-    // position
-    vertexAttributes[0].format = wgpu::VertexFormat::Float32x3;
-    vertexAttributes[0].offset = offsetof(Mesh::VertexData, position);
-    vertexAttributes[0].shaderLocation = 0;
-    // normal
-    vertexAttributes[1].format = wgpu::VertexFormat::Float32x3;
-    vertexAttributes[1].offset = offsetof(Mesh::VertexData, normal);
-    vertexAttributes[1].shaderLocation = 1;
-    // color
-    vertexAttributes[2].format = wgpu::VertexFormat::Float32x3;
-    vertexAttributes[2].offset = offsetof(Mesh::VertexData, color);
-    vertexAttributes[2].shaderLocation = 2;
-    // tangent
-    vertexAttributes[3].format = wgpu::VertexFormat::Float32x3;
-    vertexAttributes[3].offset = offsetof(Mesh::VertexData, tangent);
-    vertexAttributes[3].shaderLocation = 3;
-    // bitangent 
-    vertexAttributes[4].format = wgpu::VertexFormat::Float32x3;
-    vertexAttributes[4].offset = offsetof(Mesh::VertexData, bitangent);
-    vertexAttributes[4].shaderLocation = 4;
-    // uv
-    vertexAttributes[5].format = wgpu::VertexFormat::Float32x2;
-    vertexAttributes[5].offset = offsetof(Mesh::VertexData, uv);
-    vertexAttributes[5].shaderLocation = 5;
-
-    wgpu::VertexBufferLayout vertexBufferLayout;
-    vertexBufferLayout.arrayStride = sizeof(Mesh::VertexData);
-    vertexBufferLayout.attributes = vertexAttributes.data();
-    vertexBufferLayout.attributeCount = (uint32_t)vertexAttributes.size();
-    vertexBufferLayout.stepMode = wgpu::VertexStepMode::Vertex;
+    wgpu::VertexBufferLayout vertexBufferLayout = FullVertexLayout::bufferLayout();
 
     renderPipelineDesc.vertex.bufferCount = 1;
     renderPipelineDesc.vertex.buffers = &vertexBufferLayout;
@@ -0,0 +1,55 @@
+#pragma once
+#include <webgpu/webgpu.hpp>
+#include "../../memory/RenderPass.h"
+#include "../../ecs/Entity.h"
+#include "../../ecs/components/MeshComponent.h"
+
+// Depth only pass, binds nothing but the position stream.
+class DepthRenderPass : RenderPass {
+public:
+static void render(wgpu::Device device,
+        wgpu::TextureView depthTextureView,
+        wgpu::RenderPipeline renderPipeline,
+        wgpu::Buffer positionBuffer,
+        uint32_t positionBufferSize,
+        IndexBuffers indexBuffers,
+        wgpu::BindGroup bindGroup,
+        std::vector<std::shared_ptr<Entity>> entities,
+        const IndirectDraws* indirectDraws = nullptr,
+        uint32_t kinds = AllDraws) {
+    wgpu::RenderPassDepthStencilAttachment depthStencilAttachment;
+    depthStencilAttachment.depthClearValue = 1.0;
+    depthStencilAttachment.depthLoadOp = wgpu::LoadOp::Clear;
+    depthStencilAttachment.depthStoreOp = wgpu::StoreOp::Store;
+    depthStencilAttachment.depthReadOnly = false;
+
+    depthStencilAttachment.stencilClearValue = 0;
+    depthStencilAttachment.stencilLoadOp = wgpu::LoadOp::Clear;
+    depthStencilAttachment.stencilStoreOp = wgpu::StoreOp::Store;
+    depthStencilAttachment.stencilReadOnly = false;
+
+    depthStencilAttachment.view = depthTextureView;
+
+    wgpu::RenderPassDescriptor renderPassDesc;
+    renderPassDesc.colorAttachmentCount = 0;
+    renderPassDesc.colorAttachments = nullptr;
+    renderPassDesc.depthStencilAttachment = &depthStencilAttachment;
+    renderPassDesc.occlusionQuerySet = nullptr;
+    renderPassDesc.timestampWrites = nullptr;
+
+    wgpu::CommandEncoder commandEncoder = device.createCommandEncoder(wgpu::CommandEncoderDescriptor{});
+    wgpu::RenderPassEncoder renderPassEncoder = commandEncoder.beginRenderPass(renderPassDesc);
+    renderPassEncoder.setPipeline(renderPipeline);
+    renderPassEncoder.setVertexBuffer(0, positionBuffer, 0, positionBufferSize);
+    renderPassEncoder.setBindGroup(0, bindGroup, 0, nullptr);
+
+    drawEntities(renderPassEncoder, indexBuffers, entities, indirectDraws, kinds);
+
+    renderPassEncoder.end();
+    wgpu::CommandBuffer commandBuffer = commandEncoder.finish(wgpu::CommandBufferDescriptor{});
+    device.getQueue().submit(commandBuffer);
+    commandEncoder.release();
+    commandBuffer.release();
+    renderPassEncoder.release();
+}
+};
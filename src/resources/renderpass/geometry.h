@@ -12,10 +12,14 @@ static void render(wgpu::Device device,
         wgpu::RenderPipeline renderPipeline,
         wgpu::Buffer vertexBuffer,
         uint32_t vertexBufferSize,
-        wgpu::Buffer indexBuffer,
-        uint32_t indexBufferSize,
+        wgpu::Buffer attributeBuffer,
+        uint32_t attributeBufferSize,
+        IndexBuffers indexBuffers,
         wgpu::BindGroup bindGroup,
-        std::vector<std::shared_ptr<Entity>> entities) {
+        std::vector<std::shared_ptr<Entity>> entities,
+        wgpu::LoadOp depthLoadOp = wgpu::LoadOp::Clear,
+        const IndirectDraws* indirectDraws = nullptr,
+        uint32_t kinds = AllDraws) {
     wgpu::RenderPassColorAttachment renderPassColorAttachment;
     renderPassColorAttachment.clearValue = { 0.0, 0.0, 0.0 };
     renderPassColorAttachment.loadOp = wgpu::LoadOp::Load;
@@ -25,7 +29,7 @@ static void render(wgpu::Device device,
     
     wgpu::RenderPassDepthStencilAttachment depthStencilAttachment;
     depthStencilAttachment.depthClearValue = 1.0;
-    depthStencilAttachment.depthLoadOp = wgpu::LoadOp::Clear;
+    depthStencilAttachment.depthLoadOp = depthLoadOp;
     depthStencilAttachment.depthStoreOp = wgpu::StoreOp::Store;
     depthStencilAttachment.depthReadOnly = false;
 
@@ -47,17 +51,12 @@ static void render(wgpu::Device device,
     wgpu::RenderPassEncoder renderPassEncoder = commandEncoder.beginRenderPass(renderPassDesc);
     renderPassEncoder.setPipeline(renderPipeline);
     renderPassEncoder.setVertexBuffer(0, vertexBuffer, 0, vertexBufferSize);
+    if (attributeBuffer != nullptr) { // packed meshes only have the one stream
+        renderPassEncoder.setVertexBuffer(1, attributeBuffer, 0, attributeBufferSize);
+    }
     renderPassEncoder.setBindGroup(0, bindGroup, 0, nullptr);
-    renderPassEncoder.setIndexBuffer(indexBuffer, wgpu::IndexFormat::Uint32, 0, indexBufferSize);
 
-    for (auto entity : entities) {
-        auto mesh = entity->getComponent<MeshComponent>()->mesh;
-        if (mesh->isIndexed) {
-            renderPassEncoder.drawIndexed(mesh->getIndexCount(), entity->instanceCount, mesh->getIndexBufferOffset(), mesh->getVertexBufferOffset(), entity->getId());
-        } else {
-            renderPassEncoder.draw(mesh->getVertexCount(), entity->instanceCount, mesh->getVertexBufferOffset(), entity->getId());
-        }
-    }
+    drawEntities(renderPassEncoder, indexBuffers, entities, indirectDraws, kinds);
 
     renderPassEncoder.end();
     wgpu::CommandBuffer commandBuffer = commandEncoder.finish(wgpu::CommandBufferDescriptor{});
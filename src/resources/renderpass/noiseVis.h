@@ -12,8 +12,9 @@ static void render(wgpu::Device device,
         wgpu::RenderPipeline renderPipeline,
         wgpu::Buffer vertexBuffer,
         uint32_t vertexBufferSize,
-        wgpu::Buffer indexBuffer,
-        uint32_t indexBufferSize,
+        wgpu::Buffer attributeBuffer,
+        uint32_t attributeBufferSize,
+        IndexBuffers indexBuffers,
         wgpu::BindGroup bindGroup,
         std::shared_ptr<Entity> renderQuad) {
     wgpu::RenderPassColorAttachment renderPassColorAttachment;
@@ -47,11 +48,12 @@ static void render(wgpu::Device device,
     wgpu::RenderPassEncoder renderPassEncoder = commandEncoder.beginRenderPass(renderPassDesc);
     renderPassEncoder.setPipeline(renderPipeline);
     renderPassEncoder.setVertexBuffer(0, vertexBuffer, 0, vertexBufferSize);
+    renderPassEncoder.setVertexBuffer(1, attributeBuffer, 0, attributeBufferSize);
     renderPassEncoder.setBindGroup(0, bindGroup, 0, nullptr);
-    renderPassEncoder.setIndexBuffer(indexBuffer, wgpu::IndexFormat::Uint32, 0, indexBufferSize);
 
-    
     auto mesh = renderQuad->getComponent<MeshComponent>()->mesh;
+    int boundFormat = 0;
+    bindIndexBuffer(renderPassEncoder, indexBuffers, mesh->isIndex16, boundFormat);
     renderPassEncoder.drawIndexed(mesh->getIndexCount(), 1, mesh->getIndexBufferOffset(), mesh->getVertexBufferOffset(), renderQuad->getId());
 
     renderPassEncoder.end();
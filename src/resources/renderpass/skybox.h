@@ -1,5 +1,6 @@
 #pragma once
 #include <webgpu/webgpu.hpp>
+#include "../../memory/RenderPass.h"
 #include "../../ecs/Entity.h"
 #include "../../ecs/components/MeshComponent.h"
 
@@ -12,8 +13,11 @@ static void render(
         wgpu::RenderPipeline renderPipeline,
         wgpu::Buffer vertexBuffer,
         uint32_t vertexBufferSize,
+        wgpu::Buffer attributeBuffer,
+        uint32_t attributeBufferSize,
         wgpu::BindGroup bindGroup,
-        std::vector<std::shared_ptr<Entity>> entities
+        std::vector<std::shared_ptr<Entity>> entities,
+        const IndirectDraws* indirectDraws
     ) {
     wgpu::RenderPassColorAttachment colorAttachment;
     colorAttachment.clearValue = { 0.0, 0.0, 0.0 };
@@ -45,12 +49,14 @@ static void render(
     wgpu::RenderPassEncoder renderPassEncoder = commandEncoder.beginRenderPass(renderPassDesc);
     renderPassEncoder.setPipeline(renderPipeline);
     renderPassEncoder.setVertexBuffer(0, vertexBuffer, 0, vertexBufferSize);
+    renderPassEncoder.setVertexBuffer(1, attributeBuffer, 0, attributeBufferSize);
     renderPassEncoder.setBindGroup(0, bindGroup, 0, nullptr);
 
     // draw
     for (auto e : entities) {
         auto mesh = e->getComponent<MeshComponent>()->mesh;
-        renderPassEncoder.draw(mesh->getVertexCount(), 1, mesh->getVertexBufferOffset(), e->getId());
+        auto instances = RenderPass::instanceRange(e, indirectDraws);
+        renderPassEncoder.draw(mesh->getVertexCount(), instances.second, mesh->getVertexBufferOffset(), instances.first);
 
     }
 
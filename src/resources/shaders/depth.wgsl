@@ -0,0 +1,55 @@
+struct UniformData {
+    view_matrix: mat4x4f,
+    projection_matrix: mat4x4f,
+    camera_world_position: vec3f,
+    time: f32
+};
+
+// InstanceCompression::PackedInstance, 32 bytes
+struct ModelData {
+    position: vec3f,
+    materialIndex: u32, // the top bit flags the skybox
+    rotation: vec2u,    // snorm16 quaternion xyzw
+    scale: f32,         // x scale, negative when mirrored
+    scaleRatios: u32,   // half floats, y and z scale over the x scale
+}
+
+@group(0) @binding(0) var<uniform> uUniformData: UniformData;
+@group(0) @binding(1) var<storage, read> modelBuffer: array<ModelData>;
+@group(0) @binding(2) var<storage, read> visibleIndices: array<u32>; // instance_index -> model, see InstanceCuller
+
+// the transform packed by InstanceCompression, same math as InstanceCompression::unpack
+fn modelMatrix(modelData: ModelData) -> mat4x4f {
+    let q = vec4f(unpack2x16snorm(modelData.rotation.x), unpack2x16snorm(modelData.rotation.y));
+    let s = vec3f(modelData.scale, abs(modelData.scale) * unpack2x16float(modelData.scaleRatios));
+    let n = 2.0 / dot(q, q);
+    let xx = q.x * q.x * n;
+    let yy = q.y * q.y * n;
+    let zz = q.z * q.z * n;
+    let xy = q.x * q.y * n;
+    let xz = q.x * q.z * n;
+    let yz = q.y * q.z * n;
+    let wx = q.w * q.x * n;
+    let wy = q.w * q.y * n;
+    let wz = q.w * q.z * n;
+    return mat4x4f(
+        vec4f(vec3f(1.0 - yy - zz, xy + wz, xz - wy) * s.x, 0.0),
+        vec4f(vec3f(xy - wz, 1.0 - xx - zz, yz + wx) * s.y, 0.0),
+        vec4f(vec3f(xz + wy, yz - wx, 1.0 - xx - yy) * s.z, 0.0),
+        vec4f(modelData.position, 1.0)
+    );
+}
+
+struct VertexOutput {
+    // has to match vs_main in shader.wgsl bit for bit
+    @builtin(position) @invariant position: vec4f,
+}
+
+// position stream only, no fragment stage
+@vertex
+fn vs_main (@location(0) position: vec3f, @builtin(instance_index) instance_id: u32) -> VertexOutput {
+    var out: VertexOutput;
+    let worldPosition = modelMatrix(modelBuffer[visibleIndices[instance_id]]) * vec4f(position, 1.0);
+    out.position = uUniformData.projection_matrix * uUniformData.view_matrix * worldPosition;
+    return out;
+}
@@ -0,0 +1,160 @@
+struct UniformData {
+    view_matrix: mat4x4f,
+    projection_matrix: mat4x4f,
+    camera_world_position: vec3f,
+    time: f32
+};
+
+// InstanceCompression::PackedInstance, 32 bytes
+struct ModelData {
+    position: vec3f,
+    materialIndex: u32, // the top bit flags the skybox
+    rotation: vec2u,    // snorm16 quaternion xyzw
+    scale: f32,         // x scale, negative when mirrored
+    scaleRatios: u32,   // half floats, y and z scale over the x scale
+}
+
+struct MaterialData {
+    baseColor: vec3f,
+    diffuseTextureIndex: u32,
+    normalTextureIndex: u32,
+    roughness: f32,
+    diffuseUvTransform: vec4f, // xy scale, zw offset into an atlas page
+    normalUvTransform: vec4f,
+};
+
+@group(0) @binding(0) var<uniform> uUniformData: UniformData;
+@group(0) @binding(1) var textureArray: binding_array<texture_2d<f32>>;
+@group(0) @binding(2) var texture_sampler: sampler;
+@group(0) @binding(3) var<storage, read> modelBuffer: array<ModelData>;
+@group(0) @binding(4) var<storage, read> materialBuffer: array<MaterialData>;
+@group(0) @binding(5) var<storage, read> visibleIndices: array<u32>; // instance_index -> model, see InstanceCuller
+
+// the transform packed by InstanceCompression, same math as InstanceCompression::unpack
+fn modelMatrix(modelData: ModelData) -> mat4x4f {
+    let q = vec4f(unpack2x16snorm(modelData.rotation.x), unpack2x16snorm(modelData.rotation.y));
+    let s = vec3f(modelData.scale, abs(modelData.scale) * unpack2x16float(modelData.scaleRatios));
+    let n = 2.0 / dot(q, q);
+    let xx = q.x * q.x * n;
+    let yy = q.y * q.y * n;
+    let zz = q.z * q.z * n;
+    let xy = q.x * q.y * n;
+    let xz = q.x * q.z * n;
+    let yz = q.y * q.z * n;
+    let wx = q.w * q.x * n;
+    let wy = q.w * q.y * n;
+    let wz = q.w * q.z * n;
+    return mat4x4f(
+        vec4f(vec3f(1.0 - yy - zz, xy + wz, xz - wy) * s.x, 0.0),
+        vec4f(vec3f(xy - wz, 1.0 - xx - zz, yz + wx) * s.y, 0.0),
+        vec4f(vec3f(xz + wy, yz - wx, 1.0 - xx - yy) * s.z, 0.0),
+        vec4f(modelData.position, 1.0)
+    );
+}
+
+// ImpostorBaker::createBillboard, every vertex sits at the center
+struct VertexInput {
+    @location(0) position: vec3f, // bounding sphere center, mesh space
+    @location(1) normal: vec3f,   // radius, grid size, atlas material index
+    @location(2) color: vec3f,
+    @location(3) tangent: vec3f,
+    @location(4) bitangent: vec3f,
+    @location(5) uv: vec2f,       // corner of the card
+}
+
+struct VertexOutput {
+    @builtin(position) position: vec4f,
+    @location(0) atlasUV: vec2f,
+    @location(1) meshPosition: vec3f,  // on the card
+    @location(2) frameDirection: vec3f,
+    @location(3) radius: f32,
+    @location(4) @interpolate(flat) materialIndex: u32,
+    @location(5) @interpolate(flat) instance_id: u32 // the model buffer index
+}
+
+// the atlas octahedral map has y as its pole, see ImpostorBaker::frameDirection
+fn decodeFrame(e: vec2f) -> vec3f {
+    var n = vec3f(e.x, e.y, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0) {
+        n = vec3f((1.0 - abs(n.y)) * select(-1.0, 1.0, n.x >= 0.0), (1.0 - abs(n.x)) * select(-1.0, 1.0, n.y >= 0.0), n.z);
+    }
+    return normalize(vec3f(n.x, n.z, n.y));
+}
+
+fn encodeFrame(direction: vec3f) -> vec2f {
+    let d = vec3f(direction.x, direction.z, direction.y);
+    let n = d / (abs(d.x) + abs(d.y) + abs(d.z));
+    if (n.z < 0.0) {
+        return vec2f((1.0 - abs(n.y)) * select(-1.0, 1.0, n.x >= 0.0), (1.0 - abs(n.x)) * select(-1.0, 1.0, n.y >= 0.0));
+    }
+    return n.xy;
+}
+
+@vertex
+fn vs_main (in: VertexInput, @builtin(instance_index) instance_id: u32) -> VertexOutput {
+    let transform = modelMatrix(modelBuffer[visibleIndices[instance_id]]);
+    let radius = in.normal.x;
+    let gridSize = in.normal.y;
+
+    // the view direction in mesh space, the transform is rotation and (uniform) scale
+    let model = mat3x3f(transform[0].xyz, transform[1].xyz, transform[2].xyz);
+    let worldCenter = (transform * vec4f(in.position, 1.0)).xyz;
+    let viewDirection = normalize(transpose(model) * (uUniformData.camera_world_position - worldCenter));
+
+    // the frame whose direction is closest, the card faces it
+    let cell = clamp(floor((encodeFrame(viewDirection) * 0.5 + 0.5) * gridSize), vec2f(0.0), vec2f(gridSize - 1.0));
+    let direction = decodeFrame((cell + 0.5) / gridSize * 2.0 - 1.0);
+    let reference = select(vec3f(0.0, 1.0, 0.0), vec3f(0.0, 0.0, -1.0), abs(direction.y) > 0.999);
+    let right = normalize(cross(reference, direction));
+    let up = cross(direction, right);
+
+    let corner = in.uv * 2.0 - 1.0;
+    let meshPosition = in.position + radius * (corner.x * right + corner.y * up);
+
+    var out: VertexOutput;
+    out.position = uUniformData.projection_matrix * uUniformData.view_matrix * transform * vec4f(meshPosition, 1.0);
+    // atlas rows run top down, the top of a frame is +up
+    out.atlasUV = (cell + vec2f(in.uv.x, 1.0 - in.uv.y)) / gridSize;
+    out.meshPosition = meshPosition;
+    out.frameDirection = direction;
+    out.radius = radius;
+    out.materialIndex = u32(in.normal.z + 0.5);
+    out.instance_id = visibleIndices[instance_id];
+    return out;
+}
+
+struct FragmentOutput {
+    @location(0) color: vec4f,
+    @builtin(frag_depth) depth: f32,
+}
+
+@fragment
+fn fs_main (in: VertexOutput) -> FragmentOutput {
+    let transform = modelMatrix(modelBuffer[in.instance_id]);
+    let materialData = materialBuffer[in.materialIndex];
+    // the baked atlas may itself sit in an atlas page
+    let albedoUV = in.atlasUV * materialData.diffuseUvTransform.xy + materialData.diffuseUvTransform.zw;
+    let normalUV = in.atlasUV * materialData.normalUvTransform.xy + materialData.normalUvTransform.zw;
+    let albedo = textureSample(textureArray[materialData.diffuseTextureIndex], texture_sampler, albedoUV);
+    let normalDepth = textureSample(textureArray[materialData.normalTextureIndex], texture_sampler, normalUV);
+    if (albedo.a < 0.5) {
+        discard;
+    }
+
+    // push the card back to the baked surface so impostors intersect the scene like the mesh
+    let meshPosition = in.meshPosition + in.frameDirection * in.radius * (normalDepth.a * 2.0 - 1.0);
+    let clipPosition = uUniformData.projection_matrix * uUniformData.view_matrix * transform * vec4f(meshPosition, 1.0);
+
+    let N = normalize((transform * vec4f(normalDepth.rgb * 2.0 - 1.0, 0.0)).xyz);
+    let L = normalize(vec3f(1.0, 1.0, 1.0));
+
+    // same lighting as shader.wgsl
+    let kd = 0.8;
+    let ka = 0.2;
+    let color = kd * max(0.0, dot(N, L)) * albedo.rgb + ka * albedo.rgb;
+
+    var out: FragmentOutput;
+    out.color = vec4f(pow(color, vec3f(2.2)), 1.0);
+    out.depth = clipPosition.z / clipPosition.w;
+    return out;
+}
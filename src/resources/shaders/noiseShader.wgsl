@@ -6,9 +6,11 @@ struct UniformData {
 };
 
 struct ModelData {
-    transform: mat4x4f,
-    materialIndex: u32,
-    isSkybox: u32,
+    position: vec3f,
+    materialIndex: u32, // the top bit flags the skybox
+    rotation: vec2u,    // snorm16 quaternion xyzw
+    scale: f32,         // x scale, negative when mirrored
+    scaleRatios: u32,   // half floats, y and z scale over the x scale
 }
 
 struct MaterialData {
@@ -16,6 +18,8 @@ struct MaterialData {
     diffuseTextureIndex: u32,
     normalTextureIndex: u32,
     roughness: f32,
+    diffuseUvTransform: vec4f, // xy scale, zw offset into an atlas page
+    normalUvTransform: vec4f,
 };
 
 struct VertexInput {
@@ -44,6 +48,36 @@ struct VertexOutput {
 @group(0) @binding(3) var<storage, read> modelBuffer: array<ModelData>;
 @group(0) @binding(4) var<storage, read> materialBuffer: array<MaterialData>;
 
+// the transform packed by InstanceCompression, same math as InstanceCompression::unpack
+fn modelMatrix(modelData: ModelData) -> mat4x4f {
+    let q = vec4f(unpack2x16snorm(modelData.rotation.x), unpack2x16snorm(modelData.rotation.y));
+    let s = vec3f(modelData.scale, abs(modelData.scale) * unpack2x16float(modelData.scaleRatios));
+    let n = 2.0 / dot(q, q);
+    let xx = q.x * q.x * n;
+    let yy = q.y * q.y * n;
+    let zz = q.z * q.z * n;
+    let xy = q.x * q.y * n;
+    let xz = q.x * q.z * n;
+    let yz = q.y * q.z * n;
+    let wx = q.w * q.x * n;
+    let wy = q.w * q.y * n;
+    let wz = q.w * q.z * n;
+    return mat4x4f(
+        vec4f(vec3f(1.0 - yy - zz, xy + wz, xz - wy) * s.x, 0.0),
+        vec4f(vec3f(xy - wz, 1.0 - xx - zz, yz + wx) * s.y, 0.0),
+        vec4f(vec3f(xz + wy, yz - wx, 1.0 - xx - yy) * s.z, 0.0),
+        vec4f(modelData.position, 1.0)
+    );
+}
+
+fn materialIndex(modelData: ModelData) -> u32 {
+    return modelData.materialIndex & 0x7fffffffu;
+}
+
+fn isSkybox(modelData: ModelData) -> bool {
+    return (modelData.materialIndex >> 31u) == 1u;
+}
+
 fn noise3D(v: vec3<f32>) -> f32 {
     // let v = pos * 0.0001;
     let F3 = 1.0 / 3.0;
@@ -167,15 +201,16 @@ fn mapZeroToOneV(v: vec3f) -> vec3f {
 fn vs_main (in: VertexInput, @builtin(vertex_index) i: u32, @builtin(instance_index) instance_id: u32 ) -> VertexOutput {
     var out: VertexOutput;
     let modelData = modelBuffer[instance_id];
-    var worldPosition = modelData.transform * vec4f(in.position, 1.0);
-    if (modelData.isSkybox == 1u) {
-        worldPosition = modelData.transform * vec4f(uUniformData.camera_world_position + in.position, 1.0);
+    let transform = modelMatrix(modelData);
+    var worldPosition = transform * vec4f(in.position, 1.0);
+    if (isSkybox(modelData)) {
+        worldPosition = transform * vec4f(uUniformData.camera_world_position + in.position, 1.0);
     }
     out.position = uUniformData.projection_matrix * uUniformData.view_matrix * worldPosition;
     
-    out.tangent = (modelData.transform * vec4f(in.tangent, 0.0)).xyz;
-	out.bitangent = (modelData.transform * vec4f(in.bitangent, 0.0)).xyz;
-    out.normal = (modelData.transform * vec4f(in.normal, 0.0)).xyz;
+    out.tangent = (transform * vec4f(in.tangent, 0.0)).xyz;
+	out.bitangent = (transform * vec4f(in.bitangent, 0.0)).xyz;
+    out.normal = (transform * vec4f(in.normal, 0.0)).xyz;
     out.viewDirection = uUniformData.camera_world_position - worldPosition.xyz;
     out.color = in.color;
     out.uv = in.uv;
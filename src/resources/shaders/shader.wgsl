@@ -2,13 +2,17 @@ struct UniformData {
     view_matrix: mat4x4f,
     projection_matrix: mat4x4f,
     camera_world_position: vec3f,
-    time: f32
+    time: f32,
+    irradiance: array<vec4f, 9>, // sh9 irradiance over pi, [0].w is 1 once an environment is set
 };
 
+// InstanceCompression::PackedInstance, 32 bytes
 struct ModelData {
-    transform: mat4x4f,
-    materialIndex: u32,
-    isSkybox: u32,
+    position: vec3f,
+    materialIndex: u32, // the top bit flags the skybox
+    rotation: vec2u,    // snorm16 quaternion xyzw
+    scale: f32,         // x scale, negative when mirrored
+    scaleRatios: u32,   // half floats, y and z scale over the x scale
 }
 
 struct MaterialData {
@@ -16,6 +20,8 @@ struct MaterialData {
     diffuseTextureIndex: u32,
     normalTextureIndex: u32,
     roughness: f32,
+    diffuseUvTransform: vec4f, // xy scale, zw offset into an atlas page
+    normalUvTransform: vec4f,
 };
 
 @group(0) @binding(0) var<uniform> uUniformData: UniformData;
@@ -23,6 +29,40 @@ struct MaterialData {
 @group(0) @binding(2) var texture_sampler: sampler;
 @group(0) @binding(3) var<storage, read> modelBuffer: array<ModelData>;
 @group(0) @binding(4) var<storage, read> materialBuffer: array<MaterialData>;
+@group(0) @binding(5) var<storage, read> visibleIndices: array<u32>; // instance_index -> model, see InstanceCuller
+@group(0) @binding(6) var specularEnvironment: texture_cube<f32>; // level l is the ggx lobe of roughness l / (levels - 1)
+@group(0) @binding(7) var brdfLut: texture_2d<f32>;               // scale and bias to F0 by n dot v and roughness
+@group(0) @binding(8) var environment_sampler: sampler;
+
+// the transform packed by InstanceCompression, same math as InstanceCompression::unpack
+fn modelMatrix(modelData: ModelData) -> mat4x4f {
+    let q = vec4f(unpack2x16snorm(modelData.rotation.x), unpack2x16snorm(modelData.rotation.y));
+    let s = vec3f(modelData.scale, abs(modelData.scale) * unpack2x16float(modelData.scaleRatios));
+    let n = 2.0 / dot(q, q);
+    let xx = q.x * q.x * n;
+    let yy = q.y * q.y * n;
+    let zz = q.z * q.z * n;
+    let xy = q.x * q.y * n;
+    let xz = q.x * q.z * n;
+    let yz = q.y * q.z * n;
+    let wx = q.w * q.x * n;
+    let wy = q.w * q.y * n;
+    let wz = q.w * q.z * n;
+    return mat4x4f(
+        vec4f(vec3f(1.0 - yy - zz, xy + wz, xz - wy) * s.x, 0.0),
+        vec4f(vec3f(xy - wz, 1.0 - xx - zz, yz + wx) * s.y, 0.0),
+        vec4f(vec3f(xz + wy, yz - wx, 1.0 - xx - yy) * s.z, 0.0),
+        vec4f(modelData.position, 1.0)
+    );
+}
+
+fn materialIndex(modelData: ModelData) -> u32 {
+    return modelData.materialIndex & 0x7fffffffu;
+}
+
+fn isSkybox(modelData: ModelData) -> bool {
+    return (modelData.materialIndex >> 31u) == 1u;
+}
 
 struct VertexInput {
     @location(0) position: vec3f,
@@ -34,50 +74,135 @@ struct VertexInput {
 }
 
 struct VertexOutput {
-    @builtin(position) position: vec4f,
+    // invariant so the optional depth prepass (depth.wgsl) and this pass produce the same depth
+    @builtin(position) @invariant position: vec4f,
     @location(0) normal: vec3f,
     @location(1) color: vec3f,
     @location(2) viewDirection: vec3f,
     @location(3) tangent: vec3f,
     @location(4) bitangent: vec3f,
     @location(5) uv: vec2f,
-    @location(6) instance_id: u32
+    @location(6) instance_id: u32 // the model buffer index
 }
 
 @vertex
 fn vs_main (in: VertexInput, @builtin(vertex_index) i: u32, @builtin(instance_index) instance_id: u32 ) -> VertexOutput {
     var out: VertexOutput;
-    let modelData = modelBuffer[instance_id];
-    var worldPosition = modelData.transform * vec4f(in.position, 1.0);
-    if (modelData.isSkybox == 1u) {
-        worldPosition = modelData.transform * vec4f(uUniformData.camera_world_position + in.position, 1.0);
+    let modelData = modelBuffer[visibleIndices[instance_id]];
+    let transform = modelMatrix(modelData);
+    var worldPosition = transform * vec4f(in.position, 1.0);
+    if (isSkybox(modelData)) {
+        worldPosition = transform * vec4f(uUniformData.camera_world_position + in.position, 1.0);
     }
     out.position = uUniformData.projection_matrix * uUniformData.view_matrix * worldPosition;
     
-    out.tangent = (modelData.transform * vec4f(in.tangent, 0.0)).xyz;
-	out.bitangent = (modelData.transform * vec4f(in.bitangent, 0.0)).xyz;
-    out.normal = (modelData.transform * vec4f(in.normal, 0.0)).xyz;
+    out.tangent = (transform * vec4f(in.tangent, 0.0)).xyz;
+	out.bitangent = (transform * vec4f(in.bitangent, 0.0)).xyz;
+    out.normal = (transform * vec4f(in.normal, 0.0)).xyz;
     out.viewDirection = uUniformData.camera_world_position - worldPosition.xyz;
     out.color = in.color;
     out.uv = in.uv;
-    out.instance_id = instance_id;
+    out.instance_id = visibleIndices[instance_id];
     
 	return out;
 }
 
 
+// Mesh::PackedVertexData, see VertexCompression. the mesh dequantize transform
+// is already folded into modelData.transform.
+struct PackedVertexInput {
+    @location(0) position: vec4f, // unorm16 xyz, w = tangent angle and bitangent sign
+    @location(1) normal: vec2f,   // octahedral
+    @location(2) color: vec4f,
+    @location(5) uv: vec2f,
+}
+
+fn decodeOctahedral(e: vec2f) -> vec3f {
+    var n = vec3f(e.x, e.y, 1.0 - abs(e.x) - abs(e.y));
+    let t = max(-n.z, 0.0);
+    n.x += select(t, -t, n.x >= 0.0);
+    n.y += select(t, -t, n.y >= 0.0);
+    return normalize(n);
+}
+
+// same basis VertexCompression::normalBasis builds
+fn normalBasis(n: vec3f) -> mat2x3f {
+    let s = select(-1.0, 1.0, n.z >= 0.0);
+    let a = -1.0 / (s + n.z);
+    let b = n.x * n.y * a;
+    return mat2x3f(
+        vec3f(1.0 + s * n.x * n.x * a, s * b, -s * n.x),
+        vec3f(b, s + n.y * n.y * a, -n.y)
+    );
+}
+
+@vertex
+fn vs_main_packed (in: PackedVertexInput, @builtin(instance_index) instance_id: u32) -> VertexOutput {
+    let normal = decodeOctahedral(in.normal);
+    let basis = normalBasis(normal);
+    let tangentWord = u32(round(in.position.w * 65535.0));
+    let angle = f32(tangentWord >> 1u) / 32767.0 * 6.28318530718 - 3.14159265359;
+    let handedness = select(1.0, -1.0, (tangentWord & 1u) == 1u);
+    let tangent = cos(angle) * basis[0] + sin(angle) * basis[1];
+    let bitangent = handedness * cross(normal, tangent);
+
+    var out: VertexOutput;
+    let transform = modelMatrix(modelBuffer[visibleIndices[instance_id]]);
+    let worldPosition = transform * vec4f(in.position.xyz, 1.0);
+    out.position = uUniformData.projection_matrix * uUniformData.view_matrix * worldPosition;
+
+    // the transform carries the (uniform) dequantize scale, renormalize
+    out.tangent = normalize((transform * vec4f(tangent, 0.0)).xyz);
+    out.bitangent = normalize((transform * vec4f(bitangent, 0.0)).xyz);
+    out.normal = normalize((transform * vec4f(normal, 0.0)).xyz);
+    out.viewDirection = uUniformData.camera_world_position - worldPosition.xyz;
+    out.color = in.color.rgb;
+    out.uv = in.uv;
+    out.instance_id = visibleIndices[instance_id];
+    return out;
+}
+
+// the equirect layout the environment bakes read (see IrradienceTexture), +y at v = 0
 fn calculateReflectionUVs(lightDirection: vec3f) -> vec2f {
     let L = normalize(lightDirection);
     let Pi = 3.14159265359;
     // convert to spherical coords
-    let phi = asin(L.y);
-    let theta = atan2(L.z, L.x);
+    let phi = atan2(L.z, L.x);
+    let theta = acos(clamp(L.y, -1.0, 1.0));
 
     // map spherical coords to (0,1) uv space
-    let uv = vec2f((theta + (Pi / 2.0)) / Pi, (phi / Pi));
+    let uv = vec2f(phi / (2.0 * Pi) + 0.5, theta / Pi);
     return uv;
 }
 
+// textures packed into an atlas page tile inside their rect. the gradients come from the
+// unwrapped uv so the mip is picked as before, and the rect is inset by half a texel of
+// the coarser level trilinear filtering reads so nothing bleeds in from the neighbours
+fn sampleMaterialTexture(index: u32, uvTransform: vec4f, uv: vec2f) -> vec4f {
+    let dx = dpdx(uv) * uvTransform.xy;
+    let dy = dpdy(uv) * uvTransform.xy;
+    if (all(uvTransform == vec4f(1.0, 1.0, 0.0, 0.0))) {
+        return textureSampleGrad(textureArray[index], texture_sampler, uv, dx, dy);
+    }
+    let size = vec2f(textureDimensions(textureArray[index]));
+    let texels = max(length(dx * size), length(dy * size));
+    let lod = clamp(ceil(log2(max(texels, 1.0))), 0.0, f32(textureNumLevels(textureArray[index]) - 1u));
+    let inset = 0.5 * exp2(lod) / size;
+    let atlasUV = clamp(fract(uv) * uvTransform.xy + uvTransform.zw, uvTransform.zw + inset, uvTransform.zw + uvTransform.xy - inset);
+    return textureSampleGrad(textureArray[index], texture_sampler, atlasUV, dx, dy);
+}
+
+// the environment's irradiance over pi around a unit normal, same basis as IrradienceTexture::evaluate
+fn shIrradiance(n: vec3f) -> vec3f {
+    let sh = uUniformData.irradiance;
+    var e = sh[0].rgb * 0.282095;
+    e += (sh[1].rgb * n.z + sh[2].rgb * n.y + sh[3].rgb * n.x) * 0.488603;
+    e += (sh[4].rgb * n.x * n.z + sh[5].rgb * n.z * n.y + sh[7].rgb * n.x * n.y) * 1.092548;
+    e += sh[6].rgb * (0.315392 * (3.0 * n.y * n.y - 1.0));
+    e += sh[8].rgb * (0.546274 * (n.x * n.x - n.z * n.z));
+    return max(e, vec3f(0.0));
+}
+
 fn perceivedLuminance(color: vec3f) -> f32 {
     return (color.r * 0.299) + (color.g * 0.587) + (color.b * 0.114);
 }
@@ -86,11 +211,13 @@ fn perceivedLuminance(color: vec3f) -> f32 {
 fn fs_main (in: VertexOutput) -> @location(0) vec4f {
     let modelData = modelBuffer[in.instance_id];
     // materialIndex will be 0 if unset (default material)
-    let materialData = materialBuffer[modelData.materialIndex];
+    let materialData = materialBuffer[materialIndex(modelData)];
     // normalTextureIndex will be 0 if unset (default texture)
-    var normal_sample = textureSample(textureArray[materialData.normalTextureIndex], texture_sampler, in.uv).rgb;
-    if (modelData.isSkybox == 1u) {
-        normal_sample = in.normal;
+    // bc5 normal maps only keep xy, z is rebuilt from the unit length
+    let normalXY = 2.0 * sampleMaterialTexture(materialData.normalTextureIndex, materialData.normalUvTransform, in.uv).rg - 1.0;
+    var tangentN = vec3f(normalXY, sqrt(max(0.0, 1.0 - dot(normalXY, normalXY))));
+    if (isSkybox(modelData)) {
+        tangentN = 2.0 * in.normal - 1.0;
     }
 
     let localToWorld = mat3x3f(
@@ -99,7 +226,7 @@ fn fs_main (in: VertexOutput) -> @location(0) vec4f {
         normalize(in.normal)
     );
     
-    let worldN = localToWorld * (2.0*normal_sample - 1.0);
+    let worldN = localToWorld * tangentN;
     let normalMixBool = materialData.normalTextureIndex == 0u;
     let normalMix = f32(normalMixBool);
     let N = normalize(mix(worldN, in.normal, normalMix));
@@ -116,12 +243,12 @@ fn fs_main (in: VertexOutput) -> @location(0) vec4f {
     let normalUVs = calculateReflectionUVs(N);
     
     // diffuseTextureIndex will be 0 if unset (default texture)
-    var albedo = textureSample(textureArray[materialData.diffuseTextureIndex], texture_sampler, in.uv).rgb;
+    var albedo = sampleMaterialTexture(materialData.diffuseTextureIndex, materialData.diffuseUvTransform, in.uv).rgb;
     let albedoMixBool = materialData.diffuseTextureIndex == 0u;
     let albedoMix = f32(albedoMixBool);
     albedo = mix(albedo, materialData.baseColor * in.color, albedoMix);
 
-    if (modelData.isSkybox == 1u) {
+    if (isSkybox(modelData)) {
         return vec4f(pow(albedo, vec3f(2.2)), 1.0);
     }
 
@@ -130,19 +257,37 @@ fn fs_main (in: VertexOutput) -> @location(0) vec4f {
     let ks = 0.5;
     let ka = 0.2;
 
+    // the shading math runs on gamma encoded colors (see the correction below), so is the baked linear irradiance.
+    // a white environment comes out as 1, what ambient was before one is set
+    var ambientLight = vec3f(1.0);
+    // split sum specular of a dielectric, the prefiltered radiance along the reflection
+    // times the lut's scale and bias to F0. sampled at explicit levels, the skybox return
+    // above leaves uniform control flow
+    var environmentSpecular = vec3f(0.0);
+    if (uUniformData.irradiance[0].w > 0.5) {
+        ambientLight = pow(shIrradiance(N), vec3f(1.0 / 2.2));
+        let roughness = clamp(materialData.roughness, 0.0, 1.0);
+        let lod = roughness * f32(textureNumLevels(specularEnvironment) - 1u);
+        let prefiltered = textureSampleLevel(specularEnvironment, environment_sampler, reflect(-V, N), lod).rgb;
+        let brdf = textureSampleLevel(brdfLut, environment_sampler, vec2f(max(dot(N, V), 0.0), roughness), 0.0).rg;
+        let F0 = 0.04;
+        environmentSpecular = pow(prefiltered * (F0 * brdf.x + brdf.y), vec3f(1.0 / 2.2));
+    }
+
     var color = vec3f(0.0);
     for (var i: i32 = 0; i < 2; i++) { // loop for every light (we do one environment sample)
         var L = normalize(lightPositions[i].xyz);
 
         // let H = normalize(L + V);
 
-        let ambient = albedo;
+        let ambient = ambientLight * albedo;
         let diffuse = max(0.0, dot(N, L)) * albedo;
         // let diffuse = reflectedEnvironmentSample;
         let specular = vec3f(0.0,0.0,0.0);
         // let specular = pow(max(0.0, 1.0 - dot(V, N)), kh) * perceivedLuminance(reflectedRadianceSample) * reflectedEnvironmentSample;
         color += (kd * diffuse) + (ks * specular) + (ka * ambient);
     }
+    color += ks * environmentSpecular;
 
     // color correction
     let linear_color = pow(color, vec3f(2.2));
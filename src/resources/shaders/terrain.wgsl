@@ -265,15 +265,16 @@ fn mapToGradient(value: f32) -> vec3f {
 }
 
 
+// the equirect layout the environment bakes read (see IrradienceTexture), +y at v = 0
 fn calculateReflectionUVs(lightDirection: vec3f) -> vec2f {
     let L = normalize(lightDirection);
     let Pi = 3.14159265359;
     // convert to spherical coords
-    let phi = asin(L.y);
-    let theta = atan2(L.z, L.x);
+    let phi = atan2(L.z, L.x);
+    let theta = acos(clamp(L.y, -1.0, 1.0));
 
     // map spherical coords to (0,1) uv space
-    let uv = vec2f((theta + (Pi / 2.0)) / Pi, (phi / Pi));
+    let uv = vec2f(phi / (2.0 * Pi) + 0.5, theta / Pi);
     return uv;
 }
 
@@ -25,8 +25,13 @@ struct VertexOutput {
     @location(6) instance_id: u32
 }
 
+// InstanceCompression::PackedInstance, 32 bytes
 struct ModelData {
-    transform: mat4x4f,
+    position: vec3f,
+    materialIndex: u32, // the top bit flags the skybox
+    rotation: vec2u,    // snorm16 quaternion xyzw
+    scale: f32,         // x scale, negative when mirrored
+    scaleRatios: u32,   // half floats, y and z scale over the x scale
 }
 
 @group(0) @binding(0) var<uniform> uUniformData: UniformData;
@@ -1,5 +1,7 @@
 #include "Terrain.h"
 #include "../utilities/MeshBuilder.h"
+#include "../utilities/MeshOptimizer.h"
+#include "../utilities/MeshletBuilder.h"
 #include "../ResourceLoader.h"
 #include "../ecs/Entity.h"
 #include "../ecs/components/MeshComponent.h"
@@ -35,6 +37,10 @@ void Terrain::LoadFromImage(std::string path, std::string filename, float width,
         vd.position.y = heightSample * scale;
         vd.color = vec3(heightSample);
     }
+    // the displaced grid is culled per meshlet, hills facing away and chunks off screen are skipped.
+    // the cones come from the triangle positions, the flat plane normals don't matter
+    MeshOptimizer::optimize(terrainMesh, filename);
+    MeshletBuilder::buildMeshlets(terrainMesh);
 
     m_terrain->addComponent<TransformComponent>();
     auto meshComponent = m_terrain->addComponent<MeshComponent>();
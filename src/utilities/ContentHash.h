@@ -0,0 +1,11 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// xxHash64 over a byte range. Four independent lanes of 8 bytes each, so large
+// blobs (pixel data, cooked mip chains) hash at memory speed, several GB/s.
+// Not a cryptographic hash, matches still need to be confirmed.
+class ContentHash {
+public:
+    static uint64_t hash(const void* data, size_t size, uint64_t seed = 0);
+};
@@ -0,0 +1,252 @@
+#include "ImpostorBaker.h"
+#include "ThreadPool.h"
+#include "io/ExportTexture.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace {
+// y is the pole, so the frame looking straight down sits in the middle of the atlas
+glm::vec3 decodeOctahedral(glm::vec2 e) {
+    glm::vec3 n(e.x, e.y, 1.0f - std::abs(e.x) - std::abs(e.y));
+    if (n.z < 0.0f) {
+        float x = n.x;
+        n.x = (1.0f - std::abs(n.y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        n.y = (1.0f - std::abs(x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+    }
+    return glm::normalize(glm::vec3(n.x, n.z, n.y));
+}
+
+glm::vec4 sampleNearest(const coho::Texture& texture, glm::vec2 uv) {
+    uv -= glm::floor(uv); // repeat, like the default sampler
+    int x = std::min((int)(uv.x * texture.width), texture.width - 1);
+    int y = std::min((int)(uv.y * texture.height), texture.height - 1);
+    const unsigned char* texel = &texture.pixelData[((size_t)y * texture.width + x) * texture.channels];
+    glm::vec4 color(texel[0], texel[texture.channels > 1 ? 1 : 0], texel[texture.channels > 2 ? 2 : 0], 255.0f);
+    return color / 255.0f;
+}
+
+unsigned char toUnorm8(float value) {
+    return (unsigned char)std::round(std::clamp(value, 0.0f, 1.0f) * 255.0f);
+}
+}
+
+glm::vec3 ImpostorBaker::frameDirection(uint32_t x, uint32_t y, uint32_t gridSize) {
+    glm::vec2 e = (glm::vec2(x, y) + 0.5f) / (float)gridSize * 2.0f - 1.0f;
+    return decodeOctahedral(e);
+}
+
+void ImpostorBaker::frameBasis(glm::vec3 direction, glm::vec3& right, glm::vec3& up) {
+    glm::vec3 reference = std::abs(direction.y) > 0.999f ? glm::vec3(0.0, 0.0, -1.0) : glm::vec3(0.0, 1.0, 0.0);
+    right = glm::normalize(glm::cross(reference, direction));
+    up = glm::cross(direction, right);
+}
+
+std::shared_ptr<ImpostorAtlas> ImpostorBaker::bake(std::shared_ptr<Mesh> mesh, glm::vec3 baseColor, std::shared_ptr<coho::Texture> diffuse, ImpostorBakeOptions options) {
+    if (!mesh->isIndexed || mesh->m_vertexData.empty()) {
+        std::cout << "can't bake an impostor, the mesh needs indices and full vertex data" << std::endl;
+        return nullptr;
+    }
+    auto atlas = std::make_shared<ImpostorAtlas>();
+    atlas->gridSize = std::max(options.gridSize, 1u);
+    atlas->frameSize = std::max(options.frameSize, 1u);
+
+    // bounding sphere around the bounds center, the billboard has to cover every view
+    const std::vector<Mesh::VertexData>& vertices = mesh->m_vertexData;
+    glm::vec3 low = vertices[0].position;
+    glm::vec3 high = vertices[0].position;
+    for (auto& v : vertices) {
+        low = glm::min(low, v.position);
+        high = glm::max(high, v.position);
+    }
+    atlas->center = (low + high) * 0.5f;
+    for (auto& v : vertices) {
+        atlas->radius = std::max(atlas->radius, glm::length(v.position - atlas->center));
+    }
+    if (atlas->radius <= 0.0f) atlas->radius = 1.0f;
+
+    // a view is at most about half a cell (4pi / gridSize^2 steradians) off its frame,
+    // the flat card is off by the parallax of that angle, or a texel when that's bigger
+    float halfCellAngle = 0.5f * std::sqrt(4.0f * 3.14159265f) / (float)atlas->gridSize;
+    atlas->error = atlas->radius * std::max(std::sin(halfCellAngle), 2.0f / (float)atlas->frameSize);
+
+    uint32_t size = atlas->getSize();
+    atlas->albedo = std::make_shared<coho::Texture>();
+    atlas->normal = std::make_shared<coho::Texture>();
+    for (auto& texture : { atlas->albedo, atlas->normal }) {
+        texture->width = size;
+        texture->height = size;
+        texture->channels = 4;
+        texture->mipLevels = 1; // mips would bleed between frames
+        texture->compress = false; // the normal atlas keeps depth in alpha, bc5 would drop it
+        texture->pixelData = std::vector<unsigned char>((size_t)size * size * 4, 0);
+    }
+
+    Mesh::Lod lod = mesh->getLod(0);
+    std::vector<uint32_t> indices = mesh->getIndexData();
+    indices = std::vector<uint32_t>(indices.begin() + lod.firstIndex, indices.begin() + lod.firstIndex + lod.indexCount);
+
+    uint32_t frameCount = atlas->gridSize * atlas->gridSize;
+    ThreadPool::shared().parallelFor(frameCount, 1, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t frame = begin; frame < end; frame++) {
+            bakeFrame(vertices, indices, baseColor, diffuse, *atlas, frame % atlas->gridSize, frame / atlas->gridSize);
+        }
+    });
+    // bilinear filtering at the silhouette picks up the empty texels, give them the colors next door
+    dilate(*atlas, 2);
+
+    atlas->material = std::make_shared<coho::Material>();
+    atlas->material->name = "impostor";
+    atlas->material->baseColor = baseColor;
+    atlas->material->roughness = 1.0;
+    atlas->material->diffuseTexture = atlas->albedo;
+    atlas->material->normalTexture = atlas->normal;
+
+    std::cout << "baked a " << size << "x" << size << " impostor atlas, " << frameCount << " views, error " << atlas->error << std::endl;
+    return atlas;
+}
+
+void ImpostorBaker::bakeFrame(
+        const std::vector<Mesh::VertexData>& vertices,
+        const std::vector<uint32_t>& indices,
+        glm::vec3 baseColor,
+        std::shared_ptr<coho::Texture> diffuse,
+        ImpostorAtlas& atlas,
+        uint32_t frameX,
+        uint32_t frameY
+        ) {
+    glm::vec3 direction = frameDirection(frameX, frameY, atlas.gridSize);
+    glm::vec3 right, up;
+    frameBasis(direction, right, up);
+
+    // orthographic view over the bounding sphere: x right, y up, z towards the viewer, all in [-1, 1]
+    float frameSize = (float)atlas.frameSize;
+    std::vector<glm::vec3> projected(vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++) {
+        glm::vec3 p = (vertices[i].position - atlas.center) / atlas.radius;
+        float x = glm::dot(p, right);
+        float y = glm::dot(p, up);
+        projected[i] = glm::vec3((x * 0.5f + 0.5f) * frameSize, (0.5f - y * 0.5f) * frameSize, glm::dot(p, direction));
+    }
+
+    std::vector<float> depth((size_t)atlas.frameSize * atlas.frameSize, -2.0f);
+    uint32_t atlasSize = atlas.getSize();
+    for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+        uint32_t i0 = indices[t], i1 = indices[t + 1], i2 = indices[t + 2];
+        glm::vec3 a = projected[i0], b = projected[i1], c = projected[i2];
+        float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+        if (std::abs(area) < 1e-12f) continue;
+
+        int minX = std::max((int)std::floor(std::min(a.x, std::min(b.x, c.x))), 0);
+        int maxX = std::min((int)std::ceil(std::max(a.x, std::max(b.x, c.x))), (int)atlas.frameSize - 1);
+        int minY = std::max((int)std::floor(std::min(a.y, std::min(b.y, c.y))), 0);
+        int maxY = std::min((int)std::ceil(std::max(a.y, std::max(b.y, c.y))), (int)atlas.frameSize - 1);
+
+        // both windings, the card has to show the mesh from every side
+        glm::vec3 faceNormal = glm::cross(vertices[i1].position - vertices[i0].position, vertices[i2].position - vertices[i0].position);
+        for (int y = minY; y <= maxY; y++) {
+            for (int x = minX; x <= maxX; x++) {
+                float px = x + 0.5f, py = y + 0.5f;
+                float w0 = ((b.x - px) * (c.y - py) - (b.y - py) * (c.x - px)) / area;
+                float w1 = ((c.x - px) * (a.y - py) - (c.y - py) * (a.x - px)) / area;
+                float w2 = 1.0f - w0 - w1;
+                if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f) continue;
+
+                float z = w0 * a.z + w1 * b.z + w2 * c.z;
+                float& stored = depth[(size_t)y * atlas.frameSize + x];
+                if (z <= stored) continue;
+                stored = z;
+
+                const Mesh::VertexData& v0 = vertices[i0];
+                const Mesh::VertexData& v1 = vertices[i1];
+                const Mesh::VertexData& v2 = vertices[i2];
+                glm::vec3 normal = w0 * v0.normal + w1 * v1.normal + w2 * v2.normal;
+                if (glm::length(normal) < 1e-6f) normal = faceNormal;
+                normal = glm::normalize(normal);
+
+                glm::vec3 albedo = baseColor * (w0 * v0.color + w1 * v1.color + w2 * v2.color);
+                if (diffuse != nullptr && !diffuse->pixelData.empty()) {
+                    albedo = glm::vec3(sampleNearest(*diffuse, w0 * v0.uv + w1 * v1.uv + w2 * v2.uv));
+                }
+
+                size_t texel = ((size_t)(frameY * atlas.frameSize + y) * atlasSize + frameX * atlas.frameSize + x) * 4;
+                unsigned char* albedoTexel = &atlas.albedo->pixelData[texel];
+                albedoTexel[0] = toUnorm8(albedo.r);
+                albedoTexel[1] = toUnorm8(albedo.g);
+                albedoTexel[2] = toUnorm8(albedo.b);
+                albedoTexel[3] = 255;
+                unsigned char* normalTexel = &atlas.normal->pixelData[texel];
+                normalTexel[0] = toUnorm8(normal.x * 0.5f + 0.5f);
+                normalTexel[1] = toUnorm8(normal.y * 0.5f + 0.5f);
+                normalTexel[2] = toUnorm8(normal.z * 0.5f + 0.5f);
+                normalTexel[3] = toUnorm8(z * 0.5f + 0.5f);
+            }
+        }
+    }
+}
+
+void ImpostorBaker::dilate(ImpostorAtlas& atlas, uint32_t passes) {
+    uint32_t size = atlas.getSize();
+    std::vector<unsigned char> covered(size * size);
+    for (size_t i = 0; i < covered.size(); i++) covered[i] = atlas.albedo->pixelData[i * 4 + 3] > 0;
+
+    for (uint32_t pass = 0; pass < passes; pass++) {
+        std::vector<unsigned char> next = covered;
+        for (uint32_t y = 0; y < size; y++) {
+            for (uint32_t x = 0; x < size; x++) {
+                if (covered[y * size + x]) continue;
+                // stay inside the frame, neighbours across the border belong to another view
+                uint32_t frameX0 = x / atlas.frameSize * atlas.frameSize;
+                uint32_t frameY0 = y / atlas.frameSize * atlas.frameSize;
+                for (int dy = -1; dy <= 1 && !next[y * size + x]; dy++) {
+                    for (int dx = -1; dx <= 1; dx++) {
+                        int nx = (int)x + dx, ny = (int)y + dy;
+                        if (nx < (int)frameX0 || ny < (int)frameY0 || nx >= (int)(frameX0 + atlas.frameSize) || ny >= (int)(frameY0 + atlas.frameSize)) continue;
+                        if (!covered[ny * size + nx]) continue;
+                        size_t from = ((size_t)ny * size + nx) * 4;
+                        size_t to = ((size_t)y * size + x) * 4;
+                        for (int k = 0; k < 3; k++) {
+                            atlas.albedo->pixelData[to + k] = atlas.albedo->pixelData[from + k];
+                            atlas.normal->pixelData[to + k] = atlas.normal->pixelData[from + k];
+                        }
+                        atlas.normal->pixelData[to + 3] = atlas.normal->pixelData[from + 3];
+                        next[y * size + x] = 1; // alpha stays 0, only the color spreads
+                        break;
+                    }
+                }
+            }
+        }
+        covered.swap(next);
+    }
+}
+
+std::shared_ptr<Mesh> ImpostorBaker::createBillboard(std::shared_ptr<ImpostorAtlas> atlas) {
+    if (atlas->material == nullptr || atlas->material->materialIndex < 0) {
+        std::cout << "register the impostor material before creating its billboard" << std::endl;
+        return nullptr;
+    }
+    std::vector<Mesh::VertexData> vertexData(4);
+    glm::vec2 corners[4] = { { 0.0, 0.0 }, { 1.0, 0.0 }, { 1.0, 1.0 }, { 0.0, 1.0 } };
+    for (uint32_t i = 0; i < 4; i++) {
+        vertexData[i].position = atlas->center;
+        vertexData[i].normal = glm::vec3(atlas->radius, (float)atlas->gridSize, (float)atlas->material->materialIndex);
+        vertexData[i].color = glm::vec3(1.0);
+        vertexData[i].tangent = glm::vec3(1.0, 0.0, 0.0);
+        vertexData[i].bitangent = glm::vec3(0.0, 1.0, 0.0);
+        vertexData[i].uv = corners[i];
+    }
+    auto mesh = std::make_shared<Mesh>();
+    mesh->setVertexData(vertexData);
+    mesh->setIndexData({ 0, 1, 2, 0, 2, 3 });
+    return mesh;
+}
+
+bool ImpostorBaker::save(std::shared_ptr<ImpostorAtlas> atlas, std::string path, std::string name) {
+    uint32_t size = atlas->getSize();
+    bool saved = ExportTexture::exportPng(path, name + "_albedo.png", size, size, 4, atlas->albedo->pixelData.data()) != 0;
+    saved = ExportTexture::exportPng(path, name + "_normal.png", size, size, 4, atlas->normal->pixelData.data()) != 0 && saved;
+    if (!saved) {
+        std::cout << "failed to save impostor atlas " << name << " to " << path << std::endl;
+    }
+    return saved;
+}
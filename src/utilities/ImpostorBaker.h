@@ -0,0 +1,72 @@
+#pragma once
+#include "../ecs/components/Mesh.h"
+#include "../ecs/components/Material.h"
+#include "../ecs/components/Texture.h"
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct ImpostorBakeOptions {
+    uint32_t gridSize = 8;   // frames per side, gridSize^2 view directions
+    uint32_t frameSize = 64; // texels per side of a frame
+};
+
+// gridSize x gridSize frames, frame (x, y) shows the mesh seen from the direction
+// at the center of cell (x, y) of the octahedral map of the sphere.
+//  - albedo: rgb what the default shader would light (base color * vertex color or
+//    the diffuse texture), a coverage
+//  - normal: rgb the mesh space normal * 0.5 + 0.5, a depth towards the viewer,
+//    0 at -radius and 1 at +radius from the center
+struct ImpostorAtlas {
+    uint32_t gridSize = 0;
+    uint32_t frameSize = 0;
+    glm::vec3 center = glm::vec3(0.0); // bounding sphere, mesh space
+    float radius = 0.0;
+    float error = 0.0; // mesh space, for LodComponent
+    std::shared_ptr<coho::Texture> albedo;
+    std::shared_ptr<coho::Texture> normal;
+    std::shared_ptr<coho::Material> material; // the two atlases, registered like any material
+    std::shared_ptr<Mesh> billboard;          // shared by every entity drawing this impostor
+
+    uint32_t getSize() { return gridSize * frameSize; }
+};
+
+// Renders meshes into octahedral impostor atlases on the cpu, so it runs offline
+// and without a device. Far instances then draw a camera facing billboard that
+// picks the frame closest to the view direction (see impostor.wgsl).
+class ImpostorBaker {
+public:
+    // baseColor and diffuse follow the mesh material, diffuse can be null
+    static std::shared_ptr<ImpostorAtlas> bake(
+        std::shared_ptr<Mesh> mesh,
+        glm::vec3 baseColor,
+        std::shared_ptr<coho::Texture> diffuse = nullptr,
+        ImpostorBakeOptions options = ImpostorBakeOptions()
+        );
+
+    // the quad drawn for the impostor, its vertices carry what impostor.wgsl needs:
+    // position is the center, uv the corner, normal (radius, gridSize, material index).
+    // the atlas material has to be registered first
+    static std::shared_ptr<Mesh> createBillboard(std::shared_ptr<ImpostorAtlas> atlas);
+
+    // writes <name>_albedo.png and <name>_normal.png
+    static bool save(std::shared_ptr<ImpostorAtlas> atlas, std::string path, std::string name);
+
+    // same mapping and frame basis as impostor.wgsl
+    static glm::vec3 frameDirection(uint32_t x, uint32_t y, uint32_t gridSize);
+    static void frameBasis(glm::vec3 direction, glm::vec3& right, glm::vec3& up);
+
+private:
+    static void bakeFrame(
+        const std::vector<Mesh::VertexData>& vertices,
+        const std::vector<uint32_t>& indices,
+        glm::vec3 baseColor,
+        std::shared_ptr<coho::Texture> diffuse,
+        ImpostorAtlas& atlas,
+        uint32_t frameX,
+        uint32_t frameY
+        );
+    static void dilate(ImpostorAtlas& atlas, uint32_t passes);
+};
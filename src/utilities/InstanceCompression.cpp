@@ -0,0 +1,247 @@
+#include "InstanceCompression.h"
+#include "VertexCompression.h"
+#include <glm/ext.hpp>
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define COHO_INSTANCE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace {
+// both paths do the same operations in the same order and round to nearest even,
+// so they produce identical bits
+inline int16_t quantizeSnorm(float v) {
+    return (int16_t)std::nearbyint(std::min(std::max(v * 32767.0f, -32767.0f), 32767.0f));
+}
+
+void packInstance(const glm::mat4x4& m, uint32_t materialIndex, InstanceCompression::PackedInstance& out) {
+    glm::vec3 c0 = glm::vec3(m[0]), c1 = glm::vec3(m[1]), c2 = glm::vec3(m[2]);
+    float sx = std::sqrt(c0.x * c0.x + c0.y * c0.y + c0.z * c0.z);
+    float sy = std::sqrt(c1.x * c1.x + c1.y * c1.y + c1.z * c1.z);
+    float sz = std::sqrt(c2.x * c2.x + c2.y * c2.y + c2.z * c2.z);
+    // a mirror goes into the x scale, what's left is a proper rotation
+    float det = c0.x * (c1.y * c2.z - c1.z * c2.y) + c0.y * (c1.z * c2.x - c1.x * c2.z) + c0.z * (c1.x * c2.y - c1.y * c2.x);
+    float signedX = det < 0.0f ? -sx : sx;
+    float ix = sx > 0.0f ? 1.0f / signedX : 0.0f;
+    float iy = sy > 0.0f ? 1.0f / sy : 0.0f;
+    float iz = sz > 0.0f ? 1.0f / sz : 0.0f;
+    float m00 = c0.x * ix, m10 = c0.y * ix, m20 = c0.z * ix;
+    float m01 = c1.x * iy, m11 = c1.y * iy, m21 = c1.z * iy;
+    float m02 = c2.x * iz, m12 = c2.y * iz, m22 = c2.z * iz;
+
+    // shepperd: start from the largest of w, x, y, z (the radicands sum to 4, so it's >= 1)
+    float rw = 1.0f + m00 + m11 + m22;
+    float rx = 1.0f + m00 - m11 - m22;
+    float ry = 1.0f - m00 + m11 - m22;
+    float rz = 1.0f - m00 - m11 + m22;
+    bool isW = rw >= rx && rw >= ry && rw >= rz;
+    bool isX = !isW && rx >= ry && rx >= rz;
+    bool isY = !isW && !isX && ry >= rz;
+    float r = isW ? rw : isX ? rx : isY ? ry : rz;
+    float largest = 0.5f * std::sqrt(r);
+    float inverse = 0.25f / largest;
+    float a = m21 - m12, b = m02 - m20, c = m10 - m01; // 4wx, 4wy, 4wz
+    float d = m01 + m10, e = m02 + m20, f = m12 + m21; // 4xy, 4xz, 4yz
+    float qw = isW ? largest : (isX ? a : isY ? b : c) * inverse;
+    float qx = isX ? largest : (isW ? a : isY ? d : e) * inverse;
+    float qy = isY ? largest : (isW ? b : isX ? d : f) * inverse;
+    float qz = (!isW && !isX && !isY) ? largest : (isW ? c : isX ? e : f) * inverse;
+    float flip = qw < 0.0f ? -1.0f : 1.0f;
+
+    out.position = glm::vec3(m[3]);
+    out.materialIndex = materialIndex;
+    out.rotation[0] = quantizeSnorm(qx * flip);
+    out.rotation[1] = quantizeSnorm(qy * flip);
+    out.rotation[2] = quantizeSnorm(qz * flip);
+    out.rotation[3] = quantizeSnorm(qw * flip);
+    out.scale = signedX;
+    float ratio = sx > 0.0f ? 1.0f / sx : 0.0f;
+    out.scaleRatios[0] = VertexCompression::floatToHalf(sy * ratio);
+    out.scaleRatios[1] = VertexCompression::floatToHalf(sz * ratio);
+}
+
+#ifdef COHO_INSTANCE_SSE2
+inline __m128 select4(__m128 mask, __m128 a, __m128 b) {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+// VertexCompression::floatToHalf for four values
+inline __m128i floatToHalf4(__m128 value) {
+    __m128i f = _mm_castps_si128(value);
+    __m128i sign = _mm_and_si128(_mm_srli_epi32(f, 16), _mm_set1_epi32(0x8000));
+    f = _mm_and_si128(f, _mm_set1_epi32(0x7fffffff));
+
+    __m128i tooBig = _mm_cmpgt_epi32(f, _mm_set1_epi32(0x477fffff));
+    __m128i nan = _mm_cmpgt_epi32(f, _mm_set1_epi32(0x7f800000));
+    __m128i big = _mm_or_si128(_mm_and_si128(nan, _mm_set1_epi32(0x7e00)), _mm_andnot_si128(nan, _mm_set1_epi32(0x7c00)));
+
+    __m128i denormal = _mm_cmplt_epi32(f, _mm_set1_epi32(0x38800000));
+    __m128 magic = _mm_castsi128_ps(_mm_set1_epi32(0x3f000000));
+    __m128i small = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(_mm_castsi128_ps(f), magic)), _mm_set1_epi32(0x3f000000));
+
+    __m128i mantissaOdd = _mm_and_si128(_mm_srli_epi32(f, 13), _mm_set1_epi32(1));
+    __m128i normal = _mm_add_epi32(f, _mm_set1_epi32((int32_t)((uint32_t)(15 - 127) << 23) + 0xfff));
+    normal = _mm_srli_epi32(_mm_add_epi32(normal, mantissaOdd), 13);
+
+    __m128i result = _mm_or_si128(_mm_and_si128(denormal, small), _mm_andnot_si128(denormal, normal));
+    result = _mm_or_si128(_mm_and_si128(tooBig, big), _mm_andnot_si128(tooBig, result));
+    return _mm_or_si128(result, sign);
+}
+
+// four instances at a time, transposed to one register per matrix element
+void packInstance4(const glm::mat4x4* m, const uint32_t* materialIndices, InstanceCompression::PackedInstance* out) {
+    alignas(16) int32_t q[4];
+    alignas(16) float values[4];
+    __m128 zero = _mm_setzero_ps();
+    __m128 one = _mm_set1_ps(1.0f);
+
+    __m128 c[3][3];
+    for (int column = 0; column < 3; column++) {
+        for (int row = 0; row < 3; row++) {
+            c[column][row] = _mm_set_ps(m[3][column][row], m[2][column][row], m[1][column][row], m[0][column][row]);
+        }
+    }
+    __m128 s[3];
+    for (int column = 0; column < 3; column++) {
+        s[column] = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(c[column][0], c[column][0]), _mm_mul_ps(c[column][1], c[column][1])), _mm_mul_ps(c[column][2], c[column][2])));
+    }
+    __m128 det = _mm_add_ps(_mm_add_ps(
+        _mm_mul_ps(c[0][0], _mm_sub_ps(_mm_mul_ps(c[1][1], c[2][2]), _mm_mul_ps(c[1][2], c[2][1]))),
+        _mm_mul_ps(c[0][1], _mm_sub_ps(_mm_mul_ps(c[1][2], c[2][0]), _mm_mul_ps(c[1][0], c[2][2])))),
+        _mm_mul_ps(c[0][2], _mm_sub_ps(_mm_mul_ps(c[1][0], c[2][1]), _mm_mul_ps(c[1][1], c[2][0]))));
+    __m128 signedX = select4(_mm_cmplt_ps(det, zero), _mm_sub_ps(zero, s[0]), s[0]);
+    __m128 inverse[3] = {
+        _mm_and_ps(_mm_cmpgt_ps(s[0], zero), _mm_div_ps(one, signedX)),
+        _mm_and_ps(_mm_cmpgt_ps(s[1], zero), _mm_div_ps(one, s[1])),
+        _mm_and_ps(_mm_cmpgt_ps(s[2], zero), _mm_div_ps(one, s[2]))
+    };
+    __m128 m00 = _mm_mul_ps(c[0][0], inverse[0]), m10 = _mm_mul_ps(c[0][1], inverse[0]), m20 = _mm_mul_ps(c[0][2], inverse[0]);
+    __m128 m01 = _mm_mul_ps(c[1][0], inverse[1]), m11 = _mm_mul_ps(c[1][1], inverse[1]), m21 = _mm_mul_ps(c[1][2], inverse[1]);
+    __m128 m02 = _mm_mul_ps(c[2][0], inverse[2]), m12 = _mm_mul_ps(c[2][1], inverse[2]), m22 = _mm_mul_ps(c[2][2], inverse[2]);
+
+    __m128 rw = _mm_add_ps(_mm_add_ps(_mm_add_ps(one, m00), m11), m22);
+    __m128 rx = _mm_sub_ps(_mm_sub_ps(_mm_add_ps(one, m00), m11), m22);
+    __m128 ry = _mm_sub_ps(_mm_add_ps(_mm_sub_ps(one, m00), m11), m22);
+    __m128 rz = _mm_add_ps(_mm_sub_ps(_mm_sub_ps(one, m00), m11), m22);
+    __m128 isW = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(rw, rx), _mm_cmpge_ps(rw, ry)), _mm_cmpge_ps(rw, rz));
+    __m128 isX = _mm_andnot_ps(isW, _mm_and_ps(_mm_cmpge_ps(rx, ry), _mm_cmpge_ps(rx, rz)));
+    __m128 isY = _mm_andnot_ps(_mm_or_ps(isW, isX), _mm_cmpge_ps(ry, rz));
+    __m128 isZ = _mm_andnot_ps(_mm_or_ps(_mm_or_ps(isW, isX), isY), _mm_castsi128_ps(_mm_set1_epi32(-1)));
+    __m128 r = select4(isW, rw, select4(isX, rx, select4(isY, ry, rz)));
+    __m128 largest = _mm_mul_ps(_mm_set1_ps(0.5f), _mm_sqrt_ps(r));
+    __m128 inverseLargest = _mm_div_ps(_mm_set1_ps(0.25f), largest);
+    __m128 a = _mm_sub_ps(m21, m12), b = _mm_sub_ps(m02, m20), cc = _mm_sub_ps(m10, m01);
+    __m128 d = _mm_add_ps(m01, m10), e = _mm_add_ps(m02, m20), f = _mm_add_ps(m12, m21);
+    __m128 qw = select4(isW, largest, _mm_mul_ps(select4(isX, a, select4(isY, b, cc)), inverseLargest));
+    __m128 qx = select4(isX, largest, _mm_mul_ps(select4(isW, a, select4(isY, d, e)), inverseLargest));
+    __m128 qy = select4(isY, largest, _mm_mul_ps(select4(isW, b, select4(isX, d, f)), inverseLargest));
+    __m128 qz = select4(isZ, largest, _mm_mul_ps(select4(isW, cc, select4(isX, e, f)), inverseLargest));
+    __m128 flip = select4(_mm_cmplt_ps(qw, zero), _mm_set1_ps(-1.0f), one);
+
+    __m128 snormScale = _mm_set1_ps(32767.0f);
+    __m128 snormMin = _mm_set1_ps(-32767.0f);
+    __m128 components[4] = { qx, qy, qz, qw };
+    for (int k = 0; k < 4; k++) {
+        __m128 scaled = _mm_mul_ps(_mm_mul_ps(components[k], flip), snormScale);
+        _mm_store_si128((__m128i*)q, _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(scaled, snormMin), snormScale)));
+        for (int i = 0; i < 4; i++) out[i].rotation[k] = (int16_t)q[i];
+    }
+
+    _mm_store_ps(values, signedX);
+    __m128 ratio = _mm_and_ps(_mm_cmpgt_ps(s[0], zero), _mm_div_ps(one, s[0]));
+    for (int i = 0; i < 4; i++) {
+        out[i].position = glm::vec3(m[i][3]);
+        out[i].materialIndex = materialIndices[i];
+        out[i].scale = values[i];
+    }
+    for (int k = 0; k < 2; k++) {
+        _mm_store_si128((__m128i*)q, floatToHalf4(_mm_mul_ps(s[k + 1], ratio)));
+        for (int i = 0; i < 4; i++) out[i].scaleRatios[k] = (uint16_t)q[i];
+    }
+}
+#endif
+}
+
+InstanceCompression::PackedInstance InstanceCompression::pack(glm::mat4x4 transform, uint32_t materialIndex, bool isSkybox) {
+    PackedInstance packed;
+    packInstance(transform, materialIndex | (isSkybox ? SKYBOX_FLAG : 0u), packed);
+    return packed;
+}
+
+void InstanceCompression::pack(const glm::mat4x4* transforms, const uint32_t* materialIndices, size_t count, PackedInstance* out) {
+    size_t i = 0;
+#ifdef COHO_INSTANCE_SSE2
+    for (; i + 4 <= count; i += 4) {
+        packInstance4(&transforms[i], &materialIndices[i], &out[i]);
+    }
+#endif
+    for (; i < count; i++) {
+        packInstance(transforms[i], materialIndices[i], out[i]);
+    }
+}
+
+std::vector<InstanceCompression::PackedInstance> InstanceCompression::pack(const std::vector<glm::mat4x4>& transforms, const std::vector<uint32_t>& materialIndices) {
+    std::vector<PackedInstance> packed(std::min(transforms.size(), materialIndices.size()));
+    pack(transforms.data(), materialIndices.data(), packed.size(), packed.data());
+    return packed;
+}
+
+glm::mat4x4 InstanceCompression::unpack(const PackedInstance& instance) {
+    glm::vec4 q = glm::vec4(instance.rotation[0], instance.rotation[1], instance.rotation[2], instance.rotation[3]) / 32767.0f;
+    glm::vec3 s = glm::vec3(
+        instance.scale,
+        std::abs(instance.scale) * VertexCompression::halfToFloat(instance.scaleRatios[0]),
+        std::abs(instance.scale) * VertexCompression::halfToFloat(instance.scaleRatios[1])
+    );
+    // 2 / |q|^2 instead of 2, the quantized quaternion is only about unit length
+    float n = 2.0f / glm::dot(q, q);
+    float xx = q.x * q.x * n, yy = q.y * q.y * n, zz = q.z * q.z * n;
+    float xy = q.x * q.y * n, xz = q.x * q.z * n, yz = q.y * q.z * n;
+    float wx = q.w * q.x * n, wy = q.w * q.y * n, wz = q.w * q.z * n;
+
+    glm::mat4x4 m(1.0);
+    m[0] = glm::vec4(glm::vec3(1.0f - yy - zz, xy + wz, xz - wy) * s.x, 0.0);
+    m[1] = glm::vec4(glm::vec3(xy - wz, 1.0f - xx - zz, yz + wx) * s.y, 0.0);
+    m[2] = glm::vec4(glm::vec3(xz + wy, yz - wx, 1.0f - xx - yy) * s.z, 0.0);
+    m[3] = glm::vec4(instance.position, 1.0);
+    return m;
+}
+
+glm::vec4 InstanceCompression::transformSphere(const PackedInstance& instance, glm::vec4 sphere) {
+    glm::vec4 q = glm::vec4(instance.rotation[0], instance.rotation[1], instance.rotation[2], instance.rotation[3]);
+    q /= glm::length(q);
+    float ratioY = VertexCompression::halfToFloat(instance.scaleRatios[0]);
+    float ratioZ = VertexCompression::halfToFloat(instance.scaleRatios[1]);
+    glm::vec3 s = glm::vec3(instance.scale, std::abs(instance.scale) * ratioY, std::abs(instance.scale) * ratioZ);
+
+    // v + 2 * cross(q.xyz, cross(q.xyz, v) + w * v) rotates v by the unit quaternion
+    glm::vec3 v = glm::vec3(sphere) * s;
+    glm::vec3 axis = glm::vec3(q);
+    glm::vec3 center = v + 2.0f * glm::cross(axis, glm::cross(axis, v) + q.w * v) + instance.position;
+    float scale = std::abs(instance.scale) * std::max(1.0f, std::max(std::abs(ratioY), std::abs(ratioZ)));
+    return glm::vec4(center, sphere.w * scale);
+}
+
+InstanceCompression::PackingError InstanceCompression::measureError(const std::vector<glm::mat4x4>& transforms, const std::vector<PackedInstance>& packed, float radius) {
+    PackingError error;
+    for (size_t i = 0; i < transforms.size() && i < packed.size(); i++) {
+        const glm::mat4x4& a = transforms[i];
+        glm::mat4x4 b = unpack(packed[i]);
+        for (int corner = 0; corner < 8; corner++) {
+            glm::vec4 p = glm::vec4((corner & 1) ? radius : -radius, (corner & 2) ? radius : -radius, (corner & 4) ? radius : -radius, 1.0);
+            error.position = std::max(error.position, glm::length(glm::vec3(a * p) - glm::vec3(b * p)));
+        }
+        for (int column = 0; column < 3; column++) {
+            glm::vec3 ca = glm::vec3(a[column]), cb = glm::vec3(b[column]);
+            float la = glm::length(ca), lb = glm::length(cb);
+            if (la <= 0.0f || lb <= 0.0f) continue;
+            error.scale = std::max(error.scale, std::abs(lb - la) / la);
+            // atan2 rather than acos, acos can't resolve small angles in float
+            glm::vec3 na = ca / la, nb = cb / lb;
+            error.rotation = std::max(error.rotation, std::atan2(glm::length(glm::cross(na, nb)), glm::dot(na, nb)));
+        }
+    }
+    return error;
+}
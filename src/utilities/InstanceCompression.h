@@ -0,0 +1,42 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Packs per instance model data (a mat4 plus material index and flags, 80 bytes)
+// into 32 bytes: position, a snorm16 quaternion and the scale, which the shaders
+// turn back into the model matrix (modelMatrix() in shader.wgsl).
+// Transforms have to be translation * rotation * scale (Transform builds those),
+// a mirroring transform is stored as a negative x scale. Shear doesn't survive.
+class InstanceCompression {
+public:
+    // matches ModelData in the shaders
+    struct PackedInstance {
+        glm::vec3 position;
+        uint32_t materialIndex; // the top bit flags the skybox
+        int16_t rotation[4];    // unit quaternion xyzw, w >= 0
+        float scale;            // x scale
+        uint16_t scaleRatios[2]; // half floats, y and z scale over the x scale, exact for uniform scales
+    };
+    static const uint32_t SKYBOX_FLAG = 0x80000000u;
+
+    // max error of a round trip
+    struct PackingError {
+        float position = 0.0; // world units, over the corners of a cube of the given radius
+        float rotation = 0.0; // radians
+        float scale = 0.0;    // relative
+    };
+
+    static PackedInstance pack(glm::mat4x4 transform, uint32_t materialIndex, bool isSkybox = false);
+    // the bulk path, four instances per step with sse2. materialIndices include the flags
+    static void pack(const glm::mat4x4* transforms, const uint32_t* materialIndices, size_t count, PackedInstance* out);
+    static std::vector<PackedInstance> pack(const std::vector<glm::mat4x4>& transforms, const std::vector<uint32_t>& materialIndices);
+
+    // the matrix the shaders rebuild
+    static glm::mat4x4 unpack(const PackedInstance& instance);
+    // a mesh space bounding sphere (xyz center, w radius) moved to world space, without building the matrix
+    static glm::vec4 transformSphere(const PackedInstance& instance, glm::vec4 sphere);
+
+    static PackingError measureError(const std::vector<glm::mat4x4>& transforms, const std::vector<PackedInstance>& packed, float radius = 1.0);
+};
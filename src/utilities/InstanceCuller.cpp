@@ -0,0 +1,118 @@
+#include "InstanceCuller.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+// instances per chunk, a chunk never spans two batches
+const uint32_t CHUNK_SIZE = 4096;
+// chunks per parallelFor task, single instance batches make lots of tiny chunks
+const uint32_t CHUNK_GRAIN = 16;
+
+struct Chunk {
+    uint32_t batch;
+    uint32_t begin; // instance of the batch
+    uint32_t end;
+    uint32_t flags; // offset of its visibility flags
+};
+}
+
+void InstanceCuller::extractPlanes(glm::mat4x4 viewProjection, glm::vec4 planes[6]) {
+    // same planes as MeshletBuilder::cull, normalized so the distances compare against radii
+    glm::mat4x4 m = glm::transpose(viewProjection);
+    glm::vec4 raw[6] = { m[3] + m[0], m[3] - m[0], m[3] + m[1], m[3] - m[1], m[3] + m[2], m[3] - m[2] };
+    for (int i = 0; i < 6; i++) {
+        planes[i] = raw[i] / glm::length(glm::vec3(raw[i]));
+    }
+}
+
+bool InstanceCuller::isVisible(glm::vec4 sphere, const glm::vec4 planes[6]) {
+    for (int i = 0; i < 6; i++) {
+        if (glm::dot(glm::vec3(planes[i]), glm::vec3(sphere)) + planes[i].w < -sphere.w) return false;
+    }
+    return true;
+}
+
+void InstanceCuller::cull(
+        const std::vector<InstanceBatch>& batches,
+        const std::vector<InstanceCompression::PackedInstance>& models,
+        glm::mat4x4 viewProjection,
+        std::vector<uint32_t>& visibleIndices,
+        std::vector<VisibleRange>& ranges,
+        std::vector<VisibleRange>& levelRanges,
+        ThreadPool& pool
+        ) {
+    glm::vec4 planes[6];
+    extractPlanes(viewProjection, planes);
+
+    std::vector<Chunk> chunks;
+    std::vector<uint32_t> firstChunks(batches.size() + 1);
+    std::vector<uint32_t> firstLevelRanges(batches.size() + 1);
+    uint32_t instanceCount = 0;
+    uint32_t levelRangeCount = 0;
+    for (uint32_t b = 0; b < (uint32_t)batches.size(); b++) {
+        firstChunks[b] = (uint32_t)chunks.size();
+        firstLevelRanges[b] = levelRangeCount;
+        for (uint32_t begin = 0; begin < batches[b].count; begin += CHUNK_SIZE) {
+            uint32_t end = std::min(begin + CHUNK_SIZE, batches[b].count);
+            chunks.push_back({ b, begin, end, instanceCount + begin });
+        }
+        instanceCount += batches[b].count;
+        levelRangeCount += std::min(std::max(batches[b].levelCount, 1u), MAX_LEVELS);
+    }
+    firstChunks[batches.size()] = (uint32_t)chunks.size();
+    firstLevelRanges[batches.size()] = levelRangeCount;
+
+    // test, one flag per instance (its level + 1, 0 when culled) and a count per chunk and level
+    std::vector<uint8_t> flags(instanceCount);
+    std::vector<uint32_t> offsets(chunks.size() * MAX_LEVELS, 0);
+    pool.parallelFor((uint32_t)chunks.size(), CHUNK_GRAIN, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t c = begin; c < end; c++) {
+            const Chunk& chunk = chunks[c];
+            const InstanceBatch& batch = batches[chunk.batch];
+            uint32_t lastLevel = firstLevelRanges[chunk.batch + 1] - firstLevelRanges[chunk.batch] - 1;
+            uint32_t* counts = offsets.data() + (size_t)c * MAX_LEVELS;
+            for (uint32_t i = chunk.begin; i < chunk.end; i++) {
+                uint32_t model = batch.firstModel + i;
+                bool visible = batch.sphere.w < 0.0f || model >= models.size()
+                    || isVisible(InstanceCompression::transformSphere(models[model], batch.sphere), planes);
+                uint32_t level = batch.levels == nullptr ? 0 : std::min((uint32_t)batch.levels[i], lastLevel);
+                flags[chunk.flags + i - chunk.begin] = visible ? (uint8_t)(level + 1) : 0;
+                counts[level] += visible ? 1 : 0;
+            }
+        }
+    });
+
+    // exclusive prefix sum, level by level within a batch and chunk by chunk within a level.
+    // there are few chunks compared to instances
+    ranges.resize(batches.size());
+    levelRanges.resize(levelRangeCount);
+    uint32_t total = 0;
+    for (size_t b = 0; b < batches.size(); b++) {
+        ranges[b].first = total;
+        for (uint32_t level = 0; level < firstLevelRanges[b + 1] - firstLevelRanges[b]; level++) {
+            VisibleRange& levelRange = levelRanges[firstLevelRanges[b] + level];
+            levelRange.first = total;
+            for (uint32_t c = firstChunks[b]; c < firstChunks[b + 1]; c++) {
+                uint32_t count = offsets[(size_t)c * MAX_LEVELS + level];
+                offsets[(size_t)c * MAX_LEVELS + level] = total;
+                total += count;
+            }
+            levelRange.count = total - levelRange.first;
+        }
+        ranges[b].count = total - ranges[b].first;
+    }
+
+    // scatter, every chunk writes its own range of every level
+    visibleIndices.resize(total);
+    pool.parallelFor((uint32_t)chunks.size(), CHUNK_GRAIN, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t c = begin; c < end; c++) {
+            const Chunk& chunk = chunks[c];
+            uint32_t firstModel = batches[chunk.batch].firstModel;
+            uint32_t* out = offsets.data() + (size_t)c * MAX_LEVELS;
+            for (uint32_t i = chunk.begin; i < chunk.end; i++) {
+                uint8_t flag = flags[chunk.flags + i - chunk.begin];
+                if (flag) visibleIndices[out[flag - 1]++] = firstModel + i;
+            }
+        }
+    });
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include "InstanceCompression.h"
+#include "ThreadPool.h"
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+// instances firstModel .. firstModel + count of the model buffer drawing one mesh
+struct InstanceBatch {
+    uint32_t firstModel;
+    uint32_t count;
+    glm::vec4 sphere; // mesh space bounding sphere, a negative radius is never culled
+    const uint8_t* levels = nullptr; // per instance detail level (see LodSystem), nullptr is all level 0
+    uint32_t levelCount = 1;         // levels past the last one are drawn with it
+};
+
+// where the survivors of a batch ended up in the visible index list
+struct VisibleRange {
+    uint32_t first;
+    uint32_t count;
+};
+
+// Frustum culls instances against their model data and compacts the model indices
+// of the visible ones into one list, batch after batch. The model buffer stays
+// persistent on the gpu, only this list (4 bytes per visible instance) is uploaded
+// per frame and the shaders read modelBuffer[visibleIndices[instance_index]].
+// Batches are cut into chunks, the chunks are tested in parallel, an exclusive
+// prefix sum over the chunk counts gives every chunk its output offset and a
+// second parallel pass scatters the indices.
+// Within a batch the survivors are grouped by detail level, finest first, so every
+// level is one contiguous range drawn with its own mesh. levelRanges holds levelCount
+// ranges per batch, batch after batch, and ranges spans all levels of a batch.
+class InstanceCuller {
+public:
+    static constexpr uint32_t MAX_LEVELS = 8;
+
+    static void cull(
+        const std::vector<InstanceBatch>& batches,
+        const std::vector<InstanceCompression::PackedInstance>& models,
+        glm::mat4x4 viewProjection,
+        std::vector<uint32_t>& visibleIndices,
+        std::vector<VisibleRange>& ranges,
+        std::vector<VisibleRange>& levelRanges,
+        ThreadPool& pool = ThreadPool::shared()
+        );
+
+    // sphere against the normalized frustum planes of extractPlanes
+    static bool isVisible(glm::vec4 sphere, const glm::vec4 planes[6]);
+    static void extractPlanes(glm::mat4x4 viewProjection, glm::vec4 planes[6]);
+};
@@ -0,0 +1,306 @@
+#include "MeshOptimizer.h"
+#include <algorithm>
+#include <iostream>
+
+namespace {
+const uint32_t NONE = UINT32_MAX;
+
+// fifo cache simulation. a vertex is in the cache if fewer than cacheSize
+// misses happened since it was last loaded, so bumping time flushes it.
+struct FifoCache {
+    std::vector<uint32_t> timestamps;
+    uint32_t time;
+    uint32_t size;
+
+    FifoCache(uint32_t vertexCount, uint32_t cacheSize) : timestamps(vertexCount, 0), time(cacheSize + 1), size(cacheSize) {}
+
+    bool access(uint32_t vertex) {
+        if (time - timestamps[vertex] > size) {
+            timestamps[vertex] = time++;
+            return true; // miss
+        }
+        return false;
+    }
+
+    void flush() {
+        time += size + 1;
+    }
+};
+
+// triangles using each vertex, in csr form
+struct TriangleAdjacency {
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> triangles;
+
+    TriangleAdjacency(const std::vector<uint32_t>& indices, uint32_t vertexCount) : offsets(vertexCount + 1, 0), triangles(indices.size()) {
+        for (uint32_t index : indices) offsets[index + 1]++;
+        for (uint32_t v = 0; v < vertexCount; v++) offsets[v + 1] += offsets[v];
+        std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < indices.size(); i++) {
+            triangles[fill[indices[i]]++] = (uint32_t)(i / 3);
+        }
+    }
+};
+}
+
+std::vector<uint32_t> MeshOptimizer::optimizeVertexCache(const std::vector<uint32_t>& indices, uint32_t vertexCount, uint32_t cacheSize) {
+    uint32_t triangleCount = (uint32_t)(indices.size() / 3);
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+    if (triangleCount == 0) return result;
+
+    TriangleAdjacency adjacency(indices, vertexCount);
+    std::vector<uint32_t> live(vertexCount);
+    for (uint32_t v = 0; v < vertexCount; v++) {
+        live[v] = adjacency.offsets[v + 1] - adjacency.offsets[v];
+    }
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<uint32_t> cacheTime(vertexCount, 0);
+    uint32_t time = cacheSize + 1;
+
+    std::vector<uint32_t> deadEnd;
+    std::vector<uint32_t> candidates;
+    uint32_t cursor = 0;
+
+    // next vertex to fan around when the candidates are exhausted: the most recently
+    // used vertex with triangles left, else the next one in input order
+    auto skipDeadEnd = [&]() -> uint32_t {
+        while (!deadEnd.empty()) {
+            uint32_t vertex = deadEnd.back();
+            deadEnd.pop_back();
+            if (live[vertex] > 0) return vertex;
+        }
+        while (cursor < vertexCount) {
+            if (live[cursor] > 0) return cursor;
+            cursor++;
+        }
+        return NONE;
+    };
+
+    uint32_t fanVertex = skipDeadEnd();
+    while (fanVertex != NONE) {
+        candidates.clear();
+        for (uint32_t i = adjacency.offsets[fanVertex]; i < adjacency.offsets[fanVertex + 1]; i++) {
+            uint32_t triangle = adjacency.triangles[i];
+            if (emitted[triangle]) continue;
+            emitted[triangle] = true;
+            for (uint32_t k = 0; k < 3; k++) {
+                uint32_t vertex = indices[triangle * 3 + k];
+                result.push_back(vertex);
+                deadEnd.push_back(vertex);
+                candidates.push_back(vertex);
+                live[vertex]--;
+                if (time - cacheTime[vertex] > cacheSize) {
+                    cacheTime[vertex] = time++;
+                }
+            }
+        }
+
+        // prefer the oldest candidate that will still be in the cache after its fan is emitted
+        uint32_t best = NONE;
+        int64_t bestPriority = -1;
+        for (uint32_t vertex : candidates) {
+            if (live[vertex] == 0) continue;
+            int64_t priority = 0;
+            if (time - cacheTime[vertex] + 2 * live[vertex] <= cacheSize) {
+                priority = time - cacheTime[vertex];
+            }
+            if (priority > bestPriority) {
+                best = vertex;
+                bestPriority = priority;
+            }
+        }
+
+        fanVertex = best != NONE ? best : skipDeadEnd();
+    }
+
+    return result;
+}
+
+std::vector<uint32_t> MeshOptimizer::optimizeOverdraw(
+        const std::vector<uint32_t>& indices,
+        const std::vector<glm::vec3>& positions,
+        uint32_t cacheSize,
+        float threshold
+        ) {
+    uint32_t triangleCount = (uint32_t)(indices.size() / 3);
+    uint32_t vertexCount = (uint32_t)positions.size();
+    if (triangleCount == 0) return indices;
+
+    // cut the cache ordered triangles into clusters. a cluster ends as soon as its acmr,
+    // starting from a cold cache, is within threshold of the acmr of the whole ordering,
+    // so drawing the clusters in any order costs at most about threshold times more misses.
+    float targetAcmr = analyzeVertexCache(indices, vertexCount, cacheSize).acmr * threshold;
+    std::vector<uint32_t> boundaries = { 0 };
+    FifoCache cache(vertexCount, cacheSize);
+    uint32_t misses = 0;
+    uint32_t clusterStart = 0;
+    for (uint32_t t = 0; t < triangleCount; t++) {
+        for (uint32_t k = 0; k < 3; k++) {
+            misses += cache.access(indices[t * 3 + k]) ? 1 : 0;
+        }
+        uint32_t clusterTriangles = t - clusterStart + 1;
+        // a short leftover would pay for a cold cache on its own, keep it attached
+        bool enoughLeft = triangleCount - (t + 1) >= clusterTriangles;
+        if (enoughLeft && (float)misses / (float)clusterTriangles <= targetAcmr) {
+            boundaries.push_back(t + 1);
+            clusterStart = t + 1;
+            misses = 0;
+            cache.flush();
+        }
+    }
+
+    // area weighted centroid and normal of each cluster and of the whole mesh
+    struct Cluster {
+        uint32_t start;
+        uint32_t end;
+        float sortKey;
+    };
+    std::vector<Cluster> sorted(boundaries.size());
+    std::vector<glm::vec3> centroids(boundaries.size(), glm::vec3(0.0));
+    std::vector<glm::vec3> normals(boundaries.size(), glm::vec3(0.0));
+    std::vector<float> areas(boundaries.size(), 0.0);
+    glm::vec3 meshCentroid(0.0);
+    float meshArea = 0.0;
+    for (size_t c = 0; c < boundaries.size(); c++) {
+        sorted[c].start = boundaries[c];
+        sorted[c].end = c + 1 < boundaries.size() ? boundaries[c + 1] : triangleCount;
+        for (uint32_t t = sorted[c].start; t < sorted[c].end; t++) {
+            glm::vec3 p0 = positions[indices[t * 3 + 0]];
+            glm::vec3 p1 = positions[indices[t * 3 + 1]];
+            glm::vec3 p2 = positions[indices[t * 3 + 2]];
+            glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+            float area = glm::length(normal);
+            glm::vec3 centroid = (p0 + p1 + p2) / 3.0f;
+            centroids[c] += centroid * area;
+            normals[c] += normal;
+            areas[c] += area;
+            meshCentroid += centroid * area;
+            meshArea += area;
+        }
+    }
+    if (meshArea > 0.0) meshCentroid /= meshArea;
+
+    // clusters far out along their own normal are likely to occlude the rest, draw them first
+    for (size_t c = 0; c < sorted.size(); c++) {
+        glm::vec3 centroid = areas[c] > 0.0 ? centroids[c] / areas[c] : centroids[c];
+        float normalLength = glm::length(normals[c]);
+        sorted[c].sortKey = normalLength > 0.0 ? glm::dot(centroid - meshCentroid, normals[c] / normalLength) : 0.0f;
+    }
+    std::stable_sort(sorted.begin(), sorted.end(), [](const Cluster& a, const Cluster& b) {
+        return a.sortKey > b.sortKey;
+    });
+
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+    for (auto& cluster : sorted) {
+        result.insert(result.end(), indices.begin() + cluster.start * 3, indices.begin() + cluster.end * 3);
+    }
+    return result;
+}
+
+uint32_t MeshOptimizer::optimizeVertexFetchRemap(const std::vector<uint32_t>& indices, uint32_t vertexCount, std::vector<uint32_t>& remap) {
+    remap.assign(vertexCount, NONE);
+    uint32_t next = 0;
+    for (uint32_t index : indices) {
+        if (remap[index] == NONE) {
+            remap[index] = next++;
+        }
+    }
+    return next;
+}
+
+template<typename T>
+std::vector<T> MeshOptimizer::remapVertices(const std::vector<T>& vertices, const std::vector<uint32_t>& remap, uint32_t newVertexCount) {
+    std::vector<T> result(newVertexCount);
+    for (size_t i = 0; i < vertices.size(); i++) {
+        if (remap[i] != NONE) {
+            result[remap[i]] = vertices[i];
+        }
+    }
+    return result;
+}
+
+VertexCacheStats MeshOptimizer::analyzeVertexCache(const std::vector<uint32_t>& indices, uint32_t vertexCount, uint32_t cacheSize) {
+    VertexCacheStats stats;
+    stats.triangleCount = (uint32_t)(indices.size() / 3);
+
+    FifoCache cache(vertexCount, cacheSize);
+    std::vector<bool> referenced(vertexCount, false);
+    for (uint32_t index : indices) {
+        if (cache.access(index)) stats.misses++;
+        if (!referenced[index]) {
+            referenced[index] = true;
+            stats.vertexCount++;
+        }
+    }
+
+    stats.acmr = stats.triangleCount > 0 ? (float)stats.misses / (float)stats.triangleCount : 0.0f;
+    stats.atvr = stats.vertexCount > 0 ? (float)stats.misses / (float)stats.vertexCount : 0.0f;
+    return stats;
+}
+
+std::vector<glm::vec3> MeshOptimizer::meshPositions(std::shared_ptr<Mesh> mesh) {
+    std::vector<glm::vec3> positions;
+    if (!mesh->m_vertexData.empty()) {
+        positions.reserve(mesh->m_vertexData.size());
+        for (auto& v : mesh->m_vertexData) positions.push_back(v.position);
+    } else {
+        // quantized positions are a uniform scale of the real ones, good enough for sorting
+        positions.reserve(mesh->m_packedVertexData.size());
+        for (auto& v : mesh->m_packedVertexData) positions.push_back(glm::vec3(v.position[0], v.position[1], v.position[2]));
+    }
+    return positions;
+}
+
+bool MeshOptimizer::optimize(std::shared_ptr<Mesh> mesh, MeshOptimizeOptions options) {
+    return optimize(mesh, "mesh", options);
+}
+
+bool MeshOptimizer::optimize(std::shared_ptr<Mesh> mesh, const std::string& name, MeshOptimizeOptions options) {
+    if (!mesh->isIndexed || mesh->getIndexCount() % 3 != 0) {
+        std::cout << "can't optimize " << name << ", it needs an indexed triangle list" << std::endl;
+        return false;
+    }
+    uint32_t vertexCount = (uint32_t)std::max(mesh->m_vertexData.size(), mesh->m_packedVertexData.size());
+    std::vector<uint32_t> indices = mesh->getIndexData();
+    for (uint32_t index : indices) {
+        if (index >= vertexCount) {
+            std::cout << "can't optimize " << name << ", index " << index << " is out of range" << std::endl;
+            return false;
+        }
+    }
+
+    VertexCacheStats before = analyzeVertexCache(indices, vertexCount, options.cacheSize);
+
+    indices = optimizeVertexCache(indices, vertexCount, options.cacheSize);
+    if (options.optimizeOverdraw) {
+        indices = optimizeOverdraw(indices, meshPositions(mesh), options.cacheSize, options.overdrawThreshold);
+    }
+
+    if (options.optimizeVertexFetch) {
+        std::vector<uint32_t> remap;
+        uint32_t newVertexCount = optimizeVertexFetchRemap(indices, vertexCount, remap);
+        for (uint32_t& index : indices) {
+            index = remap[index];
+        }
+        if (!mesh->m_vertexData.empty()) {
+            mesh->setVertexData(remapVertices(mesh->m_vertexData, remap, newVertexCount));
+        }
+        if (!mesh->m_packedVertexData.empty()) {
+            mesh->m_packedVertexData = remapVertices(mesh->m_packedVertexData, remap, newVertexCount);
+        }
+        vertexCount = newVertexCount;
+    }
+    mesh->setIndexData(indices);
+
+    VertexCacheStats after = analyzeVertexCache(indices, vertexCount, options.cacheSize);
+    logStats(name, before, after);
+    return true;
+}
+
+void MeshOptimizer::logStats(const std::string& name, VertexCacheStats before, VertexCacheStats after) {
+    std::cout << "optimized " << name << ": " << after.triangleCount << " triangles, acmr "
+        << before.acmr << " -> " << after.acmr << ", atvr "
+        << before.atvr << " -> " << after.atvr << std::endl;
+}
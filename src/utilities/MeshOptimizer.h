@@ -0,0 +1,56 @@
+#pragma once
+#include "../ecs/components/Mesh.h"
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// post transform cache efficiency of an index buffer, simulated with a fifo cache
+struct VertexCacheStats {
+    uint32_t triangleCount = 0;
+    uint32_t vertexCount = 0; // vertices referenced by the index buffer
+    uint32_t misses = 0;
+    float acmr = 0.0; // average cache miss ratio, misses per triangle (0.5 - 3)
+    float atvr = 0.0; // average transformed vertex ratio, misses per vertex (1 is optimal)
+};
+
+struct MeshOptimizeOptions {
+    uint32_t cacheSize = 16;         // fifo entries the reordering targets
+    bool optimizeOverdraw = true;
+    float overdrawThreshold = 1.05;  // how much worse than the tipsify acmr the overdraw clusters may get
+    bool optimizeVertexFetch = true;
+};
+
+// Reorders the triangles and vertices of indexed meshes before upload:
+//  - Tipsify (Sander et al. 2007) orders triangles for the post transform vertex cache
+//  - its output is cut into clusters which are sorted outside in (Sander's view
+//    independent metric), so front most surfaces tend to be drawn first
+//  - vertices are renumbered in the order the index buffer first touches them
+// None of this changes what is drawn, only the order.
+class MeshOptimizer {
+public:
+    // runs every enabled stage on the mesh, logging acmr/atvr before and after.
+    // has to happen before the mesh is handed to the render module.
+    static bool optimize(std::shared_ptr<Mesh> mesh, MeshOptimizeOptions options = MeshOptimizeOptions());
+    static bool optimize(std::shared_ptr<Mesh> mesh, const std::string& name, MeshOptimizeOptions options = MeshOptimizeOptions());
+
+    static std::vector<uint32_t> optimizeVertexCache(const std::vector<uint32_t>& indices, uint32_t vertexCount, uint32_t cacheSize);
+    // expects indices already ordered by optimizeVertexCache
+    static std::vector<uint32_t> optimizeOverdraw(
+        const std::vector<uint32_t>& indices,
+        const std::vector<glm::vec3>& positions,
+        uint32_t cacheSize,
+        float threshold
+        );
+    // remap[old vertex] = new vertex, unreferenced vertices map to UINT32_MAX. returns the new vertex count.
+    static uint32_t optimizeVertexFetchRemap(const std::vector<uint32_t>& indices, uint32_t vertexCount, std::vector<uint32_t>& remap);
+
+    static VertexCacheStats analyzeVertexCache(const std::vector<uint32_t>& indices, uint32_t vertexCount, uint32_t cacheSize);
+    static void logStats(const std::string& name, VertexCacheStats before, VertexCacheStats after);
+
+private:
+    template<typename T>
+    static std::vector<T> remapVertices(const std::vector<T>& vertices, const std::vector<uint32_t>& remap, uint32_t newVertexCount);
+    static std::vector<glm::vec3> meshPositions(std::shared_ptr<Mesh> mesh);
+};
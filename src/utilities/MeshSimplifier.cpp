@@ -0,0 +1,289 @@
+#include "MeshSimplifier.h"
+#include "MeshOptimizer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+
+namespace {
+// symmetric 4x4 matrix, the sum of squared distances to a set of planes
+struct Quadric {
+    double xx = 0, xy = 0, xz = 0, xw = 0, yy = 0, yz = 0, yw = 0, zz = 0, zw = 0, ww = 0;
+
+    void addPlane(glm::dvec3 n, double d) {
+        xx += n.x * n.x; xy += n.x * n.y; xz += n.x * n.z; xw += n.x * d;
+        yy += n.y * n.y; yz += n.y * n.z; yw += n.y * d;
+        zz += n.z * n.z; zw += n.z * d;
+        ww += d * d;
+    }
+
+    Quadric operator+(const Quadric& o) const {
+        Quadric q;
+        q.xx = xx + o.xx; q.xy = xy + o.xy; q.xz = xz + o.xz; q.xw = xw + o.xw;
+        q.yy = yy + o.yy; q.yz = yz + o.yz; q.yw = yw + o.yw;
+        q.zz = zz + o.zz; q.zw = zw + o.zw;
+        q.ww = ww + o.ww;
+        return q;
+    }
+
+    double evaluate(glm::dvec3 v) const {
+        double result = xx * v.x * v.x + yy * v.y * v.y + zz * v.z * v.z + ww
+            + 2.0 * (xy * v.x * v.y + xz * v.x * v.z + yz * v.y * v.z + xw * v.x + yw * v.y + zw * v.z);
+        return std::max(result, 0.0); // rounding can dip below 0
+    }
+};
+
+struct Collapse {
+    uint32_t from; // position ids
+    uint32_t to;
+    double cost;
+};
+
+// the simplification state, kept between lod levels so each level continues
+// from the previous one and the quadrics remember the original surface
+struct Simplifier {
+    std::vector<uint32_t> indices;
+    std::vector<glm::dvec3> positionValues; // per position id
+    std::vector<uint32_t> positionIds;      // per vertex
+    std::vector<Quadric> quadrics;          // per position id
+    std::vector<uint32_t> remap;            // per vertex, collapses of the current pass
+    double maxCost = 0.0;
+
+    Simplifier(const std::vector<uint32_t>& input, const std::vector<glm::vec3>& positions) : indices(input) {
+        // vertices sharing a position are the wedges of a seam, they're simplified as one
+        std::unordered_map<uint64_t, uint32_t> idsByKey;
+        positionIds.resize(positions.size());
+        for (uint32_t v = 0; v < (uint32_t)positions.size(); v++) {
+            glm::vec3 p = positions[v] + glm::vec3(0.0f); // folds -0 into 0
+            uint64_t key = 14695981039346656037ull;
+            for (int i = 0; i < 3; i++) {
+                uint32_t bits;
+                std::memcpy(&bits, &p[i], sizeof(bits));
+                key = (key ^ bits) * 1099511628211ull;
+            }
+            // a hash collision merges two positions, so confirm the value
+            auto it = idsByKey.find(key);
+            while (it != idsByKey.end() && glm::vec3(positionValues[it->second]) != p) {
+                key++;
+                it = idsByKey.find(key);
+            }
+            if (it == idsByKey.end()) {
+                it = idsByKey.emplace(key, (uint32_t)positionValues.size()).first;
+                positionValues.push_back(glm::dvec3(p));
+            }
+            positionIds[v] = it->second;
+        }
+
+        quadrics.resize(positionValues.size());
+        for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+            glm::dvec3 p0 = positionValues[positionIds[indices[i]]];
+            glm::dvec3 p1 = positionValues[positionIds[indices[i + 1]]];
+            glm::dvec3 p2 = positionValues[positionIds[indices[i + 2]]];
+            glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+            double length = glm::length(normal);
+            if (length <= 0.0) continue;
+            normal /= length;
+            double d = -glm::dot(normal, p0);
+            for (size_t k = 0; k < 3; k++) {
+                quadrics[positionIds[indices[i + k]]].addPlane(normal, d);
+            }
+        }
+        remap.resize(positions.size());
+        for (uint32_t v = 0; v < (uint32_t)remap.size(); v++) remap[v] = v;
+    }
+
+    uint32_t position(size_t corner) const {
+        return positionIds[indices[corner]];
+    }
+
+    float error() const {
+        return (float)std::sqrt(maxCost);
+    }
+
+    void simplify(uint32_t targetIndexCount) {
+        while (indices.size() > targetIndexCount) {
+            if (!collapsePass((uint32_t)(indices.size() - targetIndexCount) / 3)) break;
+        }
+    }
+
+    // collapses the cheapest edges whose neighbourhoods don't overlap, returns false when nothing collapsed
+    bool collapsePass(uint32_t trianglesToRemove) {
+        uint32_t positionCount = (uint32_t)positionValues.size();
+        uint32_t triangleCount = (uint32_t)(indices.size() / 3);
+
+        // triangles around each position, in csr form
+        std::vector<uint32_t> offsets(positionCount + 1, 0);
+        for (size_t i = 0; i < indices.size(); i++) offsets[position(i) + 1]++;
+        for (uint32_t p = 0; p < positionCount; p++) offsets[p + 1] += offsets[p];
+        std::vector<uint32_t> ring(indices.size());
+        std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < indices.size(); i++) ring[fill[position(i)]++] = (uint32_t)(i / 3);
+
+        // an edge used by anything but two triangles is a border or non manifold, its ends stay put
+        std::unordered_map<uint64_t, uint32_t> edgeUses;
+        edgeUses.reserve(indices.size());
+        for (uint32_t t = 0; t < triangleCount; t++) {
+            for (uint32_t k = 0; k < 3; k++) {
+                uint32_t a = position(t * 3 + k);
+                uint32_t b = position(t * 3 + (k + 1) % 3);
+                edgeUses[((uint64_t)std::min(a, b) << 32) | std::max(a, b)]++;
+            }
+        }
+        std::vector<bool> locked(positionCount, false);
+        for (auto& edge : edgeUses) {
+            if (edge.second == 2) continue;
+            locked[(uint32_t)(edge.first >> 32)] = true;
+            locked[(uint32_t)edge.first] = true;
+        }
+
+        std::vector<Collapse> collapses;
+        collapses.reserve(indices.size() * 2);
+        for (uint32_t t = 0; t < triangleCount; t++) {
+            for (uint32_t k = 0; k < 3; k++) {
+                uint32_t a = position(t * 3 + k);
+                uint32_t b = position(t * 3 + (k + 1) % 3);
+                if (a == b) continue;
+                Quadric q = quadrics[a] + quadrics[b];
+                if (!locked[a]) collapses.push_back({ a, b, q.evaluate(positionValues[b]) });
+                if (!locked[b]) collapses.push_back({ b, a, q.evaluate(positionValues[a]) });
+            }
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+        std::vector<bool> touched(positionCount, false);
+        std::unordered_map<uint32_t, uint32_t> wedgeMap;
+        uint32_t removed = 0;
+        for (const Collapse& collapse : collapses) {
+            if (removed >= trianglesToRemove) break;
+            if (touched[collapse.from] || touched[collapse.to]) continue;
+            if (!findWedges(collapse, offsets, ring, wedgeMap)) continue;
+            if (flips(collapse, offsets, ring)) continue;
+
+            for (auto& wedge : wedgeMap) remap[wedge.first] = wedge.second;
+            quadrics[collapse.to] = quadrics[collapse.to] + quadrics[collapse.from];
+            maxCost = std::max(maxCost, collapse.cost);
+
+            // the ring is frozen for the rest of the pass, so the checks above stay valid
+            for (uint32_t i = offsets[collapse.from]; i < offsets[collapse.from + 1]; i++) {
+                uint32_t t = ring[i];
+                bool containsTo = false;
+                for (uint32_t k = 0; k < 3; k++) {
+                    touched[position(t * 3 + k)] = true;
+                    containsTo |= position(t * 3 + k) == collapse.to;
+                }
+                if (containsTo) removed++;
+            }
+        }
+        if (removed == 0) return false;
+
+        std::vector<uint32_t> result;
+        result.reserve(indices.size());
+        for (uint32_t t = 0; t < triangleCount; t++) {
+            uint32_t a = remap[indices[t * 3]];
+            uint32_t b = remap[indices[t * 3 + 1]];
+            uint32_t c = remap[indices[t * 3 + 2]];
+            uint32_t pa = positionIds[a], pb = positionIds[b], pc = positionIds[c];
+            if (pa == pb || pb == pc || pc == pa) continue;
+            result.push_back(a);
+            result.push_back(b);
+            result.push_back(c);
+        }
+        indices.swap(result);
+        return true;
+    }
+
+    // every wedge of the moving position has to slide onto exactly one wedge of the target
+    // through a triangle they share. a seam crossed sideways leaves a wedge without one.
+    bool findWedges(const Collapse& collapse, const std::vector<uint32_t>& offsets, const std::vector<uint32_t>& ring, std::unordered_map<uint32_t, uint32_t>& wedgeMap) {
+        wedgeMap.clear();
+        for (uint32_t i = offsets[collapse.from]; i < offsets[collapse.from + 1]; i++) {
+            uint32_t t = ring[i];
+            uint32_t from = UINT32_MAX;
+            uint32_t to = UINT32_MAX;
+            for (uint32_t k = 0; k < 3; k++) {
+                if (position(t * 3 + k) == collapse.from) from = indices[t * 3 + k];
+                if (position(t * 3 + k) == collapse.to) to = indices[t * 3 + k];
+            }
+            auto it = wedgeMap.find(from);
+            if (it == wedgeMap.end()) {
+                wedgeMap.emplace(from, to);
+            } else if (it->second == UINT32_MAX) {
+                it->second = to;
+            } else if (to != UINT32_MAX && to != it->second) {
+                return false; // one wedge touches two wedges of the target
+            }
+        }
+        for (auto& wedge : wedgeMap) {
+            if (wedge.second == UINT32_MAX) return false;
+        }
+        return true;
+    }
+
+    bool flips(const Collapse& collapse, const std::vector<uint32_t>& offsets, const std::vector<uint32_t>& ring) {
+        for (uint32_t i = offsets[collapse.from]; i < offsets[collapse.from + 1]; i++) {
+            uint32_t t = ring[i];
+            glm::dvec3 before[3];
+            glm::dvec3 after[3];
+            bool containsTo = false;
+            for (uint32_t k = 0; k < 3; k++) {
+                uint32_t p = position(t * 3 + k);
+                containsTo |= p == collapse.to;
+                before[k] = positionValues[p];
+                after[k] = p == collapse.from ? positionValues[collapse.to] : before[k];
+            }
+            if (containsTo) continue; // removed by the collapse
+            glm::dvec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+            glm::dvec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+            if (glm::dot(normalBefore, normalAfter) <= 0.0) return true;
+        }
+        return false;
+    }
+};
+}
+
+std::vector<uint32_t> MeshSimplifier::simplify(const std::vector<uint32_t>& indices, const std::vector<glm::vec3>& positions, uint32_t targetIndexCount, float& error) {
+    Simplifier simplifier(indices, positions);
+    simplifier.simplify(targetIndexCount);
+    error = simplifier.error();
+    return simplifier.indices;
+}
+
+bool MeshSimplifier::buildLodChain(std::shared_ptr<Mesh> mesh, MeshSimplifyOptions options) {
+    return buildLodChain(mesh, "mesh", options);
+}
+
+bool MeshSimplifier::buildLodChain(std::shared_ptr<Mesh> mesh, const std::string& name, MeshSimplifyOptions options) {
+    if (!mesh->isIndexed || mesh->m_vertexData.empty()) {
+        std::cout << "can't simplify " << name << ", the mesh needs indices and full vertex data" << std::endl;
+        return false;
+    }
+    std::vector<glm::vec3> positions;
+    positions.reserve(mesh->m_vertexData.size());
+    for (auto& v : mesh->m_vertexData) positions.push_back(v.position);
+
+    Mesh::Lod full = mesh->getLod(0);
+    std::vector<uint32_t> allIndices = mesh->getIndexData();
+    allIndices.resize(full.firstIndex + full.indexCount); // drop an older chain
+    std::vector<uint32_t> fullIndices(allIndices.begin() + full.firstIndex, allIndices.end());
+
+    std::vector<Mesh::Lod> lods = { full };
+    Simplifier simplifier(fullIndices, positions);
+    std::cout << "lod chain for " << name << ": " << full.indexCount / 3;
+    for (float ratio : options.lodRatios) {
+        uint32_t target = (uint32_t)(full.indexCount / 3 * ratio) * 3;
+        simplifier.simplify(target);
+        // stuck on locked borders and seams, another level would be the same mesh
+        if (simplifier.indices.empty() || simplifier.indices.size() > lods.back().indexCount * options.minReduction) break;
+
+        std::vector<uint32_t> level = MeshOptimizer::optimizeVertexCache(simplifier.indices, (uint32_t)positions.size(), 16);
+        lods.push_back({ (uint32_t)allIndices.size(), (uint32_t)level.size(), simplifier.error() });
+        allIndices.insert(allIndices.end(), level.begin(), level.end());
+        std::cout << " -> " << level.size() / 3 << " (error " << simplifier.error() << ")";
+    }
+    std::cout << " triangles" << std::endl;
+
+    mesh->setIndexData(allIndices);
+    mesh->m_lods = lods;
+    return true;
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "../ecs/components/Mesh.h"
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct MeshSimplifyOptions {
+    std::vector<float> lodRatios = { 0.5f, 0.25f, 0.125f }; // triangles kept per level, of the full mesh
+    float minReduction = 0.9f; // a level has to drop below this share of the previous one or the chain stops
+};
+
+// Quadric error edge collapse simplification (Garland and Heckbert 1997).
+// Collapses are half edge collapses onto existing vertices, so every level reuses
+// the vertex buffer of the full mesh and only needs its own indices.
+//  - vertices at the same position but with different normals or uvs are seams,
+//    a seam only collapses along itself with every side moving together
+//  - border and non manifold edges never move, open meshes keep their outline
+//  - collapses that flip a remaining triangle are rejected
+class MeshSimplifier {
+public:
+    // appends the simplified levels behind the full index data and fills mesh->m_lods.
+    // run after MeshOptimizer and before MeshletBuilder (new index data drops meshlets).
+    static bool buildLodChain(std::shared_ptr<Mesh> mesh, MeshSimplifyOptions options = MeshSimplifyOptions());
+    static bool buildLodChain(std::shared_ptr<Mesh> mesh, const std::string& name, MeshSimplifyOptions options = MeshSimplifyOptions());
+
+    // single level: simplifies towards targetIndexCount, error is the resulting mesh space deviation
+    static std::vector<uint32_t> simplify(
+        const std::vector<uint32_t>& indices,
+        const std::vector<glm::vec3>& positions,
+        uint32_t targetIndexCount,
+        float& error
+        );
+};
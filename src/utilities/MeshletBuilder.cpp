@@ -0,0 +1,194 @@
+#include "MeshletBuilder.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+bool MeshletBuilder::buildMeshlets(std::shared_ptr<Mesh> mesh, uint32_t maxVertices, uint32_t maxTriangles) {
+    if (!mesh->isIndexed || mesh->m_vertexData.empty()) {
+        std::cout << "can't build meshlets, the mesh needs indices and full vertex data" << std::endl;
+        return false;
+    }
+    std::vector<glm::vec3> positions;
+    positions.reserve(mesh->m_vertexData.size());
+    for (auto& v : mesh->m_vertexData) positions.push_back(v.position);
+
+    // only the full level is clustered, simplified levels are drawn whole
+    Mesh::Lod lod = mesh->getLod(0);
+    std::vector<uint32_t> indices = mesh->getIndexData();
+    indices = std::vector<uint32_t>(indices.begin() + lod.firstIndex, indices.begin() + lod.firstIndex + lod.indexCount);
+
+    mesh->m_meshlets = build(positions, indices, maxVertices, maxTriangles);
+    std::cout << "built " << mesh->m_meshlets.size() << " meshlets for " << lod.indexCount / 3 << " triangles" << std::endl;
+    return true;
+}
+
+std::vector<Mesh::Meshlet> MeshletBuilder::build(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices, uint32_t maxVertices, uint32_t maxTriangles) {
+    std::vector<Mesh::Meshlet> meshlets;
+    uint32_t triangleCount = (uint32_t)(indices.size() / 3);
+    if (triangleCount == 0) return meshlets;
+
+    // stamp[v] == current meshlet means v is already counted in it
+    std::vector<uint32_t> stamp(positions.size(), UINT32_MAX);
+    uint32_t current = 0;
+    uint32_t firstTriangle = 0;
+    uint32_t vertexCount = 0;
+
+    for (uint32_t t = 0; t < triangleCount; t++) {
+        uint32_t newVertices = 0;
+        for (uint32_t k = 0; k < 3; k++) {
+            uint32_t v = indices[t * 3 + k];
+            bool repeated = (k > 0 && indices[t * 3] == v) || (k > 1 && indices[t * 3 + 1] == v);
+            if (stamp[v] != current && !repeated) newVertices++;
+        }
+
+        bool full = vertexCount + newVertices > maxVertices || t - firstTriangle + 1 > maxTriangles;
+        if (full && t > firstTriangle) {
+            meshlets.push_back(finish(positions, indices, firstTriangle, t - firstTriangle, vertexCount));
+            current++;
+            firstTriangle = t;
+            vertexCount = 0;
+            t--; // count the triangle again against the empty meshlet
+            continue;
+        }
+
+        for (uint32_t k = 0; k < 3; k++) {
+            uint32_t v = indices[t * 3 + k];
+            if (stamp[v] != current) {
+                stamp[v] = current;
+                vertexCount++;
+            }
+        }
+    }
+    meshlets.push_back(finish(positions, indices, firstTriangle, triangleCount - firstTriangle, vertexCount));
+    return meshlets;
+}
+
+Mesh::Meshlet MeshletBuilder::finish(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices, uint32_t firstTriangle, uint32_t triangleCount, uint32_t vertexCount) {
+    Mesh::Meshlet meshlet;
+    meshlet.firstIndex = firstTriangle * 3;
+    meshlet.indexCount = triangleCount * 3;
+    meshlet.vertexCount = vertexCount;
+
+    std::vector<glm::vec3> points;
+    points.reserve(triangleCount * 3);
+    for (uint32_t i = meshlet.firstIndex; i < meshlet.firstIndex + meshlet.indexCount; i++) {
+        points.push_back(positions[indices[i]]);
+    }
+    boundingSphere(points, meshlet.center, meshlet.radius);
+
+    // the cone uses the geometric normals, vertex normals can be anything (e.g. flat on a heightmap)
+    std::vector<glm::vec3> normals;
+    normals.reserve(triangleCount);
+    glm::vec3 axis(0.0);
+    for (uint32_t i = 0; i < triangleCount; i++) {
+        glm::vec3 p0 = points[i * 3 + 0];
+        glm::vec3 p1 = points[i * 3 + 1];
+        glm::vec3 p2 = points[i * 3 + 2];
+        glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+        float length = glm::length(normal);
+        if (length <= 0.0f) continue; // degenerate, faces nowhere
+        normals.push_back(normal / length);
+        axis += normals.back();
+    }
+
+    meshlet.coneAxis = glm::vec3(0.0, 1.0, 0.0);
+    meshlet.coneCutoff = 1.0;
+    float axisLength = glm::length(axis);
+    if (axisLength <= 0.0f) return meshlet;
+    axis /= axisLength;
+
+    float minDot = 1.0;
+    for (auto& normal : normals) {
+        minDot = std::min(minDot, glm::dot(axis, normal));
+    }
+    meshlet.coneAxis = axis;
+    // a spread of 90 degrees or more faces every direction, it can't be back face culled
+    meshlet.coneCutoff = minDot <= 0.0f ? 1.0f : std::sqrt(1.0f - minDot * minDot);
+    return meshlet;
+}
+
+// Ritter's bounding sphere: start from the most distant pair of axis extremes and grow
+void MeshletBuilder::boundingSphere(const std::vector<glm::vec3>& points, glm::vec3& center, float& radius) {
+    center = glm::vec3(0.0);
+    radius = 0.0;
+    if (points.empty()) return;
+
+    size_t minIndex[3] = { 0, 0, 0 };
+    size_t maxIndex[3] = { 0, 0, 0 };
+    for (size_t i = 0; i < points.size(); i++) {
+        for (int axis = 0; axis < 3; axis++) {
+            if (points[i][axis] < points[minIndex[axis]][axis]) minIndex[axis] = i;
+            if (points[i][axis] > points[maxIndex[axis]][axis]) maxIndex[axis] = i;
+        }
+    }
+    int widest = 0;
+    float widestDistance = 0.0;
+    for (int axis = 0; axis < 3; axis++) {
+        float distance = glm::length(points[maxIndex[axis]] - points[minIndex[axis]]);
+        if (distance > widestDistance) {
+            widest = axis;
+            widestDistance = distance;
+        }
+    }
+    center = (points[minIndex[widest]] + points[maxIndex[widest]]) * 0.5f;
+    radius = widestDistance * 0.5f;
+
+    for (auto& p : points) {
+        float distance = glm::length(p - center);
+        if (distance > radius) {
+            float grown = (radius + distance) * 0.5f;
+            center += (p - center) * ((grown - radius) / distance);
+            radius = grown;
+        }
+    }
+}
+
+uint32_t MeshletBuilder::cull(
+        const std::vector<Mesh::Meshlet>& meshlets,
+        glm::mat4x4 model,
+        glm::mat4x4 viewProjection,
+        glm::vec3 eye,
+        std::vector<uint32_t>& visible
+        ) {
+    // frustum planes in world space (Gribb/Hartmann), normalized so distances are real
+    glm::mat4x4 m = glm::transpose(viewProjection);
+    glm::vec4 planes[6] = { m[3] + m[0], m[3] - m[0], m[3] + m[1], m[3] - m[1], m[3] + m[2], m[3] - m[2] };
+    for (auto& plane : planes) {
+        plane /= glm::length(glm::vec3(plane));
+    }
+
+    // spheres scale with the largest axis, cones only survive rotation and uniform scale
+    float scaleX = glm::length(glm::vec3(model[0]));
+    float scaleY = glm::length(glm::vec3(model[1]));
+    float scaleZ = glm::length(glm::vec3(model[2]));
+    float maxScale = std::max(scaleX, std::max(scaleY, scaleZ));
+    float minScale = std::min(scaleX, std::min(scaleY, scaleZ));
+    bool uniformScale = maxScale > 0.0f && (maxScale - minScale) <= maxScale * 0.001f;
+    glm::mat3x3 rotation = maxScale > 0.0f ? glm::mat3x3(model) / maxScale : glm::mat3x3(1.0);
+
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < (uint32_t)meshlets.size(); i++) {
+        const Mesh::Meshlet& meshlet = meshlets[i];
+        glm::vec3 center = glm::vec3(model * glm::vec4(meshlet.center, 1.0));
+        float radius = meshlet.radius * maxScale;
+
+        bool outside = false;
+        for (auto& plane : planes) {
+            if (glm::dot(glm::vec3(plane), center) + plane.w < -radius) {
+                outside = true;
+                break;
+            }
+        }
+        if (outside) continue;
+
+        if (uniformScale && meshlet.coneCutoff < 1.0f) {
+            glm::vec3 axis = rotation * meshlet.coneAxis;
+            glm::vec3 toCenter = center - eye;
+            if (glm::dot(toCenter, axis) >= meshlet.coneCutoff * glm::length(toCenter) + radius) continue;
+        }
+
+        visible.push_back(i);
+        count++;
+    }
+    return count;
+}
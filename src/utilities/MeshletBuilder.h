@@ -0,0 +1,39 @@
+#pragma once
+#include "../ecs/components/Mesh.h"
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Splits indexed meshes into meshlets (clusters of at most 64 vertices and 124
+// triangles) with a bounding sphere and a normal cone each, and culls them on
+// the cpu. Meshlets are built by scanning the triangles in index order, so run
+// MeshOptimizer first to get compact clusters; the index data isn't reordered.
+class MeshletBuilder {
+public:
+    static const uint32_t MAX_VERTICES = 64;
+    static const uint32_t MAX_TRIANGLES = 124;
+
+    // fills mesh->m_meshlets, needs the full (unpacked) vertex data for the bounds
+    static bool buildMeshlets(std::shared_ptr<Mesh> mesh, uint32_t maxVertices = MAX_VERTICES, uint32_t maxTriangles = MAX_TRIANGLES);
+    static std::vector<Mesh::Meshlet> build(
+        const std::vector<glm::vec3>& positions,
+        const std::vector<uint32_t>& indices,
+        uint32_t maxVertices = MAX_VERTICES,
+        uint32_t maxTriangles = MAX_TRIANGLES
+        );
+
+    // appends the indices of meshlets that are inside the frustum and not back facing.
+    // eye is the world space camera position, model the transform of the mesh.
+    static uint32_t cull(
+        const std::vector<Mesh::Meshlet>& meshlets,
+        glm::mat4x4 model,
+        glm::mat4x4 viewProjection,
+        glm::vec3 eye,
+        std::vector<uint32_t>& visible
+        );
+
+private:
+    static Mesh::Meshlet finish(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices, uint32_t firstTriangle, uint32_t triangleCount, uint32_t vertexCount);
+    static void boundingSphere(const std::vector<glm::vec3>& points, glm::vec3& center, float& radius);
+};
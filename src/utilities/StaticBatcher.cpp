@@ -0,0 +1,171 @@
+#include "StaticBatcher.h"
+#include "MeshOptimizer.h"
+#include "../ecs/components/MeshComponent.h"
+#include "../ecs/components/TransformComponent.h"
+#include "../ecs/components/MaterialComponent.h"
+#include "../ecs/components/InstanceComponent.h"
+#include "../ecs/components/LodComponent.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <tuple>
+
+namespace {
+struct Batch {
+    std::shared_ptr<coho::Material> material;
+    glm::ivec3 cell;
+    std::vector<Mesh::VertexData> vertices;
+    std::vector<uint32_t> indices;
+    glm::vec3 boundsMin = glm::vec3(FLT_MAX);
+    glm::vec3 boundsMax = glm::vec3(-FLT_MAX);
+    uint32_t objectCount = 0;
+};
+}
+
+bool StaticBatcher::canMerge(const std::shared_ptr<Entity>& entity) {
+    if (entity->instanceCount != 1) return false;
+    if (entity->hasComponent<InstanceComponent>() || entity->hasComponent<LodComponent>()) return false;
+    auto meshComponent = entity->getComponent<MeshComponent>();
+    if (meshComponent == nullptr || !entity->hasComponent<TransformComponent>()) return false;
+    return meshComponent->mesh != nullptr && !meshComponent->mesh->m_vertexData.empty();
+}
+
+std::vector<std::shared_ptr<Entity>> StaticBatcher::merge(
+        const std::vector<std::shared_ptr<Entity>>& entities,
+        std::vector<std::shared_ptr<Entity>>& skipped,
+        StaticBatchOptions options
+        ) {
+    // batches in order of first appearance, so the result doesn't depend on pointer values
+    std::vector<Batch> batches;
+    std::map<std::tuple<coho::Material*, int, int, int>, size_t> batchByKey;
+    std::vector<Mesh::VertexData> vertices;
+    std::vector<uint32_t> indices;
+
+    for (auto& entity : entities) {
+        if (!canMerge(entity)) {
+            skipped.push_back(entity);
+            continue;
+        }
+        vertices.clear();
+        indices.clear();
+        glm::vec3 low, high;
+        glm::mat4x4 transform = entity->getComponent<TransformComponent>()->transform->getMatrix();
+        appendTransformed(entity->getComponent<MeshComponent>()->mesh, transform, vertices, indices, low, high);
+        if (indices.empty()) {
+            skipped.push_back(entity);
+            continue;
+        }
+
+        std::shared_ptr<coho::Material> material = nullptr; // default material
+        if (entity->hasComponent<MaterialComponent>()) {
+            material = entity->getComponent<MaterialComponent>()->material;
+        }
+        glm::ivec3 cell = glm::ivec3(glm::floor((low + high) * 0.5f / options.cellSize));
+        auto key = std::make_tuple(material.get(), cell.x, cell.y, cell.z);
+        auto it = batchByKey.find(key);
+        if (it == batchByKey.end()) {
+            it = batchByKey.emplace(key, batches.size()).first;
+            batches.emplace_back();
+            batches.back().material = material;
+            batches.back().cell = cell;
+        }
+
+        Batch& batch = batches[it->second];
+        uint32_t base = (uint32_t)batch.vertices.size();
+        batch.vertices.insert(batch.vertices.end(), vertices.begin(), vertices.end());
+        for (uint32_t index : indices) {
+            batch.indices.push_back(base + index);
+        }
+        batch.boundsMin = glm::min(batch.boundsMin, low);
+        batch.boundsMax = glm::max(batch.boundsMax, high);
+        batch.objectCount++;
+    }
+
+    std::vector<std::shared_ptr<Entity>> merged;
+    uint32_t objectCount = 0;
+    for (auto& batch : batches) {
+        auto mesh = std::make_shared<Mesh>();
+        mesh->setVertexData(batch.vertices);
+        mesh->setIndexData(batch.indices);
+        // no meshlets, a cell is culled by its bounds and drawn as one index range
+        MeshOptimizer::optimize(mesh);
+
+        auto entity = std::make_shared<Entity>();
+        entity->addComponent<TransformComponent>(); // identity, the vertices are in world space
+        entity->addComponent<MeshComponent>()->mesh = mesh;
+        if (batch.material != nullptr) {
+            entity->addComponent<MaterialComponent>()->material = batch.material;
+        }
+        auto cell = entity->addComponent<StaticCellComponent>();
+        cell->cell = batch.cell;
+        cell->boundsMin = batch.boundsMin;
+        cell->boundsMax = batch.boundsMax;
+        cell->objectCount = batch.objectCount;
+        merged.push_back(entity);
+        objectCount += batch.objectCount;
+    }
+
+    std::cout << "merged " << objectCount << " static entities into " << merged.size() << " cells, " << skipped.size() << " skipped" << std::endl;
+    return merged;
+}
+
+void StaticBatcher::appendTransformed(
+        std::shared_ptr<Mesh> mesh,
+        glm::mat4x4 transform,
+        std::vector<Mesh::VertexData>& vertices,
+        std::vector<uint32_t>& indices,
+        glm::vec3& boundsMin,
+        glm::vec3& boundsMax
+        ) {
+    glm::mat3x3 linear = glm::mat3x3(transform);
+    glm::mat3x3 normalMatrix = glm::transpose(glm::inverse(linear));
+    // a mirroring transform flips the winding, swap two corners to keep the front faces
+    bool mirrored = glm::determinant(linear) < 0.0f;
+
+    boundsMin = glm::vec3(FLT_MAX);
+    boundsMax = glm::vec3(-FLT_MAX);
+    for (auto v : mesh->m_vertexData) {
+        v.position = glm::vec3(transform * glm::vec4(v.position, 1.0));
+        v.normal = glm::length(v.normal) > 0.0f ? glm::normalize(normalMatrix * v.normal) : v.normal;
+        v.tangent = glm::length(v.tangent) > 0.0f ? glm::normalize(linear * v.tangent) : v.tangent;
+        v.bitangent = glm::length(v.bitangent) > 0.0f ? glm::normalize(linear * v.bitangent) : v.bitangent;
+        boundsMin = glm::min(boundsMin, v.position);
+        boundsMax = glm::max(boundsMax, v.position);
+        vertices.push_back(v);
+    }
+
+    // the full detail level only, the merged mesh has no lod chain
+    std::vector<uint32_t> source;
+    if (mesh->isIndexed) {
+        Mesh::Lod lod = mesh->getLod(0);
+        std::vector<uint32_t> all = mesh->getIndexData();
+        source.assign(all.begin() + lod.firstIndex, all.begin() + lod.firstIndex + lod.indexCount);
+    } else {
+        uint32_t vertexCount = (uint32_t)mesh->m_vertexData.size();
+        source.resize(vertexCount - vertexCount % 3);
+        for (uint32_t i = 0; i < (uint32_t)source.size(); i++) source[i] = i;
+    }
+    for (size_t t = 0; t + 2 < source.size(); t += 3) {
+        indices.push_back(source[t]);
+        indices.push_back(source[mirrored ? t + 2 : t + 1]);
+        indices.push_back(source[mirrored ? t + 1 : t + 2]);
+    }
+}
+
+bool StaticBatcher::isVisible(const StaticCellComponent& cell, glm::mat4x4 viewProjection) {
+    // same planes as MeshletBuilder::cull, a box is out when its corner furthest along a plane normal is behind it
+    glm::mat4x4 m = glm::transpose(viewProjection);
+    glm::vec4 planes[6] = { m[3] + m[0], m[3] - m[0], m[3] + m[1], m[3] - m[1], m[3] + m[2], m[3] - m[2] };
+    for (auto& plane : planes) {
+        glm::vec3 normal = glm::vec3(plane);
+        glm::vec3 corner = glm::vec3(
+            normal.x >= 0.0f ? cell.boundsMax.x : cell.boundsMin.x,
+            normal.y >= 0.0f ? cell.boundsMax.y : cell.boundsMin.y,
+            normal.z >= 0.0f ? cell.boundsMax.z : cell.boundsMin.z
+        );
+        if (glm::dot(normal, corner) + plane.w < 0.0f) return false;
+    }
+    return true;
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include "../ecs/Entity.h"
+#include "../ecs/components/Mesh.h"
+#include "../ecs/components/Material.h"
+#include "../ecs/components/StaticCellComponent.h"
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+struct StaticBatchOptions {
+    float cellSize = 64.0; // world units per side of a cell
+};
+
+// Merges static entities into one mesh per (material, cell), so scenery costs a
+// draw per cell instead of one per object. Vertices are pre-transformed to world
+// space, an entity goes to the cell its bounds center is in. Cells keep their
+// world bounds (StaticCellComponent), a visible cell is a single indexed draw.
+class StaticBatcher {
+public:
+    // entities with a MeshComponent, a TransformComponent and full vertex data are merged,
+    // instances, lod entities and everything else end up in skipped untouched.
+    // the merged entities have an identity transform and the shared material
+    static std::vector<std::shared_ptr<Entity>> merge(
+        const std::vector<std::shared_ptr<Entity>>& entities,
+        std::vector<std::shared_ptr<Entity>>& skipped,
+        StaticBatchOptions options = StaticBatchOptions()
+        );
+
+    static bool canMerge(const std::shared_ptr<Entity>& entity);
+
+    // cell bounds against the frustum planes of viewProjection
+    static bool isVisible(const StaticCellComponent& cell, glm::mat4x4 viewProjection);
+
+private:
+    // appends the lod 0 triangles of mesh in world space, returns the world bounds
+    static void appendTransformed(
+        std::shared_ptr<Mesh> mesh,
+        glm::mat4x4 transform,
+        std::vector<Mesh::VertexData>& vertices,
+        std::vector<uint32_t>& indices,
+        glm::vec3& boundsMin,
+        glm::vec3& boundsMax
+        );
+};
@@ -0,0 +1,88 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+namespace {
+// set while a thread runs chunks, nested loops run inline instead of waiting on themselves
+thread_local bool t_insideLoop = false;
+}
+
+ThreadPool::ThreadPool(uint32_t workerCount) {
+    if (workerCount == 0) {
+        uint32_t hardwareThreads = std::thread::hardware_concurrency();
+        workerCount = hardwareThreads > 1 ? hardwareThreads - 1 : 0;
+    }
+    for (uint32_t i = 0; i < workerCount; i++) {
+        m_workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+    for (auto& worker : m_workers) {
+        worker.join();
+    }
+}
+
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::parallelFor(uint32_t count, uint32_t grainSize, const std::function<void(uint32_t begin, uint32_t end)>& body) {
+    if (count == 0) return;
+    grainSize = std::max(grainSize, 1u);
+    if (m_workers.empty() || count <= grainSize || t_insideLoop) {
+        body(0, count);
+        return;
+    }
+
+    std::lock_guard<std::mutex> loopLock(m_loopMutex);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_body = &body;
+        m_count = count;
+        m_grainSize = grainSize;
+        m_chunkCount = (count + grainSize - 1) / grainSize;
+        m_doneChunks = 0;
+        m_nextChunk = 0; // last, a late worker of the previous loop may already pick this up
+        m_generation++;
+    }
+    m_wake.notify_all();
+
+    runChunks();
+    while (m_doneChunks.load() < m_chunkCount) {
+        std::this_thread::yield();
+    }
+    m_nextChunk = UINT64_MAX / 2;
+}
+
+void ThreadPool::runChunks() {
+    t_insideLoop = true;
+    while (true) {
+        uint64_t next = m_nextChunk.fetch_add(1);
+        if (next >= m_chunkCount) break;
+        uint32_t chunk = (uint32_t)next;
+        uint32_t begin = chunk * m_grainSize;
+        uint32_t end = std::min(begin + m_grainSize, m_count);
+        (*m_body)(begin, end);
+        m_doneChunks.fetch_add(1);
+    }
+    t_insideLoop = false;
+}
+
+void ThreadPool::workerLoop() {
+    uint64_t seenGeneration = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&]() { return m_stopping || m_generation != seenGeneration; });
+            if (m_stopping) return;
+            seenGeneration = m_generation;
+        }
+        runChunks();
+    }
+}
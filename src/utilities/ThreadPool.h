@@ -0,0 +1,47 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads for data parallel loops. parallelFor cuts
+// [0, count) into chunks of grainSize that the workers and the calling thread
+// pull from a shared counter, and returns once every chunk ran.
+// One loop runs at a time, nested parallelFor calls run inline.
+class ThreadPool {
+public:
+    // 0 uses one worker per hardware thread, minus the caller
+    explicit ThreadPool(uint32_t workerCount = 0);
+    ~ThreadPool();
+
+    // the engine wide pool, created on first use
+    static ThreadPool& shared();
+
+    // workers plus the calling thread
+    uint32_t getThreadCount() { return (uint32_t)m_workers.size() + 1; }
+
+    void parallelFor(uint32_t count, uint32_t grainSize, const std::function<void(uint32_t begin, uint32_t end)>& body);
+
+private:
+    void workerLoop();
+    // runs chunks of the current loop until none are left
+    void runChunks();
+
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::mutex m_loopMutex; // serializes parallelFor callers
+    uint64_t m_generation = 0;
+    bool m_stopping = false;
+
+    const std::function<void(uint32_t, uint32_t)>* m_body = nullptr;
+    uint32_t m_count = 0;
+    uint32_t m_grainSize = 1;
+    std::atomic<uint32_t> m_chunkCount{ 0 };
+    // 64 bit so the increments of late workers never wrap it back into range
+    std::atomic<uint64_t> m_nextChunk{ UINT64_MAX / 2 };
+    std::atomic<uint32_t> m_doneChunks{ 0 };
+};
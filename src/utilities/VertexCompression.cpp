@@ -0,0 +1,340 @@
+#include "VertexCompression.h"
+#include <glm/ext.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define COHO_VERTEX_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace {
+const float PI = 3.14159265358979f;
+
+inline float signNotZero(float v) {
+    return v >= 0.0f ? 1.0f : -1.0f;
+}
+
+// both paths round to nearest even (default mxcsr / fenv), so they produce identical bits
+inline int32_t quantize(float v, float lo, float hi) {
+    return (int32_t)std::nearbyint(std::min(std::max(v, lo), hi));
+}
+
+inline void packPositionNormalColor(const Mesh::VertexData& v, glm::vec3 boundsMin, float scale, Mesh::PackedVertexData& out) {
+    out.position[0] = (uint16_t)quantize((v.position.x - boundsMin.x) * scale, 0.0f, 65535.0f);
+    out.position[1] = (uint16_t)quantize((v.position.y - boundsMin.y) * scale, 0.0f, 65535.0f);
+    out.position[2] = (uint16_t)quantize((v.position.z - boundsMin.z) * scale, 0.0f, 65535.0f);
+
+    float sum = std::abs(v.normal.x) + std::abs(v.normal.y) + std::abs(v.normal.z);
+    float px = sum > 0.0f ? v.normal.x / sum : 0.0f;
+    float py = sum > 0.0f ? v.normal.y / sum : 0.0f;
+    if (v.normal.z < 0.0f) {
+        float fx = (1.0f - std::abs(py)) * signNotZero(px);
+        float fy = (1.0f - std::abs(px)) * signNotZero(py);
+        px = fx;
+        py = fy;
+    }
+    out.normal[0] = (int16_t)quantize(px * 32767.0f, -32767.0f, 32767.0f);
+    out.normal[1] = (int16_t)quantize(py * 32767.0f, -32767.0f, 32767.0f);
+
+    out.color[0] = (uint8_t)quantize(v.color.r * 255.0f, 0.0f, 255.0f);
+    out.color[1] = (uint8_t)quantize(v.color.g * 255.0f, 0.0f, 255.0f);
+    out.color[2] = (uint8_t)quantize(v.color.b * 255.0f, 0.0f, 255.0f);
+}
+
+#ifdef COHO_VERTEX_SSE2
+// four vertices at a time, transposed to one register per component
+inline __m128i quantize4(__m128 v, __m128 lo, __m128 hi) {
+    return _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(v, lo), hi));
+}
+
+inline __m128 abs4(__m128 v) {
+    return _mm_andnot_ps(_mm_set1_ps(-0.0f), v);
+}
+
+inline __m128 signNotZero4(__m128 v) {
+    __m128 positive = _mm_cmpge_ps(v, _mm_setzero_ps());
+    return _mm_or_ps(_mm_and_ps(positive, _mm_set1_ps(1.0f)), _mm_andnot_ps(positive, _mm_set1_ps(-1.0f)));
+}
+
+void packPositionNormalColor4(const Mesh::VertexData* v, glm::vec3 boundsMin, float scale, Mesh::PackedVertexData* out) {
+    alignas(16) int32_t q[4];
+    __m128 zero = _mm_setzero_ps();
+    __m128 scale4 = _mm_set1_ps(scale);
+    __m128 maxPosition = _mm_set1_ps(65535.0f);
+
+    // positions
+    __m128 components[3] = {
+        _mm_set_ps(v[3].position.x, v[2].position.x, v[1].position.x, v[0].position.x),
+        _mm_set_ps(v[3].position.y, v[2].position.y, v[1].position.y, v[0].position.y),
+        _mm_set_ps(v[3].position.z, v[2].position.z, v[1].position.z, v[0].position.z)
+    };
+    for (int c = 0; c < 3; c++) {
+        __m128 local = _mm_mul_ps(_mm_sub_ps(components[c], _mm_set1_ps(boundsMin[c])), scale4);
+        _mm_store_si128((__m128i*)q, quantize4(local, zero, maxPosition));
+        for (int i = 0; i < 4; i++) out[i].position[c] = (uint16_t)q[i];
+    }
+
+    // octahedral normals
+    __m128 nx = _mm_set_ps(v[3].normal.x, v[2].normal.x, v[1].normal.x, v[0].normal.x);
+    __m128 ny = _mm_set_ps(v[3].normal.y, v[2].normal.y, v[1].normal.y, v[0].normal.y);
+    __m128 nz = _mm_set_ps(v[3].normal.z, v[2].normal.z, v[1].normal.z, v[0].normal.z);
+    __m128 sum = _mm_add_ps(_mm_add_ps(abs4(nx), abs4(ny)), abs4(nz));
+    __m128 valid = _mm_cmpgt_ps(sum, zero);
+    __m128 px = _mm_and_ps(valid, _mm_div_ps(nx, sum));
+    __m128 py = _mm_and_ps(valid, _mm_div_ps(ny, sum));
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 fx = _mm_mul_ps(_mm_sub_ps(one, abs4(py)), signNotZero4(px));
+    __m128 fy = _mm_mul_ps(_mm_sub_ps(one, abs4(px)), signNotZero4(py));
+    __m128 lowerHemisphere = _mm_cmplt_ps(nz, zero);
+    px = _mm_or_ps(_mm_and_ps(lowerHemisphere, fx), _mm_andnot_ps(lowerHemisphere, px));
+    py = _mm_or_ps(_mm_and_ps(lowerHemisphere, fy), _mm_andnot_ps(lowerHemisphere, py));
+
+    __m128 snormScale = _mm_set1_ps(32767.0f);
+    __m128 snormMin = _mm_set1_ps(-32767.0f);
+    _mm_store_si128((__m128i*)q, quantize4(_mm_mul_ps(px, snormScale), snormMin, snormScale));
+    for (int i = 0; i < 4; i++) out[i].normal[0] = (int16_t)q[i];
+    _mm_store_si128((__m128i*)q, quantize4(_mm_mul_ps(py, snormScale), snormMin, snormScale));
+    for (int i = 0; i < 4; i++) out[i].normal[1] = (int16_t)q[i];
+
+    // colors
+    __m128 unormScale = _mm_set1_ps(255.0f);
+    __m128 colors[3] = {
+        _mm_set_ps(v[3].color.r, v[2].color.r, v[1].color.r, v[0].color.r),
+        _mm_set_ps(v[3].color.g, v[2].color.g, v[1].color.g, v[0].color.g),
+        _mm_set_ps(v[3].color.b, v[2].color.b, v[1].color.b, v[0].color.b)
+    };
+    for (int c = 0; c < 3; c++) {
+        _mm_store_si128((__m128i*)q, quantize4(_mm_mul_ps(colors[c], unormScale), zero, unormScale));
+        for (int i = 0; i < 4; i++) out[i].color[c] = (uint8_t)q[i];
+    }
+}
+#endif
+}
+
+bool VertexCompression::packMesh(std::shared_ptr<Mesh> mesh) {
+    if (mesh->m_vertexData.empty()) {
+        std::cout << "can't pack a mesh without vertices" << std::endl;
+        return false;
+    }
+    glm::mat4x4 dequantize;
+    std::vector<Mesh::PackedVertexData> packed = pack(mesh->m_vertexData, dequantize);
+    mesh->setPackedVertexData(packed, dequantize);
+    return true;
+}
+
+std::vector<Mesh::PackedVertexData> VertexCompression::pack(const std::vector<Mesh::VertexData>& vertexData, glm::mat4x4& dequantize) {
+    std::vector<Mesh::PackedVertexData> packed(vertexData.size());
+    if (vertexData.empty()) {
+        dequantize = glm::mat4x4(1.0);
+        return packed;
+    }
+
+    glm::vec3 boundsMin = vertexData[0].position;
+    glm::vec3 boundsMax = vertexData[0].position;
+    for (auto& v : vertexData) {
+        boundsMin = glm::min(boundsMin, v.position);
+        boundsMax = glm::max(boundsMax, v.position);
+    }
+    glm::vec3 size = boundsMax - boundsMin;
+    float extent = std::max(size.x, std::max(size.y, size.z));
+    if (extent <= 0.0f) extent = 1.0f;
+    float scale = 65535.0f / extent;
+    dequantize = glm::translate(glm::mat4x4(1.0), boundsMin) * glm::scale(glm::mat4x4(1.0), glm::vec3(extent));
+
+    size_t i = 0;
+#ifdef COHO_VERTEX_SSE2
+    for (; i + 4 <= vertexData.size(); i += 4) {
+        packPositionNormalColor4(&vertexData[i], boundsMin, scale, &packed[i]);
+    }
+#endif
+    for (; i < vertexData.size(); i++) {
+        packPositionNormalColor(vertexData[i], boundsMin, scale, packed[i]);
+    }
+
+    // the tangent frame is built around the decoded normal so it matches what the shader sees
+    for (i = 0; i < vertexData.size(); i++) {
+        const Mesh::VertexData& v = vertexData[i];
+        Mesh::PackedVertexData& p = packed[i];
+        glm::vec3 n = decodeOctahedral(p.normal[0], p.normal[1]);
+        packTangent(v, n, p.position[3]);
+        p.uv[0] = floatToHalf(v.uv.x);
+        p.uv[1] = floatToHalf(v.uv.y);
+        p.color[3] = 255;
+    }
+    return packed;
+}
+
+std::vector<Mesh::VertexData> VertexCompression::unpack(const std::vector<Mesh::PackedVertexData>& packedData, glm::mat4x4 dequantize) {
+    std::vector<Mesh::VertexData> vertexData(packedData.size());
+    for (size_t i = 0; i < packedData.size(); i++) {
+        const Mesh::PackedVertexData& p = packedData[i];
+        Mesh::VertexData& v = vertexData[i];
+
+        glm::vec3 unorm = glm::vec3(p.position[0], p.position[1], p.position[2]) / 65535.0f;
+        v.position = glm::vec3(dequantize * glm::vec4(unorm, 1.0));
+        v.normal = decodeOctahedral(p.normal[0], p.normal[1]);
+
+        glm::vec3 t0, b0;
+        normalBasis(v.normal, t0, b0);
+        float angle = (float)(p.position[3] >> 1) / 32767.0f * 2.0f * PI - PI;
+        float handedness = (p.position[3] & 1) ? -1.0f : 1.0f;
+        v.tangent = std::cos(angle) * t0 + std::sin(angle) * b0;
+        v.bitangent = handedness * glm::cross(v.normal, v.tangent);
+
+        v.uv = glm::vec2(halfToFloat(p.uv[0]), halfToFloat(p.uv[1]));
+        v.color = glm::vec3(p.color[0], p.color[1], p.color[2]) / 255.0f;
+    }
+    return vertexData;
+}
+
+VertexCompression::PackingError VertexCompression::measureError(const std::vector<Mesh::VertexData>& vertexData, const std::vector<Mesh::PackedVertexData>& packedData, glm::mat4x4 dequantize) {
+    PackingError error;
+    std::vector<Mesh::VertexData> unpacked = unpack(packedData, dequantize);
+    for (size_t i = 0; i < vertexData.size() && i < unpacked.size(); i++) {
+        const Mesh::VertexData& a = vertexData[i];
+        const Mesh::VertexData& b = unpacked[i];
+
+        error.position = std::max(error.position, glm::length(a.position - b.position));
+        glm::vec2 uvError = glm::abs(a.uv - b.uv);
+        error.uv = std::max(error.uv, std::max(uvError.x, uvError.y));
+        glm::vec3 colorError = glm::abs(glm::clamp(a.color, 0.0f, 1.0f) - b.color);
+        error.color = std::max(error.color, std::max(colorError.r, std::max(colorError.g, colorError.b)));
+
+        if (glm::length(a.normal) < 1e-6f) continue;
+        glm::vec3 n = glm::normalize(a.normal);
+        error.normal = std::max(error.normal, std::acos(glm::clamp(glm::dot(n, b.normal), -1.0f, 1.0f)));
+
+        glm::vec3 t = b.normal * glm::dot(b.normal, a.tangent);
+        t = a.tangent - t;
+        if (glm::length(t) < 1e-6f) continue;
+        t = glm::normalize(t);
+        error.tangent = std::max(error.tangent, std::acos(glm::clamp(glm::dot(t, b.tangent), -1.0f, 1.0f)));
+
+        float expected = glm::dot(glm::cross(b.normal, t), a.bitangent) < 0.0f ? -1.0f : 1.0f;
+        float actual = glm::dot(glm::cross(b.normal, b.tangent), b.bitangent) < 0.0f ? -1.0f : 1.0f;
+        if (expected != actual) error.handedness = false;
+    }
+    return error;
+}
+
+bool VertexCompression::validate(const std::vector<Mesh::VertexData>& vertexData) {
+    glm::mat4x4 dequantize;
+    std::vector<Mesh::PackedVertexData> packed = pack(vertexData, dequantize);
+    PackingError error = measureError(vertexData, packed, dequantize);
+
+    float maxUV = 0.0f;
+    for (auto& v : vertexData) {
+        maxUV = std::max(maxUV, std::max(std::abs(v.uv.x), std::abs(v.uv.y)));
+    }
+
+    // half a quantization step per axis, plus float slop
+    float extent = dequantize[0][0];
+    float positionTolerance = 0.5f * extent / 65535.0f * std::sqrt(3.0f) + extent * 1e-6f;
+    float normalTolerance = 0.001f;
+    float tangentTolerance = PI / 32767.0f + normalTolerance;
+    float uvTolerance = std::max(maxUV, 1.0f / 16384.0f) / 2048.0f; // half has 11 significant bits
+    float colorTolerance = 0.5f / 255.0f + 1e-6f;
+
+    bool valid = true;
+    auto check = [&valid](const char* name, float value, float tolerance) {
+        if (value > tolerance) {
+            std::cout << "packed vertex " << name << " error " << value << " exceeds " << tolerance << std::endl;
+            valid = false;
+        }
+    };
+    check("position", error.position, positionTolerance);
+    check("normal", error.normal, normalTolerance);
+    check("tangent", error.tangent, tangentTolerance);
+    check("uv", error.uv, uvTolerance);
+    check("color", error.color, colorTolerance);
+    if (!error.handedness) {
+        std::cout << "packed vertex bitangent sign flipped" << std::endl;
+        valid = false;
+    }
+    return valid;
+}
+
+// round to nearest even, overflow goes to inf
+uint16_t VertexCompression::floatToHalf(float value) {
+    uint32_t f;
+    std::memcpy(&f, &value, sizeof(f));
+    uint16_t sign = (uint16_t)((f >> 16) & 0x8000);
+    f &= 0x7fffffff;
+
+    if (f >= 0x47800000) { // too big for a half, or inf/nan
+        return sign | (f > 0x7f800000 ? 0x7e00 : 0x7c00);
+    }
+    if (f < 0x38800000) { // half denormal, let the fpu do the rounding
+        float magic;
+        uint32_t magicBits = 0x3f000000;
+        std::memcpy(&magic, &magicBits, sizeof(magic));
+        float shifted;
+        std::memcpy(&shifted, &f, sizeof(shifted));
+        shifted += magic;
+        uint32_t bits;
+        std::memcpy(&bits, &shifted, sizeof(bits));
+        return sign | (uint16_t)(bits - magicBits);
+    }
+    uint32_t mantissaOdd = (f >> 13) & 1;
+    f += ((uint32_t)(15 - 127) << 23) + 0xfff;
+    f += mantissaOdd;
+    return sign | (uint16_t)(f >> 13);
+}
+
+float VertexCompression::halfToFloat(uint16_t value) {
+    uint32_t sign = (uint32_t)(value & 0x8000) << 16;
+    uint32_t exponent = (value >> 10) & 0x1f;
+    uint32_t mantissa = value & 0x3ff;
+    uint32_t bits;
+    if (exponent == 0) {
+        float denormal = (float)mantissa * (1.0f / 16777216.0f); // 2^-24
+        return sign ? -denormal : denormal;
+    } else if (exponent == 31) {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    } else {
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+    float result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+void VertexCompression::packTangent(Mesh::VertexData vertex, glm::vec3 decodedNormal, uint16_t& word) {
+    glm::vec3 n = decodedNormal;
+    glm::vec3 t = vertex.tangent - n * glm::dot(n, vertex.tangent);
+    if (glm::length(t) < 1e-8f) {
+        word = 0;
+        return;
+    }
+    t = glm::normalize(t);
+
+    glm::vec3 t0, b0;
+    normalBasis(n, t0, b0);
+    float angle = std::atan2(glm::dot(t, b0), glm::dot(t, t0));
+    uint32_t quantized = (uint32_t)quantize((angle + PI) / (2.0f * PI) * 32767.0f, 0.0f, 32767.0f);
+    uint32_t flipped = glm::dot(glm::cross(n, t), vertex.bitangent) < 0.0f ? 1 : 0;
+    word = (uint16_t)((quantized << 1) | flipped);
+}
+
+// mirrors decodeOctahedral in shader.wgsl
+glm::vec3 VertexCompression::decodeOctahedral(int16_t x, int16_t y) {
+    float fx = std::max((float)x / 32767.0f, -1.0f);
+    float fy = std::max((float)y / 32767.0f, -1.0f);
+    glm::vec3 n = glm::vec3(fx, fy, 1.0f - std::abs(fx) - std::abs(fy));
+    float t = std::max(-n.z, 0.0f);
+    n.x += n.x >= 0.0f ? -t : t;
+    n.y += n.y >= 0.0f ? -t : t;
+    return glm::normalize(n);
+}
+
+// branchless orthonormal basis (Duff et al. 2017), mirrors normalBasis in shader.wgsl
+void VertexCompression::normalBasis(glm::vec3 n, glm::vec3& t0, glm::vec3& b0) {
+    float sign = n.z >= 0.0f ? 1.0f : -1.0f;
+    float a = -1.0f / (sign + n.z);
+    float b = n.x * n.y * a;
+    t0 = glm::vec3(1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+    b0 = glm::vec3(b, sign + n.y * n.y * a, -n.y);
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include "../ecs/components/Mesh.h"
+#include <glm/glm.hpp>
+#include <memory>
+#include <vector>
+
+// Packs Mesh::VertexData (68 bytes) into Mesh::PackedVertexData (20 bytes):
+//  - position quantized to 16 bits inside a cube around the mesh bounds
+//  - octahedral normal
+//  - tangent stored as an angle around the normal plus the bitangent sign
+//  - half float uvs and 8 bit color
+// The bounds cube is uniform so the dequantize transform can be folded into the
+// model transform without skewing normals.
+class VertexCompression {
+public:
+    // max error of each attribute after a round trip
+    struct PackingError {
+        float position = 0.0; // mesh space units
+        float normal = 0.0;   // radians
+        float tangent = 0.0;  // radians, against the tangent orthogonalized to the normal
+        float uv = 0.0;
+        float color = 0.0;
+        bool handedness = true; // all bitangent signs survived
+    };
+
+    static bool packMesh(std::shared_ptr<Mesh> mesh);
+    static std::vector<Mesh::PackedVertexData> pack(const std::vector<Mesh::VertexData>& vertexData, glm::mat4x4& dequantize);
+    static std::vector<Mesh::VertexData> unpack(const std::vector<Mesh::PackedVertexData>& packedData, glm::mat4x4 dequantize);
+
+    static PackingError measureError(const std::vector<Mesh::VertexData>& vertexData, const std::vector<Mesh::PackedVertexData>& packedData, glm::mat4x4 dequantize);
+    // checks a round trip against the expected quantization error, returns false and logs if it's off
+    static bool validate(const std::vector<Mesh::VertexData>& vertexData);
+
+    static uint16_t floatToHalf(float value);
+    static float halfToFloat(uint16_t value);
+
+private:
+    static void packTangent(Mesh::VertexData vertex, glm::vec3 decodedNormal, uint16_t& word);
+    static glm::vec3 decodeOctahedral(int16_t x, int16_t y);
+    static void normalBasis(glm::vec3 n, glm::vec3& t0, glm::vec3& b0);
+};
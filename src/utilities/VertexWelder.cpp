@@ -0,0 +1,170 @@
+#include "VertexWelder.h"
+#include <glm/ext.hpp>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+
+using VertexData = Mesh::VertexData;
+
+namespace {
+inline uint64_t mix(uint64_t hash, uint64_t value) {
+    // fnv-1a over the 8 bytes of value
+    for (int i = 0; i < 8; i++) {
+        hash ^= (value >> (i * 8)) & 0xff;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+inline uint32_t floatBits(float v) {
+    v += 0.0f; // -0 -> +0, they compare equal so they have to hash equal
+    uint32_t bits;
+    std::memcpy(&bits, &v, sizeof(bits));
+    return bits;
+}
+
+inline bool near(glm::vec3 a, glm::vec3 b, float epsilon) {
+    glm::vec3 d = glm::abs(a - b);
+    return d.x <= epsilon && d.y <= epsilon && d.z <= epsilon;
+}
+
+inline bool near(glm::vec2 a, glm::vec2 b, float epsilon) {
+    glm::vec2 d = glm::abs(a - b);
+    return d.x <= epsilon && d.y <= epsilon;
+}
+}
+
+bool VertexWelder::matches(const VertexData& a, const VertexData& b, VertexWeldOptions options) {
+    return near(a.position, b.position, options.positionEpsilon)
+        && near(a.normal, b.normal, options.normalEpsilon)
+        && near(a.uv, b.uv, options.uvEpsilon)
+        && a.color == b.color;
+}
+
+uint64_t VertexWelder::hashCell(int64_t x, int64_t y, int64_t z) {
+    uint64_t hash = 14695981039346656037ull;
+    hash = mix(hash, (uint64_t)x);
+    hash = mix(hash, (uint64_t)y);
+    hash = mix(hash, (uint64_t)z);
+    return hash;
+}
+
+uint64_t VertexWelder::hashExact(const VertexData& vertex) {
+    uint64_t hash = 14695981039346656037ull;
+    hash = mix(hash, ((uint64_t)floatBits(vertex.position.x) << 32) | floatBits(vertex.position.y));
+    hash = mix(hash, floatBits(vertex.position.z));
+    return hash;
+}
+
+VertexWeldStats VertexWelder::weld(
+        const std::vector<VertexData>& vertexData,
+        std::vector<VertexData>& uniqueVertices,
+        std::vector<uint32_t>& indices,
+        VertexWeldOptions options
+        ) {
+    VertexWeldStats stats;
+    stats.inputVertexCount = (uint32_t)vertexData.size();
+
+    uniqueVertices.clear();
+    indices.clear();
+    indices.reserve(vertexData.size());
+
+    // unique vertices are bucketed by position only, the other attributes are compared in the bucket.
+    // with a position epsilon the buckets are grid cells of that size and the neighbouring cells
+    // are searched too, so two vertices within epsilon are always found whatever cell they land in.
+    bool snapped = options.positionEpsilon > 0.0;
+    float cellScale = snapped ? 1.0f / options.positionEpsilon : 0.0f;
+    std::unordered_map<uint64_t, std::vector<uint32_t>> buckets;
+    buckets.reserve(vertexData.size());
+
+    // merged corners contribute to the tangent frame of the vertex they were welded into
+    std::vector<glm::vec3> tangentSums;
+    std::vector<glm::vec3> bitangentSums;
+
+    for (const VertexData& vertex : vertexData) {
+        uint32_t found = UINT32_MAX;
+        uint64_t ownKey = 0;
+        if (snapped) {
+            glm::vec3 cell = glm::floor(vertex.position * cellScale);
+            int64_t cx = (int64_t)cell.x, cy = (int64_t)cell.y, cz = (int64_t)cell.z;
+            ownKey = hashCell(cx, cy, cz);
+            for (int64_t dz = -1; dz <= 1 && found == UINT32_MAX; dz++) {
+                for (int64_t dy = -1; dy <= 1 && found == UINT32_MAX; dy++) {
+                    for (int64_t dx = -1; dx <= 1 && found == UINT32_MAX; dx++) {
+                        auto bucket = buckets.find(hashCell(cx + dx, cy + dy, cz + dz));
+                        if (bucket == buckets.end()) continue;
+                        for (uint32_t candidate : bucket->second) {
+                            if (matches(uniqueVertices[candidate], vertex, options)) {
+                                found = candidate;
+                                break;
+                            }
+                        }
+                    }
+                }
+            }
+        } else {
+            ownKey = hashExact(vertex);
+            auto bucket = buckets.find(ownKey);
+            if (bucket != buckets.end()) {
+                for (uint32_t candidate : bucket->second) {
+                    if (matches(uniqueVertices[candidate], vertex, options)) {
+                        found = candidate;
+                        break;
+                    }
+                }
+            }
+        }
+
+        if (found == UINT32_MAX) {
+            found = (uint32_t)uniqueVertices.size();
+            uniqueVertices.push_back(vertex);
+            tangentSums.push_back(vertex.tangent);
+            bitangentSums.push_back(vertex.bitangent);
+            buckets[ownKey].push_back(found);
+        } else {
+            tangentSums[found] += vertex.tangent;
+            bitangentSums[found] += vertex.bitangent;
+        }
+        indices.push_back(found);
+    }
+
+    // re-orthonormalize the averaged frames against the kept normal, keeping the handedness
+    for (size_t i = 0; i < uniqueVertices.size(); i++) {
+        VertexData& vertex = uniqueVertices[i];
+        glm::vec3 n = vertex.normal;
+        glm::vec3 t = tangentSums[i] - glm::dot(tangentSums[i], n) * n;
+        if (glm::length(t) < 1e-6f) continue; // the corners cancelled out, keep the first one's frame
+        t = glm::normalize(t);
+        glm::vec3 b = glm::cross(n, t);
+        if (glm::dot(b, bitangentSums[i]) < 0.0f) b = -b;
+        vertex.tangent = t;
+        vertex.bitangent = b;
+    }
+
+    stats.outputVertexCount = (uint32_t)uniqueVertices.size();
+    stats.fitsIndex16 = fitsIndex16(stats.outputVertexCount);
+    return stats;
+}
+
+VertexWeldStats VertexWelder::weld(std::vector<VertexData>& vertexData, std::vector<uint32_t>& indices, VertexWeldOptions options) {
+    std::vector<VertexData> uniqueVertices;
+    VertexWeldStats stats = weld(vertexData, uniqueVertices, indices, options);
+    vertexData = std::move(uniqueVertices);
+    return stats;
+}
+
+std::vector<uint16_t> VertexWelder::toIndex16(const std::vector<uint32_t>& indices) {
+    std::vector<uint16_t> narrow(indices.size());
+    for (size_t i = 0; i < indices.size(); i++) {
+        narrow[i] = (uint16_t)indices[i];
+    }
+    return narrow;
+}
+
+void VertexWelder::logStats(const std::string& name, VertexWeldStats stats) {
+    float ratio = stats.inputVertexCount > 0 ? (float)stats.outputVertexCount / (float)stats.inputVertexCount : 1.0f;
+    std::cout << "welded " << name << ": " << stats.inputVertexCount << " -> " << stats.outputVertexCount
+        << " vertices (" << (int)std::round((1.0f - ratio) * 100.0f) << "% fewer), "
+        << (stats.fitsIndex16 ? "16" : "32") << " bit indices" << std::endl;
+}
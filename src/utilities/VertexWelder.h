@@ -0,0 +1,45 @@
+#pragma once
+#include "../ecs/components/Mesh.h"
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Turns triangle soup (every face corner its own vertex) into unique vertices
+// plus an index buffer. Vertices are matched on position, normal, uv and color,
+// exactly by default or within the given epsilons. Tangent frames aren't part
+// of the key, they are averaged over the merged corners and re-orthonormalized.
+struct VertexWeldOptions {
+    float positionEpsilon = 0.0; // mesh space units
+    float normalEpsilon = 0.0;   // per component
+    float uvEpsilon = 0.0;
+};
+
+struct VertexWeldStats {
+    uint32_t inputVertexCount = 0;
+    uint32_t outputVertexCount = 0;
+    bool fitsIndex16 = false; // every index fits into a uint16
+};
+
+class VertexWelder {
+public:
+    static VertexWeldStats weld(
+        const std::vector<Mesh::VertexData>& vertexData,
+        std::vector<Mesh::VertexData>& uniqueVertices,
+        std::vector<uint32_t>& indices,
+        VertexWeldOptions options = VertexWeldOptions()
+        );
+    // welds in place, vertexData is replaced by the unique vertices
+    static VertexWeldStats weld(std::vector<Mesh::VertexData>& vertexData, std::vector<uint32_t>& indices, VertexWeldOptions options = VertexWeldOptions());
+
+    static bool fitsIndex16(uint32_t vertexCount) { return vertexCount <= UINT16_MAX; };
+    // only valid when every index is below 65536, see fitsIndex16
+    static std::vector<uint16_t> toIndex16(const std::vector<uint32_t>& indices);
+
+    static void logStats(const std::string& name, VertexWeldStats stats);
+
+private:
+    static bool matches(const Mesh::VertexData& a, const Mesh::VertexData& b, VertexWeldOptions options);
+    static uint64_t hashCell(int64_t x, int64_t y, int64_t z);
+    static uint64_t hashExact(const Mesh::VertexData& vertex);
+};
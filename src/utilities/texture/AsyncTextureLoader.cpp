@@ -0,0 +1,199 @@
+#include "AsyncTextureLoader.h"
+#include "../../stb_image.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace fs = std::filesystem;
+
+namespace {
+bool readFile(const std::string& filename, std::vector<uint8_t>& buffer) {
+    std::ifstream file(filename, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!file.is_open()) return false;
+    std::streamsize size = file.tellg();
+    if (size <= 0) return false;
+    buffer.resize((size_t)size); // a pooled buffer only grows
+    file.seekg(0, std::ios::beg);
+    return (bool)file.read((char*)buffer.data(), size);
+}
+}
+
+AsyncTextureLoader::AsyncTextureLoader(uint32_t threadCount, size_t memoryBudget) : m_memoryBudget(memoryBudget) {
+    for (uint32_t i = 0; i < std::max(threadCount, 1u); i++) {
+        m_threads.emplace_back(&AsyncTextureLoader::workerLoop, this);
+    }
+}
+
+AsyncTextureLoader::~AsyncTextureLoader() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+    m_budget.notify_all();
+    for (auto& thread : m_threads) {
+        thread.join();
+    }
+}
+
+void AsyncTextureLoader::load(std::shared_ptr<coho::Texture> texture, const std::string& path, const std::string& filename, MippedTexture::CookOptions options) {
+    texture->loading = true;
+    Job job;
+    job.texture = texture;
+    job.source = path + std::string("/") + filename;
+    job.options = options;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.push_back(std::move(job));
+    }
+    m_wake.notify_one();
+}
+
+std::vector<std::shared_ptr<coho::Texture>> AsyncTextureLoader::drain(uint32_t maxCount) {
+    std::vector<Job> jobs;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        while (!m_finished.empty() && jobs.size() < maxCount) {
+            jobs.push_back(std::move(m_finished.front()));
+            m_finished.pop_front();
+        }
+    }
+
+    std::vector<std::shared_ptr<coho::Texture>> textures;
+    for (Job& job : jobs) {
+        // the texture is only touched here, on the draining thread
+        std::shared_ptr<coho::Texture> texture = job.texture;
+        if (job.result != nullptr) {
+            texture->width = (int)job.result->width;
+            texture->height = (int)job.result->height;
+            texture->channels = 4;
+            texture->mipLevels = (int)job.result->levels.size();
+            texture->mipped = job.result;
+        }
+        texture->loading = false;
+        textures.push_back(texture);
+        release(job.bytes);
+    }
+    return textures;
+}
+
+uint32_t AsyncTextureLoader::getPendingCount() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return (uint32_t)(m_queue.size() + m_finished.size()) + m_running;
+}
+
+size_t AsyncTextureLoader::getInFlightBytes() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_inFlightBytes;
+}
+
+void AsyncTextureLoader::workerLoop() {
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&] { return m_stopping || !m_queue.empty(); });
+            if (m_stopping) return;
+            job = std::move(m_queue.front());
+            m_queue.pop_front();
+            m_running++;
+        }
+
+        run(job);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_running--;
+            m_finished.push_back(std::move(job));
+        }
+    }
+}
+
+void AsyncTextureLoader::run(Job& job) {
+    // a fresh cooked cache is only mapped, nothing to decode or charge
+    job.result = MippedTexture::loadCache(job.source, job.options);
+    if (job.result != nullptr) return;
+
+    // the header alone is enough to size the job, it's charged before the file is read
+    int width, height, channels;
+    std::error_code error;
+    uintmax_t fileSize = fs::file_size(job.source, error);
+    if (error || !stbi_info(job.source.c_str(), &width, &height, &channels)) {
+        std::cout << "failed to load image: " << job.source << std::endl;
+        return;
+    }
+
+    // the file while it's decoded, then the decoded base, its rgba8 mips and the cooked chain
+    size_t fileBytes = (size_t)fileSize;
+    size_t estimate = (size_t)width * height * 4 * 3;
+    reserve(fileBytes + estimate);
+    std::vector<uint8_t> file = acquireBuffer();
+    unsigned char* decoded = nullptr;
+    if (readFile(job.source, file)) {
+        decoded = stbi_load_from_memory(file.data(), (int)file.size(), &width, &height, &channels, 4);
+    }
+    releaseBuffer(std::move(file));
+    release(fileBytes);
+    if (decoded == nullptr) {
+        std::cout << "failed to decode image: " << job.source << std::endl;
+        release(estimate);
+        return;
+    }
+
+    std::vector<MipLevel> mips = acquireMips();
+    // cooked straight from stb's allocation, it's freed as soon as the chain is built
+    job.result = MippedTexture::cook(decoded, (uint32_t)width, (uint32_t)height, job.options, mips, m_cookPool);
+    stbi_image_free(decoded);
+    releaseMips(std::move(mips));
+    if (job.result->save(MippedTexture::cachePath(job.source))) {
+        std::cout << "cooked " << job.source << " (" << BlockCompression::name(job.result->format) << ", " << job.result->levels.size() << " levels)" << std::endl;
+    }
+
+    // only the cooked chain is left until it's drained
+    for (const MippedTexture::Level& level : job.result->levels) {
+        job.bytes += level.size;
+    }
+    job.bytes = std::min(job.bytes, estimate);
+    release(estimate - job.bytes);
+}
+
+void AsyncTextureLoader::reserve(size_t bytes) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_budget.wait(lock, [&] { return m_stopping || m_inFlightBytes == 0 || m_inFlightBytes + bytes <= m_memoryBudget; });
+    m_inFlightBytes += bytes;
+}
+
+void AsyncTextureLoader::release(size_t bytes) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_inFlightBytes -= bytes;
+    }
+    m_budget.notify_all();
+}
+
+std::vector<uint8_t> AsyncTextureLoader::acquireBuffer() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_bufferPool.empty()) return std::vector<uint8_t>();
+    std::vector<uint8_t> buffer = std::move(m_bufferPool.back());
+    m_bufferPool.pop_back();
+    return buffer;
+}
+
+void AsyncTextureLoader::releaseBuffer(std::vector<uint8_t> buffer) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_bufferPool.push_back(std::move(buffer));
+}
+
+std::vector<MipLevel> AsyncTextureLoader::acquireMips() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_mipPool.empty()) return std::vector<MipLevel>();
+    std::vector<MipLevel> mips = std::move(m_mipPool.back());
+    m_mipPool.pop_back();
+    return mips;
+}
+
+void AsyncTextureLoader::releaseMips(std::vector<MipLevel> mips) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_mipPool.push_back(std::move(mips));
+}
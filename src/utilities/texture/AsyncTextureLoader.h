@@ -0,0 +1,74 @@
+#pragma once
+#include "MippedTexture.h"
+#include "../ThreadPool.h"
+#include "../../ecs/components/Texture.h"
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Loads textures off the main thread. Decoder threads read the image into a pooled
+// file buffer, decode it with stb and cook the decoded pixels with a pooled mip chain
+// (or map the cooked cache, see MippedTexture::loadCache). Only stb's pixels and the
+// cooked levels are allocated per texture, the pixels go as soon as the cook is done. The cook's mip and block loops run
+// on a pool of the loader's own, so they never hold up ThreadPool::shared.
+// A job is only started while the bytes of the jobs decoding or waiting to be
+// drained fit in the memory budget, the file being decoded included, one job always may run so a big image can't
+// stall the queue. drain hands the finished textures back on the main thread.
+class AsyncTextureLoader {
+public:
+    explicit AsyncTextureLoader(uint32_t threadCount = 2, size_t memoryBudget = 256 * 1024 * 1024);
+    ~AsyncTextureLoader();
+
+    // texture->loading is set until drain hands it back with mipped, width, height and
+    // mipLevels filled in. mipped stays null when the image couldn't be read
+    void load(std::shared_ptr<coho::Texture> texture, const std::string& path, const std::string& filename, MippedTexture::CookOptions options);
+
+    // at most maxCount of the finished textures, oldest first
+    std::vector<std::shared_ptr<coho::Texture>> drain(uint32_t maxCount = UINT32_MAX);
+
+    // queued, decoding or waiting to be drained
+    uint32_t getPendingCount();
+    size_t getInFlightBytes();
+
+private:
+    struct Job {
+        std::shared_ptr<coho::Texture> texture;
+        std::string source;
+        MippedTexture::CookOptions options;
+        std::shared_ptr<MippedTexture> result;
+        size_t bytes = 0; // charged against the budget
+    };
+
+    void workerLoop();
+    void run(Job& job);
+    // waits until bytes fit the budget and charges them
+    void reserve(size_t bytes);
+    // returns bytes to the budget
+    void release(size_t bytes);
+
+    std::vector<uint8_t> acquireBuffer();
+    void releaseBuffer(std::vector<uint8_t> buffer);
+    std::vector<MipLevel> acquireMips();
+    void releaseMips(std::vector<MipLevel> mips);
+
+    std::vector<std::thread> m_threads;
+    ThreadPool m_cookPool;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;   // a job was queued or the loader stops
+    std::condition_variable m_budget; // bytes were released
+    std::deque<Job> m_queue;
+    std::deque<Job> m_finished;
+    uint32_t m_running = 0;
+    size_t m_memoryBudget;
+    size_t m_inFlightBytes = 0;
+    bool m_stopping = false;
+
+    std::vector<std::vector<uint8_t>> m_bufferPool; // file buffers, kept at their capacity
+    std::vector<std::vector<MipLevel>> m_mipPool;   // rgba8 mip chains for the cook
+};
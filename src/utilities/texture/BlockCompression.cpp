@@ -0,0 +1,562 @@
+#include "BlockCompression.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define COHO_BLOCK_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace {
+// the 16 pixels of a block by channel, 0 - 255
+struct Block {
+    float px[4][16];
+};
+
+const int BC7_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+void loadBlock(const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t bx, uint32_t by, Block& block) {
+    for (uint32_t y = 0; y < 4; y++) {
+        uint32_t sy = std::min(by * 4 + y, height - 1);
+        for (uint32_t x = 0; x < 4; x++) {
+            uint32_t sx = std::min(bx * 4 + x, width - 1);
+            const uint8_t* p = pixels + 4 * ((size_t)sy * width + sx);
+            for (int c = 0; c < 4; c++) block.px[c][y * 4 + x] = p[c];
+        }
+    }
+}
+
+// nearest palette entry of every pixel over the first channels, returns the summed squared error
+float selectIndices(const Block& block, const float palette[][4], int paletteSize, int channels, uint8_t indices[16]) {
+    float error = 0.0f;
+#ifdef COHO_BLOCK_SSE2
+    for (int p = 0; p < 16; p += 4) {
+        __m128 best = _mm_set1_ps(FLT_MAX);
+        __m128i bestIndex = _mm_setzero_si128();
+        for (int i = 0; i < paletteSize; i++) {
+            __m128 distance = _mm_setzero_ps();
+            for (int c = 0; c < channels; c++) {
+                __m128 d = _mm_sub_ps(_mm_loadu_ps(&block.px[c][p]), _mm_set1_ps(palette[i][c]));
+                distance = _mm_add_ps(distance, _mm_mul_ps(d, d));
+            }
+            __m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, best));
+            bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(i)), _mm_andnot_si128(closer, bestIndex));
+            best = _mm_min_ps(distance, best);
+        }
+        alignas(16) int32_t index[4];
+        alignas(16) float distance[4];
+        _mm_store_si128((__m128i*)index, bestIndex);
+        _mm_store_ps(distance, best);
+        for (int k = 0; k < 4; k++) {
+            indices[p + k] = (uint8_t)index[k];
+            error += distance[k];
+        }
+    }
+#else
+    for (int p = 0; p < 16; p++) {
+        float best = FLT_MAX;
+        for (int i = 0; i < paletteSize; i++) {
+            float distance = 0.0f;
+            for (int c = 0; c < channels; c++) {
+                float d = block.px[c][p] - palette[i][c];
+                distance += d * d;
+            }
+            if (distance < best) {
+                best = distance;
+                indices[p] = (uint8_t)i;
+            }
+        }
+        error += best;
+    }
+#endif
+    return error;
+}
+
+// the mean and the direction of largest variance, by power iteration on the covariance
+void principalAxis(const Block& block, int channels, float mean[4], float axis[4]) {
+    for (int c = 0; c < 4; c++) {
+        mean[c] = 0.0f;
+        axis[c] = 0.0f;
+    }
+    for (int c = 0; c < channels; c++) {
+        for (int p = 0; p < 16; p++) mean[c] += block.px[c][p];
+        mean[c] /= 16.0f;
+    }
+    float covariance[4][4] = {};
+    for (int p = 0; p < 16; p++) {
+        for (int i = 0; i < channels; i++) {
+            for (int j = i; j < channels; j++) {
+                covariance[i][j] += (block.px[i][p] - mean[i]) * (block.px[j][p] - mean[j]);
+            }
+        }
+    }
+    for (int i = 0; i < channels; i++) {
+        for (int j = 0; j < i; j++) covariance[i][j] = covariance[j][i];
+    }
+    // start from the channel that varies most
+    int largest = 0;
+    for (int c = 1; c < channels; c++) {
+        if (covariance[c][c] > covariance[largest][largest]) largest = c;
+    }
+    if (covariance[largest][largest] <= 0.0f) return; // a flat block
+    axis[largest] = 1.0f;
+    for (int iteration = 0; iteration < 8; iteration++) {
+        float next[4] = {};
+        float length = 0.0f;
+        for (int i = 0; i < channels; i++) {
+            for (int j = 0; j < channels; j++) next[i] += covariance[i][j] * axis[j];
+            length += next[i] * next[i];
+        }
+        length = std::sqrt(length);
+        if (length <= 0.0f) return;
+        for (int i = 0; i < channels; i++) axis[i] = next[i] / length;
+    }
+}
+
+// the extremes of the block along its principal axis
+void rangeFit(const Block& block, int channels, float e0[4], float e1[4]) {
+    float mean[4], axis[4];
+    principalAxis(block, channels, mean, axis);
+    float lo = FLT_MAX;
+    float hi = -FLT_MAX;
+    for (int p = 0; p < 16; p++) {
+        float t = 0.0f;
+        for (int c = 0; c < channels; c++) t += (block.px[c][p] - mean[c]) * axis[c];
+        lo = std::min(lo, t);
+        hi = std::max(hi, t);
+    }
+    for (int c = 0; c < 4; c++) {
+        e0[c] = mean[c] + axis[c] * hi;
+        e1[c] = mean[c] + axis[c] * lo;
+    }
+}
+
+// least squares endpoints for pixel = (1 - w) * e0 + w * e1, false when the weights can't tell them apart
+bool leastSquaresFit(const Block& block, int channels, const float weights[16], float e0[4], float e1[4]) {
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    float ax[4] = {}, bx[4] = {};
+    for (int p = 0; p < 16; p++) {
+        float b = weights[p];
+        float a = 1.0f - b;
+        aa += a * a;
+        ab += a * b;
+        bb += b * b;
+        for (int c = 0; c < channels; c++) {
+            ax[c] += a * block.px[c][p];
+            bx[c] += b * block.px[c][p];
+        }
+    }
+    float det = aa * bb - ab * ab;
+    if (std::abs(det) < 1e-6f) return false;
+    for (int c = 0; c < channels; c++) {
+        e0[c] = std::min(std::max((bb * ax[c] - ab * bx[c]) / det, 0.0f), 255.0f);
+        e1[c] = std::min(std::max((aa * bx[c] - ab * ax[c]) / det, 0.0f), 255.0f);
+    }
+    return true;
+}
+
+uint16_t to565(const float c[4]) {
+    uint32_t r = (uint32_t)std::lround(std::min(std::max(c[0], 0.0f), 255.0f) * 31.0f / 255.0f);
+    uint32_t g = (uint32_t)std::lround(std::min(std::max(c[1], 0.0f), 255.0f) * 63.0f / 255.0f);
+    uint32_t b = (uint32_t)std::lround(std::min(std::max(c[2], 0.0f), 255.0f) * 31.0f / 255.0f);
+    return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+void from565(uint16_t v, int out[3]) {
+    int r = (v >> 11) & 31;
+    int g = (v >> 5) & 63;
+    int b = v & 31;
+    out[0] = (r << 3) | (r >> 2);
+    out[1] = (g << 2) | (g >> 4);
+    out[2] = (b << 3) | (b >> 2);
+}
+
+// the four color mode palette, decode uses the same integer math
+void bc1Palette(uint16_t c0, uint16_t c1, int palette[4][3]) {
+    from565(c0, palette[0]);
+    from565(c1, palette[1]);
+    for (int c = 0; c < 3; c++) {
+        palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+        palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+}
+
+float tryBC1(const Block& block, const float e0[4], const float e1[4], uint16_t& c0, uint16_t& c1, uint8_t indices[16]) {
+    c0 = to565(e0);
+    c1 = to565(e1);
+    int ipalette[4][3];
+    bc1Palette(c0, c1, ipalette);
+    float palette[4][4];
+    for (int i = 0; i < 4; i++) {
+        for (int c = 0; c < 3; c++) palette[i][c] = (float)ipalette[i][c];
+        palette[i][3] = 0.0f;
+    }
+    return selectIndices(block, palette, 4, 3, indices);
+}
+
+void encodeBC1(const Block& block, uint8_t* out) {
+    float e0[4], e1[4];
+    rangeFit(block, 3, e0, e1);
+    uint16_t c0, c1;
+    uint8_t indices[16];
+    float error = tryBC1(block, e0, e1, c0, c1, indices);
+
+    const float weightOf[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+    float weights[16];
+    for (int p = 0; p < 16; p++) weights[p] = weightOf[indices[p]];
+    if (leastSquaresFit(block, 3, weights, e0, e1)) {
+        uint16_t r0, r1;
+        uint8_t refit[16];
+        float refitError = tryBC1(block, e0, e1, r0, r1, refit);
+        if (refitError < error) {
+            c0 = r0;
+            c1 = r1;
+            std::memcpy(indices, refit, 16);
+        }
+    }
+
+    // c0 > c1 selects the four color mode, swapping the endpoints swaps index 0/1 and 2/3
+    if (c0 < c1) {
+        std::swap(c0, c1);
+        for (int p = 0; p < 16; p++) indices[p] ^= 1;
+    } else if (c0 == c1) {
+        std::memset(indices, 0, 16);
+    }
+    uint32_t bits = 0;
+    for (int p = 0; p < 16; p++) bits |= (uint32_t)indices[p] << (2 * p);
+    out[0] = (uint8_t)(c0 & 0xff);
+    out[1] = (uint8_t)(c0 >> 8);
+    out[2] = (uint8_t)(c1 & 0xff);
+    out[3] = (uint8_t)(c1 >> 8);
+    for (int i = 0; i < 4; i++) out[4 + i] = (uint8_t)(bits >> (8 * i));
+}
+
+// the eight value palette for a0 > a1
+void bc4Palette(int a0, int a1, int palette[8]) {
+    palette[0] = a0;
+    palette[1] = a1;
+    if (a0 > a1) {
+        for (int i = 2; i < 8; i++) palette[i] = ((8 - i) * a0 + (i - 1) * a1) / 7;
+    } else {
+        for (int i = 2; i < 6; i++) palette[i] = ((6 - i) * a0 + (i - 1) * a1) / 5;
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+}
+
+void encodeBC4(const Block& block, int channel, uint8_t* out) {
+    float lo = 255.0f, hi = 0.0f;
+    for (int p = 0; p < 16; p++) {
+        lo = std::min(lo, block.px[channel][p]);
+        hi = std::max(hi, block.px[channel][p]);
+    }
+    int a0 = (int)hi;
+    int a1 = (int)lo;
+    int palette[8];
+    bc4Palette(a0, a1, palette);
+
+    uint64_t bits = 0;
+    for (int p = 0; p < 16; p++) {
+        int value = (int)block.px[channel][p];
+        int best = 0;
+        if (a0 != a1) {
+            for (int i = 1; i < 8; i++) {
+                if (std::abs(palette[i] - value) < std::abs(palette[best] - value)) best = i;
+            }
+        }
+        bits |= (uint64_t)best << (3 * p);
+    }
+    out[0] = (uint8_t)a0;
+    out[1] = (uint8_t)a1;
+    for (int i = 0; i < 6; i++) out[2 + i] = (uint8_t)(bits >> (8 * i));
+}
+
+// 7 bit endpoint plus shared p bit, the p bit that lands closest over all four channels
+void quantizeBC7Endpoint(const float e[4], int q[4], int& pbit) {
+    float bestError = FLT_MAX;
+    for (int p = 0; p < 2; p++) {
+        float error = 0.0f;
+        int candidate[4];
+        for (int c = 0; c < 4; c++) {
+            candidate[c] = std::min(std::max((int)std::lround((e[c] - p) * 0.5f), 0), 127);
+            float d = (float)(candidate[c] * 2 + p) - e[c];
+            error += d * d;
+        }
+        if (error < bestError) {
+            bestError = error;
+            pbit = p;
+            std::memcpy(q, candidate, sizeof(candidate));
+        }
+    }
+}
+
+struct BC7Endpoints {
+    int q0[4], q1[4];
+    int p0, p1;
+};
+
+float tryBC7(const Block& block, const float e0[4], const float e1[4], BC7Endpoints& endpoints, uint8_t indices[16]) {
+    quantizeBC7Endpoint(e0, endpoints.q0, endpoints.p0);
+    quantizeBC7Endpoint(e1, endpoints.q1, endpoints.p1);
+    float palette[16][4];
+    for (int i = 0; i < 16; i++) {
+        for (int c = 0; c < 4; c++) {
+            int v0 = endpoints.q0[c] * 2 + endpoints.p0;
+            int v1 = endpoints.q1[c] * 2 + endpoints.p1;
+            palette[i][c] = (float)(((64 - BC7_WEIGHTS[i]) * v0 + BC7_WEIGHTS[i] * v1 + 32) >> 6);
+        }
+    }
+    return selectIndices(block, palette, 16, 4, indices);
+}
+
+void putBits(uint8_t* out, uint32_t& position, uint32_t value, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++, position++) {
+        if ((value >> i) & 1) out[position >> 3] |= (uint8_t)(1 << (position & 7));
+    }
+}
+
+uint32_t getBits(const uint8_t* in, uint32_t& position, uint32_t count) {
+    uint32_t value = 0;
+    for (uint32_t i = 0; i < count; i++, position++) {
+        value |= (uint32_t)((in[position >> 3] >> (position & 7)) & 1) << i;
+    }
+    return value;
+}
+
+void encodeBC7(const Block& block, uint8_t* out) {
+    float e0[4], e1[4];
+    rangeFit(block, 4, e0, e1);
+    BC7Endpoints endpoints;
+    uint8_t indices[16];
+    float error = tryBC7(block, e0, e1, endpoints, indices);
+
+    float weights[16];
+    for (int p = 0; p < 16; p++) weights[p] = BC7_WEIGHTS[indices[p]] / 64.0f;
+    if (leastSquaresFit(block, 4, weights, e0, e1)) {
+        BC7Endpoints refit;
+        uint8_t refitIndices[16];
+        if (tryBC7(block, e0, e1, refit, refitIndices) < error) {
+            endpoints = refit;
+            std::memcpy(indices, refitIndices, 16);
+        }
+    }
+
+    // the anchor (pixel 0) index has an implicit 0 top bit, swap the endpoints when it's set
+    if (indices[0] & 8) {
+        std::swap(endpoints.q0, endpoints.q1);
+        std::swap(endpoints.p0, endpoints.p1);
+        for (int p = 0; p < 16; p++) indices[p] = (uint8_t)(15 - indices[p]);
+    }
+
+    std::memset(out, 0, 16);
+    uint32_t position = 0;
+    putBits(out, position, 1 << 6, 7); // mode 6
+    for (int c = 0; c < 4; c++) {
+        putBits(out, position, endpoints.q0[c], 7);
+        putBits(out, position, endpoints.q1[c], 7);
+    }
+    putBits(out, position, endpoints.p0, 1);
+    putBits(out, position, endpoints.p1, 1);
+    putBits(out, position, indices[0], 3);
+    for (int p = 1; p < 16; p++) putBits(out, position, indices[p], 4);
+}
+
+void decodeBC1(const uint8_t* in, uint8_t out[16][4]) {
+    uint16_t c0 = (uint16_t)(in[0] | (in[1] << 8));
+    uint16_t c1 = (uint16_t)(in[2] | (in[3] << 8));
+    uint32_t bits = in[4] | (in[5] << 8) | (in[6] << 16) | ((uint32_t)in[7] << 24);
+    int palette[4][3];
+    bc1Palette(c0, c1, palette);
+    bool transparent = c0 <= c1;
+    if (transparent) {
+        for (int c = 0; c < 3; c++) {
+            palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+            palette[3][c] = 0;
+        }
+    }
+    for (int p = 0; p < 16; p++) {
+        uint32_t index = (bits >> (2 * p)) & 3;
+        for (int c = 0; c < 3; c++) out[p][c] = (uint8_t)palette[index][c];
+        out[p][3] = (transparent && index == 3) ? 0 : 255;
+    }
+}
+
+void decodeBC4(const uint8_t* in, int channel, uint8_t out[16][4]) {
+    int palette[8];
+    bc4Palette(in[0], in[1], palette);
+    uint64_t bits = 0;
+    for (int i = 0; i < 6; i++) bits |= (uint64_t)in[2 + i] << (8 * i);
+    for (int p = 0; p < 16; p++) {
+        out[p][channel] = (uint8_t)palette[(bits >> (3 * p)) & 7];
+    }
+}
+
+// mode 6 only, the one encodeBC7 writes. other modes decode as magenta
+void decodeBC7(const uint8_t* in, uint8_t out[16][4]) {
+    uint32_t position = 0;
+    if (getBits(in, position, 7) != (1u << 6)) {
+        for (int p = 0; p < 16; p++) {
+            out[p][0] = 255; out[p][1] = 0; out[p][2] = 255; out[p][3] = 255;
+        }
+        return;
+    }
+    int q0[4], q1[4];
+    for (int c = 0; c < 4; c++) {
+        q0[c] = (int)getBits(in, position, 7);
+        q1[c] = (int)getBits(in, position, 7);
+    }
+    int p0 = (int)getBits(in, position, 1);
+    int p1 = (int)getBits(in, position, 1);
+    for (int p = 0; p < 16; p++) {
+        uint32_t index = getBits(in, position, p == 0 ? 3 : 4);
+        for (int c = 0; c < 4; c++) {
+            int v0 = q0[c] * 2 + p0;
+            int v1 = q1[c] * 2 + p1;
+            out[p][c] = (uint8_t)(((64 - BC7_WEIGHTS[index]) * v0 + BC7_WEIGHTS[index] * v1 + 32) >> 6);
+        }
+    }
+}
+}
+
+uint32_t BlockCompression::bytesPerBlock(BlockFormat format) {
+    switch (format) {
+    case BlockFormat::BC1: return 8;
+    case BlockFormat::BC3: return 16;
+    case BlockFormat::BC5: return 16;
+    case BlockFormat::BC7: return 16;
+    default: return 64; // a 4x4 block of rgba8
+    }
+}
+
+size_t BlockCompression::encodedSize(BlockFormat format, uint32_t width, uint32_t height) {
+    if (format == BlockFormat::RGBA8) return (size_t)width * height * 4;
+    return (size_t)blockCount(width) * blockCount(height) * bytesPerBlock(format);
+}
+
+const char* BlockCompression::name(BlockFormat format) {
+    switch (format) {
+    case BlockFormat::BC1: return "BC1";
+    case BlockFormat::BC3: return "BC3";
+    case BlockFormat::BC5: return "BC5";
+    case BlockFormat::BC7: return "BC7";
+    default: return "RGBA8";
+    }
+}
+
+bool BlockCompression::isOpaque(const uint8_t* pixels, uint32_t width, uint32_t height) {
+    size_t count = (size_t)width * height;
+    for (size_t i = 0; i < count; i++) {
+        if (pixels[4 * i + 3] != 255) return false;
+    }
+    return true;
+}
+
+std::vector<uint8_t> BlockCompression::encode(const uint8_t* pixels, uint32_t width, uint32_t height, BlockFormat format, ThreadPool& pool) {
+    std::vector<uint8_t> blocks(encodedSize(format, width, height));
+    encode(pixels, width, height, format, blocks.data(), pool);
+    return blocks;
+}
+
+void BlockCompression::encode(const uint8_t* pixels, uint32_t width, uint32_t height, BlockFormat format, uint8_t* blocks, ThreadPool& pool) {
+    if (format == BlockFormat::RGBA8) {
+        std::memcpy(blocks, pixels, (size_t)width * height * 4);
+        return;
+    }
+    uint32_t blocksWide = blockCount(width);
+    uint32_t blocksHigh = blockCount(height);
+    uint32_t blockBytes = bytesPerBlock(format);
+
+    pool.parallelFor(blocksHigh, 1, [&](uint32_t begin, uint32_t end) {
+        Block block;
+        for (uint32_t by = begin; by < end; by++) {
+            for (uint32_t bx = 0; bx < blocksWide; bx++) {
+                loadBlock(pixels, width, height, bx, by, block);
+                uint8_t* out = blocks + ((size_t)by * blocksWide + bx) * blockBytes;
+                switch (format) {
+                case BlockFormat::BC1:
+                    encodeBC1(block, out);
+                    break;
+                case BlockFormat::BC3:
+                    encodeBC4(block, 3, out);
+                    encodeBC1(block, out + 8);
+                    break;
+                case BlockFormat::BC5:
+                    encodeBC4(block, 0, out);
+                    encodeBC4(block, 1, out + 8);
+                    break;
+                case BlockFormat::BC7:
+                    encodeBC7(block, out);
+                    break;
+                default:
+                    break;
+                }
+            }
+        }
+    });
+}
+
+std::vector<uint8_t> BlockCompression::decode(const uint8_t* blocks, uint32_t width, uint32_t height, BlockFormat format) {
+    std::vector<uint8_t> pixels((size_t)width * height * 4);
+    if (format == BlockFormat::RGBA8) {
+        std::memcpy(pixels.data(), blocks, pixels.size());
+        return pixels;
+    }
+    uint32_t blocksWide = blockCount(width);
+    uint32_t blockBytes = bytesPerBlock(format);
+    uint8_t decoded[16][4];
+    for (uint32_t by = 0; by < blockCount(height); by++) {
+        for (uint32_t bx = 0; bx < blocksWide; bx++) {
+            const uint8_t* in = blocks + ((size_t)by * blocksWide + bx) * blockBytes;
+            switch (format) {
+            case BlockFormat::BC1:
+                decodeBC1(in, decoded);
+                break;
+            case BlockFormat::BC3:
+                decodeBC1(in + 8, decoded);
+                decodeBC4(in, 3, decoded);
+                break;
+            case BlockFormat::BC5:
+                decodeBC4(in, 0, decoded);
+                decodeBC4(in + 8, 1, decoded);
+                for (int p = 0; p < 16; p++) {
+                    decoded[p][2] = 0;
+                    decoded[p][3] = 255;
+                }
+                break;
+            default:
+                decodeBC7(in, decoded);
+                break;
+            }
+            for (uint32_t y = 0; y < 4 && by * 4 + y < height; y++) {
+                for (uint32_t x = 0; x < 4 && bx * 4 + x < width; x++) {
+                    std::memcpy(&pixels[4 * ((size_t)(by * 4 + y) * width + bx * 4 + x)], decoded[y * 4 + x], 4);
+                }
+            }
+        }
+    }
+    return pixels;
+}
+
+BlockCompression::Quality BlockCompression::measure(const uint8_t* pixels, uint32_t width, uint32_t height, const std::vector<uint8_t>& blocks, BlockFormat format) {
+    Quality quality;
+    quality.bytes = blocks.size();
+    quality.uncompressedBytes = (size_t)width * height * 4;
+
+    // the channels the format keeps, bc1 is only picked for opaque images
+    int channels = format == BlockFormat::BC5 ? 2 : (format == BlockFormat::BC1 ? 3 : 4);
+    std::vector<uint8_t> decoded = decode(blocks.data(), width, height, format);
+    double squaredError = 0.0;
+    size_t count = (size_t)width * height;
+    for (size_t i = 0; i < count; i++) {
+        for (int c = 0; c < channels; c++) {
+            double d = (double)pixels[4 * i + c] - (double)decoded[4 * i + c];
+            squaredError += d * d;
+        }
+    }
+    double mse = squaredError / (double)(count * channels);
+    quality.psnr = mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : std::numeric_limits<double>::infinity();
+    return quality;
+}
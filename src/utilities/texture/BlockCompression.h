@@ -0,0 +1,55 @@
+#pragma once
+#include "../ThreadPool.h"
+#include <cstdint>
+#include <vector>
+
+enum class BlockFormat {
+    RGBA8, // uncompressed
+    BC1,   // rgb, 8 bytes per 4x4 block
+    BC3,   // rgb + bc4 alpha, 16 bytes
+    BC5,   // two bc4 channels (rg, normal xy), 16 bytes
+    BC7,   // rgba, mode 6 only, 16 bytes
+};
+
+// Encodes rgba8 images into BC blocks on the cpu. Blocks are independent, rows of
+// blocks run in parallel on the ThreadPool. Endpoints come from the principal axis
+// of the block (range fit) and are refit once by least squares on the chosen
+// indices, the indices are picked against the palette with sse2.
+// Partial blocks at the right and bottom edges repeat the last row / column.
+class BlockCompression {
+public:
+    struct Quality {
+        double psnr = 0.0; // db over the channels the format keeps, infinite when lossless
+        size_t bytes = 0;
+        size_t uncompressedBytes = 0;
+    };
+
+    static uint32_t bytesPerBlock(BlockFormat format);
+    static uint32_t blockCount(uint32_t size) { return (size + 3) / 4; }
+    // size of a width x height image in the format
+    static size_t encodedSize(BlockFormat format, uint32_t width, uint32_t height);
+
+    static std::vector<uint8_t> encode(
+        const uint8_t* pixels,
+        uint32_t width,
+        uint32_t height,
+        BlockFormat format,
+        ThreadPool& pool = ThreadPool::shared()
+        );
+    // the same into out, which holds encodedSize bytes
+    static void encode(
+        const uint8_t* pixels,
+        uint32_t width,
+        uint32_t height,
+        BlockFormat format,
+        uint8_t* out,
+        ThreadPool& pool = ThreadPool::shared()
+        );
+    // back to rgba8, bc5 decodes to (r, g, 0, 255)
+    static std::vector<uint8_t> decode(const uint8_t* blocks, uint32_t width, uint32_t height, BlockFormat format);
+
+    static Quality measure(const uint8_t* pixels, uint32_t width, uint32_t height, const std::vector<uint8_t>& blocks, BlockFormat format);
+
+    static bool isOpaque(const uint8_t* pixels, uint32_t width, uint32_t height);
+    static const char* name(BlockFormat format);
+};
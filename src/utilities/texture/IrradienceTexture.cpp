@@ -0,0 +1,249 @@
+#include "IrradienceTexture.h"
+#include "MipGenerator.h"
+#include "../ContentHash.h"
+#include "../io/MappedFile.h"
+#include "../../stb_image.h"
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define COHO_IRRADIANCE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace {
+const char MAGIC[4] = { 'C', 'S', 'H', '9' };
+const uint32_t VERSION = 1;
+const float PI = 3.14159265358979f;
+
+struct FileHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t sourceHash; // ContentHash of the image file
+};
+
+// the real sh basis with y up, band 2 scaled by their normalization
+const float C0 = 0.282095f;
+const float C1 = 0.488603f;
+const float C2 = 1.092548f;
+const float C3 = 0.315392f;
+const float C4 = 0.546274f;
+
+// the clamped cosine convolved bands over pi, 1, 2/3 and 1/4
+const float BAND_SCALE[9] = { 1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f };
+
+void basis(float x, float y, float z, float b[9]) {
+    b[0] = C0;
+    b[1] = C1 * z;
+    b[2] = C1 * y;
+    b[3] = C1 * x;
+    b[4] = C2 * x * z;
+    b[5] = C2 * z * y;
+    b[6] = C3 * (3.0f * y * y - 1.0f);
+    b[7] = C2 * x * y;
+    b[8] = C4 * (x * x - z * z);
+}
+
+const float* unormToFloatTable() {
+    static const std::vector<float> table = [] {
+        std::vector<float> t(256);
+        for (int i = 0; i < 256; i++) t[i] = (float)i / 255.0f;
+        return t;
+    }();
+    return table.data();
+}
+
+// the sum of color * basis over a row, out[basis * 3 + channel]. the row's solid angle is applied by the caller
+void projectRow(
+        const uint8_t* row,
+        uint32_t width,
+        const float* toLinear,
+        const float* cosPhi,
+        const float* sinPhi,
+        float sinTheta,
+        float cosTheta,
+        double out[27]
+        ) {
+    float sum[27] = {};
+    uint32_t x = 0;
+#ifdef COHO_IRRADIANCE_SSE2
+    __m128 acc[27];
+    for (int i = 0; i < 27; i++) acc[i] = _mm_setzero_ps();
+    const __m128 st = _mm_set1_ps(sinTheta);
+    const __m128 dy = _mm_set1_ps(cosTheta);
+    const __m128 c1 = _mm_set1_ps(C1);
+    const __m128 c2 = _mm_set1_ps(C2);
+    const __m128 c4 = _mm_set1_ps(C4);
+    const __m128 b0 = _mm_set1_ps(C0);
+    const __m128 b2 = _mm_set1_ps(C1 * cosTheta);
+    const __m128 b6 = _mm_set1_ps(C3 * (3.0f * cosTheta * cosTheta - 1.0f));
+    for (; x + 4 <= width; x += 4) {
+        __m128 dx = _mm_mul_ps(st, _mm_loadu_ps(cosPhi + x));
+        __m128 dz = _mm_mul_ps(st, _mm_loadu_ps(sinPhi + x));
+        const uint8_t* p = row + 4 * x;
+        __m128 color[3];
+        for (int c = 0; c < 3; c++) {
+            color[c] = _mm_setr_ps(toLinear[p[c]], toLinear[p[4 + c]], toLinear[p[8 + c]], toLinear[p[12 + c]]);
+        }
+
+        __m128 b[9];
+        b[0] = b0;
+        b[1] = _mm_mul_ps(c1, dz);
+        b[2] = b2;
+        b[3] = _mm_mul_ps(c1, dx);
+        b[4] = _mm_mul_ps(c2, _mm_mul_ps(dx, dz));
+        b[5] = _mm_mul_ps(c2, _mm_mul_ps(dz, dy));
+        b[6] = b6;
+        b[7] = _mm_mul_ps(c2, _mm_mul_ps(dx, dy));
+        b[8] = _mm_mul_ps(c4, _mm_sub_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dz, dz)));
+        for (int k = 0; k < 9; k++) {
+            for (int c = 0; c < 3; c++) {
+                acc[k * 3 + c] = _mm_add_ps(acc[k * 3 + c], _mm_mul_ps(color[c], b[k]));
+            }
+        }
+    }
+    for (int i = 0; i < 27; i++) {
+        float lanes[4];
+        _mm_storeu_ps(lanes, acc[i]);
+        sum[i] = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    }
+#endif
+    for (; x < width; x++) {
+        const uint8_t* p = row + 4 * x;
+        float b[9];
+        basis(sinTheta * cosPhi[x], cosTheta, sinTheta * sinPhi[x], b);
+        for (int k = 0; k < 9; k++) {
+            for (int c = 0; c < 3; c++) sum[k * 3 + c] += toLinear[p[c]] * b[k];
+        }
+    }
+    for (int i = 0; i < 27; i++) out[i] = sum[i];
+}
+}
+
+IrradienceTexture::Coefficients IrradienceTexture::project(
+        const uint8_t* pixels,
+        uint32_t width,
+        uint32_t height,
+        bool srgb,
+        ThreadPool& pool
+        ) {
+    const float* toLinear = srgb ? MipGenerator::srgbToLinearTable() : unormToFloatTable();
+
+    // pixel centers, longitude per column and latitude per row
+    std::vector<float> cosPhi(width);
+    std::vector<float> sinPhi(width);
+    for (uint32_t x = 0; x < width; x++) {
+        float phi = 2.0f * PI * (((float)x + 0.5f) / (float)width - 0.5f);
+        cosPhi[x] = std::cos(phi);
+        sinPhi[x] = std::sin(phi);
+    }
+
+    // every row keeps its own sums so the result doesn't depend on the thread count
+    std::vector<double> rows((size_t)height * 27);
+    const double pixelAngle = (2.0 * PI / width) * (PI / height);
+    pool.parallelFor(height, 16, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t y = begin; y < end; y++) {
+            float theta = PI * ((float)y + 0.5f) / (float)height;
+            double* out = rows.data() + (size_t)y * 27;
+            projectRow(pixels + (size_t)4 * width * y, width, toLinear, cosPhi.data(), sinPhi.data(), std::sin(theta), std::cos(theta), out);
+            // the solid angle of a pixel shrinks with sin(theta) towards the poles
+            double weight = pixelAngle * std::sin((double)theta);
+            for (int i = 0; i < 27; i++) out[i] *= weight;
+        }
+    });
+
+    double sum[27] = {};
+    for (uint32_t y = 0; y < height; y++) {
+        for (int i = 0; i < 27; i++) sum[i] += rows[(size_t)y * 27 + i];
+    }
+    Coefficients coefficients;
+    for (int k = 0; k < 9; k++) {
+        coefficients.sh[k] = glm::vec3(sum[k * 3], sum[k * 3 + 1], sum[k * 3 + 2]) * BAND_SCALE[k];
+    }
+    return coefficients;
+}
+
+glm::vec3 IrradienceTexture::evaluate(const Coefficients& coefficients, glm::vec3 normal) {
+    float b[9];
+    basis(normal.x, normal.y, normal.z, b);
+    glm::vec3 irradiance(0.0f);
+    for (int k = 0; k < 9; k++) irradiance += coefficients.sh[k] * b[k];
+    return irradiance;
+}
+
+bool IrradienceTexture::bake(const std::string& path, const std::string& filename, Coefficients& coefficients) {
+    std::string source = path + "/" + filename;
+    std::shared_ptr<MappedFile> file = MappedFile::open(source);
+    if (file == nullptr) {
+        std::cout << "failed to load environment: " << source << std::endl;
+        return false;
+    }
+    uint64_t hash = ContentHash::hash(file->data(), file->size());
+    if (load(cachePath(source), hash, coefficients)) return true;
+
+    int width, height, channels;
+    unsigned char* pixels = stbi_load_from_memory(file->data(), (int)file->size(), &width, &height, &channels, 4);
+    if (pixels == nullptr) {
+        std::cout << "failed to decode environment: " << source << std::endl;
+        return false;
+    }
+    auto start = std::chrono::steady_clock::now();
+    coefficients = project(pixels, (uint32_t)width, (uint32_t)height);
+    auto end = std::chrono::steady_clock::now();
+    stbi_image_free(pixels);
+    std::cout << "baked the irradiance of " << source << " (" << width << "x" << height << ") in "
+        << std::chrono::duration<double, std::milli>(end - start).count() << " ms" << std::endl;
+
+    save(cachePath(source), hash, coefficients);
+    return true;
+}
+
+std::string IrradienceTexture::cachePath(const std::string& source) {
+    return source + ".sh9";
+}
+
+bool IrradienceTexture::load(const std::string& filename, uint64_t sourceHash, Coefficients& coefficients) {
+    std::ifstream file(filename, std::ios::in | std::ios::binary);
+    if (!file.is_open()) return false;
+
+    FileHeader header;
+    float values[27];
+    file.read((char*)&header, sizeof(header));
+    file.read((char*)values, sizeof(values));
+    if (!file.good()) {
+        std::cout << filename << " is truncated" << std::endl;
+        return false;
+    }
+    if (std::memcmp(header.magic, MAGIC, 4) != 0 || header.version != VERSION || header.sourceHash != sourceHash) return false;
+
+    for (int k = 0; k < 9; k++) {
+        coefficients.sh[k] = glm::vec3(values[k * 3], values[k * 3 + 1], values[k * 3 + 2]);
+    }
+    return true;
+}
+
+bool IrradienceTexture::save(const std::string& filename, uint64_t sourceHash, const Coefficients& coefficients) {
+    std::ofstream file(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        std::cout << "failed to open " << filename << " for writing" << std::endl;
+        return false;
+    }
+
+    FileHeader header = {};
+    std::memcpy(header.magic, MAGIC, 4);
+    header.version = VERSION;
+    header.sourceHash = sourceHash;
+    float values[27];
+    for (int k = 0; k < 9; k++) {
+        values[k * 3] = coefficients.sh[k].x;
+        values[k * 3 + 1] = coefficients.sh[k].y;
+        values[k * 3 + 2] = coefficients.sh[k].z;
+    }
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)values, sizeof(values));
+    return file.good();
+}
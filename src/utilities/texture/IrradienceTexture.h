@@ -1 +1,42 @@
-// todo:
\ No newline at end of file
+#pragma once
+#include "../ThreadPool.h"
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <string>
+
+// The diffuse lighting of an equirectangular environment as 9 spherical harmonics
+// coefficients (bands 0 - 2), so shading a normal is a few multiply adds instead of
+// texture fetches. The environment is projected with every pixel weighted by the
+// solid angle it covers, rows run in parallel on the ThreadPool, four pixels at a
+// time with sse2. The radiance is then convolved with the clamped cosine
+// (Ramamoorthi and Hanrahan), the coefficients give irradiance over pi, what a
+// lambertian albedo is multiplied with.
+// The equirect is u = longitude with u = 0.5 looking down +x, v = 0 straight up (+y).
+// Baked results are cached in <source>.sh9, keyed by the hash of the image file.
+class IrradienceTexture {
+public:
+    struct Coefficients {
+        glm::vec3 sh[9]; // rgb, linear
+    };
+
+    // rgba8 pixels, srgb rgb is decoded to linear first
+    static Coefficients project(
+        const uint8_t* pixels,
+        uint32_t width,
+        uint32_t height,
+        bool srgb = true,
+        ThreadPool& pool = ThreadPool::shared()
+        );
+
+    // irradiance over pi around a unit normal, same math as shIrradiance in shader.wgsl
+    static glm::vec3 evaluate(const Coefficients& coefficients, glm::vec3 normal);
+
+    // the cached coefficients when the image is unchanged, otherwise decodes, projects and caches it
+    static bool bake(const std::string& path, const std::string& filename, Coefficients& coefficients);
+
+    // <source>.sh9
+    static std::string cachePath(const std::string& source);
+    // false when the file is missing, from another version or baked from other content
+    static bool load(const std::string& filename, uint64_t sourceHash, Coefficients& coefficients);
+    static bool save(const std::string& filename, uint64_t sourceHash, const Coefficients& coefficients);
+};
@@ -0,0 +1,300 @@
+#include "MipGenerator.h"
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define COHO_MIP_SSE2 1
+#include <emmintrin.h>
+#endif
+#if defined(__AVX__)
+#define COHO_MIP_AVX 1
+#include <immintrin.h>
+#endif
+
+namespace {
+const float PI = 3.14159265358979f;
+// destination rows per parallel task
+const uint32_t BLOCK_ROWS = 16;
+const float KAISER_WIDTH = 3.0f;
+const float KAISER_ALPHA = 4.0f;
+
+// the source pixels (clamped to the edge) and normalized weights of every destination pixel along one axis
+struct Taps {
+    std::vector<uint32_t> offsets; // into indices and weights, one past the end for the last pixel
+    std::vector<uint32_t> indices;
+    std::vector<float> weights;
+};
+
+float sinc(float x) {
+    x *= PI;
+    return std::abs(x) < 1e-5f ? 1.0f : std::sin(x) / x;
+}
+
+// modified bessel function of the first kind, order 0
+float besselI0(float x) {
+    float sum = 1.0f;
+    float term = 1.0f;
+    float q = x * x * 0.25f;
+    for (int k = 1; k < 32 && term > sum * 1e-8f; k++) {
+        term *= q / (float)(k * k);
+        sum += term;
+    }
+    return sum;
+}
+
+// x in destination pixels
+float evaluate(MipFilter filter, float x) {
+    x = std::abs(x);
+    if (filter == MipFilter::Lanczos) {
+        return x < 3.0f ? sinc(x) * sinc(x / 3.0f) : 0.0f;
+    }
+    if (x >= KAISER_WIDTH) return 0.0f;
+    float t = x / KAISER_WIDTH;
+    return sinc(x) * besselI0(KAISER_ALPHA * std::sqrt(1.0f - t * t)) / besselI0(KAISER_ALPHA);
+}
+
+Taps buildTaps(uint32_t srcSize, uint32_t dstSize, MipFilter filter) {
+    Taps taps;
+    float scale = (float)srcSize / (float)dstSize;
+    float radius = filter == MipFilter::Box ? scale * 0.5f : 3.0f * std::max(scale, 1.0f);
+    taps.offsets.push_back(0);
+    for (uint32_t d = 0; d < dstSize; d++) {
+        float center = ((float)d + 0.5f) * scale; // in source pixels
+        int32_t lo = (int32_t)std::floor(center - radius);
+        int32_t hi = (int32_t)std::ceil(center + radius);
+        uint32_t first = (uint32_t)taps.weights.size();
+        float sum = 0.0f;
+        for (int32_t i = lo; i < hi; i++) {
+            float weight;
+            if (filter == MipFilter::Box) {
+                // the part of source pixel i inside the destination pixel's footprint
+                weight = std::min((float)i + 1.0f, center + radius) - std::max((float)i, center - radius);
+            } else {
+                weight = evaluate(filter, ((float)i + 0.5f - center) / std::max(scale, 1.0f));
+            }
+            if (weight == 0.0f || (filter == MipFilter::Box && weight < 0.0f)) continue;
+            taps.indices.push_back((uint32_t)std::min(std::max(i, 0), (int32_t)srcSize - 1));
+            taps.weights.push_back(weight);
+            sum += weight;
+        }
+        for (uint32_t t = first; t < (uint32_t)taps.weights.size(); t++) {
+            taps.weights[t] /= sum;
+        }
+        taps.offsets.push_back((uint32_t)taps.weights.size());
+    }
+    return taps;
+}
+
+// indexed by linear * 65535, fine enough that the darkest srgb steps stay apart
+const uint8_t* linearToSrgbTable() {
+    static const std::vector<uint8_t> table = [] {
+        std::vector<uint8_t> t(65536);
+        for (int i = 0; i < 65536; i++) {
+            float c = (float)i / 65535.0f;
+            float s = c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+            t[i] = (uint8_t)std::min(std::max(s * 255.0f + 0.5f, 0.0f), 255.0f);
+        }
+        return t;
+    }();
+    return table.data();
+}
+
+void decodeRow(const uint8_t* src, uint32_t width, bool srgb, float* out) {
+    const float* toLinear = MipGenerator::srgbToLinearTable();
+    const float inv255 = 1.0f / 255.0f;
+    for (uint32_t x = 0; x < width; x++) {
+        const uint8_t* p = src + 4 * x;
+        float* o = out + 4 * x;
+        if (srgb) {
+            o[0] = toLinear[p[0]];
+            o[1] = toLinear[p[1]];
+            o[2] = toLinear[p[2]];
+        } else {
+            o[0] = p[0] * inv255;
+            o[1] = p[1] * inv255;
+            o[2] = p[2] * inv255;
+        }
+        o[3] = p[3] * inv255;
+    }
+}
+
+// a pixel is one float4, the taps of a destination pixel are summed as vectors
+void filterRow(const float* src, const Taps& taps, uint32_t dstWidth, float* out) {
+    for (uint32_t x = 0; x < dstWidth; x++) {
+        uint32_t begin = taps.offsets[x];
+        uint32_t end = taps.offsets[x + 1];
+#ifdef COHO_MIP_SSE2
+        __m128 sum = _mm_setzero_ps();
+        for (uint32_t t = begin; t < end; t++) {
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(src + 4 * taps.indices[t]), _mm_set1_ps(taps.weights[t])));
+        }
+        _mm_storeu_ps(out + 4 * x, sum);
+#else
+        float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        for (uint32_t t = begin; t < end; t++) {
+            const float* p = src + 4 * taps.indices[t];
+            float w = taps.weights[t];
+            for (int c = 0; c < 4; c++) sum[c] += p[c] * w;
+        }
+        for (int c = 0; c < 4; c++) out[4 * x + c] = sum[c];
+#endif
+    }
+}
+
+// out = sum of weight * row, over count floats
+void accumulateRow(const float* row, float weight, uint32_t count, float* out) {
+    uint32_t i = 0;
+#if defined(COHO_MIP_AVX)
+    __m256 w8 = _mm256_set1_ps(weight);
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_loadu_ps(out + i), _mm256_mul_ps(_mm256_loadu_ps(row + i), w8)));
+    }
+#endif
+#ifdef COHO_MIP_SSE2
+    __m128 w4 = _mm_set1_ps(weight);
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(_mm_loadu_ps(row + i), w4)));
+    }
+#endif
+    for (; i < count; i++) {
+        out[i] += row[i] * weight;
+    }
+}
+
+void encodeRow(const float* src, uint32_t width, bool srgb, uint8_t* out) {
+    const uint8_t* toSrgb = linearToSrgbTable();
+    uint32_t x = 0;
+#ifdef COHO_MIP_SSE2
+    if (!srgb) {
+        // 4 pixels per step, clamped, scaled and packed with saturation
+        __m128 zero = _mm_setzero_ps();
+        __m128 one = _mm_set1_ps(1.0f);
+        __m128 scale = _mm_set1_ps(255.0f);
+        __m128 half = _mm_set1_ps(0.5f);
+        for (; x + 4 <= width; x += 4) {
+            __m128i v[4];
+            for (int p = 0; p < 4; p++) {
+                __m128 f = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + 4 * (x + p)), zero), one);
+                v[p] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(f, scale), half));
+            }
+            __m128i packed = _mm_packus_epi16(_mm_packs_epi32(v[0], v[1]), _mm_packs_epi32(v[2], v[3]));
+            _mm_storeu_si128((__m128i*)(out + 4 * x), packed);
+        }
+    }
+#endif
+    for (; x < width; x++) {
+        const float* p = src + 4 * x;
+        uint8_t* o = out + 4 * x;
+        for (int c = 0; c < 4; c++) {
+            float v = std::min(std::max(p[c], 0.0f), 1.0f);
+            o[c] = (srgb && c < 3) ? toSrgb[(uint32_t)(v * 65535.0f + 0.5f)] : (uint8_t)(v * 255.0f + 0.5f);
+        }
+    }
+}
+}
+
+uint32_t MipGenerator::fullChainLength(uint32_t width, uint32_t height) {
+    uint32_t levels = 1;
+    for (uint32_t size = std::max(width, height); size > 1; size >>= 1) {
+        levels++;
+    }
+    return levels;
+}
+
+void MipGenerator::resample(
+        const uint8_t* src,
+        uint32_t srcWidth,
+        uint32_t srcHeight,
+        uint8_t* dst,
+        uint32_t dstWidth,
+        uint32_t dstHeight,
+        MipFilter filter,
+        bool srgb,
+        ThreadPool& pool
+        ) {
+    Taps horizontal = buildTaps(srcWidth, dstWidth, filter);
+    Taps vertical = buildTaps(srcHeight, dstHeight, filter);
+    uint32_t blockCount = (dstHeight + BLOCK_ROWS - 1) / BLOCK_ROWS;
+
+    pool.parallelFor(blockCount, 1, [&](uint32_t beginBlock, uint32_t endBlock) {
+        std::vector<float> decoded(4 * srcWidth);
+        std::vector<float> rows; // the horizontally filtered source rows of a block
+        std::vector<float> sum(4 * dstWidth);
+        for (uint32_t block = beginBlock; block < endBlock; block++) {
+            uint32_t firstRow = block * BLOCK_ROWS;
+            uint32_t endRow = std::min(firstRow + BLOCK_ROWS, dstHeight);
+
+            // the taps are clamped to the image, so the source rows of a block are one range
+            uint32_t lo = srcHeight;
+            uint32_t hi = 0;
+            for (uint32_t t = vertical.offsets[firstRow]; t < vertical.offsets[endRow]; t++) {
+                lo = std::min(lo, vertical.indices[t]);
+                hi = std::max(hi, vertical.indices[t]);
+            }
+            rows.resize((size_t)4 * dstWidth * (hi - lo + 1));
+            for (uint32_t y = lo; y <= hi; y++) {
+                decodeRow(src + (size_t)4 * srcWidth * y, srcWidth, srgb, decoded.data());
+                filterRow(decoded.data(), horizontal, dstWidth, rows.data() + (size_t)4 * dstWidth * (y - lo));
+            }
+
+            for (uint32_t y = firstRow; y < endRow; y++) {
+                std::fill(sum.begin(), sum.end(), 0.0f);
+                for (uint32_t t = vertical.offsets[y]; t < vertical.offsets[y + 1]; t++) {
+                    const float* row = rows.data() + (size_t)4 * dstWidth * (vertical.indices[t] - lo);
+                    accumulateRow(row, vertical.weights[t], 4 * dstWidth, sum.data());
+                }
+                encodeRow(sum.data(), dstWidth, srgb, dst + (size_t)4 * dstWidth * y);
+            }
+        }
+    });
+}
+
+const float* MipGenerator::srgbToLinearTable() {
+    static const std::vector<float> table = [] {
+        std::vector<float> t(256);
+        for (int i = 0; i < 256; i++) {
+            float c = (float)i / 255.0f;
+            t[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+        }
+        return t;
+    }();
+    return table.data();
+}
+
+std::vector<MipLevel> MipGenerator::generate(
+        const uint8_t* pixels,
+        uint32_t width,
+        uint32_t height,
+        MipOptions options,
+        ThreadPool& pool
+        ) {
+    std::vector<MipLevel> levels;
+    generate(pixels, width, height, options, levels, pool);
+    return levels;
+}
+
+void MipGenerator::generate(
+        const uint8_t* pixels,
+        uint32_t width,
+        uint32_t height,
+        MipOptions options,
+        std::vector<MipLevel>& levels,
+        ThreadPool& pool
+        ) {
+    uint32_t levelCount = fullChainLength(width, height);
+    if (options.levelCount != 0) levelCount = std::min(levelCount, options.levelCount);
+
+    levels.resize(levelCount > 0 ? levelCount - 1 : 0);
+    const uint8_t* src = pixels;
+    uint32_t srcWidth = width;
+    uint32_t srcHeight = height;
+    for (uint32_t level = 1; level < levelCount; level++) {
+        MipLevel& mip = levels[level - 1];
+        mip.width = levelSize(width, level);
+        mip.height = levelSize(height, level);
+        mip.pixels.resize((size_t)4 * mip.width * mip.height);
+        resample(src, srcWidth, srcHeight, mip.pixels.data(), mip.width, mip.height, options.filter, options.srgb, pool);
+        src = mip.pixels.data();
+        srcWidth = mip.width;
+        srcHeight = mip.height;
+    }
+}
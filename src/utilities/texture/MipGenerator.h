@@ -0,0 +1,70 @@
+#pragma once
+#include "../ThreadPool.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+enum class MipFilter {
+    Box,     // area average, exact for any ratio
+    Kaiser,  // kaiser windowed sinc, width 3, alpha 4
+    Lanczos, // lanczos 3
+};
+
+struct MipOptions {
+    MipFilter filter = MipFilter::Box;
+    bool srgb = false;       // rgb is srgb encoded color, it's filtered in linear space. alpha always is linear
+    uint32_t levelCount = 0; // levels including the base, 0 for the full chain
+};
+
+// an rgba8 level, width * height * 4 bytes
+struct MipLevel {
+    uint32_t width;
+    uint32_t height;
+    std::vector<uint8_t> pixels;
+};
+
+// Builds the mip chain of an rgba8 image. Every level is filtered from the one
+// above it with a separable filter whose taps follow the actual size ratio, so
+// odd and non power of two sizes don't drop rows or columns. A level is cut into
+// blocks of rows that run in parallel on the ThreadPool, each block filters the
+// source rows it needs horizontally and then its rows vertically (sse2, the
+// vertical pass uses avx when the build enables it).
+class MipGenerator {
+public:
+    // levels down to 1x1, the base included
+    static uint32_t fullChainLength(uint32_t width, uint32_t height);
+    static uint32_t levelSize(uint32_t size, uint32_t level) { return std::max(size >> level, 1u); }
+    // 256 entries, an srgb encoded byte to linear 0 - 1
+    static const float* srgbToLinearTable();
+
+    // levels 1 .. levelCount - 1. the base is only read, it stays with the caller
+    static std::vector<MipLevel> generate(
+        const uint8_t* pixels,
+        uint32_t width,
+        uint32_t height,
+        MipOptions options = MipOptions(),
+        ThreadPool& pool = ThreadPool::shared()
+        );
+    // the same into levels, whose pixel buffers are reused, so a pooled chain keeps its capacity
+    static void generate(
+        const uint8_t* pixels,
+        uint32_t width,
+        uint32_t height,
+        MipOptions options,
+        std::vector<MipLevel>& levels,
+        ThreadPool& pool = ThreadPool::shared()
+        );
+
+    // one level from another of any size, dst has to be dstWidth * dstHeight * 4 bytes
+    static void resample(
+        const uint8_t* src,
+        uint32_t srcWidth,
+        uint32_t srcHeight,
+        uint8_t* dst,
+        uint32_t dstWidth,
+        uint32_t dstHeight,
+        MipFilter filter,
+        bool srgb,
+        ThreadPool& pool = ThreadPool::shared()
+        );
+};
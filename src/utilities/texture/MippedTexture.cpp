@@ -0,0 +1,207 @@
+#include "MippedTexture.h"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+namespace fs = std::filesystem;
+
+namespace {
+const char MAGIC[4] = { 'C', 'T', 'E', 'X' };
+const uint32_t VERSION = 1;
+const size_t LEVEL_ALIGNMENT = 16;
+
+struct FileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t format;          // BlockFormat
+    uint32_t filter;          // MipFilter
+    uint32_t srgb;
+    uint32_t requestedLevels; // MipOptions::levelCount, 0 for the full chain
+    uint32_t width;
+    uint32_t height;
+    uint32_t levelCount;
+    uint32_t padding;
+};
+
+struct FileLevel {
+    uint64_t offset; // from the start of the file
+    uint64_t size;
+    uint32_t width;
+    uint32_t height;
+};
+
+size_t align(size_t offset) {
+    return (offset + LEVEL_ALIGNMENT - 1) / LEVEL_ALIGNMENT * LEVEL_ALIGNMENT;
+}
+
+size_t dataOffset(uint32_t levelCount) {
+    return align(sizeof(FileHeader) + levelCount * sizeof(FileLevel));
+}
+}
+
+std::shared_ptr<MippedTexture> MippedTexture::cook(
+        const uint8_t* pixels,
+        uint32_t width,
+        uint32_t height,
+        CookOptions options,
+        ThreadPool& pool
+        ) {
+    std::vector<MipLevel> mips;
+    return cook(pixels, width, height, options, mips, pool);
+}
+
+std::shared_ptr<MippedTexture> MippedTexture::cook(
+        const uint8_t* pixels,
+        uint32_t width,
+        uint32_t height,
+        CookOptions options,
+        std::vector<MipLevel>& mips,
+        ThreadPool& pool
+        ) {
+    if (options.format != BlockFormat::RGBA8 && (width % 4 != 0 || height % 4 != 0)) {
+        std::cout << width << "x" << height << " isn't made of whole blocks, cooking it as rgba8" << std::endl;
+        options.format = BlockFormat::RGBA8;
+    }
+    if (options.format == BlockFormat::BC1 && !BlockCompression::isOpaque(pixels, width, height)) {
+        options.format = BlockFormat::BC3;
+    }
+    MipGenerator::generate(pixels, width, height, options.mips, mips, pool);
+
+    auto texture = std::make_shared<MippedTexture>();
+    texture->format = options.format;
+    texture->width = width;
+    texture->height = height;
+    texture->m_options = options;
+
+    // every level encoded straight into one allocation, laid out like the file
+    uint32_t levelCount = (uint32_t)mips.size() + 1;
+    std::vector<size_t> offsets;
+    size_t size = 0;
+    for (uint32_t i = 0; i < levelCount; i++) {
+        Level level;
+        level.width = i == 0 ? width : mips[i - 1].width;
+        level.height = i == 0 ? height : mips[i - 1].height;
+        level.size = BlockCompression::encodedSize(options.format, level.width, level.height);
+        texture->levels.push_back(level);
+        offsets.push_back(size);
+        size = align(size + level.size);
+    }
+    texture->m_storage.resize(size);
+    for (uint32_t i = 0; i < levelCount; i++) {
+        Level& level = texture->levels[i];
+        level.data = texture->m_storage.data() + offsets[i];
+        const uint8_t* source = i == 0 ? pixels : mips[i - 1].pixels.data();
+        BlockCompression::encode(source, level.width, level.height, options.format, texture->m_storage.data() + offsets[i], pool);
+    }
+    return texture;
+}
+
+std::shared_ptr<MippedTexture> MippedTexture::load(const std::string& filename) {
+    std::shared_ptr<MappedFile> file = MappedFile::open(filename);
+    if (file == nullptr) return nullptr;
+
+    FileHeader header;
+    if (file->size() < sizeof(FileHeader)) return nullptr;
+    std::memcpy(&header, file->data(), sizeof(FileHeader));
+    if (std::memcmp(header.magic, MAGIC, 4) != 0 || header.version != VERSION) {
+        std::cout << filename << " isn't a version " << VERSION << " cooked texture" << std::endl;
+        return nullptr;
+    }
+    if (header.format > (uint32_t)BlockFormat::BC7 || header.levelCount == 0 || file->size() < dataOffset(header.levelCount)) {
+        std::cout << filename << " has a broken header" << std::endl;
+        return nullptr;
+    }
+
+    auto texture = std::make_shared<MippedTexture>();
+    texture->format = (BlockFormat)header.format;
+    texture->width = header.width;
+    texture->height = header.height;
+    texture->m_options.format = texture->format;
+    texture->m_options.mips.filter = (MipFilter)header.filter;
+    texture->m_options.mips.srgb = header.srgb != 0;
+    texture->m_options.mips.levelCount = header.requestedLevels;
+    texture->m_file = file;
+
+    const uint8_t* table = file->data() + sizeof(FileHeader);
+    for (uint32_t i = 0; i < header.levelCount; i++) {
+        FileLevel entry;
+        std::memcpy(&entry, table + i * sizeof(FileLevel), sizeof(FileLevel));
+        bool expected = entry.width == MipGenerator::levelSize(header.width, i)
+            && entry.height == MipGenerator::levelSize(header.height, i)
+            && entry.size == BlockCompression::encodedSize(texture->format, entry.width, entry.height);
+        if (!expected || entry.offset + entry.size > file->size()) {
+            std::cout << filename << " is truncated or has a broken level " << i << std::endl;
+            return nullptr;
+        }
+        texture->levels.push_back({ entry.width, entry.height, file->data() + entry.offset, (size_t)entry.size });
+    }
+    return texture;
+}
+
+bool MippedTexture::save(const std::string& filename) const {
+    std::ofstream file(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        std::cout << "failed to open " << filename << " for writing" << std::endl;
+        return false;
+    }
+
+    FileHeader header = {};
+    std::memcpy(header.magic, MAGIC, 4);
+    header.version = VERSION;
+    header.format = (uint32_t)format;
+    header.filter = (uint32_t)m_options.mips.filter;
+    header.srgb = m_options.mips.srgb ? 1 : 0;
+    header.requestedLevels = m_options.mips.levelCount;
+    header.width = width;
+    header.height = height;
+    header.levelCount = (uint32_t)levels.size();
+    file.write((const char*)&header, sizeof(header));
+
+    size_t offset = dataOffset(header.levelCount);
+    for (const Level& level : levels) {
+        FileLevel entry = { offset, level.size, level.width, level.height };
+        file.write((const char*)&entry, sizeof(entry));
+        offset = align(offset + level.size);
+    }
+
+    const char zeros[LEVEL_ALIGNMENT] = {};
+    size_t position = sizeof(FileHeader) + levels.size() * sizeof(FileLevel);
+    for (const Level& level : levels) {
+        file.write(zeros, align(position) - position);
+        file.write((const char*)level.data, level.size);
+        position = align(position) + level.size;
+    }
+    return file.good();
+}
+
+std::string MippedTexture::cachePath(const std::string& source) {
+    return source + ".ctex";
+}
+
+std::shared_ptr<MippedTexture> MippedTexture::loadCache(const std::string& source, const CookOptions& options) {
+    // the cooked file alone is enough, the image only has to be there to be checked against
+    std::string cooked = cachePath(source);
+    std::error_code error;
+    if (!fs::exists(cooked, error)) return nullptr;
+    if (fs::exists(source, error) && fs::last_write_time(cooked, error) < fs::last_write_time(source, error)) return nullptr;
+
+    std::shared_ptr<MippedTexture> texture = load(cooked);
+    if (texture == nullptr || !texture->cookedWith(options)) return nullptr;
+    return texture;
+}
+
+bool MippedTexture::cookedWith(const CookOptions& options) const {
+    // a requested block format that fell back to rgba8 or from bc1 to bc3 still counts as a match
+    bool formatMatches = options.format == format
+        || (format == BlockFormat::RGBA8 && (width % 4 != 0 || height % 4 != 0))
+        || (options.format == BlockFormat::BC1 && format == BlockFormat::BC3);
+    return formatMatches
+        && options.mips.filter == m_options.mips.filter
+        && options.mips.srgb == m_options.mips.srgb
+        && options.mips.levelCount == m_options.mips.levelCount;
+}
+
+std::vector<uint8_t> MippedTexture::decodeLevel(uint32_t level) const {
+    const Level& l = levels[level];
+    return BlockCompression::decode(l.data, l.width, l.height, format);
+}
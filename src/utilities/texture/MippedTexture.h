@@ -1 +1,70 @@
-// todo: allow generation and saving of mip-mapped textures so i dont have to calculate the at runtime.
\ No newline at end of file
+#pragma once
+#include "BlockCompression.h"
+#include "MipGenerator.h"
+#include "../io/MappedFile.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// A texture with its whole mip chain ready for upload, every level already in the
+// gpu format. Cooked once from an image and saved as a .ctex file: a header, a
+// table of per level offsets and sizes, then the level data (16 byte aligned).
+// Loading maps the file, the levels point straight into the mapping.
+class MippedTexture {
+public:
+    struct CookOptions {
+        // falls back to rgba8 for sizes that aren't whole blocks, bc1 turns into bc3 for images with alpha
+        BlockFormat format = BlockFormat::RGBA8;
+        MipOptions mips = { MipFilter::Kaiser, false, 0 };
+    };
+
+    struct Level {
+        uint32_t width;
+        uint32_t height;
+        const uint8_t* data;
+        size_t size;
+    };
+
+    BlockFormat format = BlockFormat::RGBA8;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<Level> levels; // the base first
+
+    // mipmaps and encodes an rgba8 image
+    static std::shared_ptr<MippedTexture> cook(
+        const uint8_t* pixels,
+        uint32_t width,
+        uint32_t height,
+        CookOptions options,
+        ThreadPool& pool = ThreadPool::shared()
+        );
+    // the same with the rgba8 mips built in mipScratch, a pooled one keeps its buffers' capacity
+    static std::shared_ptr<MippedTexture> cook(
+        const uint8_t* pixels,
+        uint32_t width,
+        uint32_t height,
+        CookOptions options,
+        std::vector<MipLevel>& mipScratch,
+        ThreadPool& pool = ThreadPool::shared()
+        );
+    // nullptr when the file is missing, from another version or truncated
+    static std::shared_ptr<MippedTexture> load(const std::string& filename);
+    bool save(const std::string& filename) const;
+
+    // <source>.ctex
+    static std::string cachePath(const std::string& source);
+    // the cooked cache of an image, nullptr when it's missing, older than the image or cooked with other options
+    static std::shared_ptr<MippedTexture> loadCache(const std::string& source, const CookOptions& options);
+
+    // whether it was cooked with these options, a changed format or filter needs a new cook
+    bool cookedWith(const CookOptions& options) const;
+
+    // the level as rgba8, decoded when it's block compressed
+    std::vector<uint8_t> decodeLevel(uint32_t level) const;
+
+private:
+    CookOptions m_options;
+    std::shared_ptr<MappedFile> m_file; // the levels of a loaded texture point into it
+    std::vector<uint8_t> m_storage;     // and those of a cooked one into this
+};
@@ -0,0 +1,524 @@
+#include "SpecularEnvironment.h"
+#include "MipGenerator.h"
+#include "../ContentHash.h"
+#include "../VertexCompression.h"
+#include "../../stb_image.h"
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define COHO_SPECULAR_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace {
+const char MAGIC[4] = { 'C', 'E', 'N', 'V' };
+const uint32_t VERSION = 1;
+const float PI = 3.14159265358979f;
+
+struct FileHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t sourceHash; // ContentHash of the image file
+    uint32_t faceSize;
+    uint32_t levelCount;
+    uint32_t sampleCount;
+    uint32_t lutSize;
+    uint32_t lutSampleCount;
+    uint32_t padding;
+};
+
+// a level of the resampled cube, linear rgb
+struct CubeLevel {
+    uint32_t size;
+    std::vector<float> rgb; // the six faces one after another
+};
+
+// the ggx lobe around +z, l for n = v = +z
+struct LobeSample {
+    glm::vec3 l;
+    float lod;    // the source level matching the solid angle of the sample
+    float weight; // n dot l
+};
+
+SpecularSettings clampSettings(SpecularSettings settings) {
+    settings.faceSize = std::max(settings.faceSize, 1u);
+    settings.levelCount = std::clamp(settings.levelCount, 1u, MipGenerator::fullChainLength(settings.faceSize, settings.faceSize));
+    settings.sampleCount = std::max(settings.sampleCount, 1u);
+    settings.lutSize = std::max(settings.lutSize, 1u);
+    settings.lutSampleCount = std::max(settings.lutSampleCount, 1u);
+    return settings;
+}
+
+// halfs of a level, six rgba16f faces
+size_t levelLength(uint32_t size) {
+    return (size_t)6 * size * size * 4;
+}
+
+size_t lutLength(uint32_t size) {
+    return (size_t)size * size * 2;
+}
+
+// the direction through u, v in [-1, 1] on a face, v grows downwards
+glm::vec3 faceDirection(uint32_t face, float u, float v) {
+    switch (face) {
+    case 0: return glm::vec3(1.0f, -v, -u);
+    case 1: return glm::vec3(-1.0f, -v, u);
+    case 2: return glm::vec3(u, 1.0f, v);
+    case 3: return glm::vec3(u, -1.0f, -v);
+    case 4: return glm::vec3(u, -v, 1.0f);
+    default: return glm::vec3(-u, -v, -1.0f);
+    }
+}
+
+// the face a direction points into, u and v in [0, 1]
+void faceCoordinates(glm::vec3 d, uint32_t& face, float& u, float& v) {
+    glm::vec3 a = glm::abs(d);
+    float major, s, t;
+    if (a.x >= a.y && a.x >= a.z) {
+        face = d.x > 0.0f ? 0 : 1;
+        major = a.x;
+        s = d.x > 0.0f ? -d.z : d.z;
+        t = -d.y;
+    } else if (a.y >= a.z) {
+        face = d.y > 0.0f ? 2 : 3;
+        major = a.y;
+        s = d.x;
+        t = d.y > 0.0f ? d.z : -d.z;
+    } else {
+        face = d.z > 0.0f ? 4 : 5;
+        major = a.z;
+        s = d.z > 0.0f ? d.x : -d.x;
+        t = -d.y;
+    }
+    u = 0.5f * (s / major + 1.0f);
+    v = 0.5f * (t / major + 1.0f);
+}
+
+// bilinear, clamped to the edges of the face
+glm::vec3 sampleFace(const CubeLevel& level, uint32_t face, float u, float v) {
+    uint32_t size = level.size;
+    float fx = std::clamp(u * size - 0.5f, 0.0f, (float)(size - 1));
+    float fy = std::clamp(v * size - 0.5f, 0.0f, (float)(size - 1));
+    uint32_t x0 = (uint32_t)fx;
+    uint32_t y0 = (uint32_t)fy;
+    uint32_t x1 = std::min(x0 + 1, size - 1);
+    uint32_t y1 = std::min(y0 + 1, size - 1);
+    float tx = fx - (float)x0;
+    float ty = fy - (float)y0;
+    const float* base = level.rgb.data() + (size_t)face * size * size * 3;
+    auto texel = [&](uint32_t x, uint32_t y) {
+        const float* p = base + ((size_t)y * size + x) * 3;
+        return glm::vec3(p[0], p[1], p[2]);
+    };
+    return glm::mix(glm::mix(texel(x0, y0), texel(x1, y0), tx), glm::mix(texel(x0, y1), texel(x1, y1), tx), ty);
+}
+
+// trilinear between the levels around lod
+glm::vec3 sampleCube(const std::vector<CubeLevel>& chain, glm::vec3 d, float lod) {
+    uint32_t face;
+    float u, v;
+    faceCoordinates(d, face, u, v);
+    lod = std::clamp(lod, 0.0f, (float)(chain.size() - 1));
+    uint32_t level = (uint32_t)lod;
+    float t = lod - (float)level;
+    glm::vec3 color = sampleFace(chain[level], face, u, v);
+    if (t > 0.0f) color = glm::mix(color, sampleFace(chain[level + 1], face, u, v), t);
+    return color;
+}
+
+// bilinear, wrapping around in longitude
+glm::vec3 sampleEquirect(const uint8_t* pixels, uint32_t width, uint32_t height, const float* toLinear, glm::vec3 d) {
+    float u = std::atan2(d.z, d.x) / (2.0f * PI) + 0.5f;
+    float v = std::acos(std::clamp(d.y, -1.0f, 1.0f)) / PI;
+    float fx = u * width - 0.5f;
+    float fy = std::clamp(v * height - 0.5f, 0.0f, (float)(height - 1));
+    float left = std::floor(fx);
+    float tx = fx - left;
+    uint32_t x0 = (uint32_t)(((int64_t)left % width + width) % width);
+    uint32_t x1 = (x0 + 1) % width;
+    uint32_t y0 = (uint32_t)fy;
+    uint32_t y1 = std::min(y0 + 1, height - 1);
+    float ty = fy - (float)y0;
+    auto texel = [&](uint32_t x, uint32_t y) {
+        const uint8_t* p = pixels + 4 * ((size_t)y * width + x);
+        return glm::vec3(toLinear[p[0]], toLinear[p[1]], toLinear[p[2]]);
+    };
+    return glm::mix(glm::mix(texel(x0, y0), texel(x1, y0), tx), glm::mix(texel(x0, y1), texel(x1, y1), tx), ty);
+}
+
+glm::vec2 hammersley(uint32_t i, uint32_t count) {
+    uint32_t bits = i;
+    bits = (bits << 16u) | (bits >> 16u);
+    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+    return glm::vec2((float)i / (float)count, (float)bits * 2.3283064365386963e-10f);
+}
+
+// a half vector of the ggx distribution around +z
+glm::vec3 sampleGgx(glm::vec2 xi, float alpha) {
+    float phi = 2.0f * PI * xi.x;
+    float cosTheta = std::sqrt((1.0f - xi.y) / (1.0f + (alpha * alpha - 1.0f) * xi.y));
+    float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+    return glm::vec3(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+}
+
+std::vector<LobeSample> lobeSamples(float roughness, uint32_t count, uint32_t sourceSize) {
+    float alpha = roughness * roughness;
+    float a2 = alpha * alpha;
+    float texelAngle = 4.0f * PI / (6.0f * sourceSize * sourceSize);
+    std::vector<LobeSample> samples;
+    for (uint32_t i = 0; i < count; i++) {
+        glm::vec3 h = sampleGgx(hammersley(i, count), alpha);
+        // n = v, so l = 2 (v dot h) h - v and the pdf is d(h) / 4
+        glm::vec3 l(2.0f * h.z * h.x, 2.0f * h.z * h.y, 2.0f * h.z * h.z - 1.0f);
+        if (l.z <= 0.0f) continue;
+        float d = h.z * h.z * (a2 - 1.0f) + 1.0f;
+        float pdf = a2 / (PI * d * d) / 4.0f;
+        float sampleAngle = 1.0f / ((float)count * pdf);
+        float lod = std::max(0.5f * std::log2(sampleAngle / texelAngle) + 1.0f, 0.0f);
+        samples.push_back({ l, lod, l.z });
+    }
+    return samples;
+}
+
+void tangentFrame(glm::vec3 n, glm::vec3& t, glm::vec3& b) {
+    glm::vec3 up = std::abs(n.y) < 0.999f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+    t = glm::normalize(glm::cross(up, n));
+    b = glm::cross(n, t);
+}
+
+glm::vec3 texelNormal(uint32_t face, uint32_t x, uint32_t y, uint32_t size) {
+    float u = 2.0f * ((float)x + 0.5f) / (float)size - 1.0f;
+    float v = 2.0f * ((float)y + 0.5f) / (float)size - 1.0f;
+    return glm::normalize(faceDirection(face, u, v));
+}
+
+void writeTexel(uint16_t* out, glm::vec3 color) {
+    out[0] = VertexCompression::floatToHalf(color.r);
+    out[1] = VertexCompression::floatToHalf(color.g);
+    out[2] = VertexCompression::floatToHalf(color.b);
+    out[3] = VertexCompression::floatToHalf(1.0f);
+}
+
+// one row of a face of a prefiltered level. the lobe is rotated onto four texels at a
+// time with sse2, the cube reads stay scalar
+void prefilterRow(
+        const std::vector<CubeLevel>& chain,
+        const std::vector<LobeSample>& samples,
+        float weightSum,
+        uint32_t face,
+        uint32_t y,
+        uint32_t size,
+        uint16_t* out
+        ) {
+    uint32_t x = 0;
+#ifdef COHO_SPECULAR_SSE2
+    for (; x + 4 <= size; x += 4) {
+        float frame[9][4]; // t, b, n by component and lane
+        for (uint32_t lane = 0; lane < 4; lane++) {
+            glm::vec3 n = texelNormal(face, x + lane, y, size);
+            glm::vec3 t, b;
+            tangentFrame(n, t, b);
+            for (int c = 0; c < 3; c++) {
+                frame[c][lane] = t[c];
+                frame[3 + c][lane] = b[c];
+                frame[6 + c][lane] = n[c];
+            }
+        }
+        __m128 axis[9];
+        for (int i = 0; i < 9; i++) axis[i] = _mm_loadu_ps(frame[i]);
+
+        __m128 sum[3] = { _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps() };
+        for (const LobeSample& sample : samples) {
+            __m128 lx = _mm_set1_ps(sample.l.x);
+            __m128 ly = _mm_set1_ps(sample.l.y);
+            __m128 lz = _mm_set1_ps(sample.l.z);
+            float direction[3][4];
+            for (int c = 0; c < 3; c++) {
+                __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(axis[c], lx), _mm_mul_ps(axis[3 + c], ly)), _mm_mul_ps(axis[6 + c], lz));
+                _mm_storeu_ps(direction[c], d);
+            }
+            float color[3][4];
+            for (uint32_t lane = 0; lane < 4; lane++) {
+                glm::vec3 c = sampleCube(chain, glm::vec3(direction[0][lane], direction[1][lane], direction[2][lane]), sample.lod);
+                color[0][lane] = c.r;
+                color[1][lane] = c.g;
+                color[2][lane] = c.b;
+            }
+            __m128 weight = _mm_set1_ps(sample.weight);
+            for (int c = 0; c < 3; c++) {
+                sum[c] = _mm_add_ps(sum[c], _mm_mul_ps(_mm_loadu_ps(color[c]), weight));
+            }
+        }
+        float result[3][4];
+        __m128 scale = _mm_set1_ps(1.0f / weightSum);
+        for (int c = 0; c < 3; c++) _mm_storeu_ps(result[c], _mm_mul_ps(sum[c], scale));
+        for (uint32_t lane = 0; lane < 4; lane++) {
+            writeTexel(out + 4 * (x + lane), glm::vec3(result[0][lane], result[1][lane], result[2][lane]));
+        }
+    }
+#endif
+    for (; x < size; x++) {
+        glm::vec3 n = texelNormal(face, x, y, size);
+        glm::vec3 t, b;
+        tangentFrame(n, t, b);
+        glm::vec3 sum(0.0f);
+        for (const LobeSample& sample : samples) {
+            glm::vec3 l = t * sample.l.x + b * sample.l.y + n * sample.l.z;
+            sum += sampleCube(chain, l, sample.lod) * sample.weight;
+        }
+        writeTexel(out + 4 * x, sum / weightSum);
+    }
+}
+
+// one roughness of the split sum lut, schlick-ggx geometry with k = alpha / 2 for image based lighting
+void lutRow(uint32_t y, uint32_t size, const std::vector<glm::vec2>& points, uint16_t* out) {
+    float roughness = ((float)y + 0.5f) / (float)size;
+    float alpha = roughness * roughness;
+    float k = alpha / 2.0f;
+    auto geometry = [k](float cosine) { return cosine / (cosine * (1.0f - k) + k); };
+    for (uint32_t x = 0; x < size; x++) {
+        float nv = ((float)x + 0.5f) / (float)size;
+        glm::vec3 v(std::sqrt(1.0f - nv * nv), 0.0f, nv);
+        float scale = 0.0f;
+        float bias = 0.0f;
+        for (const glm::vec2& point : points) {
+            glm::vec3 h = sampleGgx(point, alpha);
+            float vh = glm::dot(v, h);
+            glm::vec3 l = 2.0f * vh * h - v;
+            if (l.z <= 0.0f || vh <= 0.0f) continue;
+            float visibility = geometry(nv) * geometry(l.z) * vh / (h.z * nv);
+            float fresnel = std::pow(1.0f - vh, 5.0f);
+            scale += (1.0f - fresnel) * visibility;
+            bias += fresnel * visibility;
+        }
+        out[2 * x] = VertexCompression::floatToHalf(scale / (float)points.size());
+        out[2 * x + 1] = VertexCompression::floatToHalf(bias / (float)points.size());
+    }
+}
+}
+
+std::shared_ptr<SpecularEnvironment> SpecularEnvironment::prefilter(
+        const uint8_t* pixels,
+        uint32_t width,
+        uint32_t height,
+        SpecularSettings settings,
+        bool srgb,
+        ThreadPool& pool
+        ) {
+    settings = clampSettings(settings);
+    auto environment = std::make_shared<SpecularEnvironment>();
+    environment->m_settings = settings;
+
+    // every level and the lut in one allocation, laid out like the file
+    size_t length = lutLength(settings.lutSize);
+    for (uint32_t level = 0; level < settings.levelCount; level++) {
+        length += levelLength(MipGenerator::levelSize(settings.faceSize, level));
+    }
+    environment->m_storage.resize(length);
+    uint16_t* data = environment->m_storage.data();
+    for (uint32_t level = 0; level < settings.levelCount; level++) {
+        uint32_t size = MipGenerator::levelSize(settings.faceSize, level);
+        environment->levels.push_back({ size, data, levelLength(size) * sizeof(uint16_t) });
+        data += levelLength(size);
+    }
+    environment->lutSize = settings.lutSize;
+    environment->lut = data;
+
+    std::vector<float> toLinear(256);
+    for (int i = 0; i < 256; i++) {
+        toLinear[i] = srgb ? MipGenerator::srgbToLinearTable()[i] : (float)i / 255.0f;
+    }
+
+    // the equirect resampled into the cube, supersampled where a texel covers several pixels
+    std::vector<CubeLevel> chain(1);
+    uint32_t faceSize = settings.faceSize;
+    chain[0].size = faceSize;
+    chain[0].rgb.resize((size_t)6 * faceSize * faceSize * 3);
+    uint32_t subSamples = std::clamp(width / (4 * faceSize), 1u, 4u);
+    pool.parallelFor(6 * faceSize, 4, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t row = begin; row < end; row++) {
+            uint32_t face = row / faceSize;
+            uint32_t y = row % faceSize;
+            float* out = chain[0].rgb.data() + (size_t)row * faceSize * 3;
+            for (uint32_t x = 0; x < faceSize; x++) {
+                glm::vec3 sum(0.0f);
+                for (uint32_t sy = 0; sy < subSamples; sy++) {
+                    for (uint32_t sx = 0; sx < subSamples; sx++) {
+                        float u = 2.0f * ((float)x + ((float)sx + 0.5f) / subSamples) / faceSize - 1.0f;
+                        float v = 2.0f * ((float)y + ((float)sy + 0.5f) / subSamples) / faceSize - 1.0f;
+                        sum += sampleEquirect(pixels, width, height, toLinear.data(), glm::normalize(faceDirection(face, u, v)));
+                    }
+                }
+                sum /= (float)(subSamples * subSamples);
+                out[3 * x] = sum.r;
+                out[3 * x + 1] = sum.g;
+                out[3 * x + 2] = sum.b;
+            }
+        }
+    });
+
+    // its box filtered chain down to 1x1, what the lobe samples read from
+    while (chain.back().size > 1) {
+        const CubeLevel& source = chain.back();
+        CubeLevel level;
+        level.size = std::max(source.size / 2, 1u);
+        level.rgb.resize((size_t)6 * level.size * level.size * 3);
+        for (uint32_t face = 0; face < 6; face++) {
+            const float* src = source.rgb.data() + (size_t)face * source.size * source.size * 3;
+            float* dst = level.rgb.data() + (size_t)face * level.size * level.size * 3;
+            for (uint32_t y = 0; y < level.size; y++) {
+                uint32_t y0 = std::min(2 * y, source.size - 1);
+                uint32_t y1 = std::min(2 * y + 1, source.size - 1);
+                for (uint32_t x = 0; x < level.size; x++) {
+                    uint32_t x0 = std::min(2 * x, source.size - 1);
+                    uint32_t x1 = std::min(2 * x + 1, source.size - 1);
+                    for (int c = 0; c < 3; c++) {
+                        dst[((size_t)y * level.size + x) * 3 + c] = 0.25f * (
+                            src[((size_t)y0 * source.size + x0) * 3 + c] + src[((size_t)y0 * source.size + x1) * 3 + c] +
+                            src[((size_t)y1 * source.size + x0) * 3 + c] + src[((size_t)y1 * source.size + x1) * 3 + c]);
+                    }
+                }
+            }
+        }
+        chain.push_back(std::move(level));
+    }
+
+    // level 0 is the mirror reflection, the resampled cube as it is
+    uint16_t* mirror = (uint16_t*)environment->levels[0].data;
+    for (size_t texel = 0; texel < (size_t)6 * faceSize * faceSize; texel++) {
+        const float* p = chain[0].rgb.data() + texel * 3;
+        writeTexel(mirror + texel * 4, glm::vec3(p[0], p[1], p[2]));
+    }
+
+    for (uint32_t level = 1; level < settings.levelCount; level++) {
+        float roughness = (float)level / (float)(settings.levelCount - 1);
+        std::vector<LobeSample> samples = lobeSamples(roughness, settings.sampleCount, faceSize);
+        float weightSum = 0.0f;
+        for (const LobeSample& sample : samples) weightSum += sample.weight;
+        uint32_t size = environment->levels[level].size;
+        uint16_t* out = (uint16_t*)environment->levels[level].data;
+        pool.parallelFor(6 * size, 1, [&](uint32_t begin, uint32_t end) {
+            for (uint32_t row = begin; row < end; row++) {
+                prefilterRow(chain, samples, weightSum, row / size, row % size, size, out + (size_t)row * size * 4);
+            }
+        });
+    }
+
+    std::vector<glm::vec2> points;
+    for (uint32_t i = 0; i < settings.lutSampleCount; i++) points.push_back(hammersley(i, settings.lutSampleCount));
+    uint16_t* lut = (uint16_t*)environment->lut;
+    pool.parallelFor(settings.lutSize, 4, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t y = begin; y < end; y++) {
+            lutRow(y, settings.lutSize, points, lut + (size_t)y * settings.lutSize * 2);
+        }
+    });
+    return environment;
+}
+
+std::shared_ptr<SpecularEnvironment> SpecularEnvironment::bake(const std::string& path, const std::string& filename, SpecularSettings settings) {
+    std::string source = path + "/" + filename;
+    std::shared_ptr<MappedFile> file = MappedFile::open(source);
+    if (file == nullptr) {
+        std::cout << "failed to load environment: " << source << std::endl;
+        return nullptr;
+    }
+    uint64_t hash = ContentHash::hash(file->data(), file->size());
+    std::shared_ptr<SpecularEnvironment> environment = load(cachePath(source), hash, settings);
+    if (environment != nullptr) return environment;
+
+    int width, height, channels;
+    unsigned char* pixels = stbi_load_from_memory(file->data(), (int)file->size(), &width, &height, &channels, 4);
+    if (pixels == nullptr) {
+        std::cout << "failed to decode environment: " << source << std::endl;
+        return nullptr;
+    }
+    auto start = std::chrono::steady_clock::now();
+    environment = prefilter(pixels, (uint32_t)width, (uint32_t)height, settings);
+    auto end = std::chrono::steady_clock::now();
+    stbi_image_free(pixels);
+    std::cout << "prefiltered " << source << " into " << environment->levels.size() << " levels of " << environment->levels[0].size
+        << "x" << environment->levels[0].size << " faces in " << std::chrono::duration<double, std::milli>(end - start).count() << " ms" << std::endl;
+
+    environment->save(cachePath(source), hash);
+    return environment;
+}
+
+std::string SpecularEnvironment::cachePath(const std::string& source) {
+    return source + ".spec";
+}
+
+std::shared_ptr<SpecularEnvironment> SpecularEnvironment::load(const std::string& filename, uint64_t sourceHash, SpecularSettings settings) {
+    std::shared_ptr<MappedFile> file = MappedFile::open(filename);
+    if (file == nullptr) return nullptr;
+
+    FileHeader header;
+    if (file->size() < sizeof(FileHeader)) return nullptr;
+    std::memcpy(&header, file->data(), sizeof(FileHeader));
+    if (std::memcmp(header.magic, MAGIC, 4) != 0 || header.version != VERSION) {
+        std::cout << filename << " isn't a version " << VERSION << " specular environment" << std::endl;
+        return nullptr;
+    }
+    settings = clampSettings(settings);
+    bool sameBake = header.sourceHash == sourceHash
+        && header.faceSize == settings.faceSize
+        && header.levelCount == settings.levelCount
+        && header.sampleCount == settings.sampleCount
+        && header.lutSize == settings.lutSize
+        && header.lutSampleCount == settings.lutSampleCount;
+    if (!sameBake) return nullptr;
+
+    size_t length = lutLength(settings.lutSize);
+    for (uint32_t level = 0; level < settings.levelCount; level++) {
+        length += levelLength(MipGenerator::levelSize(settings.faceSize, level));
+    }
+    if (file->size() != sizeof(FileHeader) + length * sizeof(uint16_t)) {
+        std::cout << filename << " is truncated" << std::endl;
+        return nullptr;
+    }
+
+    auto environment = std::make_shared<SpecularEnvironment>();
+    environment->m_settings = settings;
+    environment->m_file = file;
+    const uint16_t* data = (const uint16_t*)(file->data() + sizeof(FileHeader));
+    for (uint32_t level = 0; level < settings.levelCount; level++) {
+        uint32_t size = MipGenerator::levelSize(settings.faceSize, level);
+        environment->levels.push_back({ size, data, levelLength(size) * sizeof(uint16_t) });
+        data += levelLength(size);
+    }
+    environment->lutSize = settings.lutSize;
+    environment->lut = data;
+    return environment;
+}
+
+bool SpecularEnvironment::save(const std::string& filename, uint64_t sourceHash) const {
+    std::ofstream file(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        std::cout << "failed to open " << filename << " for writing" << std::endl;
+        return false;
+    }
+
+    FileHeader header = {};
+    std::memcpy(header.magic, MAGIC, 4);
+    header.version = VERSION;
+    header.sourceHash = sourceHash;
+    header.faceSize = m_settings.faceSize;
+    header.levelCount = m_settings.levelCount;
+    header.sampleCount = m_settings.sampleCount;
+    header.lutSize = m_settings.lutSize;
+    header.lutSampleCount = m_settings.lutSampleCount;
+    file.write((const char*)&header, sizeof(header));
+    for (const Level& level : levels) {
+        file.write((const char*)level.data, level.bytes);
+    }
+    file.write((const char*)lut, lutLength(lutSize) * sizeof(uint16_t));
+    return file.good();
+}
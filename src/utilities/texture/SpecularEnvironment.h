@@ -0,0 +1,63 @@
+#pragma once
+#include "../ThreadPool.h"
+#include "../io/MappedFile.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct SpecularSettings {
+    uint32_t faceSize = 256;      // of level 0, the mirror reflection
+    uint32_t levelCount = 6;      // cut to the chain down to 1x1
+    uint32_t sampleCount = 64;    // ggx samples per texel
+    uint32_t lutSize = 128;
+    uint32_t lutSampleCount = 256;
+};
+
+// The split sum specular lighting of an equirectangular environment (same layout as
+// IrradienceTexture). The equirect is resampled into a cubemap, faces +x -x +y -y
+// +z -z in rgba16f, and every mip level is the environment convolved with the ggx
+// lobe of roughness level / (levelCount - 1). The lobe is importance sampled from
+// the mip chain of the resampled cube, each sample reads the level matching its
+// solid angle, so a few dozen samples come out without noise. The brdf lut holds
+// the scale and bias to F0 by n dot v (x) and roughness (y), rg16f.
+// Texels run in parallel on the ThreadPool, four at a time with sse2.
+// Baked once and saved as <source>.spec, keyed by the hash of the image file, so
+// startup only maps the file.
+class SpecularEnvironment {
+public:
+    struct Level {
+        uint32_t size;         // face width and height
+        const uint16_t* data;  // the six faces one after another
+        size_t bytes;
+    };
+
+    std::vector<Level> levels;
+    uint32_t lutSize = 0;
+    const uint16_t* lut = nullptr;
+
+    // rgba8 pixels, srgb rgb is decoded to linear first
+    static std::shared_ptr<SpecularEnvironment> prefilter(
+        const uint8_t* pixels,
+        uint32_t width,
+        uint32_t height,
+        SpecularSettings settings = SpecularSettings(),
+        bool srgb = true,
+        ThreadPool& pool = ThreadPool::shared()
+        );
+
+    // the cached bake when the image is unchanged, otherwise decodes, prefilters and caches it. nullptr when it can't be read
+    static std::shared_ptr<SpecularEnvironment> bake(const std::string& path, const std::string& filename, SpecularSettings settings = SpecularSettings());
+
+    // <source>.spec
+    static std::string cachePath(const std::string& source);
+    // nullptr when the file is missing, from another version, baked from other content or with other settings
+    static std::shared_ptr<SpecularEnvironment> load(const std::string& filename, uint64_t sourceHash, SpecularSettings settings);
+    bool save(const std::string& filename, uint64_t sourceHash) const;
+
+private:
+    SpecularSettings m_settings;
+    std::shared_ptr<MappedFile> m_file; // the data of a loaded bake points into it
+    std::vector<uint16_t> m_storage;    // and that of a fresh one into this
+};
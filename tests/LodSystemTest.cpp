@@ -0,0 +1,154 @@
+#include "ecs/LodSystem.h"
+#include "utilities/InstanceCuller.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Walks instances back and forth across a level's switching distance and counts how
+// often LodSystem::select changes their level, with and without hysteresis. Then checks
+// that InstanceCuller groups the visible instances of a batch by the levels selected.
+
+namespace {
+const float PI = 3.14159265358979f;
+
+int failures = 0;
+
+void expect(bool condition, const std::string& what) {
+    if (condition) return;
+    std::cout << "FAILED: " << what << std::endl;
+    failures++;
+}
+
+// errors 0, 0.01, 0.02, 0.04 mesh units. with a 1 pixel threshold at 1000 pixels per unit
+// level 1 is good enough from a distance of 10 on, level 2 from 20 and level 3 from 40
+const float PROJECTION_SCALE = 1000.0f;
+
+std::vector<LodSystem::ErrorSet> errorSets() {
+    LodSystem::ErrorSet errorSet;
+    errorSet.levelCount = 4;
+    float errors[LodSystem::MAX_LEVELS] = { 0.0f, 0.01f, 0.02f, 0.04f, FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX };
+    std::copy(errors, errors + LodSystem::MAX_LEVELS, errorSet.errors);
+    return { errorSet };
+}
+
+// one instance at distance(step) from the eye for every step, the number of level changes
+uint32_t walk(float hysteresis, uint32_t steps, float (*distance)(uint32_t)) {
+    LodSettings settings;
+    settings.hysteresis = hysteresis;
+    std::vector<LodSystem::ErrorSet> sets = errorSets();
+
+    LodSystem::Instances instances;
+    instances.resize(1);
+    instances.scales[0] = 1.0f;
+    instances.errorSets[0] = 0;
+    uint32_t switches = 0;
+    uint8_t previous = 0;
+    for (uint32_t step = 0; step < steps; step++) {
+        instances.spheres[0] = glm::vec4(distance(step), 0.0f, 0.0f, 0.0f);
+        LodSystem::select(instances, 0, 1, sets, glm::vec3(0.0f), PROJECTION_SCALE, settings);
+        switches += instances.levels[0] != previous;
+        previous = instances.levels[0];
+    }
+    return switches;
+}
+
+// jitters within 5% of the level 1 switching distance, 62 round trips
+float jitter(uint32_t step) {
+    return 10.0f + 0.5f * std::sin(2.0f * PI * (float)step / 16.0f + 0.25f);
+}
+
+// from 5 out to 60 and back, past every switching distance twice
+float sweep(uint32_t step) {
+    float t = (float)step / 500.0f;
+    return 5.0f + 55.0f * (t < 1.0f ? t : 2.0f - t);
+}
+
+void checkHysteresis() {
+    uint32_t jitterSwitches = walk(0.0f, 1000, jitter);
+    uint32_t jitterSwitchesHysteresis = walk(0.25f, 1000, jitter);
+    std::cout << "jitter around a switch: " << jitterSwitches << " level changes, " << jitterSwitchesHysteresis << " with hysteresis" << std::endl;
+    // every crossing flips without a band, one per half period
+    expect(jitterSwitches >= 120, "jitter flips every crossing without hysteresis");
+    expect(jitterSwitchesHysteresis == 0, "jitter inside the band never switches with hysteresis");
+
+    // a wide sweep still reaches every level and comes back, one change per level each way
+    uint32_t sweepSwitches = walk(0.0f, 1000, sweep);
+    uint32_t sweepSwitchesHysteresis = walk(0.25f, 1000, sweep);
+    std::cout << "sweep: " << sweepSwitches << " level changes, " << sweepSwitchesHysteresis << " with hysteresis" << std::endl;
+    expect(sweepSwitches == 6, "sweep without hysteresis");
+    expect(sweepSwitchesHysteresis == 6, "sweep with hysteresis");
+}
+
+void checkPerInstance() {
+    // instances of one entity pick their levels independently
+    LodSettings settings;
+    std::vector<LodSystem::ErrorSet> sets = errorSets();
+    LodSystem::Instances instances;
+    instances.resize(4);
+    float distances[4] = { 5.0f, 15.0f, 30.0f, 100.0f };
+    for (uint32_t i = 0; i < 4; i++) {
+        instances.spheres[i] = glm::vec4(0.0f, 0.0f, distances[i], 0.0f);
+        instances.scales[i] = 1.0f;
+        instances.errorSets[i] = 0;
+    }
+    LodSystem::select(instances, 0, 4, sets, glm::vec3(0.0f), PROJECTION_SCALE, settings);
+    // coarsening waits for the tighter band, 15 * 0.75 is past 10 but 30 * 0.75 isn't past 40
+    uint8_t expected[4] = { 0, 1, 2, 3 };
+    for (uint32_t i = 0; i < 4; i++) {
+        expect(instances.levels[i] == expected[i], "instance " + std::to_string(i) + " level");
+    }
+
+    // twice as large in the world projects twice the error, the finer level comes back
+    instances.scales[1] = 2.0f;
+    LodSystem::select(instances, 0, 4, sets, glm::vec3(0.0f), PROJECTION_SCALE, settings);
+    expect(instances.levels[1] == 0, "scaled instance refines");
+}
+
+void checkCullerLevels() {
+    // identity instances, all inside the frustum of an identity view projection
+    std::vector<glm::mat4x4> transforms(10, glm::mat4x4(1.0f));
+    std::vector<InstanceCompression::PackedInstance> models = InstanceCompression::pack(transforms, std::vector<uint32_t>(10, 0));
+    std::vector<uint8_t> levels = { 2, 0, 1, 2, 0, 0, 1, 7, 2, 0 };
+
+    std::vector<InstanceBatch> batches(2);
+    batches[0] = { 0, 2, glm::vec4(0.0f, 0.0f, 0.0f, 0.1f) };
+    batches[1] = { 2, 8, glm::vec4(0.0f, 0.0f, 0.0f, 0.1f) };
+    batches[1].levels = levels.data() + 2;
+    batches[1].levelCount = 3;
+
+    std::vector<uint32_t> visible;
+    std::vector<VisibleRange> ranges;
+    std::vector<VisibleRange> levelRanges;
+    InstanceCuller::cull(batches, models, glm::mat4x4(1.0f), visible, ranges, levelRanges);
+
+    expect(visible.size() == 10, "culler keeps every instance");
+    expect(levelRanges.size() == 4, "one range per level of every batch");
+    expect(ranges[0].first == 0 && ranges[0].count == 2, "batch without levels");
+    expect(ranges[1].first == 2 && ranges[1].count == 8, "batch with levels");
+    // models 2 .. 9 at levels 1 2 0 0 1 7 2 0, the 7 is past the last level and drawn with it
+    std::vector<std::vector<uint32_t>> expected = { { 0, 1 }, { 4, 5, 9 }, { 2, 6 }, { 3, 7, 8 } };
+    for (size_t r = 0; r < expected.size(); r++) {
+        expect(levelRanges[r].count == expected[r].size(), "level range " + std::to_string(r) + " count");
+        for (size_t i = 0; i < expected[r].size() && i < levelRanges[r].count; i++) {
+            expect(visible[levelRanges[r].first + i] == expected[r][i], "level range " + std::to_string(r) + " order");
+        }
+    }
+}
+}
+
+int main() {
+    checkHysteresis();
+    checkPerInstance();
+    checkCullerLevels();
+
+    if (failures > 0) {
+        std::cout << failures << " checks failed" << std::endl;
+        return 1;
+    }
+    std::cout << "all checks passed" << std::endl;
+    return 0;
+}
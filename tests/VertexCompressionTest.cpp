@@ -0,0 +1,126 @@
+#include "utilities/VertexCompression.h"
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// Round trips vertex sets through VertexCompression and checks every attribute
+// against the packed format's tolerance: half a quantization step of the bounds
+// per position axis, 0.001 radians for normals, a tangent angle step on top of
+// that, 11 significant bits for uvs and half an 8 bit step for colors.
+
+static_assert(sizeof(Mesh::PackedVertexData) < 24, "the packed vertex has to stay under 24 bytes");
+
+namespace {
+const float PI = 3.14159265358979f;
+
+int failures = 0;
+
+void expect(bool condition, const std::string& what) {
+    if (condition) return;
+    std::cout << "FAILED: " << what << std::endl;
+    failures++;
+}
+
+glm::vec3 randomUnit(std::mt19937& random) {
+    std::normal_distribution<float> gauss(0.0f, 1.0f);
+    glm::vec3 v;
+    do {
+        v = glm::vec3(gauss(random), gauss(random), gauss(random));
+    } while (glm::length(v) < 1e-3f);
+    return glm::normalize(v);
+}
+
+// random positions in [center - extent / 2, center + extent / 2], a full tangent frame of either handedness
+std::vector<Mesh::VertexData> randomVertices(uint32_t count, glm::vec3 center, float extent, float uvRange, uint32_t seed) {
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<float> unit(-0.5f, 0.5f);
+    std::uniform_real_distribution<float> uv(-uvRange, uvRange);
+    std::uniform_real_distribution<float> color(0.0f, 1.0f);
+
+    std::vector<Mesh::VertexData> vertices(count);
+    for (auto& v : vertices) {
+        v.position = center + extent * glm::vec3(unit(random), unit(random), unit(random));
+        v.normal = randomUnit(random);
+        glm::vec3 t = randomUnit(random);
+        t = t - v.normal * glm::dot(v.normal, t);
+        if (glm::length(t) < 1e-3f) t = std::abs(v.normal.x) < 0.9f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+        v.tangent = glm::normalize(t - v.normal * glm::dot(v.normal, t));
+        float handedness = random() % 2 == 0 ? 1.0f : -1.0f;
+        v.bitangent = handedness * glm::cross(v.normal, v.tangent);
+        v.uv = glm::vec2(uv(random), uv(random));
+        v.color = glm::vec3(color(random), color(random), color(random));
+    }
+    return vertices;
+}
+
+void checkRoundTrip(const std::string& name, const std::vector<Mesh::VertexData>& vertices) {
+    glm::mat4x4 dequantize;
+    std::vector<Mesh::PackedVertexData> packed = VertexCompression::pack(vertices, dequantize);
+    expect(packed.size() == vertices.size(), name + ": vertex count");
+    VertexCompression::PackingError error = VertexCompression::measureError(vertices, packed, dequantize);
+
+    float maxUV = 0.0f;
+    for (auto& v : vertices) {
+        maxUV = std::max(maxUV, std::max(std::abs(v.uv.x), std::abs(v.uv.y)));
+    }
+    float extent = dequantize[0][0];
+    float positionTolerance = 0.5f * extent / 65535.0f * std::sqrt(3.0f) + extent * 1e-6f;
+    float normalTolerance = 0.001f;
+    float tangentTolerance = PI / 32767.0f + normalTolerance;
+    float uvTolerance = std::max(maxUV, 1.0f / 16384.0f) / 2048.0f;
+    float colorTolerance = 0.5f / 255.0f + 1e-6f;
+
+    std::cout << name << ": position " << error.position << " (" << positionTolerance << "), normal " << error.normal
+        << " (" << normalTolerance << "), tangent " << error.tangent << " (" << tangentTolerance << "), uv " << error.uv
+        << " (" << uvTolerance << "), color " << error.color << " (" << colorTolerance << ")" << std::endl;
+    expect(error.position <= positionTolerance, name + ": position error");
+    expect(error.normal <= normalTolerance, name + ": normal error");
+    expect(error.tangent <= tangentTolerance, name + ": tangent error");
+    expect(error.uv <= uvTolerance, name + ": uv error");
+    expect(error.color <= colorTolerance, name + ": color error");
+    expect(error.handedness, name + ": bitangent sign");
+    // the same bounds as the engine checks with
+    expect(VertexCompression::validate(vertices), name + ": validate");
+}
+
+void checkHalfs() {
+    // every finite half survives a round trip bit for bit
+    for (uint32_t bits = 0; bits < 0x10000; bits++) {
+        if ((bits & 0x7c00) == 0x7c00) continue; // inf and nan
+        float value = VertexCompression::halfToFloat((uint16_t)bits);
+        if (VertexCompression::floatToHalf(value) != bits) {
+            expect(false, "half " + std::to_string(bits) + " round trip");
+            return;
+        }
+    }
+    // halfway between 1 and the next half rounds to even
+    expect(VertexCompression::floatToHalf(1.0f + 1.0f / 2048.0f) == 0x3c00, "half rounds to nearest even");
+    expect(VertexCompression::floatToHalf(70000.0f) == 0x7c00, "half overflow goes to inf");
+}
+}
+
+int main() {
+    checkRoundTrip("unit cube", randomVertices(10000, glm::vec3(0.0f), 1.0f, 1.0f, 1));
+    checkRoundTrip("large offset bounds", randomVertices(10000, glm::vec3(1000.0f, -250.0f, 40.0f), 500.0f, 1.0f, 2));
+    checkRoundTrip("tiny bounds", randomVertices(10000, glm::vec3(0.25f), 0.01f, 1.0f, 3));
+    checkRoundTrip("tiled uvs", randomVertices(10000, glm::vec3(0.0f), 10.0f, 64.0f, 4));
+    // not a multiple of the sse2 batch, the scalar tail has to agree
+    checkRoundTrip("odd count", randomVertices(1001, glm::vec3(0.0f), 2.0f, 1.0f, 5));
+
+    // a single point has no extent to quantize against
+    std::vector<Mesh::VertexData> point = randomVertices(7, glm::vec3(0.0f), 1.0f, 1.0f, 6);
+    for (auto& v : point) v.position = glm::vec3(3.0f, 2.0f, 1.0f);
+    checkRoundTrip("flat bounds", point);
+
+    checkHalfs();
+
+    if (failures > 0) {
+        std::cout << failures << " checks failed" << std::endl;
+        return 1;
+    }
+    std::cout << "all checks passed" << std::endl;
+    return 0;
+}